@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Indexes the contents of a small file and of one too big to index, 
+ * and queries text that only the big one has. None of its trigrams are
+ * in the index, yet the big file has to come back as a candidate.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "filesearch-content.h"
+#include "filesearch-index.h"
+#include "filesearch-stats.h"
+
+static FileSearchIndex* write_file        (const gchar *folder_path,
+                                           const gchar *file_name,
+                                           const gchar *text,
+                                           gsize        length);
+static gboolean has_result                (GPtrArray   *results,
+                                           const gchar *file_path);
+
+int
+main (int   argc, 
+      char *argv[])
+{
+  FileSearchContent *content;
+  FileSearchStats *stats;
+  FileSearchIndex *small;
+  FileSearchIndex *big;
+  GPtrArray *results;
+  GList *indexes = NULL;
+  GError *error = NULL;
+  gchar *folder_path;
+  gchar *content_file;
+  gint failures = 0;
+
+  folder_path = g_dir_make_tmp ("filesearch-content-test-XXXXXX", &error);
+  if (folder_path == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  small = write_file (folder_path, "small.c", "int main;\n", 0);
+  big = write_file (folder_path, "big.log", "QJZXVKW\n", FILE_SEARCH_CONTENT_MAX_FILE_SIZE + 1);
+  indexes = g_list_prepend (indexes, small);
+  indexes = g_list_prepend (indexes, big);
+
+  stats = file_search_stats_new ();
+  content_file = g_build_filename (folder_path, "content", NULL);
+
+  if (!file_search_content_write (NULL, indexes, stats, content_file, &error) ||
+      (content = file_search_content_new_from_file (content_file, &error)) == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  results = file_search_content_query (content, "QJZXVKW");
+  if (results == NULL || !has_result (results, file_search_index_get_file_path (big)))
+    {
+      g_printerr ("the file too big to index was left out of the candidates\n");
+      failures++;
+    }
+  if (results != NULL && has_result (results, file_search_index_get_file_path (small)))
+    {
+      g_printerr ("an indexed file without the text was a candidate\n");
+      failures++;
+    }
+  if (results != NULL)
+    g_ptr_array_free (results, TRUE);
+
+  results = file_search_content_query (content, "main");
+  if (results == NULL || 
+      !has_result (results, file_search_index_get_file_path (small)) ||
+      !has_result (results, file_search_index_get_file_path (big)))
+    {
+      g_printerr ("text in the index did not find both files\n");
+      failures++;
+    }
+  if (results != NULL)
+    g_ptr_array_free (results, TRUE);
+
+  g_object_unref (content);
+  g_object_unref (stats);
+
+  g_unlink (content_file);
+  g_unlink (file_search_index_get_file_path (small));
+  g_unlink (file_search_index_get_file_path (big));
+  g_rmdir (folder_path);
+
+  g_list_foreach (indexes, (GFunc) g_object_unref, NULL);
+  g_list_free (indexes);
+  g_free (content_file);
+  g_free (folder_path);
+
+  if (failures > 0)
+    {
+      g_printerr ("%d failures\n", failures);
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
+
+/* the text is padded with spaces to the length, when that is longer */
+static FileSearchIndex*
+write_file (const gchar *folder_path,
+            const gchar *file_name,
+            const gchar *text,
+            gsize        length)
+{
+  FileSearchIndex *index;
+  gchar *file_path;
+  gchar *contents;
+  gsize text_length;
+
+  text_length = strlen (text);
+  if (length < text_length)
+    length = text_length;
+
+  contents = g_malloc (length);
+  memset (contents, ' ', length);
+  memcpy (contents + length - text_length, text, text_length);
+
+  file_path = g_build_filename (folder_path, file_name, NULL);
+  g_file_set_contents (file_path, contents, length, NULL);
+
+  index = file_search_index_new ();
+  file_search_index_set_file_name (index, file_name);
+  file_search_index_set_file_path (index, file_path);
+
+  g_free (contents);
+  g_free (file_path);
+
+  return index;
+}
+
+static gboolean
+has_result (GPtrArray   *results,
+            const gchar *file_path)
+{
+  guint i;
+
+  for (i = 0; i < results->len; i++)
+    {
+      if (g_strcmp0 (g_ptr_array_index (results, i), file_path) == 0)
+        return TRUE;
+    }
+
+  return FALSE;
+}
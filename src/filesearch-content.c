@@ -0,0 +1,796 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include "filesearch-content.h"
+#include "filesearch-index.h"
+#include "filesearch-varint.h"
+
+/*
+ * The content index maps every trigram to the files containing it, in
+ * the spirit of codesearch. A query intersects the lists of the trigrams
+ * of its text and only the files left over are read to verify a match.
+ *
+ *   header | files[n_files] | trigrams[n_trigrams] | postings | strings
+ *
+ * Files are sorted by path and keep the mtime and size they had when
+ * they were read, so the next build only reads the files that changed
+ * and carries the lists of the others over. Trigrams are sorted, each
+ * posting list is a run of varint deltas between ascending file ids.
+ */
+
+#define FILE_SEARCH_CONTENT_MAGIC    "CSFSCNT"
+#define FILE_SEARCH_CONTENT_VERSION  1
+
+/* a NUL byte in the head of a file marks it as binary */
+#define BINARY_CHECK_LENGTH  4096
+
+#define N_TRIGRAMS           (1 << 24)
+
+/* marks the files whose lists were carried over while building */
+#define FILE_CARRIED         0x80000000u
+
+typedef enum
+{
+  FILE_BINARY    = 1 << 0,
+  FILE_UNINDEXED = 1 << 1
+} FileFlags;
+
+typedef struct
+{
+  gchar   magic[8];
+  guint32 version;
+  guint32 n_files;
+  guint32 n_trigrams;
+  guint32 reserved;
+  guint64 postings_offset;
+  guint64 postings_length;
+  guint64 strings_offset;
+  guint64 strings_length;
+} Header;
+
+typedef struct
+{
+  guint32 path;
+  guint32 flags;
+  gint64  mtime;
+  guint64 size;
+} File;
+
+typedef struct
+{
+  guint32 trigram;
+  guint32 n_files;
+  guint64 offset;
+} Trigram;
+
+typedef struct
+{
+  GByteArray *bytes;
+  guint32     last;
+  guint32     n_files;
+} Posting;
+
+static void file_search_content_class_init  (FileSearchContentClass *klass);
+static void file_search_content_init        (FileSearchContent      *content);
+static void file_search_content_finalize    (FileSearchContent      *content);
+
+static gboolean validate                    (FileSearchContent      *content,
+                                             GError                **error);
+static const Trigram* find_trigram          (FileSearchContent      *content,
+                                             guint32                 trigram);
+static void decode_posting                  (FileSearchContent      *content,
+                                             const Trigram          *trigram,
+                                             const guint32          *id_map,
+                                             GArray                 *ids);
+static guint32 read_file                    (const gchar            *file_path,
+                                             guint32                 id,
+                                             guint8                 *seen,
+                                             GArray                 *touched,
+                                             GHashTable             *postings);
+static void posting_free                    (Posting                *posting);
+static gint compare_paths                   (gconstpointer           a,
+                                             gconstpointer           b);
+static gint compare_ids                     (gconstpointer           a,
+                                             gconstpointer           b);
+static gint compare_lengths                 (gconstpointer           a,
+                                             gconstpointer           b);
+
+#define FILE_SEARCH_CONTENT_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_CONTENT_TYPE, FileSearchContentPrivate))
+
+typedef struct _FileSearchContentPrivate FileSearchContentPrivate;
+
+struct _FileSearchContentPrivate
+{
+  GMappedFile   *mapped_file;
+  const gchar   *data;
+  gsize          length;
+  const Header  *header;
+  const File    *files;
+  const Trigram *trigrams;
+  const guint8  *postings;
+  const gchar   *strings;
+};
+
+G_DEFINE_TYPE (FileSearchContent, file_search_content, G_TYPE_OBJECT)
+
+static void
+file_search_content_class_init (FileSearchContentClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = (GObjectFinalizeFunc) file_search_content_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchContentPrivate));
+}
+
+static void
+file_search_content_init (FileSearchContent *content)
+{
+  FileSearchContentPrivate *priv;
+  priv = FILE_SEARCH_CONTENT_GET_PRIVATE (content);
+  priv->mapped_file = NULL;
+  priv->data = NULL;
+  priv->length = 0;
+  priv->header = NULL;
+  priv->files = NULL;
+  priv->trigrams = NULL;
+  priv->postings = NULL;
+  priv->strings = NULL;
+}
+
+static void
+file_search_content_finalize (FileSearchContent *content)
+{
+  FileSearchContentPrivate *priv;
+  priv = FILE_SEARCH_CONTENT_GET_PRIVATE (content);
+  if (priv->mapped_file)
+    g_mapped_file_unref (priv->mapped_file);
+  G_OBJECT_CLASS (file_search_content_parent_class)->finalize (G_OBJECT (content));
+}
+
+FileSearchContent*
+file_search_content_new_from_file (const gchar  *file_path,
+                                   GError      **error)
+{
+  FileSearchContentPrivate *priv;
+  FileSearchContent *content;
+  GMappedFile *mapped_file;
+
+  mapped_file = g_mapped_file_new (file_path, FALSE, error);
+  if (mapped_file == NULL)
+    return NULL;
+
+  content = FILE_SEARCH_CONTENT (g_object_new (file_search_content_get_type (), NULL));
+  priv = FILE_SEARCH_CONTENT_GET_PRIVATE (content);
+
+  priv->mapped_file = mapped_file;
+  priv->data = g_mapped_file_get_contents (mapped_file);
+  priv->length = g_mapped_file_get_length (mapped_file);
+
+  if (!validate (content, error))
+    {
+      g_object_unref (content);
+      return NULL;
+    }
+
+  return content;
+}
+
+static gboolean
+validate (FileSearchContent  *content,
+          GError            **error)
+{
+  FileSearchContentPrivate *priv;
+  const Header *header;
+  guint64 tables_length;
+  guint32 i;
+
+  priv = FILE_SEARCH_CONTENT_GET_PRIVATE (content);
+
+  header = (const Header *) priv->data;
+
+  if (priv->length < sizeof (Header) ||
+      memcmp (header->magic, FILE_SEARCH_CONTENT_MAGIC, sizeof (FILE_SEARCH_CONTENT_MAGIC)) != 0 ||
+      header->version != FILE_SEARCH_CONTENT_VERSION)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "The file search content index is not a version %u index.",
+                   FILE_SEARCH_CONTENT_VERSION);
+      return FALSE;
+    }
+
+  tables_length = (guint64) header->n_files * sizeof (File) +
+                  (guint64) header->n_trigrams * sizeof (Trigram);
+
+  if (sizeof (Header) + tables_length > priv->length ||
+      header->postings_offset > priv->length ||
+      header->postings_length > priv->length - header->postings_offset ||
+      header->strings_offset > priv->length ||
+      header->strings_length > priv->length - header->strings_offset ||
+      header->strings_length == 0 ||
+      priv->data[header->strings_offset + header->strings_length - 1] != '\0')
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "The file search content index is truncated.");
+      return FALSE;
+    }
+
+  priv->header = header;
+  priv->files = (const File *) (priv->data + sizeof (Header));
+  priv->trigrams = (const Trigram *) (priv->files + header->n_files);
+  priv->postings = (const guint8 *) priv->data + header->postings_offset;
+  priv->strings = priv->data + header->strings_offset;
+
+  for (i = 0; i < header->n_files; i++)
+    {
+      if (priv->files[i].path >= header->strings_length)
+        {
+          g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                       "The file search content index file %u is out of bounds.", i);
+          return FALSE;
+        }
+    }
+
+  /* the lists themselves are bounds checked while decoding */
+  for (i = 0; i < header->n_trigrams; i++)
+    {
+      if (priv->trigrams[i].offset > header->postings_length ||
+          priv->trigrams[i].n_files > header->n_files ||
+          (i > 0 && priv->trigrams[i].trigram <= priv->trigrams[i - 1].trigram))
+        {
+          g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                       "The file search content index trigram %u is broken.", i);
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/*
+ * Returns the paths of the files that may contain the text, or NULL
+ * when the text is too short to narrow anything down. The paths point
+ * into the index and live as long as it does.
+ */
+GPtrArray*
+file_search_content_query (FileSearchContent *content,
+                           const gchar       *text)
+{
+  FileSearchContentPrivate *priv;
+  GPtrArray *results;
+  GPtrArray *lists;
+  GArray *ids = NULL;
+  GArray *other;
+  gsize length;
+  gsize i;
+
+  priv = FILE_SEARCH_CONTENT_GET_PRIVATE (content);
+
+  length = strlen (text);
+  if (length < 3)
+    return NULL;
+
+  results = g_ptr_array_new ();
+  lists = g_ptr_array_new ();
+
+  for (i = 0; i + 3 <= length; i++)
+    {
+      const Trigram *trigram;
+      trigram = find_trigram (content, ((guint8) text[i] << 16) |
+                                       ((guint8) text[i + 1] << 8) |
+                                        (guint8) text[i + 2]);
+      if (trigram == NULL)
+        {
+          /* no indexed file has it, but the unindexed ones still can */
+          g_ptr_array_set_size (lists, 0);
+          break;
+        }
+      g_ptr_array_add (lists, (gpointer) trigram);
+    }
+
+  /* intersect from the rarest trigram up, the candidates only shrink */
+  g_ptr_array_sort (lists, compare_lengths);
+
+  ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+  other = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  if (lists->len > 0)
+    decode_posting (content, g_ptr_array_index (lists, 0), NULL, ids);
+
+  for (i = 1; i < lists->len && ids->len > 0; i++)
+    {
+      guint j = 0;
+      guint k = 0;
+      guint n = 0;
+
+      g_array_set_size (other, 0);
+      decode_posting (content, g_ptr_array_index (lists, i), NULL, other);
+
+      while (j < ids->len && k < other->len)
+        {
+          guint32 a = g_array_index (ids, guint32, j);
+          guint32 b = g_array_index (other, guint32, k);
+          if (a < b)
+            {
+              j++;
+            }
+          else if (a > b)
+            {
+              k++;
+            }
+          else
+            {
+              g_array_index (ids, guint32, n++) = a;
+              j++;
+              k++;
+            }
+        }
+
+      g_array_set_size (ids, n);
+    }
+
+  for (i = 0; i < ids->len; i++)
+    {
+      const File *file = &priv->files[g_array_index (ids, guint32, i)];
+      g_ptr_array_add (results, (gpointer) (priv->strings + file->path));
+    }
+
+  /* files too big to index could contain anything */
+  for (i = 0; i < priv->header->n_files; i++)
+    {
+      if (priv->files[i].flags & FILE_UNINDEXED)
+        g_ptr_array_add (results, (gpointer) (priv->strings + priv->files[i].path));
+    }
+
+  g_array_free (other, TRUE);
+  g_array_free (ids, TRUE);
+  g_ptr_array_free (lists, TRUE);
+
+  return results;
+}
+
+static const Trigram*
+find_trigram (FileSearchContent *content,
+              guint32            trigram)
+{
+  FileSearchContentPrivate *priv;
+  guint low = 0;
+  guint high;
+
+  priv = FILE_SEARCH_CONTENT_GET_PRIVATE (content);
+  high = priv->header->n_trigrams;
+
+  while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+      if (priv->trigrams[middle].trigram < trigram)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+  if (low < priv->header->n_trigrams && priv->trigrams[low].trigram == trigram)
+    return &priv->trigrams[low];
+
+  return NULL;
+}
+
+/*
+ * Appends the file ids of the list to the array, mapped through the
+ * id map when one is given. Ids that map to G_MAXUINT32 are dropped.
+ */
+static void
+decode_posting (FileSearchContent *content,
+                const Trigram     *trigram,
+                const guint32     *id_map,
+                GArray            *ids)
+{
+  FileSearchContentPrivate *priv;
+  const guint8 *p;
+  const guint8 *end;
+  guint32 id = 0;
+  guint32 i;
+
+  priv = FILE_SEARCH_CONTENT_GET_PRIVATE (content);
+
+  p = priv->postings + trigram->offset;
+  end = priv->postings + priv->header->postings_length;
+
+  for (i = 0; i < trigram->n_files; i++)
+    {
+      guint32 delta;
+      guint32 mapped;
+
+      if (!file_search_varint_read (&p, end, &delta))
+        return;
+
+      id += delta;
+      if (id >= priv->header->n_files)
+        return;
+
+      mapped = id_map != NULL ? id_map[id] : id;
+      if (mapped != G_MAXUINT32)
+        g_array_append_val (ids, mapped);
+    }
+}
+
+/*
+ * Writes a new content index for the indexes. The files that have the
+ * same mtime and size as in the previous index keep their lists, only
+ * the others are read.
+ */
+gboolean
+file_search_content_write (FileSearchContent  *previous,
+                           GList              *indexes,
+                           FileSearchStats    *stats,
+                           const gchar        *file_path,
+                           GError            **error)
+{
+  FileSearchContentPrivate *previous_priv = NULL;
+  GPtrArray *paths;
+  GArray *files;
+  GArray *trigrams;
+  GArray *fresh_trigrams;
+  GArray *ids;
+  GArray *touched;
+  GByteArray *postings;
+  GByteArray *strings;
+  GByteArray *content;
+  GHashTable *fresh;
+  GHashTableIter iter;
+  gpointer key;
+  guint32 *id_map = NULL;
+  guint8 *seen;
+  Header header;
+  gint64 start;
+  gint64 bytes_read = 0;
+  guint old_index;
+  guint fresh_index;
+  guint i;
+  gboolean result;
+  static const guint8 padding[8] = { 0 };
+
+  start = g_get_monotonic_time ();
+
+  if (previous != NULL)
+    previous_priv = FILE_SEARCH_CONTENT_GET_PRIVATE (previous);
+
+  paths = g_ptr_array_new ();
+  for (; indexes != NULL; indexes = g_list_next (indexes))
+    g_ptr_array_add (paths, (gpointer) file_search_index_get_file_path (indexes->data));
+  g_ptr_array_sort (paths, compare_paths);
+
+  files = g_array_new (FALSE, TRUE, sizeof (File));
+  strings = g_byte_array_new ();
+  g_byte_array_append (strings, (const guint8 *) "", 1);
+
+  for (i = 0; i < paths->len; i++)
+    {
+      const gchar *path = g_ptr_array_index (paths, i);
+      GStatBuf buf;
+      File file;
+
+      if ((i > 0 && strcmp (path, g_ptr_array_index (paths, i - 1)) == 0) ||
+          g_stat (path, &buf) != 0)
+        continue;
+
+      file.path = strings->len;
+      file.flags = buf.st_size > FILE_SEARCH_CONTENT_MAX_FILE_SIZE ? FILE_UNINDEXED : 0;
+      file.mtime = buf.st_mtime;
+      file.size = buf.st_size;
+      g_array_append_val (files, file);
+      g_byte_array_append (strings, (const guint8 *) path, strlen (path) + 1);
+    }
+
+  /* both lists are sorted by path, so the ids map over in order */
+  if (previous != NULL)
+    {
+      guint32 n_files = previous_priv->header->n_files;
+      guint j = 0;
+
+      id_map = g_new (guint32, n_files);
+
+      for (i = 0; i < n_files; i++)
+        {
+          const File *old_file = &previous_priv->files[i];
+          const gchar *old_path = previous_priv->strings + old_file->path;
+          gint compare = 1;
+
+          id_map[i] = G_MAXUINT32;
+
+          while (j < files->len &&
+                 (compare = strcmp ((const gchar *) strings->data + g_array_index (files, File, j).path,
+                                    old_path)) < 0)
+            j++;
+
+          if (compare == 0)
+            {
+              File *file = &g_array_index (files, File, j);
+              if (file->mtime == old_file->mtime && file->size == old_file->size)
+                {
+                  id_map[i] = j;
+                  file->flags = old_file->flags | FILE_CARRIED;
+                }
+            }
+        }
+    }
+
+  /* read every file that was not carried over */
+  seen = g_malloc0 (N_TRIGRAMS / 8);
+  touched = g_array_new (FALSE, FALSE, sizeof (guint32));
+  fresh = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                 (GDestroyNotify) posting_free);
+
+  for (i = 0; i < files->len; i++)
+    {
+      File *file = &g_array_index (files, File, i);
+
+      if (file->flags & FILE_CARRIED)
+        {
+          file->flags &= ~FILE_CARRIED;
+          continue;
+        }
+
+      if (file->flags & FILE_UNINDEXED)
+        continue;
+
+      file->flags = read_file ((const gchar *) strings->data + file->path, i,
+                               seen, touched, fresh);
+      bytes_read += file->size;
+    }
+
+  g_free (seen);
+  g_array_free (touched, TRUE);
+
+  fresh_trigrams = g_array_new (FALSE, FALSE, sizeof (guint32));
+  g_hash_table_iter_init (&iter, fresh);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      guint32 trigram = GPOINTER_TO_UINT (key);
+      g_array_append_val (fresh_trigrams, trigram);
+    }
+  g_array_sort (fresh_trigrams, compare_ids);
+
+  /* merge the carried over lists with the fresh ones, trigram by trigram */
+  trigrams = g_array_new (FALSE, FALSE, sizeof (Trigram));
+  postings = g_byte_array_new ();
+  ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+  old_index = 0;
+  fresh_index = 0;
+
+  while ((previous != NULL && old_index < previous_priv->header->n_trigrams) ||
+         fresh_index < fresh_trigrams->len)
+    {
+      const Trigram *old_trigram = NULL;
+      Posting *posting = NULL;
+      Trigram trigram;
+      guint32 last = 0;
+      guint j;
+
+      if (previous != NULL && old_index < previous_priv->header->n_trigrams)
+        old_trigram = &previous_priv->trigrams[old_index];
+
+      if (fresh_index < fresh_trigrams->len)
+        {
+          guint32 value = g_array_index (fresh_trigrams, guint32, fresh_index);
+          if (old_trigram == NULL || value <= old_trigram->trigram)
+            posting = g_hash_table_lookup (fresh, GUINT_TO_POINTER (value));
+          if (old_trigram != NULL && value < old_trigram->trigram)
+            old_trigram = NULL;
+        }
+
+      g_array_set_size (ids, 0);
+
+      if (old_trigram != NULL)
+        {
+          trigram.trigram = old_trigram->trigram;
+          decode_posting (previous, old_trigram, id_map, ids);
+          old_index++;
+        }
+
+      /* fresh files are never carried over, so the two sets do not overlap */
+      if (posting != NULL)
+        {
+          const guint8 *p = posting->bytes->data;
+          const guint8 *end = p + posting->bytes->len;
+          guint32 id = 0;
+          guint32 delta;
+
+          trigram.trigram = g_array_index (fresh_trigrams, guint32, fresh_index);
+          while (file_search_varint_read (&p, end, &delta))
+            {
+              id += delta;
+              g_array_append_val (ids, id);
+            }
+          fresh_index++;
+
+          if (old_trigram != NULL)
+            g_array_sort (ids, compare_ids);
+        }
+
+      if (ids->len == 0)
+        continue;
+
+      trigram.n_files = ids->len;
+      trigram.offset = postings->len;
+      g_array_append_val (trigrams, trigram);
+
+      for (j = 0; j < ids->len; j++)
+        {
+          guint32 id = g_array_index (ids, guint32, j);
+          file_search_varint_write (postings, id - last);
+          last = id;
+        }
+    }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, FILE_SEARCH_CONTENT_MAGIC, sizeof (FILE_SEARCH_CONTENT_MAGIC));
+  header.version = FILE_SEARCH_CONTENT_VERSION;
+  header.n_files = files->len;
+  header.n_trigrams = trigrams->len;
+  header.postings_offset = sizeof (Header) + files->len * sizeof (File) +
+                           trigrams->len * sizeof (Trigram);
+  header.postings_length = postings->len;
+  header.strings_offset = (header.postings_offset + postings->len + 7) & ~7;
+  header.strings_length = strings->len;
+
+  content = g_byte_array_sized_new (header.strings_offset + strings->len);
+  g_byte_array_append (content, (const guint8 *) &header, sizeof (header));
+  g_byte_array_append (content, (const guint8 *) files->data, files->len * sizeof (File));
+  g_byte_array_append (content, (const guint8 *) trigrams->data, trigrams->len * sizeof (Trigram));
+  g_byte_array_append (content, postings->data, postings->len);
+  g_byte_array_append (content, padding, header.strings_offset - content->len);
+  g_byte_array_append (content, strings->data, strings->len);
+
+  result = g_file_set_contents (file_path, (const gchar *) content->data, content->len, error);
+
+  file_search_stats_add (stats, FILE_SEARCH_COUNTER_BYTES_WRITTEN, content->len);
+  file_search_stats_add (stats, FILE_SEARCH_COUNTER_BYTES_SCANNED, bytes_read);
+  file_search_stats_record (stats, FILE_SEARCH_PHASE_CONTENT, g_get_monotonic_time () - start);
+
+  g_byte_array_free (content, TRUE);
+  g_array_free (ids, TRUE);
+  g_byte_array_free (postings, TRUE);
+  g_array_free (trigrams, TRUE);
+  g_array_free (fresh_trigrams, TRUE);
+  g_hash_table_destroy (fresh);
+  g_free (id_map);
+  g_byte_array_free (strings, TRUE);
+  g_array_free (files, TRUE);
+  g_ptr_array_free (paths, TRUE);
+
+  return result;
+}
+
+/*
+ * Adds the file to the list of every distinct trigram in it and returns
+ * its flags. The seen bitmap is left cleared for the next file. The file
+ * is read rather than mapped, since another process can truncate it 
+ * meanwhile, and no further than the size limit in case it grew.
+ */
+static guint32
+read_file (const gchar *file_path,
+           guint32      id,
+           guint8      *seen,
+           GArray      *touched,
+           GHashTable  *postings)
+{
+  guint8 *data;
+  gsize length = 0;
+  gsize i;
+  gint fd;
+
+  fd = g_open (file_path, O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0)
+    return FILE_BINARY;
+
+  data = g_malloc (FILE_SEARCH_CONTENT_MAX_FILE_SIZE);
+
+  while (length < FILE_SEARCH_CONTENT_MAX_FILE_SIZE)
+    {
+      gssize n;
+      n = read (fd, data + length, FILE_SEARCH_CONTENT_MAX_FILE_SIZE - length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      length += n;
+    }
+
+  close (fd);
+
+  if (length > 0 && memchr (data, '\0', MIN (length, BINARY_CHECK_LENGTH)) != NULL)
+    {
+      g_free (data);
+      return FILE_BINARY;
+    }
+
+  for (i = 0; i + 3 <= length; i++)
+    {
+      guint32 trigram = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+      if ((seen[trigram / 8] & (1 << (trigram % 8))) == 0)
+        {
+          seen[trigram / 8] |= 1 << (trigram % 8);
+          g_array_append_val (touched, trigram);
+        }
+    }
+
+  for (i = 0; i < touched->len; i++)
+    {
+      guint32 trigram = g_array_index (touched, guint32, i);
+      Posting *posting;
+
+      seen[trigram / 8] = 0;
+
+      posting = g_hash_table_lookup (postings, GUINT_TO_POINTER (trigram));
+      if (posting == NULL)
+        {
+          posting = g_slice_new (Posting);
+          posting->bytes = g_byte_array_new ();
+          posting->last = 0;
+          posting->n_files = 0;
+          g_hash_table_insert (postings, GUINT_TO_POINTER (trigram), posting);
+        }
+
+      /* files are read in id order, so the deltas are never negative */
+      file_search_varint_write (posting->bytes, id - posting->last);
+      posting->last = id;
+      posting->n_files++;
+    }
+
+  g_array_set_size (touched, 0);
+  g_free (data);
+
+  return 0;
+}
+
+static void
+posting_free (Posting *posting)
+{
+  g_byte_array_free (posting->bytes, TRUE);
+  g_slice_free (Posting, posting);
+}
+
+static gint
+compare_paths (gconstpointer a,
+               gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+static gint
+compare_ids (gconstpointer a,
+                  gconstpointer b)
+{
+  guint32 trigram_a = *(const guint32 *) a;
+  guint32 trigram_b = *(const guint32 *) b;
+  return trigram_a < trigram_b ? -1 : (trigram_a > trigram_b ? 1 : 0);
+}
+
+static gint
+compare_lengths (gconstpointer a,
+                 gconstpointer b)
+{
+  const Trigram *trigram_a = *(const Trigram **) a;
+  const Trigram *trigram_b = *(const Trigram **) b;
+  return (gint) trigram_a->n_files - (gint) trigram_b->n_files;
+}
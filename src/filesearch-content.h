@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_CONTENT_H__
+#define	__FILE_SEARCH_CONTENT_H__
+
+#include <glib-object.h>
+#include "filesearch-stats.h"
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_CONTENT_TYPE            (file_search_content_get_type ())
+#define FILE_SEARCH_CONTENT(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_CONTENT_TYPE, FileSearchContent))
+#define FILE_SEARCH_CONTENT_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_CONTENT_TYPE, FileSearchContentClass))
+#define IS_FILE_SEARCH_CONTENT(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_CONTENT_TYPE))
+#define IS_FILE_SEARCH_CONTENT_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_CONTENT_TYPE))
+
+/* larger files are listed but their contents are not indexed */
+#define FILE_SEARCH_CONTENT_MAX_FILE_SIZE   (1 << 20)
+
+/* the content index sits next to the indexes file */
+#define FILE_SEARCH_CONTENT_SUFFIX          "-content"
+
+typedef struct _FileSearchContent FileSearchContent;
+typedef struct _FileSearchContentClass FileSearchContentClass;
+
+struct _FileSearchContent
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchContentClass
+{
+  GObjectClass parent_class;
+};
+
+GType file_search_content_get_type (void) G_GNUC_CONST;
+
+FileSearchContent*  file_search_content_new_from_file  (const gchar        *file_path,
+                                                        GError            **error);
+
+GPtrArray*          file_search_content_query          (FileSearchContent  *content,
+                                                        const gchar        *text);
+
+gboolean            file_search_content_write          (FileSearchContent  *previous,
+                                                        GList              *indexes,
+                                                        FileSearchStats    *stats,
+                                                        const gchar        *file_path,
+                                                        GError            **error);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_CONTENT_H__ */
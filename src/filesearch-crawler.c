@@ -0,0 +1,1231 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+#include <glib/gstdio.h>
+#include "filesearch-crawler.h"
+#include "filesearch-content.h"
+#include "filesearch-git.h"
+#include "filesearch-image.h"
+#include "filesearch-index.h"
+#include "filesearch-journal.h"
+#include "filesearch-probes.h"
+
+static void file_search_crawler_class_init  (FileSearchCrawlerClass *klass);
+static void file_search_crawler_init        (FileSearchCrawler      *crawler);
+static void file_search_crawler_finalize    (FileSearchCrawler      *crawler);
+
+typedef struct
+{
+  GHashTable *visited;
+  GList      *indexes;
+  gint64      filter_usec;
+  dev_t       device;
+  gint        files;
+  gboolean    truncated;
+} Walk;
+
+static void get_project_indexes             (FileSearchCrawler      *crawler,
+                                             const gchar            *dir_path, 
+                                             gint                    fd,
+                                             gint                    depth,
+                                             Walk                   *walk);
+static gint get_file_type                   (DIR                    *dir,
+                                             struct dirent          *dirent,
+                                             gboolean                follow_symlinks,
+                                             gint64                 *syscalls);
+static gint open_dir                        (FileSearchCrawler      *crawler,
+                                             gint                    parent_fd,
+                                             const gchar            *dir_name,
+                                             Walk                   *walk);
+static gboolean is_pseudo_filesystem        (gint                    fd);
+static void throttle                        (FileSearchCrawler      *crawler);
+static void get_git_indexes                 (FileSearchCrawler      *crawler,
+                                             GPtrArray              *paths,
+                                             Walk                   *walk);
+static gboolean visit_dir                   (GHashTable             *visited,
+                                             struct stat            *stat_buf);
+static guint file_id_hash                   (gconstpointer           key);
+static gboolean file_id_equal               (gconstpointer           a,
+                                             gconstpointer           b);
+static void file_id_free                    (gpointer                key);
+static void write_content                   (FileSearchCrawler      *crawler,
+                                             GList                  *indexes);
+static gboolean append_indexes              (FileSearchCrawler      *crawler,
+                                             GList                  *indexes,
+                                             guint64                *generation,
+                                             gsize                  *bytes_written);
+static GPtrArray* diff_indexes              (GHashTable             *files,
+                                             GList                  *indexes);
+static gboolean contains_element            (GList                  *list,
+                                             const gchar            *element);
+static gboolean contains_element_with_suffix (GList                 *list,
+                                              const gchar           *element);
+
+/* what a followed directory is known by, whatever path led to it */
+typedef struct
+{
+  guint64 device;
+  guint64 inode;
+} FileId;
+
+/* an update changing more than this share of the files rewrites the index file */
+#define MAX_CHANGED_FRACTION 8
+
+/* a main loop late by more than this many milliseconds halves the crawl rate */
+#define MAX_FOREGROUND_LAG 20
+/* which never drops below this many directories a second */
+#define MIN_DIRS_PER_SECOND 10
+/* and climbs back to the full rate over this long */
+#define RATE_RECOVERY_USEC (4 * G_USEC_PER_SEC)
+
+#define FILE_SEARCH_CRAWLER_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_CRAWLER_TYPE, FileSearchCrawlerPrivate))
+
+typedef struct _FileSearchCrawlerPrivate FileSearchCrawlerPrivate;
+
+/*
+ * The crawler only depends on GLib and POSIX, walking directories with
+ * openat and the d_type of readdir, and never on the CodeSlayer objects
+ * so that the same code can run inside the editor and inside the out of
+ * process indexing daemon.
+ */
+struct _FileSearchCrawlerPrivate
+{
+  FileSearchStats *stats;
+  gchar           *indexes_file;
+  gchar           *content_file;
+  GList           *projects;
+  GList           *project_keys;
+  GList           *exclude_types;
+  GList           *exclude_dirs;
+  gdouble          false_positive_rate;
+  gboolean         follow_symlinks;
+  gboolean         git_index;
+  gboolean         git_untracked;
+  gboolean         cross_mounts;
+  gint             max_depth;
+  gint             max_files;
+  gint             dirs_per_second;
+  gdouble          rate;
+  gdouble          tokens;
+  gint64           refill_time;
+  gint64           throttle_usec;
+  volatile gint    foreground_lag;
+  volatile gint    user_idle;
+  volatile gint    finished;
+};
+
+G_DEFINE_TYPE (FileSearchCrawler, file_search_crawler, G_TYPE_OBJECT)
+
+static void
+file_search_crawler_class_init (FileSearchCrawlerClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = (GObjectFinalizeFunc) file_search_crawler_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchCrawlerPrivate));
+}
+
+static void
+file_search_crawler_init (FileSearchCrawler *crawler)
+{
+  FileSearchCrawlerPrivate *priv;
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  priv->stats = NULL;
+  priv->indexes_file = NULL;
+  priv->content_file = NULL;
+  priv->projects = NULL;
+  priv->project_keys = NULL;
+  priv->exclude_types = NULL;
+  priv->exclude_dirs = NULL;
+  priv->false_positive_rate = FILE_SEARCH_IMAGE_FALSE_POSITIVE_RATE;
+  priv->follow_symlinks = FALSE;
+  priv->git_index = FALSE;
+  priv->git_untracked = FALSE;
+  priv->cross_mounts = FALSE;
+  priv->max_depth = 0;
+  priv->max_files = 0;
+  priv->dirs_per_second = 0;
+  priv->rate = 0;
+  priv->tokens = 0;
+  priv->refill_time = 0;
+  priv->throttle_usec = 0;
+  priv->foreground_lag = 0;
+  priv->user_idle = FALSE;
+  priv->finished = FALSE;
+}
+
+static void
+file_search_crawler_finalize (FileSearchCrawler *crawler)
+{
+  FileSearchCrawlerPrivate *priv;
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  if (priv->stats)
+    g_object_unref (priv->stats);
+  if (priv->indexes_file)
+    g_free (priv->indexes_file);
+  if (priv->content_file)
+    g_free (priv->content_file);
+  if (priv->projects)
+    {
+      g_list_foreach (priv->projects, (GFunc) g_free, NULL);
+      g_list_free (priv->projects);
+    }
+  if (priv->project_keys)
+    {
+      g_list_foreach (priv->project_keys, (GFunc) g_free, NULL);
+      g_list_free (priv->project_keys);
+    }
+  if (priv->exclude_types)
+    {
+      g_list_foreach (priv->exclude_types, (GFunc) g_free, NULL);
+      g_list_free (priv->exclude_types);
+    }
+  if (priv->exclude_dirs)
+    {
+      g_list_foreach (priv->exclude_dirs, (GFunc) g_free, NULL);
+      g_list_free (priv->exclude_dirs);
+    }
+  G_OBJECT_CLASS (file_search_crawler_parent_class)->finalize (G_OBJECT (crawler));
+}
+
+FileSearchCrawler*
+file_search_crawler_new (FileSearchStats *stats,
+                         const gchar     *indexes_file)
+{
+  FileSearchCrawlerPrivate *priv;
+  FileSearchCrawler *crawler;
+
+  crawler = FILE_SEARCH_CRAWLER (g_object_new (file_search_crawler_get_type (), NULL));
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  priv->stats = g_object_ref (stats);
+  priv->indexes_file = g_strdup (indexes_file);
+
+  return crawler;
+}
+
+const gchar*
+file_search_crawler_get_indexes_file (FileSearchCrawler *crawler)
+{
+  return FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler)->indexes_file;
+}
+
+/*
+ * The false positive rate of the block filters in the image, lower rates 
+ * skip more blocks for a bigger image.
+ */
+void
+file_search_crawler_set_false_positive_rate (FileSearchCrawler *crawler,
+                                             gdouble            false_positive_rate)
+{
+  FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler)->false_positive_rate = false_positive_rate;
+}
+
+/*
+ * When set the file contents are indexed by trigram into this file 
+ * every time the indexes are written.
+ */
+void
+file_search_crawler_set_content_file (FileSearchCrawler *crawler,
+                                      const gchar       *content_file)
+{
+  FileSearchCrawlerPrivate *priv;
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  g_free (priv->content_file);
+  priv->content_file = g_strdup (content_file);
+}
+
+/*
+ * Symbolic links are not followed unless asked for. When they are, every
+ * directory is visited once no matter how many links lead to it, so link
+ * cycles end and shared subtrees are not indexed twice.
+ */
+void
+file_search_crawler_set_follow_symlinks (FileSearchCrawler *crawler,
+                                         gboolean           follow_symlinks)
+{
+  FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler)->follow_symlinks = follow_symlinks;
+}
+
+/*
+ * Projects inside a git work tree are listed from the git index instead
+ * of being crawled. Only the tracked files are listed unless untracked 
+ * is set, which walks the project for the files that are not ignored.
+ */
+void
+file_search_crawler_set_git_index (FileSearchCrawler *crawler,
+                                   gboolean           git_index,
+                                   gboolean           untracked)
+{
+  FileSearchCrawlerPrivate *priv;
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  priv->git_index = git_index;
+  priv->git_untracked = untracked;
+}
+
+/*
+ * The crawl stays on the filesystem of the project folder unless cross
+ * mounts is set, and even then never enters a pseudo filesystem such as
+ * /proc or sysfs.
+ */
+void
+file_search_crawler_set_cross_mounts (FileSearchCrawler *crawler,
+                                      gboolean           cross_mounts)
+{
+  FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler)->cross_mounts = cross_mounts;
+}
+
+/*
+ * Directories deeper than max depth below the project folder are left 
+ * out, and a project stops being crawled once it has max files. Either 
+ * limit is off when 0.
+ */
+void
+file_search_crawler_set_limits (FileSearchCrawler *crawler,
+                                gint               max_depth,
+                                gint               max_files)
+{
+  FileSearchCrawlerPrivate *priv;
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  priv->max_depth = max_depth;
+  priv->max_files = max_files;
+}
+
+/*
+ * Directory reads are rationed by a token bucket of this many a second, 
+ * holding a second's worth at most, so that a crawl of a cold disk or a 
+ * network home leaves room for the editor's own file access.
+ */
+void
+file_search_crawler_set_dirs_per_second (FileSearchCrawler *crawler,
+                                         gint               dirs_per_second)
+{
+  FileSearchCrawlerPrivate *priv;
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  priv->dirs_per_second = dirs_per_second;
+  priv->rate = dirs_per_second;
+  priv->tokens = dirs_per_second;
+}
+
+/*
+ * Called from the main thread with how late its main loop ran. The worst
+ * lag since the crawl thread last looked is kept, and each report past 
+ * MAX_FOREGROUND_LAG halves the crawl rate.
+ */
+void
+file_search_crawler_report_lag (FileSearchCrawler *crawler,
+                                gint               lag_msec)
+{
+  FileSearchCrawlerPrivate *priv;
+  gint lag;
+  
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  
+  do
+    lag = g_atomic_int_get (&priv->foreground_lag);
+  while (lag < lag_msec && 
+         !g_atomic_int_compare_and_exchange (&priv->foreground_lag, lag, lag_msec));
+}
+
+/*
+ * Nobody is waiting on the editor while the user is away, so the crawl 
+ * runs at full speed until they are back.
+ */
+void
+file_search_crawler_set_user_idle (FileSearchCrawler *crawler,
+                                   gboolean           user_idle)
+{
+  g_atomic_int_set (&FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler)->user_idle, user_idle);
+}
+
+/*
+ * Whether the crawl is over, so there is nothing left to throttle.
+ */
+gboolean
+file_search_crawler_is_finished (FileSearchCrawler *crawler)
+{
+  return g_atomic_int_get (&FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler)->finished);
+}
+
+/*
+ * Every file found under the folder is tagged with the project key, so 
+ * the searches can be scoped to the project.
+ */
+void
+file_search_crawler_add_project (FileSearchCrawler *crawler,
+                                 const gchar       *project_key,
+                                 const gchar       *folder_path)
+{
+  FileSearchCrawlerPrivate *priv;
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  priv->projects = g_list_append (priv->projects, g_strdup (folder_path));
+  priv->project_keys = g_list_append (priv->project_keys, g_strdup (project_key));
+}
+
+void
+file_search_crawler_add_exclude_type (FileSearchCrawler *crawler,
+                                      const gchar       *exclude_type)
+{
+  FileSearchCrawlerPrivate *priv;
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  priv->exclude_types = g_list_append (priv->exclude_types, g_strdup (exclude_type));
+}
+
+void
+file_search_crawler_add_exclude_dir (FileSearchCrawler *crawler,
+                                     const gchar       *exclude_dir)
+{
+  FileSearchCrawlerPrivate *priv;
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  priv->exclude_dirs = g_list_append (priv->exclude_dirs, g_strdup (exclude_dir));
+}
+
+GList*
+file_search_crawler_get_projects (FileSearchCrawler *crawler)
+{
+  return FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler)->projects;
+}
+
+/*
+ * The project keys, in the same order as the folders of the projects.
+ */
+GList*
+file_search_crawler_get_project_keys (FileSearchCrawler *crawler)
+{
+  return FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler)->project_keys;
+}
+
+GList*
+file_search_crawler_get_exclude_types (FileSearchCrawler *crawler)
+{
+  return FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler)->exclude_types;
+}
+
+GList*
+file_search_crawler_get_exclude_dirs (FileSearchCrawler *crawler)
+{
+  return FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler)->exclude_dirs;
+}
+
+GList*
+file_search_crawler_get_indexes (FileSearchCrawler *crawler)
+{
+  FileSearchCrawlerPrivate *priv;
+  GList *results = NULL;
+  GList *projects;
+  GList *project_keys;
+  
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  
+  projects = priv->projects;
+  project_keys = priv->project_keys;
+  while (projects != NULL)
+    {
+      const gchar *folder_path = projects->data;
+      const gchar *project_key = project_keys->data;
+      GList *list;
+      GPtrArray *paths = NULL;
+      GList *indexes = NULL;
+      Walk walk = { NULL, NULL, 0, 0, 0, FALSE };
+      gint64 start;
+      gint64 throttle_usec = priv->throttle_usec;
+      
+      FILE_SEARCH_PROBE1 (crawl__start, folder_path);
+      start = g_get_monotonic_time ();
+      
+      if (priv->git_index)
+        paths = file_search_git_get_paths (folder_path, priv->exclude_dirs, 
+                                           priv->git_untracked);
+      
+      if (paths != NULL)
+        {
+          get_git_indexes (crawler, paths, &walk);
+          g_ptr_array_free (paths, TRUE);
+        }
+      else
+        {
+          struct stat stat_buf;
+          gint fd;
+          
+          fd = g_open (folder_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+          if (fd >= 0 && fstat (fd, &stat_buf) == 0)
+            {
+              walk.device = stat_buf.st_dev;
+              if (priv->follow_symlinks)
+                {
+                  walk.visited = g_hash_table_new_full (file_id_hash, file_id_equal, 
+                                                        file_id_free, NULL);
+                  visit_dir (walk.visited, &stat_buf);
+                }
+              get_project_indexes (crawler, folder_path, fd, 0, &walk);
+            }
+          else if (fd >= 0)
+            {
+              close (fd);
+            }
+        }
+      
+      if (walk.visited != NULL)
+        g_hash_table_destroy (walk.visited);
+        
+      if (walk.truncated)
+        g_warning ("Stopped indexing %s after %d files\n", folder_path, walk.files);
+      
+      /* the filter and throttle time is spent inside the crawl so keep the phases apart */
+      throttle_usec = priv->throttle_usec - throttle_usec;
+      file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_ENUMERATE, 
+                                g_get_monotonic_time () - start - walk.filter_usec - throttle_usec);
+      file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_FILTER, walk.filter_usec);
+      FILE_SEARCH_PROBE1 (crawl__done, folder_path);
+      
+      indexes = walk.indexes;
+      for (list = indexes; list != NULL; list = list->next)
+        file_search_index_set_project_key (list->data, project_key);
+      
+      if (indexes != NULL)
+        results = g_list_concat (results, indexes);
+
+      projects = g_list_next (projects);
+      project_keys = g_list_next (project_keys);
+    }
+  
+  g_atomic_int_set (&priv->finished, TRUE);
+    
+  return results;    
+}
+
+/*
+ * Walks the directory open on fd, which it closes. Only the entry names
+ * and types from the directory itself are looked at, so an excluded 
+ * directory or file costs nothing beyond its name, and nothing is 
+ * allocated for the entries that are left out.
+ */
+static void
+get_project_indexes (FileSearchCrawler *crawler,
+                     const gchar       *dir_path,
+                     gint               fd,
+                     gint               depth,
+                     Walk              *walk)
+{
+  FileSearchCrawlerPrivate *priv;
+  DIR *dir;
+  struct dirent *dirent;
+  gint64 files = 0;
+  gint64 excluded = 0;
+  gint64 syscalls = 1;
+  
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  
+  throttle (crawler);
+  
+  dir = fdopendir (fd);
+  if (dir == NULL)
+    {
+      close (fd);
+      return;
+    }
+  
+  while (!walk->truncated && (dirent = readdir (dir)) != NULL)
+    {
+      const gchar *file_name = dirent->d_name;
+      gboolean include;
+      gint64 start;
+      
+      if (file_name[0] == '.' && 
+          (file_name[1] == '\0' || (file_name[1] == '.' && file_name[2] == '\0')))
+        continue;
+        
+      if (get_file_type (dir, dirent, priv->follow_symlinks, &syscalls) == DT_DIR)
+        {
+          gint child_fd = -1;
+          
+          start = g_get_monotonic_time ();
+          include = !contains_element (priv->exclude_dirs, file_name) &&
+                    (priv->max_depth <= 0 || depth < priv->max_depth);
+          walk->filter_usec += g_get_monotonic_time () - start;
+          
+          if (include)
+            {
+              child_fd = open_dir (crawler, dirfd (dir), file_name, walk);
+              syscalls += 2;
+            }
+          
+          if (child_fd >= 0)
+            {
+              gchar *child_path;
+              child_path = g_build_filename (dir_path, file_name, NULL);
+              get_project_indexes (crawler, child_path, child_fd, depth + 1, walk);
+              g_free (child_path);
+            }
+          else
+            {
+              excluded++;
+            }
+        }
+      else
+        {
+          files++;
+          
+          if (priv->max_files > 0 && walk->files >= priv->max_files)
+            {
+              walk->truncated = TRUE;
+              break;
+            }
+          
+          start = g_get_monotonic_time ();
+          include = !contains_element_with_suffix (priv->exclude_types, file_name);
+          walk->filter_usec += g_get_monotonic_time () - start;
+          
+          if (!include)
+            {
+              excluded++;
+            }
+          else
+            {
+              FileSearchIndex *index;
+              gchar *file_path;
+              file_path = g_build_filename (dir_path, file_name, NULL);
+              
+              index = file_search_index_new ();
+              file_search_index_set_file_name (index, file_name);
+              file_search_index_set_file_path (index, file_path);
+              
+              g_free (file_path);
+              
+              walk->indexes = g_list_prepend (walk->indexes, index);
+              walk->files++;
+            }
+        }
+    }
+    
+  closedir (dir);
+  
+  /* batch the counters per directory so the stats lock stays cold */
+  file_search_stats_add (priv->stats, FILE_SEARCH_COUNTER_DIRS_VISITED, 1);
+  file_search_stats_add (priv->stats, FILE_SEARCH_COUNTER_FILES_VISITED, files);
+  file_search_stats_add (priv->stats, FILE_SEARCH_COUNTER_EXCLUDED, excluded);
+  file_search_stats_add (priv->stats, FILE_SEARCH_COUNTER_SYSCALLS, syscalls);
+}
+
+/*
+ * The type comes from the directory entry, only filesystems that leave 
+ * it out, and links that are followed, need a stat. Links that are not
+ * followed are indexed like files.
+ */
+static gint
+get_file_type (DIR           *dir,
+               struct dirent *dirent,
+               gboolean       follow_symlinks,
+               gint64        *syscalls)
+{
+  struct stat stat_buf;
+  gint type = DT_UNKNOWN;
+  
+#ifdef _DIRENT_HAVE_D_TYPE
+  type = dirent->d_type;
+#endif
+
+  if (type == DT_UNKNOWN || (type == DT_LNK && follow_symlinks))
+    {
+      (*syscalls)++;
+      if (fstatat (dirfd (dir), dirent->d_name, &stat_buf, 
+                   follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW) == 0 &&
+          S_ISDIR (stat_buf.st_mode))
+        type = DT_DIR;
+      else if (type == DT_UNKNOWN)
+        type = DT_REG;
+    }
+    
+  return type;
+}
+
+/*
+ * Returns the open directory, or -1 when it is not to be crawled: it is
+ * on another filesystem, or a link to a directory that was visited.
+ */
+static gint
+open_dir (FileSearchCrawler *crawler,
+          gint               parent_fd,
+          const gchar       *dir_name,
+          Walk              *walk)
+{
+  FileSearchCrawlerPrivate *priv;
+  struct stat stat_buf;
+  gint flags;
+  gint fd;
+  
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  
+  flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+  if (!priv->follow_symlinks)
+    flags |= O_NOFOLLOW;
+  
+  fd = openat (parent_fd, dir_name, flags);
+  if (fd < 0)
+    return -1;
+    
+  if (fstat (fd, &stat_buf) != 0 ||
+      (stat_buf.st_dev != walk->device && 
+       (!priv->cross_mounts || is_pseudo_filesystem (fd))) ||
+      (walk->visited != NULL && !visit_dir (walk->visited, &stat_buf)))
+    {
+      close (fd);
+      return -1;
+    }
+    
+  return fd;
+}
+
+/*
+ * Filesystems made up by the kernel, which may be endless or have side 
+ * effects on read. The automounter is in the list so that crossing into
+ * it never triggers a mount.
+ */
+static gboolean
+is_pseudo_filesystem (gint fd)
+{
+#ifdef __linux__
+  static const gulong magics[] = 
+  {
+    0x00009fa0, /* proc */
+    0x62656572, /* sysfs */
+    0x00001cd1, /* devpts */
+    0x0027e0eb, /* cgroup */
+    0x63677270, /* cgroup2 */
+    0x64626720, /* debugfs */
+    0x74726163, /* tracefs */
+    0x73636673, /* securityfs */
+    0xcafe4a11, /* bpf */
+    0x62656570, /* configfs */
+    0x6165676c, /* pstore */
+    0x65735543, /* fusectl */
+    0x42494e4d, /* binfmt_misc */
+    0x00000187  /* autofs */
+  };
+  struct statfs statfs_buf;
+  guint i;
+  
+  if (fstatfs (fd, &statfs_buf) != 0)
+    return TRUE;
+    
+  for (i = 0; i < G_N_ELEMENTS (magics); i++)
+    if ((gulong) statfs_buf.f_type == magics[i])
+      return TRUE;
+#endif
+      
+  return FALSE;
+}
+
+/*
+ * Takes a token for the next directory read, sleeping until one is due. 
+ * The rate backs off while the editor lags and recovers slowly after.
+ */
+static void
+throttle (FileSearchCrawler *crawler)
+{
+  FileSearchCrawlerPrivate *priv;
+  gint64 now;
+  gint64 elapsed;
+  gint lag;
+  
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  
+  if (priv->dirs_per_second <= 0)
+    return;
+    
+  now = g_get_monotonic_time ();
+  elapsed = priv->refill_time > 0 ? now - priv->refill_time : 0;
+  priv->refill_time = now;
+  
+  if (g_atomic_int_get (&priv->user_idle))
+    {
+      priv->rate = priv->dirs_per_second;
+      priv->tokens = priv->rate;
+      return;
+    }
+    
+  lag = g_atomic_int_get (&priv->foreground_lag);
+  if (lag > MAX_FOREGROUND_LAG && 
+      g_atomic_int_compare_and_exchange (&priv->foreground_lag, lag, 0))
+    {
+      priv->rate = MAX (priv->rate / 2, MIN_DIRS_PER_SECOND);
+      FILE_SEARCH_PROBE1 (crawl__backoff, (gint) priv->rate);
+    }
+  else
+    {
+      priv->rate = MIN (priv->rate + (gdouble) priv->dirs_per_second * elapsed / RATE_RECOVERY_USEC, 
+                        priv->dirs_per_second);
+    }
+  
+  priv->tokens = MIN (priv->tokens + priv->rate * elapsed / G_USEC_PER_SEC, priv->rate);
+  if (priv->tokens < 1)
+    {
+      gint64 wait = (1 - priv->tokens) * G_USEC_PER_SEC / priv->rate;
+      
+      g_usleep (wait);
+      priv->refill_time += wait;
+      priv->throttle_usec += wait;
+      priv->tokens = 1;
+      file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_THROTTLE, wait);
+    }
+    
+  priv->tokens--;
+}
+
+/*
+ * The excluded directories were already left out while the paths were 
+ * listed, only the excluded types are left to filter.
+ */
+static void
+get_git_indexes (FileSearchCrawler *crawler,
+                 GPtrArray         *paths,
+                 Walk              *walk)
+{
+  FileSearchCrawlerPrivate *priv;
+  gint64 excluded = 0;
+  gint64 start;
+  guint i;
+  
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  
+  start = g_get_monotonic_time ();
+  
+  for (i = 0; i < paths->len; i++)
+    {
+      const gchar *file_path = g_ptr_array_index (paths, i);
+      const gchar *file_name;
+      FileSearchIndex *index;
+      
+      if (priv->max_files > 0 && walk->files >= priv->max_files)
+        {
+          walk->truncated = TRUE;
+          excluded += paths->len - i;
+          break;
+        }
+      
+      file_name = strrchr (file_path, G_DIR_SEPARATOR) + 1;
+      
+      if (contains_element_with_suffix (priv->exclude_types, file_name))
+        {
+          excluded++;
+          continue;
+        }
+      
+      index = file_search_index_new ();
+      file_search_index_set_file_name (index, file_name);
+      file_search_index_set_file_path (index, file_path);
+      walk->indexes = g_list_prepend (walk->indexes, index);
+      walk->files++;
+    }
+    
+  walk->filter_usec += g_get_monotonic_time () - start;
+  
+  file_search_stats_add (priv->stats, FILE_SEARCH_COUNTER_FILES_VISITED, paths->len);
+  file_search_stats_add (priv->stats, FILE_SEARCH_COUNTER_EXCLUDED, excluded);
+}
+
+/*
+ * A small change to the files is appended to the log of the indexes 
+ * file, anything else rewrites the indexes file and starts a new log. 
+ * The image is only built when the indexes file is rewritten or when
+ * the caller asks for it to publish to other processes, otherwise NULL
+ * is returned. A log grown past its limit is left for 
+ * file_search_crawler_compact_indexes() to fold in afterwards.
+ */
+GBytes*
+file_search_crawler_write_indexes (FileSearchCrawler *crawler,
+                                   GList             *indexes,
+                                   gboolean           publish)
+{
+  FileSearchCrawlerPrivate *priv;
+  GError *error = NULL;
+  GBytes *image = NULL;
+  gint64 start;
+  gsize bytes_written;
+  gboolean appended;
+  gchar *journal_file;
+  
+  /* wall clock time keeps generations unique across processes and restarts */
+  guint64 generation = g_get_real_time ();
+  
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+
+  if (priv->content_file != NULL)
+    write_content (crawler, indexes);
+
+  start = g_get_monotonic_time ();
+
+  appended = append_indexes (crawler, indexes, &generation, &bytes_written);
+
+  if (!appended || publish)
+    image = file_search_image_build (indexes, generation, priv->false_positive_rate, 0);
+  
+  if (!appended)
+    {
+      bytes_written = g_bytes_get_size (image);
+      if (!file_search_image_write (image, priv->indexes_file, &error))
+        {
+          g_warning ("Error writing to file search file: %s\n", error->message);
+          g_error_free (error);
+          g_bytes_unref (image);
+          return NULL;
+        }
+        
+      /* the log went stale with the rename, this only tidies it away */
+      journal_file = g_strconcat (priv->indexes_file, FILE_SEARCH_JOURNAL_SUFFIX, NULL);
+      g_unlink (journal_file);
+      g_free (journal_file);
+    }
+
+  file_search_stats_add (priv->stats, FILE_SEARCH_COUNTER_BYTES_WRITTEN, bytes_written);
+  file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_SERIALIZE, 
+                            g_get_monotonic_time () - start);
+  FILE_SEARCH_PROBE1 (serialize__done, bytes_written);
+  
+  return image;
+}
+
+/*
+ * Folds a log grown past FILE_SEARCH_JOURNAL_MAX_SIZE into a new indexes
+ * file. It runs after the write, once readers already see the update 
+ * through the log, and on the same thread so that it never races the 
+ * next append. The image of the write is reused when there is one.
+ */
+void
+file_search_crawler_compact_indexes (FileSearchCrawler *crawler,
+                                     GBytes            *image)
+{
+  FileSearchCrawlerPrivate *priv;
+  GError *error = NULL;
+  GStatBuf buf;
+  gchar *journal_file;
+  gint64 start;
+  
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+  
+  journal_file = g_strconcat (priv->indexes_file, FILE_SEARCH_JOURNAL_SUFFIX, NULL);
+  if (g_stat (journal_file, &buf) != 0 || buf.st_size < FILE_SEARCH_JOURNAL_MAX_SIZE)
+    {
+      g_free (journal_file);
+      return;
+    }
+  g_free (journal_file);
+  
+  start = g_get_monotonic_time ();
+  
+  if (!file_search_journal_compact (priv->indexes_file, image, 
+                                    priv->false_positive_rate, &error))
+    {
+      g_warning ("Error compacting file search file: %s\n", error->message);
+      g_error_free (error);
+      return;
+    }
+    
+  file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_SERIALIZE, 
+                            g_get_monotonic_time () - start);
+}
+
+/*
+ * Appends the difference between the indexes file, with its log, and
+ * the crawled indexes to the log. Returns FALSE when the indexes file
+ * has to be written instead. Without a change nothing is written and 
+ * the generation stays what it was. Readers need a memfd to replay the
+ * log into, so without one the log is never used.
+ */
+static gboolean
+append_indexes (FileSearchCrawler *crawler,
+                GList             *indexes,
+                guint64           *generation,
+                gsize             *bytes_written)
+{
+#ifdef HAVE_MEMFD_CREATE
+  FileSearchCrawlerPrivate *priv;
+  FileSearchImage *image;
+  FileSearchJournal *journal;
+  GHashTable *files;
+  GPtrArray *records;
+  GError *error = NULL;
+  gchar *journal_file;
+  gsize length;
+  gboolean result = FALSE;
+  
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+
+  image = file_search_image_new_from_file (priv->indexes_file, NULL);
+  if (image == NULL)
+    return FALSE;
+    
+  if (file_search_image_is_relative (image))
+    {
+      g_object_unref (image);
+      return FALSE;
+    }
+  
+  journal_file = g_strconcat (priv->indexes_file, FILE_SEARCH_JOURNAL_SUFFIX, NULL);
+  journal = file_search_journal_new_from_file (journal_file, 
+                                               file_search_image_get_generation (image));
+  g_free (journal_file);
+  
+  files = file_search_journal_replay (journal, image);
+  records = diff_indexes (files, indexes);
+  length = file_search_journal_get_length (journal);
+  
+  if (records->len == 0)
+    {
+      *generation = file_search_journal_get_generation (journal);
+      *bytes_written = 0;
+      result = TRUE;
+    }
+  else if (records->len <= g_hash_table_size (files) / MAX_CHANGED_FRACTION)
+    {
+      result = file_search_journal_append (journal, records, *generation, &error);
+      g_ptr_array_set_size (records, 0);
+      if (result)
+        {
+          *bytes_written = file_search_journal_get_length (journal) - length;
+        }
+      else
+        {
+          g_warning ("%s\n", error->message);
+          g_error_free (error);
+        }
+    }
+  
+  g_ptr_array_foreach (records, (GFunc) file_search_journal_record_free, NULL);
+  g_ptr_array_free (records, TRUE);
+  g_hash_table_destroy (files);
+  g_object_unref (journal);
+  g_object_unref (image);
+  
+  return result;
+#else
+  return FALSE;
+#endif
+}
+
+/*
+ * A file that went away and one with the same name that showed up in 
+ * the same project are taken for a rename. A file that moved to another
+ * project is removed and added again, the removals go first.
+ */
+static GPtrArray*
+diff_indexes (GHashTable *files,
+              GList      *indexes)
+{
+  GPtrArray *records;
+  GPtrArray *changes;
+  GHashTable *crawled;
+  GHashTable *removed;
+  GHashTableIter iter;
+  gpointer file_path;
+  gpointer project_key;
+  GList *list;
+  guint i;
+  
+  records = g_ptr_array_new ();
+  changes = g_ptr_array_new ();
+  crawled = g_hash_table_new (g_str_hash, g_str_equal);
+  removed = g_hash_table_new (g_str_hash, g_str_equal);
+  
+  for (list = indexes; list != NULL; list = list->next)
+    g_hash_table_insert (crawled, (gpointer) file_search_index_get_file_path (list->data), 
+                         list->data);
+  
+  /* the paths that went away, by file name */
+  g_hash_table_iter_init (&iter, files);
+  while (g_hash_table_iter_next (&iter, &file_path, &project_key))
+    {
+      FileSearchIndex *index = g_hash_table_lookup (crawled, file_path);
+      if (index == NULL || 
+          g_strcmp0 (file_search_index_get_project_key (index), project_key) != 0)
+        {
+          const gchar *file_name = strrchr (file_path, G_DIR_SEPARATOR);
+          file_name = file_name != NULL ? file_name + 1 : file_path;
+          g_hash_table_insert (removed, (gpointer) file_name, 
+                               g_list_prepend (g_hash_table_lookup (removed, file_name), 
+                                               file_path));
+        }
+    }
+  
+  for (list = indexes; list != NULL; list = list->next)
+    {
+      FileSearchIndex *index = list->data;
+      const gchar *file_name = file_search_index_get_file_name (index);
+      const gchar *new_project_key = file_search_index_get_project_key (index);
+      GList *candidates;
+      GList *candidate;
+      
+      if (new_project_key == NULL)
+        new_project_key = "";
+      
+      project_key = g_hash_table_lookup (files, file_search_index_get_file_path (index));
+      if (project_key != NULL && strcmp (project_key, new_project_key) == 0)
+        continue;
+        
+      candidates = g_hash_table_lookup (removed, file_name);
+      for (candidate = candidates; candidate != NULL; candidate = candidate->next)
+        {
+          if (strcmp (g_hash_table_lookup (files, candidate->data), new_project_key) == 0)
+            break;
+        }
+        
+      if (candidate != NULL)
+        {
+          g_ptr_array_add (changes, 
+                           file_search_journal_record_new (FILE_SEARCH_JOURNAL_RENAME, NULL, 
+                                                           candidate->data,
+                                                           file_search_index_get_file_path (index)));
+          candidates = g_list_delete_link (candidates, candidate);
+          g_hash_table_insert (removed, (gpointer) file_name, candidates);
+        }
+      else
+        {
+          g_ptr_array_add (changes, 
+                           file_search_journal_record_new (FILE_SEARCH_JOURNAL_ADD, new_project_key, 
+                                                           file_search_index_get_file_path (index),
+                                                           NULL));
+        }
+    }
+  
+  g_hash_table_iter_init (&iter, removed);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &list))
+    {
+      GList *candidate;
+      for (candidate = list; candidate != NULL; candidate = candidate->next)
+        g_ptr_array_add (records, 
+                         file_search_journal_record_new (FILE_SEARCH_JOURNAL_REMOVE, NULL, 
+                                                         candidate->data, NULL));
+      g_list_free (list);
+    }
+    
+  for (i = 0; i < changes->len; i++)
+    g_ptr_array_add (records, g_ptr_array_index (changes, i));
+  
+  g_ptr_array_free (changes, TRUE);
+  g_hash_table_destroy (removed);
+  g_hash_table_destroy (crawled);
+  
+  return records;
+}
+
+/*
+ * The content index is written before the image so that 
+ * by the time the editor loads the new image its contents are indexed 
+ * too. The previous index lets unchanged files keep their lists.
+ */
+static void
+write_content (FileSearchCrawler *crawler,
+               GList             *indexes)
+{
+  FileSearchCrawlerPrivate *priv;
+  FileSearchContent *previous;
+  GError *error = NULL;
+  
+  priv = FILE_SEARCH_CRAWLER_GET_PRIVATE (crawler);
+
+  previous = file_search_content_new_from_file (priv->content_file, NULL);
+  
+  if (!file_search_content_write (previous, indexes, priv->stats, 
+                                  priv->content_file, &error))
+    {
+      g_warning ("Error writing to file search content file: %s\n", error->message);
+      g_error_free (error);
+    }
+
+  if (previous != NULL)
+    g_object_unref (previous);
+}
+
+/*
+ * Returns FALSE when the directory was already crawled through another 
+ * path.
+ */
+static gboolean
+visit_dir (GHashTable  *visited,
+           struct stat *stat_buf)
+{
+  FileId *file_id;
+  
+  file_id = g_slice_new (FileId);
+  file_id->device = stat_buf->st_dev;
+  file_id->inode = stat_buf->st_ino;
+  
+  if (g_hash_table_lookup_extended (visited, file_id, NULL, NULL))
+    {
+      g_slice_free (FileId, file_id);
+      return FALSE;
+    }
+    
+  g_hash_table_insert (visited, file_id, file_id);
+  return TRUE;
+}
+
+static guint
+file_id_hash (gconstpointer key)
+{
+  const FileId *file_id = key;
+  return (guint) (file_id->inode ^ (file_id->inode >> 32) ^ (file_id->device * 31));
+}
+
+static gboolean
+file_id_equal (gconstpointer a,
+               gconstpointer b)
+{
+  const FileId *file_id_a = a;
+  const FileId *file_id_b = b;
+  return file_id_a->inode == file_id_b->inode && file_id_a->device == file_id_b->device;
+}
+
+static void
+file_id_free (gpointer key)
+{
+  g_slice_free (FileId, key);
+}
+
+static gboolean
+contains_element (GList       *list,
+                  const gchar *element)
+{
+  while (list != NULL)
+    {
+      if (g_strcmp0 (list->data, element) == 0)
+        return TRUE;
+      list = g_list_next (list);
+    }
+  return FALSE;
+}
+
+static gboolean
+contains_element_with_suffix (GList       *list,
+                              const gchar *element)
+{
+  while (list != NULL)
+    {
+      if (g_str_has_suffix (element, list->data))
+        return TRUE;
+      list = g_list_next (list);
+    }
+  return FALSE;
+}
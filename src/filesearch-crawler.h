@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_CRAWLER_H__
+#define	__FILE_SEARCH_CRAWLER_H__
+
+#include <gio/gio.h>
+#include "filesearch-stats.h"
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_CRAWLER_TYPE            (file_search_crawler_get_type ())
+#define FILE_SEARCH_CRAWLER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_CRAWLER_TYPE, FileSearchCrawler))
+#define FILE_SEARCH_CRAWLER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_CRAWLER_TYPE, FileSearchCrawlerClass))
+#define IS_FILE_SEARCH_CRAWLER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_CRAWLER_TYPE))
+#define IS_FILE_SEARCH_CRAWLER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_CRAWLER_TYPE))
+
+/* directories read a second while the editor is in use, 0 does not limit */
+#define FILE_SEARCH_CRAWLER_DIRS_PER_SECOND 500
+
+/* how deep below a project folder, and how many files in a project, are crawled */
+#define FILE_SEARCH_CRAWLER_MAX_DEPTH       64
+#define FILE_SEARCH_CRAWLER_MAX_FILES       1000000
+
+typedef struct _FileSearchCrawler FileSearchCrawler;
+typedef struct _FileSearchCrawlerClass FileSearchCrawlerClass;
+
+struct _FileSearchCrawler
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchCrawlerClass
+{
+  GObjectClass parent_class;
+};
+
+GType file_search_crawler_get_type (void) G_GNUC_CONST;
+
+FileSearchCrawler*  file_search_crawler_new                (FileSearchStats   *stats,
+                                                            const gchar       *indexes_file);
+
+const gchar*        file_search_crawler_get_indexes_file   (FileSearchCrawler *crawler);
+void                file_search_crawler_set_false_positive_rate (FileSearchCrawler *crawler,
+                                                                 gdouble            false_positive_rate);
+void                file_search_crawler_set_content_file   (FileSearchCrawler *crawler,
+                                                            const gchar       *content_file);
+void                file_search_crawler_set_follow_symlinks (FileSearchCrawler *crawler,
+                                                             gboolean           follow_symlinks);
+void                file_search_crawler_set_git_index      (FileSearchCrawler *crawler,
+                                                            gboolean           git_index,
+                                                            gboolean           untracked);
+void                file_search_crawler_set_cross_mounts   (FileSearchCrawler *crawler,
+                                                            gboolean           cross_mounts);
+void                file_search_crawler_set_limits         (FileSearchCrawler *crawler,
+                                                            gint               max_depth,
+                                                            gint               max_files);
+void                file_search_crawler_set_dirs_per_second (FileSearchCrawler *crawler,
+                                                             gint               dirs_per_second);
+void                file_search_crawler_report_lag         (FileSearchCrawler *crawler,
+                                                            gint               lag_msec);
+void                file_search_crawler_set_user_idle      (FileSearchCrawler *crawler,
+                                                            gboolean           user_idle);
+gboolean            file_search_crawler_is_finished        (FileSearchCrawler *crawler);
+
+void                file_search_crawler_add_project        (FileSearchCrawler *crawler,
+                                                            const gchar       *project_key,
+                                                            const gchar       *folder_path);
+void                file_search_crawler_add_exclude_type   (FileSearchCrawler *crawler,
+                                                            const gchar       *exclude_type);
+void                file_search_crawler_add_exclude_dir    (FileSearchCrawler *crawler,
+                                                            const gchar       *exclude_dir);
+GList*              file_search_crawler_get_projects       (FileSearchCrawler *crawler);
+GList*              file_search_crawler_get_project_keys   (FileSearchCrawler *crawler);
+GList*              file_search_crawler_get_exclude_types  (FileSearchCrawler *crawler);
+GList*              file_search_crawler_get_exclude_dirs   (FileSearchCrawler *crawler);
+
+GList*              file_search_crawler_get_indexes        (FileSearchCrawler *crawler);
+GBytes*             file_search_crawler_write_indexes      (FileSearchCrawler *crawler,
+                                                            GList             *indexes,
+                                                            gboolean           publish);
+void                file_search_crawler_compact_indexes    (FileSearchCrawler *crawler,
+                                                            GBytes            *image);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_CRAWLER_H__ */
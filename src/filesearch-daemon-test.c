@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Starts the daemon on a private session bus, has it index a small 
+ * project and asks for the index the way an editor does, checking that
+ * the sealed memfd comes back with the reply and maps to the generation
+ * the daemon announced. Needs dbus-daemon, and is skipped where there 
+ * is no memfd to hand over.
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <glib/gstdio.h>
+#include "filesearch-daemon.h"
+#include "filesearch-image.h"
+
+/* how long the daemon gets to show up on the bus and finish the crawl */
+#define WAIT_SECONDS 30
+
+/* automake takes this exit status for a skipped test */
+#define EXIT_SKIP 77
+
+static void name_appeared_action      (GDBusConnection *connection,
+                                       const gchar     *name,
+                                       const gchar     *name_owner,
+                                       GMainLoop       *loop);
+static void index_changed_action      (GDBusConnection *connection,
+                                       const gchar     *sender_name,
+                                       const gchar     *object_path,
+                                       const gchar     *interface_name,
+                                       const gchar     *signal_name,
+                                       GVariant        *parameters,
+                                       GMainLoop       *loop);
+static gboolean timeout_action        (GMainLoop       *loop);
+static gboolean wait_for              (GMainLoop       *loop);
+static guint64 request_index          (GDBusConnection *bus,
+                                       const gchar     *index_file,
+                                       const gchar     *folder_path);
+static gint check_get_index           (GDBusConnection *bus,
+                                       const gchar     *index_file);
+static void remove_folder             (const gchar     *folder_path);
+
+static guint64 announced = 0;
+static gboolean timed_out = FALSE;
+
+int
+main (int   argc, 
+      char *argv[])
+{
+#if defined (HAVE_MEMFD_CREATE) && GLIB_CHECK_VERSION (2, 34, 0)
+  GTestDBus *test_bus;
+  GDBusConnection *bus;
+  GMainLoop *loop;
+  GError *error = NULL;
+  gchar *daemon_argv[] = { FILE_SEARCH_DAEMON_EXECUTABLE, NULL };
+  gchar *folder_path;
+  gchar *file_path;
+  gchar *index_file;
+  GPid pid;
+  guint watch_id;
+  guint signal_id;
+  gint failures = 0;
+
+  folder_path = g_dir_make_tmp ("filesearch-daemon-test-XXXXXX", &error);
+  if (folder_path == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  file_path = g_build_filename (folder_path, "hello.c", NULL);
+  index_file = g_build_filename (folder_path, "filesearch", NULL);
+  g_file_set_contents (file_path, "int main;\n", -1, NULL);
+
+  test_bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_up (test_bus);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  if (bus == NULL ||
+      !g_spawn_async (NULL, daemon_argv, NULL, G_SPAWN_DEFAULT, NULL, NULL, &pid, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return EXIT_FAILURE;
+    }
+
+  watch_id = g_bus_watch_name_on_connection (bus, FILE_SEARCH_DAEMON_NAME,
+                                             G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                             (GBusNameAppearedCallback) name_appeared_action,
+                                             NULL, loop, NULL);
+  signal_id = g_dbus_connection_signal_subscribe (bus, NULL, FILE_SEARCH_DAEMON_INTERFACE,
+                                                  "IndexChanged",
+                                                  FILE_SEARCH_DAEMON_OBJECT_PATH,
+                                                  NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                                  (GDBusSignalCallback) index_changed_action,
+                                                  loop, NULL);
+
+  if (!wait_for (loop))
+    {
+      g_printerr ("the daemon did not show up on the bus\n");
+      failures++;
+    }
+  else if (request_index (bus, index_file, folder_path) == 0 && !wait_for (loop))
+    {
+      g_printerr ("the daemon did not announce an index\n");
+      failures++;
+    }
+  else
+    {
+      failures += check_get_index (bus, index_file);
+    }
+
+  g_dbus_connection_signal_unsubscribe (bus, signal_id);
+  g_bus_unwatch_name (watch_id);
+  kill (pid, SIGTERM);
+  g_spawn_close_pid (pid);
+  g_object_unref (bus);
+  g_main_loop_unref (loop);
+  g_test_dbus_down (test_bus);
+  g_object_unref (test_bus);
+
+  remove_folder (folder_path);
+  g_free (folder_path);
+  g_free (file_path);
+  g_free (index_file);
+
+  if (failures > 0)
+    {
+      g_printerr ("%d failures\n", failures);
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+#else
+  return EXIT_SKIP;
+#endif
+}
+
+static void
+name_appeared_action (GDBusConnection *connection,
+                      const gchar     *name,
+                      const gchar     *name_owner,
+                      GMainLoop       *loop)
+{
+  g_main_loop_quit (loop);
+}
+
+static void
+index_changed_action (GDBusConnection *connection,
+                      const gchar     *sender_name,
+                      const gchar     *object_path,
+                      const gchar     *interface_name,
+                      const gchar     *signal_name,
+                      GVariant        *parameters,
+                      GMainLoop       *loop)
+{
+  g_variant_get (parameters, "(&st)", NULL, &announced);
+  g_main_loop_quit (loop);
+}
+
+static gboolean
+timeout_action (GMainLoop *loop)
+{
+  timed_out = TRUE;
+  g_main_loop_quit (loop);
+  return FALSE;
+}
+
+/* runs the loop until a callback quits it, FALSE when it timed out */
+static gboolean
+wait_for (GMainLoop *loop)
+{
+  guint source_id;
+
+  timed_out = FALSE;
+  source_id = g_timeout_add_seconds (WAIT_SECONDS, (GSourceFunc) timeout_action, loop);
+  g_main_loop_run (loop);
+  if (!timed_out)
+    g_source_remove (source_id);
+
+  return !timed_out;
+}
+
+/* the generation of an index that was already there, 0 while it crawls */
+static guint64
+request_index (GDBusConnection *bus,
+               const gchar     *index_file,
+               const gchar     *folder_path)
+{
+  GVariantBuilder projects;
+  GVariantBuilder exclude_types;
+  GVariantBuilder exclude_dirs;
+  GVariant *reply;
+  GError *error = NULL;
+  guint64 generation = 0;
+
+  g_variant_builder_init (&projects, G_VARIANT_TYPE ("a(ss)"));
+  g_variant_builder_init (&exclude_types, G_VARIANT_TYPE ("as"));
+  g_variant_builder_init (&exclude_dirs, G_VARIANT_TYPE ("as"));
+  g_variant_builder_add (&projects, "(ss)", "test", folder_path);
+
+  reply = g_dbus_connection_call_sync (bus, FILE_SEARCH_DAEMON_NAME, 
+                                       FILE_SEARCH_DAEMON_OBJECT_PATH, 
+                                       FILE_SEARCH_DAEMON_INTERFACE, "Index",
+                                       g_variant_new ("(sa(ss)asasb)", index_file, &projects,
+                                                      &exclude_types, &exclude_dirs, TRUE),
+                                       G_VARIANT_TYPE ("(t)"), G_DBUS_CALL_FLAGS_NONE, 
+                                       -1, NULL, &error);
+  if (reply == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 0;
+    }
+
+  g_variant_get (reply, "(t)", &generation);
+  g_variant_unref (reply);
+
+  if (generation > 0)
+    announced = generation;
+
+  return generation;
+}
+
+/* the reply carries one descriptor, and it maps the announced generation */
+static gint
+check_get_index (GDBusConnection *bus,
+                 const gchar     *index_file)
+{
+  FileSearchImage *image;
+  GUnixFDList *fd_list = NULL;
+  GVariant *reply;
+  GError *error = NULL;
+  gint32 handle;
+  guint64 generation;
+  gint failures = 0;
+  gint fd;
+
+  reply = g_dbus_connection_call_with_unix_fd_list_sync (bus, FILE_SEARCH_DAEMON_NAME,
+                                                         FILE_SEARCH_DAEMON_OBJECT_PATH,
+                                                         FILE_SEARCH_DAEMON_INTERFACE, 
+                                                         "GetIndex",
+                                                         g_variant_new ("(s)", index_file),
+                                                         G_VARIANT_TYPE ("(ht)"),
+                                                         G_DBUS_CALL_FLAGS_NONE, -1, NULL, 
+                                                         &fd_list, NULL, &error);
+  if (reply == NULL)
+    {
+      g_printerr ("GetIndex failed: %s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_variant_get (reply, "(ht)", &handle, &generation);
+  g_variant_unref (reply);
+
+  if (fd_list == NULL || handle < 0 || handle >= g_unix_fd_list_get_length (fd_list))
+    {
+      g_printerr ("GetIndex did not hand over the descriptor\n");
+      if (fd_list != NULL)
+        g_object_unref (fd_list);
+      return 1;
+    }
+
+  if (generation != announced)
+    {
+      g_printerr ("GetIndex returned generation %" G_GUINT64_FORMAT 
+                  " after %" G_GUINT64_FORMAT " was announced\n", generation, announced);
+      failures++;
+    }
+
+  fd = g_unix_fd_list_get (fd_list, handle, &error);
+  g_object_unref (fd_list);
+  if (fd < 0)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return failures + 1;
+    }
+
+  image = file_search_image_new_from_fd (fd, &error);
+  close (fd);
+  if (image == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return failures + 1;
+    }
+
+  if (file_search_image_get_generation (image) != generation ||
+      file_search_image_get_n_entries (image) == 0)
+    {
+      g_printerr ("the handed over image is not the one that was indexed\n");
+      failures++;
+    }
+
+  g_object_unref (image);
+
+  return failures;
+}
+
+/* the project folder only holds plain files, the index ones among them */
+static void
+remove_folder (const gchar *folder_path)
+{
+  const gchar *file_name;
+  GDir *dir;
+
+  dir = g_dir_open (folder_path, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((file_name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *file_path;
+          file_path = g_build_filename (folder_path, file_name, NULL);
+          g_unlink (file_path);
+          g_free (file_path);
+        }
+      g_dir_close (dir);
+    }
+
+  g_rmdir (folder_path);
+}
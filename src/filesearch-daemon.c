@@ -0,0 +1,734 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include "filesearch-daemon.h"
+#include "filesearch-content.h"
+#include "filesearch-crawler.h"
+#include "filesearch-image.h"
+#include "filesearch-index.h"
+#include "filesearch-priority.h"
+#include "filesearch-snapshot.h"
+#include "filesearch-stats.h"
+
+typedef struct
+{
+  gchar             *index_file;
+  gchar             *signature;
+  guint64            generation;
+  gint               fd;
+  gint64             completed;
+  gboolean           crawling;
+  FileSearchCrawler *crawler;
+  FileSearchCrawler *pending;
+  gint64             busy_time;
+} Workspace;
+
+typedef struct
+{
+  Workspace         *workspace;
+  FileSearchCrawler *crawler;
+  GBytes            *image;
+} Crawl;
+
+static void method_call_action        (GDBusConnection       *connection,
+                                       const gchar           *sender,
+                                       const gchar           *object_path,
+                                       const gchar           *interface_name,
+                                       const gchar           *method_name,
+                                       GVariant              *parameters,
+                                       GDBusMethodInvocation *invocation,
+                                       gpointer               user_data);
+static void bus_acquired_action       (GDBusConnection       *connection,
+                                       const gchar           *name,
+                                       gpointer               user_data);
+static void name_lost_action          (GDBusConnection       *connection,
+                                       const gchar           *name,
+                                       gpointer               user_data);
+static guint64 index_workspace        (const gchar           *index_file,
+                                       FileSearchCrawler     *crawler,
+                                       gboolean               force);
+static void start_crawl               (Workspace             *workspace,
+                                       FileSearchCrawler     *crawler);
+static gpointer execute               (Crawl                 *crawl);
+static gboolean crawl_done_action     (Crawl                 *crawl);
+static gchar* get_signature           (FileSearchCrawler     *crawler);
+static void get_index                 (GDBusMethodInvocation *invocation,
+                                       const gchar           *index_file);
+static void report_activity           (const gchar           *index_file,
+                                       gint                   lag_msec,
+                                       gboolean               user_idle);
+static void emit_index_changed        (Workspace             *workspace);
+static void workspace_free            (Workspace             *workspace);
+static void reset_idle_timeout        (void);
+static gboolean idle_timeout_action   (gpointer               user_data);
+static gint run_snapshot              (void);
+static gboolean export_snapshot       (GHashTable            *folder_paths,
+                                       GError               **error);
+
+static const gchar introspection_xml[] =
+  "<node>"
+  "  <interface name='" FILE_SEARCH_DAEMON_INTERFACE "'>"
+  "    <method name='Index'>"
+  "      <arg type='s' name='index_file' direction='in'/>"
+  "      <arg type='a(ss)' name='projects' direction='in'/>"
+  "      <arg type='as' name='exclude_types' direction='in'/>"
+  "      <arg type='as' name='exclude_dirs' direction='in'/>"
+  "      <arg type='b' name='force' direction='in'/>"
+  "      <arg type='t' name='generation' direction='out'/>"
+  "    </method>"
+  "    <method name='GetIndex'>"
+  "      <arg type='s' name='index_file' direction='in'/>"
+  "      <arg type='h' name='fd' direction='out'/>"
+  "      <arg type='t' name='generation' direction='out'/>"
+  "    </method>"
+  "    <method name='ReportActivity'>"
+  "      <arg type='s' name='index_file' direction='in'/>"
+  "      <arg type='i' name='lag_msec' direction='in'/>"
+  "      <arg type='b' name='user_idle' direction='in'/>"
+  "    </method>"
+  "    <method name='GetStats'>"
+  "      <arg type='s' name='json' direction='out'/>"
+  "    </method>"
+  "    <signal name='IndexChanged'>"
+  "      <arg type='s' name='index_file'/>"
+  "      <arg type='t' name='generation'/>"
+  "    </signal>"
+  "  </interface>"
+  "</node>";
+
+/* seconds an editor counts as busy after it last said so */
+#define ACTIVITY_TIMEOUT 3
+
+static const GDBusInterfaceVTable interface_vtable =
+{
+  method_call_action,
+  NULL,
+  NULL
+};
+
+static GMainLoop *loop = NULL;
+static GDBusConnection *bus = NULL;
+static GDBusNodeInfo *introspection_data = NULL;
+static GHashTable *workspaces = NULL;
+static FileSearchStats *stats = NULL;
+static guint idle_source_id = 0;
+
+static gint idle_timeout = 1800;
+static gint max_age = 300;
+static gdouble false_positive_rate = FILE_SEARCH_IMAGE_FALSE_POSITIVE_RATE;
+static gboolean content_index = FALSE;
+static gboolean follow_symlinks = FALSE;
+static gboolean git_index = TRUE;
+static gboolean git_untracked = TRUE;
+static gint crawl_rate = FILE_SEARCH_CRAWLER_DIRS_PER_SECOND;
+static gint max_depth = FILE_SEARCH_CRAWLER_MAX_DEPTH;
+static gint max_files = FILE_SEARCH_CRAWLER_MAX_FILES;
+static gboolean cross_mounts = FALSE;
+static gchar *export_file = NULL;
+static gchar *import_file = NULL;
+static gchar *index_file = NULL;
+static gchar **projects = NULL;
+static gchar **exclude_types = NULL;
+static gchar **exclude_dirs = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "idle-timeout", 0, 0, G_OPTION_ARG_INT, &idle_timeout, 
+    "Exit after SECONDS without requests (0 never exits)", "SECONDS" },
+  { "max-age", 0, 0, G_OPTION_ARG_INT, &max_age, 
+    "Reuse an index younger than SECONDS instead of crawling again", "SECONDS" },
+  { "false-positive-rate", 0, 0, G_OPTION_ARG_DOUBLE, &false_positive_rate, 
+    "False positive rate of the block filters in the index", "RATE" },
+  { "content-index", 0, 0, G_OPTION_ARG_NONE, &content_index, 
+    "Also index the file contents by trigram", NULL },
+  { "follow-symlinks", 0, 0, G_OPTION_ARG_NONE, &follow_symlinks, 
+    "Follow symbolic links, visiting every directory once", NULL },
+  { "no-git-index", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &git_index, 
+    "Crawl git work trees instead of reading their git index", NULL },
+  { "no-git-untracked", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &git_untracked, 
+    "Only list the files git tracks, not the new files that are not ignored", NULL },
+  { "crawl-rate", 0, 0, G_OPTION_ARG_INT, &crawl_rate, 
+    "Read at most N directories a second (0 does not limit)", "N" },
+  { "max-depth", 0, 0, G_OPTION_ARG_INT, &max_depth, 
+    "Crawl at most DEPTH directories below a project folder (0 does not limit)", "DEPTH" },
+  { "max-files", 0, 0, G_OPTION_ARG_INT, &max_files, 
+    "Stop crawling a project after N files (0 does not limit)", "N" },
+  { "cross-mounts", 0, 0, G_OPTION_ARG_NONE, &cross_mounts, 
+    "Crawl into other filesystems mounted inside a project", NULL },
+  { "export-snapshot", 0, 0, G_OPTION_ARG_FILENAME, &export_file, 
+    "Crawl the projects, write a snapshot of the index to FILE and exit", "FILE" },
+  { "import-snapshot", 0, 0, G_OPTION_ARG_FILENAME, &import_file, 
+    "Import the snapshot FILE as the index file of the projects and exit", "FILE" },
+  { "index-file", 0, 0, G_OPTION_ARG_FILENAME, &index_file, 
+    "The index file a snapshot is imported as", "FILE" },
+  { "project", 0, 0, G_OPTION_ARG_STRING_ARRAY, &projects, 
+    "A project of the snapshot, once for each", "KEY=FOLDER" },
+  { "exclude-type", 0, 0, G_OPTION_ARG_STRING_ARRAY, &exclude_types, 
+    "A file name suffix left out of the snapshot", "SUFFIX" },
+  { "exclude-dir", 0, 0, G_OPTION_ARG_STRING_ARRAY, &exclude_dirs, 
+    "A directory name left out of the snapshot", "NAME" },
+  { NULL }
+};
+
+int
+main (int   argc, 
+      char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  guint owner_id;
+
+  context = g_option_context_new ("- CodeSlayer file search indexing daemon");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (export_file != NULL || import_file != NULL)
+    return run_snapshot ();
+
+  introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+  workspaces = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, 
+                                      (GDestroyNotify) workspace_free);
+  stats = file_search_stats_new ();
+
+  owner_id = g_bus_own_name (G_BUS_TYPE_SESSION, FILE_SEARCH_DAEMON_NAME,
+                             G_BUS_NAME_OWNER_FLAGS_NONE,
+                             bus_acquired_action, NULL, name_lost_action,
+                             NULL, NULL);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  reset_idle_timeout ();
+  g_main_loop_run (loop);
+
+  g_bus_unown_name (owner_id);
+  g_main_loop_unref (loop);
+  g_hash_table_destroy (workspaces);
+  g_dbus_node_info_unref (introspection_data);
+  g_object_unref (stats);
+
+  return EXIT_SUCCESS;
+}
+
+static void
+bus_acquired_action (GDBusConnection *connection,
+                     const gchar     *name,
+                     gpointer         user_data)
+{
+  bus = connection;
+  g_dbus_connection_register_object (connection, FILE_SEARCH_DAEMON_OBJECT_PATH,
+                                     introspection_data->interfaces[0],
+                                     &interface_vtable, NULL, NULL, NULL);
+}
+
+static void
+name_lost_action (GDBusConnection *connection,
+                  const gchar     *name,
+                  gpointer         user_data)
+{
+  /* another daemon won the race for the name, or the bus went away */
+  g_main_loop_quit (loop);
+}
+
+static void
+method_call_action (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+  reset_idle_timeout ();
+
+  if (g_strcmp0 (method_name, "Index") == 0)
+    {
+      FileSearchCrawler *crawler;
+      const gchar *index_file;
+      GVariantIter *projects;
+      GVariantIter *exclude_types;
+      GVariantIter *exclude_dirs;
+      const gchar *key;
+      const gchar *value;
+      gboolean force;
+      guint64 generation;
+      
+      g_variant_get (parameters, "(&sa(ss)asasb)", &index_file, &projects, 
+                     &exclude_types, &exclude_dirs, &force);
+
+      crawler = file_search_crawler_new (stats, index_file);
+      file_search_crawler_set_false_positive_rate (crawler, false_positive_rate);
+      file_search_crawler_set_follow_symlinks (crawler, follow_symlinks);
+      file_search_crawler_set_git_index (crawler, git_index, git_untracked);
+      file_search_crawler_set_cross_mounts (crawler, cross_mounts);
+      file_search_crawler_set_limits (crawler, max_depth, max_files);
+      file_search_crawler_set_dirs_per_second (crawler, crawl_rate);
+      if (content_index)
+        {
+          gchar *content_file;
+          content_file = g_strconcat (index_file, FILE_SEARCH_CONTENT_SUFFIX, NULL);
+          file_search_crawler_set_content_file (crawler, content_file);
+          g_free (content_file);
+        }
+      while (g_variant_iter_next (projects, "(&s&s)", &key, &value))
+        file_search_crawler_add_project (crawler, key, value);
+      while (g_variant_iter_next (exclude_types, "&s", &value))
+        file_search_crawler_add_exclude_type (crawler, value);
+      while (g_variant_iter_next (exclude_dirs, "&s", &value))
+        file_search_crawler_add_exclude_dir (crawler, value);
+
+      g_variant_iter_free (projects);
+      g_variant_iter_free (exclude_types);
+      g_variant_iter_free (exclude_dirs);
+
+      generation = index_workspace (index_file, crawler, force);
+      g_object_unref (crawler);
+
+      g_dbus_method_invocation_return_value (invocation, 
+                                             g_variant_new ("(t)", generation));
+    }
+  else if (g_strcmp0 (method_name, "GetIndex") == 0)
+    {
+      const gchar *index_file;
+      g_variant_get (parameters, "(&s)", &index_file);
+      get_index (invocation, index_file);
+    }
+  else if (g_strcmp0 (method_name, "ReportActivity") == 0)
+    {
+      const gchar *index_file;
+      gint lag_msec;
+      gboolean user_idle;
+      g_variant_get (parameters, "(&sib)", &index_file, &lag_msec, &user_idle);
+      report_activity (index_file, lag_msec, user_idle);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else if (g_strcmp0 (method_name, "GetStats") == 0)
+    {
+      gchar *json;
+      json = file_search_stats_to_json (stats);
+      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(s)", json));
+      g_free (json);
+    }
+}
+
+/*
+ * Every editor window asks for an index when it starts and whenever its
+ * projects change. Identical requests are folded into the crawl that is
+ * already running, or answered straight away when the last index is
+ * still fresh, so a single crawl serves all of the editors.
+ */
+static guint64
+index_workspace (const gchar       *index_file,
+                 FileSearchCrawler *crawler,
+                 gboolean           force)
+{
+  Workspace *workspace;
+  gchar *signature;
+
+  workspace = g_hash_table_lookup (workspaces, index_file);
+  if (workspace == NULL)
+    {
+      workspace = g_new0 (Workspace, 1);
+      workspace->index_file = g_strdup (index_file);
+      workspace->fd = -1;
+      g_hash_table_insert (workspaces, workspace->index_file, workspace);
+    }
+
+  signature = get_signature (crawler);
+
+  if (workspace->crawling)
+    {
+      if (force || g_strcmp0 (signature, workspace->signature) != 0)
+        {
+          if (workspace->pending)
+            g_object_unref (workspace->pending);
+          workspace->pending = g_object_ref (crawler);
+        }
+    }
+  else if (!force && 
+           workspace->generation > 0 &&
+           g_strcmp0 (signature, workspace->signature) == 0 &&
+           g_get_monotonic_time () - workspace->completed < (gint64) max_age * G_USEC_PER_SEC)
+    {
+      emit_index_changed (workspace);
+    }
+  else
+    {
+      start_crawl (workspace, crawler);
+    }
+
+  g_free (signature);
+
+  return workspace->generation;
+}
+
+static void
+start_crawl (Workspace         *workspace,
+             FileSearchCrawler *crawler)
+{
+  Crawl *crawl;
+
+  g_free (workspace->signature);
+  workspace->signature = get_signature (crawler);
+  workspace->crawling = TRUE;
+
+  crawl = g_new0 (Crawl, 1);
+  crawl->workspace = workspace;
+  crawl->crawler = g_object_ref (crawler);
+  workspace->crawler = g_object_ref (crawler);
+
+  g_thread_unref (g_thread_new ("index files", (GThreadFunc) execute, crawl));
+}
+
+static gpointer
+execute (Crawl *crawl)
+{
+  GList *indexes;
+  
+  file_search_priority_set_idle ();
+
+  indexes = file_search_crawler_get_indexes (crawl->crawler);
+  crawl->image = file_search_crawler_write_indexes (crawl->crawler, indexes, TRUE);
+  file_search_crawler_compact_indexes (crawl->crawler, crawl->image);
+  
+  g_list_foreach (indexes, (GFunc) g_object_unref, NULL);
+  g_list_free (indexes);
+
+  g_idle_add ((GSourceFunc) crawl_done_action, crawl);
+
+  return NULL;
+}
+
+static gboolean
+crawl_done_action (Crawl *crawl)
+{
+  Workspace *workspace = crawl->workspace;
+
+  workspace->crawling = FALSE;
+  g_object_unref (workspace->crawler);
+  workspace->crawler = NULL;
+
+  if (crawl->image != NULL)
+    {
+      GError *error = NULL;
+      gint fd;
+      
+      /* readers that already mapped the old memfd keep it until they remap */
+      fd = file_search_image_publish (crawl->image, &error);
+      if (fd < 0)
+        {
+          g_warning ("%s\n", error->message);
+          g_error_free (error);
+        }
+        
+      if (workspace->fd >= 0)
+        close (workspace->fd);
+      workspace->fd = fd;
+      
+      workspace->generation = file_search_image_peek_generation (crawl->image);
+      workspace->completed = g_get_monotonic_time ();
+      emit_index_changed (workspace);
+      
+      g_bytes_unref (crawl->image);
+    }
+
+  if (workspace->pending != NULL)
+    {
+      FileSearchCrawler *pending = workspace->pending;
+      workspace->pending = NULL;
+      start_crawl (workspace, pending);
+      g_object_unref (pending);
+    }
+
+  g_object_unref (crawl->crawler);
+  g_free (crawl);
+
+  reset_idle_timeout ();
+
+  return FALSE;
+}
+
+static gchar*
+get_signature (FileSearchCrawler *crawler)
+{
+  GString *signature;
+  GList *list;
+  GList *keys;
+
+  signature = g_string_new (NULL);
+
+  keys = file_search_crawler_get_project_keys (crawler);
+  for (list = file_search_crawler_get_projects (crawler); list != NULL; list = list->next)
+    {
+      g_string_append_printf (signature, "p:%s %s\n", (gchar*) keys->data, (gchar*) list->data);
+      keys = keys->next;
+    }
+  for (list = file_search_crawler_get_exclude_types (crawler); list != NULL; list = list->next)
+    g_string_append_printf (signature, "t:%s\n", (gchar*) list->data);
+  for (list = file_search_crawler_get_exclude_dirs (crawler); list != NULL; list = list->next)
+    g_string_append_printf (signature, "d:%s\n", (gchar*) list->data);
+
+  return g_string_free (signature, FALSE);
+}
+
+static void
+get_index (GDBusMethodInvocation *invocation,
+           const gchar           *index_file)
+{
+  Workspace *workspace;
+  GUnixFDList *fd_list;
+  GError *error = NULL;
+  gint handle;
+
+  workspace = g_hash_table_lookup (workspaces, index_file);
+  if (workspace == NULL || workspace->fd < 0)
+    {
+      /* the caller falls back to mapping the index file */
+      g_dbus_method_invocation_return_error (invocation, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                             "No shared index for %s", index_file);
+      return;
+    }
+
+  fd_list = g_unix_fd_list_new ();
+  handle = g_unix_fd_list_append (fd_list, workspace->fd, &error);
+  if (handle < 0)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      g_object_unref (fd_list);
+      return;
+    }
+    
+  g_dbus_method_invocation_return_value_with_unix_fd_list (invocation, 
+                                                           g_variant_new ("(ht)", handle, 
+                                                                          workspace->generation),
+                                                           fd_list);
+  g_object_unref (fd_list);
+}
+
+/*
+ * The editors waiting on a crawl time their main loops and report how
+ * late they ran, so the crawl backs off for them as it does in process.
+ * It only runs at full speed once none of them has seen a key press or
+ * click for a while, an editor that went away stops counting after
+ * ACTIVITY_TIMEOUT.
+ */
+static void
+report_activity (const gchar *index_file,
+                 gint         lag_msec,
+                 gboolean     user_idle)
+{
+  Workspace *workspace;
+  gint64 now;
+
+  workspace = g_hash_table_lookup (workspaces, index_file);
+  if (workspace == NULL)
+    return;
+
+  now = g_get_monotonic_time ();
+  if (!user_idle)
+    workspace->busy_time = now;
+
+  if (workspace->crawler == NULL)
+    return;
+
+  if (lag_msec > 0)
+    file_search_crawler_report_lag (workspace->crawler, lag_msec);
+  file_search_crawler_set_user_idle (workspace->crawler, 
+                                     now - workspace->busy_time > 
+                                     (gint64) ACTIVITY_TIMEOUT * G_USEC_PER_SEC);
+}
+
+static void
+emit_index_changed (Workspace *workspace)
+{
+  if (bus == NULL)
+    return;
+
+  g_dbus_connection_emit_signal (bus, NULL, FILE_SEARCH_DAEMON_OBJECT_PATH,
+                                 FILE_SEARCH_DAEMON_INTERFACE, "IndexChanged",
+                                 g_variant_new ("(st)", workspace->index_file, 
+                                                workspace->generation),
+                                 NULL);
+}
+
+static void
+workspace_free (Workspace *workspace)
+{
+  if (workspace->crawler)
+    g_object_unref (workspace->crawler);
+  if (workspace->pending)
+    g_object_unref (workspace->pending);
+  if (workspace->fd >= 0)
+    close (workspace->fd);
+  g_free (workspace->signature);
+  g_free (workspace->index_file);
+  g_free (workspace);
+}
+
+static void
+reset_idle_timeout (void)
+{
+  if (idle_source_id != 0)
+    {
+      g_source_remove (idle_source_id);
+      idle_source_id = 0;
+    }
+
+  if (idle_timeout > 0)
+    idle_source_id = g_timeout_add_seconds (idle_timeout, idle_timeout_action, NULL);
+}
+
+static gboolean
+idle_timeout_action (gpointer user_data)
+{
+  GHashTableIter iter;
+  Workspace *workspace;
+
+  g_hash_table_iter_init (&iter, workspaces);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &workspace))
+    {
+      if (workspace->crawling)
+        return TRUE;
+    }
+
+  idle_source_id = 0;
+  g_main_loop_quit (loop);
+
+  return FALSE;
+}
+
+/*
+ * Without the bus, for provisioning: crawls the projects once and 
+ * exports a snapshot, or imports one as the index file of a profile.
+ */
+static gint
+run_snapshot (void)
+{
+  GHashTable *folder_paths;
+  GError *error = NULL;
+  gboolean result;
+  gint i;
+
+  if (import_file != NULL && index_file == NULL)
+    {
+      g_printerr ("--import-snapshot needs --index-file\n");
+      return EXIT_FAILURE;
+    }
+
+  folder_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  for (i = 0; projects != NULL && projects[i] != NULL; i++)
+    {
+      const gchar *separator;
+      gchar *folder_path;
+
+      separator = strchr (projects[i], '=');
+      if (separator == NULL || separator == projects[i] || separator[1] == '\0')
+        {
+          g_printerr ("Expected KEY=FOLDER, not %s\n", projects[i]);
+          g_hash_table_destroy (folder_paths);
+          return EXIT_FAILURE;
+        }
+
+      /* the paths of the index are always absolute */
+      if (g_path_is_absolute (separator + 1))
+        {
+          folder_path = g_strdup (separator + 1);
+        }
+      else
+        {
+          gchar *current_dir = g_get_current_dir ();
+          folder_path = g_build_filename (current_dir, separator + 1, NULL);
+          g_free (current_dir);
+        }
+
+      g_hash_table_insert (folder_paths, g_strndup (projects[i], separator - projects[i]), 
+                           folder_path);
+    }
+
+  stats = file_search_stats_new ();
+
+  if (export_file != NULL)
+    result = export_snapshot (folder_paths, &error);
+  else
+    result = file_search_snapshot_import (import_file, folder_paths, index_file,
+                                          false_positive_rate, &error);
+
+  if (!result)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+    }
+
+  g_hash_table_destroy (folder_paths);
+  g_object_unref (stats);
+
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static gboolean
+export_snapshot (GHashTable  *folder_paths,
+                 GError     **error)
+{
+  FileSearchCrawler *crawler;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GList *indexes;
+  gboolean result;
+  gint i;
+
+  crawler = file_search_crawler_new (stats, export_file);
+  file_search_crawler_set_follow_symlinks (crawler, follow_symlinks);
+  file_search_crawler_set_git_index (crawler, git_index, git_untracked);
+  file_search_crawler_set_cross_mounts (crawler, cross_mounts);
+  file_search_crawler_set_limits (crawler, max_depth, max_files);
+  file_search_crawler_set_dirs_per_second (crawler, crawl_rate);
+
+  /* nobody is waiting on the machine the snapshot is built on */
+  file_search_crawler_set_user_idle (crawler, TRUE);
+
+  g_hash_table_iter_init (&iter, folder_paths);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    file_search_crawler_add_project (crawler, key, value);
+  for (i = 0; exclude_types != NULL && exclude_types[i] != NULL; i++)
+    file_search_crawler_add_exclude_type (crawler, exclude_types[i]);
+  for (i = 0; exclude_dirs != NULL && exclude_dirs[i] != NULL; i++)
+    file_search_crawler_add_exclude_dir (crawler, exclude_dirs[i]);
+
+  indexes = file_search_crawler_get_indexes (crawler);
+  result = file_search_snapshot_export (indexes, folder_paths, export_file, 
+                                        false_positive_rate, error);
+
+  g_list_foreach (indexes, (GFunc) g_object_unref, NULL);
+  g_list_free (indexes);
+  g_object_unref (crawler);
+
+  return result;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_DAEMON_H__
+#define	__FILE_SEARCH_DAEMON_H__
+
+/*
+ * The indexing daemon owns the crawl for every editor that shares a
+ * profile. The editors ask for an index over the session bus, and map
+ * the sealed memfd the daemon publishes for each generation.
+ *
+ *   Index (s index_file, as projects, as exclude_types, 
+ *          as exclude_dirs, b force) -> (t generation)
+ *   GetIndex (s index_file) -> (h fd, t generation)
+ *   ReportActivity (s index_file, i lag_msec, b user_idle)
+ *   GetStats () -> (s json)
+ *   IndexChanged (s index_file, t generation)
+ *
+ * While a crawl runs, the editors that asked for it report how late
+ * their main loops ran and whether anyone is using them, and the crawl
+ * is paced by that as it would be in the editor.
+ *
+ * Started with --export-snapshot or --import-snapshot it stays off the
+ * bus, does the one crawl or import and exits, see filesearch-snapshot.h.
+ */
+
+#define FILE_SEARCH_DAEMON_NAME        "org.codeslayer.FileSearch"
+#define FILE_SEARCH_DAEMON_OBJECT_PATH "/org/codeslayer/FileSearch"
+#define FILE_SEARCH_DAEMON_INTERFACE   "org.codeslayer.FileSearch"
+
+#endif /* __FILE_SEARCH_DAEMON_H__ */
@@ -20,7 +20,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include "filesearch-dialog.h"
+#include "filesearch-epoch.h"
+#include "filesearch-grep.h"
 #include "filesearch-index.h"
+#include "filesearch-matcher.h"
+#include "filesearch-preview.h"
+#include "filesearch-probes.h"
+#include "filesearch-query.h"
 
 static void file_search_dialog_class_init  (FileSearchDialogClass *klass);
 static void file_search_dialog_init        (FileSearchDialog      *dialog);
@@ -32,22 +38,47 @@ static gboolean key_release_action         (FileSearchDialog      *dialog,
                                             GdkEventKey           *event);
 static gboolean key_press_action           (FileSearchDialog      *dialog,
                                             GdkEventKey           *event);
+static FileSearchImage* enter_image        (FileSearchDialog      *dialog,
+                                            guint                 *slot);
 static GList* get_indexes                  (FileSearchDialog      *dialog);
-static FileSearchIndex* get_index          (gchar                 *line);
 static void render_indexes                 (FileSearchDialog      *dialog, 
                                             GList                 *indexes);
 static void select_tree                    (FileSearchDialog      *dialog, 
                                             GdkEventKey           *event);
 static void row_activated_action           (FileSearchDialog      *dialog);
+static void selection_changed_action       (FileSearchDialog      *dialog);
+static void preview_loaded_action          (FileSearchPreview     *preview,
+                                            const gchar           *file_path,
+                                            const gchar           *text,
+                                            FileSearchDialog      *dialog);
+static void contents_toggled_action        (FileSearchDialog      *dialog);
+static void match_case_toggled_action      (FileSearchDialog      *dialog);
+static void scope_changed_action           (FileSearchDialog      *dialog);
+static void fill_scope                     (FileSearchDialog      *dialog);
+static guint8* get_scope                   (FileSearchDialog      *dialog,
+                                            FileSearchImage       *image);
+static gchar* get_current_project_key      (FileSearchDialog      *dialog);
+static void search_names                   (FileSearchDialog      *dialog,
+                                            gboolean               refilter);
+static gboolean match_case                 (FileSearchDialog      *dialog);
+static gboolean grep_timeout_action        (FileSearchDialog      *dialog);
+static void start_grep                     (FileSearchDialog      *dialog);
+static void stop_grep                      (FileSearchDialog      *dialog);
+static void matches_found_action           (FileSearchGrep        *grep,
+                                            GPtrArray             *matches,
+                                            FileSearchDialog      *dialog);
+static void grep_finished_action           (FileSearchDialog      *dialog);
+static void trim_image                     (FileSearchDialog      *dialog);
 static gboolean filter_callback            (GtkTreeModel          *model,
                                             GtkTreeIter           *iter,
                                             FileSearchDialog      *dialog);
-static gchar* get_globbing                 (const gchar           *entry, 
-                                            gboolean               match_case);
-static gint sort_compare                   (GtkTreeModel            *model, 
-                                            GtkTreeIter             *a,
-                                            GtkTreeIter             *b, 
-                                            gpointer                 userdata);
+static void set_filter                     (FileSearchDialog      *dialog);
+static void narrow_rows                    (FileSearchDialog      *dialog);
+static void name_data_func                 (GtkTreeViewColumn     *column,
+                                            GtkCellRenderer       *renderer,
+                                            GtkTreeModel          *model,
+                                            GtkTreeIter           *iter,
+                                            FileSearchDialog      *dialog);
 
 #define FILE_SEARCH_DIALOG_GET_PRIVATE(obj) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_DIALOG_TYPE, FileSearchDialogPrivate))
@@ -56,24 +87,51 @@ typedef struct _FileSearchDialogPrivate FileSearchDialogPrivate;
 
 struct _FileSearchDialogPrivate
 {
-  CodeSlayer   *codeslayer;
-  GtkWidget    *dialog;
-  GtkWidget    *entry;
-  GtkWidget    *tree;
-  GtkListStore *store;
-  GtkTreeModel *filter;
-  gchar        *find_globbing;
-  GPatternSpec *find_pattern; 
+  CodeSlayer      *codeslayer;
+  FileSearchStats *stats;
+  GtkWidget       *dialog;
+  GtkWidget       *label;
+  GtkWidget       *entry;
+  GtkWidget       *contents;
+  GtkWidget       *match_case;
+  GtkWidget       *scope;
+  GtkWidget       *tree;
+  GtkWidget       *preview_view;
+  GtkListStore    *store;
+  GtkTreeModel    *filter;
+  FileSearchQuery *query;
+  gboolean         matched;
+  gboolean         truncated;
+  gboolean         loading;
+  gboolean         stale;
+  FileSearchMatcher *matcher;
+  FileSearchPreview *preview;
+  FileSearchEpoch *images;
+  FileSearchContent *content;
+  FileSearchGrep  *grep;
+  gchar           *grep_text;
+  guint            grep_source_id;
 };
 
 enum
 {
   FILE_NAME = 0,
+  FOLDED_NAME,
   FILE_PATH,
   PROJECT_KEY,
+  LINE,
+  TEXT,
+  SPANS,
   COLUMNS
 };
 
+/* the scopes that are not a single project */
+#define SCOPE_ALL     "scope:all"
+#define SCOPE_CURRENT "scope:current"
+
+/* wait for a pause in the typing before searching the contents */
+#define GREP_DELAY 300
+
 G_DEFINE_TYPE (FileSearchDialog, file_search_dialog, G_TYPE_OBJECT)
 
 static void 
@@ -89,9 +147,23 @@ file_search_dialog_init (FileSearchDialog *dialog)
   FileSearchDialogPrivate *priv;
   priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
   priv->dialog = NULL;
+  priv->contents = NULL;
+  priv->match_case = NULL;
+  priv->scope = NULL;
+  priv->store = NULL;
   priv->filter = NULL;
-  priv->find_globbing = NULL;
-  priv->find_pattern = NULL;
+  priv->query = NULL;
+  priv->matched = FALSE;
+  priv->truncated = FALSE;
+  priv->loading = FALSE;
+  priv->stale = FALSE;
+  priv->matcher = NULL;
+  priv->preview = NULL;
+  priv->images = file_search_epoch_new (g_object_unref);
+  priv->content = NULL;
+  priv->grep = NULL;
+  priv->grep_text = NULL;
+  priv->grep_source_id = 0;
 }
 
 static void
@@ -100,21 +172,42 @@ file_search_dialog_finalize (FileSearchDialog *dialog)
   FileSearchDialogPrivate *priv;
   priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
   
+  stop_grep (dialog);
+  
   if (priv->dialog != NULL)
     gtk_widget_destroy (priv->dialog);
 
-  if (priv->find_pattern != NULL)
-    g_pattern_spec_free (priv->find_pattern);
+  if (priv->store != NULL)
+    g_object_unref (priv->store);
 
-  if (priv->find_globbing != NULL)
-    g_free (priv->find_globbing);
+  if (priv->query != NULL)
+    g_object_unref (priv->query);
+    
+  if (priv->matcher != NULL)
+    g_object_unref (priv->matcher);
+    
+  if (priv->preview != NULL)
+    {
+      file_search_preview_cancel (priv->preview);
+      g_signal_handlers_disconnect_by_func (priv->preview, preview_loaded_action, dialog);
+      g_object_unref (priv->preview);
+    }
+    
+  g_object_unref (priv->images);
+    
+  if (priv->content != NULL)
+    g_object_unref (priv->content);
+  
+  if (priv->grep_text != NULL)
+    g_free (priv->grep_text);
   
   G_OBJECT_CLASS (file_search_dialog_parent_class)-> finalize (G_OBJECT (dialog));
 }
 
 FileSearchDialog*
-file_search_dialog_new (CodeSlayer *codeslayer,
-                        GtkWidget  *menu)
+file_search_dialog_new (CodeSlayer      *codeslayer,
+                        GtkWidget       *menu,
+                        FileSearchStats *stats)
 {
   FileSearchDialogPrivate *priv;
   FileSearchDialog *dialog;
@@ -122,6 +215,12 @@ file_search_dialog_new (CodeSlayer *codeslayer,
   dialog = FILE_SEARCH_DIALOG (g_object_new (file_search_dialog_get_type (), NULL));
   priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
   priv->codeslayer = codeslayer;
+  priv->stats = stats;
+  priv->matcher = file_search_matcher_new (stats);
+  priv->preview = file_search_preview_new (stats);
+  
+  g_signal_connect (G_OBJECT (priv->preview), "loaded",
+                    G_CALLBACK (preview_loaded_action), dialog);
   
   g_signal_connect_swapped (G_OBJECT (menu), "search-files",
                             G_CALLBACK (search_action), dialog);
@@ -129,6 +228,60 @@ file_search_dialog_new (CodeSlayer *codeslayer,
   return dialog;
 }
 
+/*
+ * Called whenever a new index generation is mapped. The rows already in
+ * the list stay as they are, the next search that goes back to the 
+ * index sees the new generation. A search that is still walking the 
+ * old one keeps it until it is done, see filesearch-epoch.h. A search
+ * that found no index at all is run again against this one.
+ */
+void
+file_search_dialog_set_image (FileSearchDialog *dialog,
+                              FileSearchImage  *image)
+{
+  FileSearchDialogPrivate *priv;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  file_search_epoch_publish (priv->images, g_object_ref (image));
+  
+  if (priv->stale)
+    {
+      priv->stale = FALSE;
+      if (priv->dialog != NULL && gtk_widget_get_visible (priv->dialog) &&
+          !gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (priv->contents)))
+        search_names (dialog, FALSE);
+    }
+}
+
+/*
+ * Set while the index is being read in. A search meanwhile comes up 
+ * empty rather than blocking, and is refreshed by the next image.
+ */
+void
+file_search_dialog_set_loading (FileSearchDialog *dialog,
+                                gboolean          loading)
+{
+  FileSearchDialogPrivate *priv;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  priv->loading = loading;
+}
+
+/*
+ * The content index narrows a contents search down to the files that 
+ * may match, without it every file in the image is read. It is NULL 
+ * when the content index is turned off.
+ */
+void
+file_search_dialog_set_content (FileSearchDialog  *dialog,
+                                FileSearchContent *content)
+{
+  FileSearchDialogPrivate *priv;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  if (priv->content != NULL)
+    g_object_unref (priv->content);
+  priv->content = content != NULL ? g_object_ref (content) : NULL;
+}
+
 static void
 search_action (FileSearchDialog *dialog)
 {
@@ -146,9 +299,10 @@ run_dialog (FileSearchDialog *dialog)
       GtkWidget *content_area;
       GtkWidget *vbox;
       GtkWidget *hbox;
-      GtkWidget *label;
-      GtkTreeSortable *sortable;
       GtkWidget *scrolled_window;
+      GtkWidget *preview_window;
+      GtkWidget *paned;
+      PangoFontDescription *font;
       GtkTreeViewColumn *column;
       GtkCellRenderer *renderer;
 
@@ -170,36 +324,35 @@ run_dialog (FileSearchDialog *dialog)
       hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 2);
       gtk_box_set_homogeneous (GTK_BOX (hbox), FALSE);
       
-      label = gtk_label_new ("File: ");
+      priv->label = gtk_label_new ("File: ");
       priv->entry = gtk_entry_new ();
-      gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 2);
+      priv->scope = gtk_combo_box_text_new ();
+      priv->match_case = gtk_check_button_new_with_label ("Match case");
+      priv->contents = gtk_check_button_new_with_label ("Contents");
+      gtk_box_pack_start (GTK_BOX (hbox), priv->label, FALSE, FALSE, 2);
       gtk_box_pack_start (GTK_BOX (hbox), priv->entry, TRUE, TRUE, 2);
+      gtk_box_pack_start (GTK_BOX (hbox), priv->scope, FALSE, FALSE, 2);
+      gtk_box_pack_start (GTK_BOX (hbox), priv->match_case, FALSE, FALSE, 2);
+      gtk_box_pack_start (GTK_BOX (hbox), priv->contents, FALSE, FALSE, 2);
       
       /* the tree view */   
          
-      priv->store = gtk_list_store_new (COLUMNS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+      priv->store = gtk_list_store_new (COLUMNS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, 
+                                        G_TYPE_STRING, G_TYPE_UINT, G_TYPE_STRING, 
+                                        G_TYPE_BYTES);
       priv->tree =  gtk_tree_view_new ();
       gtk_tree_view_set_headers_visible (GTK_TREE_VIEW (priv->tree), FALSE);
       gtk_tree_view_set_enable_search (GTK_TREE_VIEW (priv->tree), FALSE);
       
-      priv->filter = gtk_tree_model_filter_new (GTK_TREE_MODEL (priv->store), NULL);
-      gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (priv->filter),
-                                              (GtkTreeModelFilterVisibleFunc) filter_callback,
-                                               dialog, NULL);
-      
-      gtk_tree_view_set_model (GTK_TREE_VIEW (priv->tree), GTK_TREE_MODEL (priv->filter));
-      g_object_unref (priv->store);
-      
-      sortable = GTK_TREE_SORTABLE (priv->store);
-      gtk_tree_sortable_set_sort_func (sortable, FILE_NAME, sort_compare,
-                                       GINT_TO_POINTER (FILE_NAME), NULL);
-      gtk_tree_sortable_set_sort_column_id (sortable, FILE_NAME, GTK_SORT_ASCENDING);
+      set_filter (dialog);
 
       column = gtk_tree_view_column_new ();
       gtk_tree_view_column_set_sizing (column, GTK_TREE_VIEW_COLUMN_AUTOSIZE);
       renderer = gtk_cell_renderer_text_new ();
       gtk_tree_view_column_pack_start (column, renderer, FALSE);
-      gtk_tree_view_column_add_attribute (column, renderer, "text", FILE_NAME);
+      gtk_tree_view_column_set_cell_data_func (column, renderer, 
+                                               (GtkTreeCellDataFunc) name_data_func, 
+                                               dialog, NULL);
       gtk_tree_view_append_column (GTK_TREE_VIEW (priv->tree), column);
       
       column = gtk_tree_view_column_new ();
@@ -209,11 +362,37 @@ run_dialog (FileSearchDialog *dialog)
       gtk_tree_view_column_add_attribute (column, renderer, "text", FILE_PATH);
       gtk_tree_view_append_column (GTK_TREE_VIEW (priv->tree), column);
       
+      column = gtk_tree_view_column_new ();
+      gtk_tree_view_column_set_sizing (column, GTK_TREE_VIEW_COLUMN_AUTOSIZE);
+      renderer = gtk_cell_renderer_text_new ();
+      gtk_tree_view_column_pack_start (column, renderer, FALSE);
+      gtk_tree_view_column_add_attribute (column, renderer, "text", TEXT);
+      gtk_tree_view_append_column (GTK_TREE_VIEW (priv->tree), column);
+      
       scrolled_window = gtk_scrolled_window_new (NULL, NULL);
       gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled_window),
                                       GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
       gtk_container_add (GTK_CONTAINER (scrolled_window), GTK_WIDGET (priv->tree));
       
+      /* the preview of the selected file */
+      
+      priv->preview_view = gtk_text_view_new ();
+      gtk_text_view_set_editable (GTK_TEXT_VIEW (priv->preview_view), FALSE);
+      gtk_text_view_set_cursor_visible (GTK_TEXT_VIEW (priv->preview_view), FALSE);
+      font = pango_font_description_from_string ("Monospace");
+      gtk_widget_override_font (priv->preview_view, font);
+      pango_font_description_free (font);
+      
+      preview_window = gtk_scrolled_window_new (NULL, NULL);
+      gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (preview_window),
+                                      GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+      gtk_container_add (GTK_CONTAINER (preview_window), priv->preview_view);
+      
+      paned = gtk_paned_new (GTK_ORIENTATION_VERTICAL);
+      gtk_paned_pack1 (GTK_PANED (paned), scrolled_window, TRUE, FALSE);
+      gtk_paned_pack2 (GTK_PANED (paned), preview_window, FALSE, TRUE);
+      gtk_paned_set_position (GTK_PANED (paned), 300);
+      
       /* hook up the signals */
       
       g_signal_connect_swapped (G_OBJECT (priv->entry), "key-release-event",
@@ -225,20 +404,46 @@ run_dialog (FileSearchDialog *dialog)
       g_signal_connect_swapped (G_OBJECT (priv->tree), "row-activated",
                                 G_CALLBACK (row_activated_action), dialog);                                
       
+      g_signal_connect_swapped (G_OBJECT (gtk_tree_view_get_selection (GTK_TREE_VIEW (priv->tree))), 
+                                "changed", G_CALLBACK (selection_changed_action), dialog);
+      
+      g_signal_connect_swapped (G_OBJECT (priv->contents), "toggled",
+                                G_CALLBACK (contents_toggled_action), dialog);
+      
+      g_signal_connect_swapped (G_OBJECT (priv->match_case), "toggled",
+                                G_CALLBACK (match_case_toggled_action), dialog);
+      
+      g_signal_connect_swapped (G_OBJECT (priv->scope), "changed",
+                                G_CALLBACK (scope_changed_action), dialog);
+      
       /* render everything */
       
-      gtk_widget_set_size_request (content_area, 600, 400);
+      gtk_widget_set_size_request (content_area, 600, 550);
       
       gtk_box_pack_start (GTK_BOX (vbox), hbox, FALSE, FALSE, 0);
-      gtk_box_pack_start (GTK_BOX (vbox), scrolled_window, TRUE, TRUE, 0);
+      gtk_box_pack_start (GTK_BOX (vbox), paned, TRUE, TRUE, 0);
       gtk_box_pack_start (GTK_BOX (content_area), vbox, TRUE, TRUE, 0);
 
       gtk_widget_show_all (content_area);
     }
     
+  fill_scope (dialog);
+  
+  /* 
+   * The last search is shown again, straight from the cache of the 
+   * matcher unless the index moved on to a new generation meanwhile.
+   * Focusing the entry selects its text, so typing starts a new one.
+   */
+  if (gtk_entry_get_text_length (GTK_ENTRY (priv->entry)) > 0 &&
+      !gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (priv->contents)))
+    search_names (dialog, FALSE);
+    
   gtk_widget_grab_focus (priv->entry);
   gtk_dialog_run (GTK_DIALOG (priv->dialog));
   gtk_widget_hide (priv->dialog);
+  
+  stop_grep (dialog);
+  file_search_preview_cancel (priv->preview);
 }
 
 static gboolean
@@ -264,7 +469,6 @@ key_release_action (FileSearchDialog *dialog,
                     GdkEventKey      *event)
 {
   FileSearchDialogPrivate *priv;
-  gint text_length;
   
   priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
   
@@ -273,167 +477,234 @@ key_release_action (FileSearchDialog *dialog,
       event->keyval == GDK_KEY_Left ||
       event->keyval == GDK_KEY_Right)
     return FALSE;
+    
+  if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (priv->contents)))
+    {
+      if (priv->grep_source_id != 0)
+        g_source_remove (priv->grep_source_id);
+      priv->grep_source_id = g_timeout_add (GREP_DELAY, (GSourceFunc) grep_timeout_action, 
+                                            dialog);
+      return FALSE;
+    }
+
+  search_names (dialog, TRUE);
+
+  return FALSE;
+}
 
+/*
+ * The query is compiled once per change of the text. While the text 
+ * only narrows the previous query down, the rows in the list are 
+ * narrowed instead of going back to the image, unless the list was cut
+ * short and may be missing rows the narrower query would show.
+ */
+static void
+search_names (FileSearchDialog *dialog,
+              gboolean          refilter)
+{
+  FileSearchDialogPrivate *priv;
+  FileSearchQuery *query;
+  const gchar *text;
+  gboolean narrowed = FALSE;
+  gint text_length;
+  
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
   text_length = gtk_entry_get_text_length (GTK_ENTRY (priv->entry));
   
   if (text_length == 0)
     {
-      gtk_list_store_clear (priv->store);
+      render_indexes (dialog, NULL);
+      return;
     }
-  else if (text_length >= 1) 
+
+  text = gtk_entry_get_text (GTK_ENTRY (priv->entry));
+  
+  query = file_search_query_new (text, match_case (dialog));
+  
+  if (priv->query != NULL)
     {
-      const gchar *text;
-      gboolean first_char_changed = FALSE;
-      
-      text = gtk_entry_get_text (GTK_ENTRY (priv->entry));
-      
-      if (priv->find_globbing != NULL)
-        {
-          first_char_changed = text == priv->find_globbing;
-          g_free (priv->find_globbing);
-        }
+      narrowed = file_search_query_narrows (query, priv->query);
+      g_object_unref (priv->query);
+    }
 
-      priv->find_globbing = get_globbing (text, TRUE);
+  priv->query = query;
+  priv->matched = FALSE;
+  
+  FILE_SEARCH_PROBE1 (query__start, text);
+
+  if (refilter && narrowed && !priv->truncated &&
+      gtk_tree_model_iter_n_children (GTK_TREE_MODEL (priv->filter), NULL) > 0)
+    {
+      gint64 start = g_get_monotonic_time ();
+      narrow_rows (dialog);
+      priv->matched = TRUE;
+      file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_MATCH, 
+                                g_get_monotonic_time () - start);
+    }
+  else
+    {
+      GList *indexes;
+      gint64 start;
       
-      if (priv->find_pattern != NULL)
-        g_pattern_spec_free (priv->find_pattern);
+      indexes = get_indexes (dialog);
+      priv->matched = TRUE;
       
-      priv->find_pattern = g_pattern_spec_new (priv->find_globbing);
-
-      if (!first_char_changed && 
-          gtk_tree_model_iter_n_children (GTK_TREE_MODEL (priv->filter), NULL) > 0)
-        {
-          gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (priv->filter));
-        }
-      else
-        {
-          GList *indexes;
-          
-          gtk_list_store_clear (priv->store);
-
-          indexes = get_indexes (dialog);
-          
-          if (indexes != NULL)
-            {        
-              render_indexes (dialog, indexes);
-              g_list_foreach (indexes, (GFunc) g_object_unref, NULL);
-              g_list_free (indexes);
-            }      
-        }
+      start = g_get_monotonic_time ();
+      render_indexes (dialog, indexes);
+      file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_RENDER, 
+                                g_get_monotonic_time () - start);
+      
+      g_list_foreach (indexes, (GFunc) g_object_unref, NULL);
+      g_list_free (indexes);
     }
 
-  return FALSE;
+  FILE_SEARCH_PROBE1 (query__done, 
+                      gtk_tree_model_iter_n_children (GTK_TREE_MODEL (priv->filter), NULL));
 }
 
-static GList*
-get_indexes (FileSearchDialog *dialog)
+static gboolean
+match_case (FileSearchDialog *dialog)
 {
   FileSearchDialogPrivate *priv;
-  GList *results = NULL;
-
-  GIOChannel *channel = NULL;
-  gchar *line;
-  gsize len;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  return priv->match_case != NULL && 
+         gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (priv->match_case));
+}
 
-  gchar *profile_folder_path;
-  gchar *profile_indexes_file;
+/*
+ * The current generation, for the caller to pass the slot back to 
+ * file_search_epoch_leave() when it is done with it. NULL, with nothing 
+ * to leave, when nothing was indexed yet.
+ */
+static FileSearchImage*
+enter_image (FileSearchDialog *dialog,
+             guint            *slot)
+{
+  FileSearchDialogPrivate *priv;
+  FileSearchImage *image;
+  GtkWidget *message;
   
   priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
-
-  profile_folder_path = codeslayer_get_profile_config_folder_path (priv->codeslayer);
-  profile_indexes_file = g_strconcat (profile_folder_path, G_DIR_SEPARATOR_S, "filesearch", NULL);
   
-  channel = g_io_channel_new_file (profile_indexes_file, "r", NULL);
-  if (channel == NULL)
+  image = file_search_epoch_enter (priv->images, slot);
+  if (image != NULL)
+    return image;
+  
+  file_search_epoch_leave (priv->images, *slot);
+  
+  if (priv->loading)
     {
-      GtkWidget *dialog;
-      dialog =  gtk_message_dialog_new (NULL, 
-                                        GTK_DIALOG_MODAL,
-                                        GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
-                                        "The search file does not exist. First index the files in the tools menu.");
-      gtk_dialog_run (GTK_DIALOG (dialog));
-      gtk_widget_destroy (dialog);
-      g_free (profile_folder_path);
-      g_free (profile_indexes_file);
+      priv->stale = TRUE;
       return NULL;
     }
   
-  while (g_io_channel_read_line (channel, &line, &len, NULL, NULL) != G_IO_STATUS_EOF)
-    {
-      FileSearchIndex *index = get_index (line);
-      if (g_pattern_match_string (priv->find_pattern, file_search_index_get_file_name (index)))
-        results = g_list_prepend (results, index);
-      else
-        g_object_unref (index);
-      g_free (line);
-    }
-    
-  g_free (profile_folder_path);
-  g_free (profile_indexes_file);
+  message =  gtk_message_dialog_new (NULL, 
+                                     GTK_DIALOG_MODAL,
+                                     GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
+                                     "The search file does not exist. First index the files in the tools menu.");
+  gtk_dialog_run (GTK_DIALOG (message));
+  gtk_widget_destroy (message);
   
-  return results;
+  return NULL;
 }
 
-static FileSearchIndex*
-get_index (gchar *line)
+static GList*
+get_indexes (FileSearchDialog *dialog)
 {
-  FileSearchIndex *index = NULL;
-  gchar **split;
-  gchar **tmp;
+  FileSearchDialogPrivate *priv;
+  FileSearchImage *image;
+  GList *results;
+  guint8 *scope;
+  guint slot;
   
-  if (!codeslayer_utils_has_text (line))
-    return NULL;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
   
-  split = g_strsplit (line, "\t", -1);
-  if (split != NULL)
-    {
-      gchar *file_name;  
-      gchar *file_path;  
-      gchar *project_key;
-      
-      tmp = split;
-
-      file_name = *tmp;
-      file_path = *++tmp;
-      project_key = *++tmp;
-      
-      if (file_name != NULL && 
-          file_path != NULL && 
-          project_key != NULL)
-        {
-          index = file_search_index_new ();
-          file_search_index_set_file_name (index, file_name);
-          file_search_index_set_file_path (index, file_path);
-          file_search_index_set_project_key (index, project_key);
-        }
+  priv->truncated = FALSE;
+  
+  image = enter_image (dialog, &slot);
+  if (image == NULL)
+    return NULL;
 
-      g_strfreev (split);
-    }
-    
-  return index;
+  /* 
+   * The image narrows the walk down to the entries of the projects in 
+   * scope that can match, only those have to go through the query.
+   */
+  scope = get_scope (dialog, image);
+  results = file_search_matcher_run (priv->matcher, image, priv->query, 
+                                     scope, &priv->truncated);
+  g_free (scope);
+  
+  file_search_epoch_leave (priv->images, slot);
+  
+  trim_image (dialog);
+  
+  return results;
 }
 
+/*
+ * Replaces the rows with the matches, which come sorted by file name. 
+ * Every row added to a store in view goes through the filter and the 
+ * tree view one signal at a time, so the store is taken out of view and 
+ * filled in one pass with nothing listening. It then gets a new filter 
+ * that builds its rows in one go.
+ */
 static void
 render_indexes (FileSearchDialog *dialog, 
                 GList            *indexes)
 {
   FileSearchDialogPrivate *priv;
-  GtkTreeIter iter;
+  gint columns[] = { FILE_NAME, FOLDED_NAME, FILE_PATH, PROJECT_KEY, SPANS };
+  GValue values[G_N_ELEMENTS (columns)];
+  guint i;
 
   priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
   
+  gtk_tree_view_set_model (GTK_TREE_VIEW (priv->tree), NULL);
+  priv->filter = NULL;
+  
+  gtk_list_store_clear (priv->store);
+  
+  memset (values, 0, sizeof (values));
+  for (i = 0; i < 4; i++)
+    g_value_init (&values[i], G_TYPE_STRING);
+  g_value_init (&values[4], G_TYPE_BYTES);
+  
   while (indexes != NULL)
     {
       FileSearchIndex *index = indexes->data;      
-      gtk_list_store_append (priv->store, &iter);
-      gtk_list_store_set (priv->store, &iter, 
-                          FILE_NAME, file_search_index_get_file_name (index), 
-                          FILE_PATH, file_search_index_get_file_path (index), 
-                          PROJECT_KEY, file_search_index_get_project_key (index), 
-                          -1);
-                          
+      g_value_set_static_string (&values[0], file_search_index_get_file_name (index));
+      g_value_set_static_string (&values[1], file_search_index_get_folded_name (index));
+      g_value_set_static_string (&values[2], file_search_index_get_file_path (index));
+      g_value_set_static_string (&values[3], file_search_index_get_project_key (index));
+      g_value_set_static_boxed (&values[4], file_search_index_get_spans (index));
+      gtk_list_store_insert_with_valuesv (priv->store, NULL, -1, columns, values, 
+                                          G_N_ELEMENTS (columns));
       indexes = g_list_next (indexes);
     }
+  
+  for (i = 0; i < G_N_ELEMENTS (columns); i++)
+    g_value_unset (&values[i]);
+  
+  set_filter (dialog);
+}
+
+/*
+ * The view holds the only reference to the filter, so taking the store 
+ * out of view drops the filter as well.
+ */
+static void
+set_filter (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  priv->filter = gtk_tree_model_filter_new (GTK_TREE_MODEL (priv->store), NULL);
+  gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (priv->filter),
+                                          (GtkTreeModelFilterVisibleFunc) filter_callback,
+                                          dialog, NULL);
+  gtk_tree_view_set_model (GTK_TREE_VIEW (priv->tree), priv->filter);
+  g_object_unref (priv->filter);
 }
 
 static gboolean
@@ -442,49 +713,126 @@ filter_callback (GtkTreeModel     *model,
                  FileSearchDialog *dialog)
 {  
   FileSearchDialogPrivate *priv;
-  gchar *value = NULL;
 
   priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
   
-  if (priv->find_pattern == NULL)
-    return FALSE;
-  
-  gtk_tree_model_get (model, iter, FILE_NAME, &value, -1);
+  /* the content matches are not filtered by name */
+  if (priv->contents != NULL && 
+      gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (priv->contents)))
+    return TRUE;
   
-  if (value == NULL)
+  if (priv->query == NULL)
     return FALSE;
+  
+  /* the rows left in the store were all matched by this same query */
+  return priv->matched;
+}
+
+/*
+ * Drops the rows the narrower query no longer matches and gives the 
+ * rest the spans of this query, so the renderer only has to read them.
+ * Like render_indexes(), the store is out of view meanwhile.
+ */
+static void
+narrow_rows (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  GtkTreeIter iter;
+  gboolean valid;
 
-  if (g_pattern_match_string (priv->find_pattern, value))
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  gtk_tree_view_set_model (GTK_TREE_VIEW (priv->tree), NULL);
+  priv->filter = NULL;
+  
+  valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (priv->store), &iter);
+  while (valid)
     {
-      g_free (value);    
-      return TRUE;
-    }
+      FileSearchQuerySpan spans[FILE_SEARCH_QUERY_MAX_SPANS];
+      guint n_spans = 0;
+      gchar *file_name = NULL;
+      gchar *folded_name = NULL;
+      gchar *file_path = NULL;
+      gchar *project_key = NULL;
+      
+      gtk_tree_model_get (GTK_TREE_MODEL (priv->store), &iter, 
+                          FILE_NAME, &file_name, 
+                          FOLDED_NAME, &folded_name, 
+                          FILE_PATH, &file_path, 
+                          PROJECT_KEY, &project_key, 
+                          -1);
+      
+      if (file_search_query_match_file (priv->query, file_name, folded_name, 
+                                        file_path, project_key, spans, &n_spans))
+        {
+          GBytes *bytes = NULL;
+          if (n_spans > 0)
+            bytes = g_bytes_new (spans, n_spans * sizeof (FileSearchQuerySpan));
+          gtk_list_store_set (priv->store, &iter, SPANS, bytes, -1);
+          if (bytes != NULL)
+            g_bytes_unref (bytes);
+          valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (priv->store), &iter);
+        }
+      else
+        {
+          valid = gtk_list_store_remove (priv->store, &iter);
+        }
 
-  g_free (value);
+      g_free (file_name);
+      g_free (folded_name);
+      g_free (file_path);
+      g_free (project_key);
+    }
   
-  return FALSE;
+  set_filter (dialog);
 }
 
-static gchar*
-get_globbing (const gchar *entry, 
-              gboolean     match_case)
+/*
+ * Only the rows drawn get their matches bold, from the spans the rows
+ * were stored with.
+ */
+static void
+name_data_func (GtkTreeViewColumn *column,
+                GtkCellRenderer   *renderer,
+                GtkTreeModel      *model,
+                GtkTreeIter       *iter,
+                FileSearchDialog  *dialog)
 {
-  gchar *entry_text;
-  gchar *result;
-  
-  entry_text = g_strconcat (entry, "*", NULL);
+  const FileSearchQuerySpan *spans = NULL;
+  PangoAttrList *attributes = NULL;
+  GBytes *bytes = NULL;
+  gchar *file_name = NULL;
+  gsize n_spans = 0;
+  guint i;
+
+  /* the content matches have no spans */
+  gtk_tree_model_get (model, iter, FILE_NAME, &file_name, SPANS, &bytes, -1);
   
-  if (match_case)
+  if (bytes != NULL)
     {
-      result = entry_text;
+      spans = g_bytes_get_data (bytes, &n_spans);
+      n_spans /= sizeof (FileSearchQuerySpan);
     }
-  else
+  
+  if (n_spans > 0)
     {
-      result = codeslayer_utils_to_lowercase (entry_text);
-      g_free (entry_text);
+      attributes = pango_attr_list_new ();
+      for (i = 0; i < n_spans; i++)
+        {
+          PangoAttribute *weight = pango_attr_weight_new (PANGO_WEIGHT_BOLD);
+          weight->start_index = spans[i].start;
+          weight->end_index = spans[i].end;
+          pango_attr_list_insert (attributes, weight);
+        }
     }
   
-  return result;
+  g_object_set (renderer, "text", file_name, "attributes", attributes, NULL);
+  
+  if (attributes != NULL)
+    pango_attr_list_unref (attributes);
+  if (bytes != NULL)
+    g_bytes_unref (bytes);
+  g_free (file_name);
 }
 
 static void
@@ -552,12 +900,14 @@ row_activated_action (FileSearchDialog  *dialog)
     {
       GtkTreeIter treeiter;
       gchar *file_path; 
+      guint line;
       GtkTreePath *tree_path = tmp->data;
       
       gtk_tree_model_get_iter (tree_model, &treeiter, tree_path);
-      gtk_tree_model_get (GTK_TREE_MODEL (priv->filter), &treeiter, FILE_PATH, &file_path, -1);
+      gtk_tree_model_get (GTK_TREE_MODEL (priv->filter), &treeiter, 
+                          FILE_PATH, &file_path, LINE, &line, -1);
       
-      codeslayer_select_document_by_file_path (priv->codeslayer, file_path, 0);
+      codeslayer_select_document_by_file_path (priv->codeslayer, file_path, line);
       gtk_widget_hide (priv->dialog);
       
       g_free (file_path);
@@ -567,33 +917,365 @@ row_activated_action (FileSearchDialog  *dialog)
   g_list_free (selected_rows);
 }                     
 
-gint
-sort_compare (GtkTreeModel *model, 
-              GtkTreeIter  *a,
-              GtkTreeIter  *b, 
-              gpointer      userdata)
+/*
+ * The head of the selected file is read in the background, so arrowing
+ * through the list never waits on the disk and never loads a document.
+ */
+static void
+selection_changed_action (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  GtkTreeSelection *selection;
+  GtkTreeModel *tree_model;
+  GtkTreeIter iter;
+  gchar *file_path;
+  
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (priv->tree));
+  
+  if (!gtk_tree_selection_get_selected (selection, &tree_model, &iter))
+    {
+      file_search_preview_cancel (priv->preview);
+      gtk_text_buffer_set_text (gtk_text_view_get_buffer (GTK_TEXT_VIEW (priv->preview_view)), 
+                                "", -1);
+      return;
+    }
+  
+  gtk_tree_model_get (tree_model, &iter, FILE_PATH, &file_path, -1);
+  file_search_preview_load (priv->preview, file_path);
+  g_free (file_path);
+}
+
+static void
+preview_loaded_action (FileSearchPreview *preview,
+                       const gchar       *file_path,
+                       const gchar       *text,
+                       FileSearchDialog  *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  gtk_text_buffer_set_text (gtk_text_view_get_buffer (GTK_TEXT_VIEW (priv->preview_view)), 
+                            text != NULL ? text : "", -1);
+}
+
+/*
+ * Switching between names and contents starts over with an empty list.
+ * The content matches stream in file by file, and are listed that way.
+ */
+static void
+contents_toggled_action (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  stop_grep (dialog);
+  gtk_list_store_clear (priv->store);
+  
+  if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (priv->contents)))
+    {
+      gtk_label_set_text (GTK_LABEL (priv->label), "Text: ");
+      start_grep (dialog);
+    }
+  else
+    {
+      gtk_label_set_text (GTK_LABEL (priv->label), "File: ");
+    }
+    
+  gtk_widget_grab_focus (priv->entry);
+}
+
+/*
+ * The rows in the list were matched the other way, so the names are 
+ * looked up again.
+ */
+static void
+match_case_toggled_action (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  if (!gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (priv->contents)))
+    search_names (dialog, FALSE);
+    
+  gtk_widget_grab_focus (priv->entry);
+}
+
+static void
+scope_changed_action (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  if (!gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (priv->contents)))
+    search_names (dialog, FALSE);
+}
+
+/*
+ * The projects may have changed since the dialog was last shown. The 
+ * scope stays on the same project as long as it is still open.
+ */
+static void
+fill_scope (FileSearchDialog *dialog)
 {
-  gint sortcol;
-  gint ret = 0;
+  FileSearchDialogPrivate *priv;
+  GtkComboBoxText *combo;
+  gchar *active_id;
+  GList *projects;
+  
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  combo = GTK_COMBO_BOX_TEXT (priv->scope);
+  active_id = g_strdup (gtk_combo_box_get_active_id (GTK_COMBO_BOX (combo)));
+  
+  g_signal_handlers_block_by_func (combo, scope_changed_action, dialog);
+  
+  gtk_combo_box_text_remove_all (combo);
+  gtk_combo_box_text_append (combo, SCOPE_ALL, "All projects");
+  gtk_combo_box_text_append (combo, SCOPE_CURRENT, "Current project");
+  
+  for (projects = codeslayer_get_projects (priv->codeslayer); projects != NULL; 
+       projects = g_list_next (projects))
+    {
+      CodeSlayerProject *project = projects->data;
+      gtk_combo_box_text_append (combo, codeslayer_project_get_key (project), 
+                                 codeslayer_project_get_name (project));
+    }
+  
+  if (active_id == NULL || 
+      !gtk_combo_box_set_active_id (GTK_COMBO_BOX (combo), active_id))
+    gtk_combo_box_set_active_id (GTK_COMBO_BOX (combo), SCOPE_ALL);
+  
+  g_signal_handlers_unblock_by_func (combo, scope_changed_action, dialog);
+  
+  g_free (active_id);
+}
 
-  sortcol = GPOINTER_TO_INT (userdata);
+/*
+ * The scope is a bitmap over the project ids of the image: the projects
+ * picked in the dialog minus the ones the project terms of the query 
+ * rule out. NULL when every project is in scope.
+ */
+static guint8*
+get_scope (FileSearchDialog *dialog,
+           FileSearchImage  *image)
+{
+  FileSearchDialogPrivate *priv;
+  const gchar *scope_id;
+  gchar *current_key = NULL;
+  guint8 *scope;
+  gboolean everything = TRUE;
+  guint n_projects;
+  guint project;
+  
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  scope_id = gtk_combo_box_get_active_id (GTK_COMBO_BOX (priv->scope));
+  if (scope_id == NULL)
+    scope_id = SCOPE_ALL;
+  
+  /* without an open document there is no current project to scope to */
+  if (g_strcmp0 (scope_id, SCOPE_CURRENT) == 0)
+    {
+      current_key = get_current_project_key (dialog);
+      scope_id = current_key != NULL ? current_key : SCOPE_ALL;
+    }
+  
+  n_projects = file_search_image_get_n_projects (image);
+  scope = g_new0 (guint8, (n_projects + 7) / 8);
+  
+  for (project = 0; project < n_projects; project++)
+    {
+      const gchar *project_key;
+      project_key = file_search_image_get_project_key (image, project);
+      
+      if ((g_strcmp0 (scope_id, SCOPE_ALL) == 0 || g_strcmp0 (scope_id, project_key) == 0) &&
+          file_search_query_match_project (priv->query, project_key))
+        scope[project / 8] |= 1 << (project % 8);
+      else
+        everything = FALSE;
+    }
+  
+  g_free (current_key);
   
-  switch (sortcol)
+  if (everything)
     {
-    case FILE_NAME:
-      {
-        gchar *text1, *text2;
+      g_free (scope);
+      return NULL;
+    }
+  
+  return scope;
+}
+
+static gchar*
+get_current_project_key (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  CodeSlayerDocument *document;
+  CodeSlayerProject *project;
+  
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  document = codeslayer_get_active_editor_document (priv->codeslayer);
+  if (document == NULL)
+    return NULL;
+    
+  project = codeslayer_document_get_project (document);
+  if (project == NULL)
+    return NULL;
+  
+  return g_strdup (codeslayer_project_get_key (project));
+}
+
+static gboolean
+grep_timeout_action (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  priv->grep_source_id = 0;
+  start_grep (dialog);
+  return FALSE;
+}
 
-        gtk_tree_model_get (model, a, FILE_NAME, &text1, -1);
-        gtk_tree_model_get (model, b, FILE_NAME, &text2, -1);
+static void
+start_grep (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  FileSearchImage *image;
+  const gchar *text;
+  guint slot;
+  
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  text = gtk_entry_get_text (GTK_ENTRY (priv->entry));
+  
+  /* moving the cursor around does not change the search */
+  if (g_strcmp0 (text, priv->grep_text) == 0)
+    return;
+  
+  stop_grep (dialog);
+  gtk_list_store_clear (priv->store);
+  
+  if (*text == '\0')
+    return;
+  
+  image = enter_image (dialog, &slot);
+  if (image == NULL)
+    return;
+    
+  /* the grep holds on to the generation it walks */
+  priv->grep_text = g_strdup (text);
+  priv->grep = file_search_grep_new (image, priv->stats, text);
+  file_search_epoch_leave (priv->images, slot);
+  file_search_grep_set_content (priv->grep, priv->content);
+  g_signal_connect (G_OBJECT (priv->grep), "matches-found",
+                    G_CALLBACK (matches_found_action), dialog);
+  g_signal_connect_swapped (G_OBJECT (priv->grep), "finished",
+                            G_CALLBACK (grep_finished_action), dialog);
+  file_search_grep_start (priv->grep);
+}
 
-        ret = g_strcmp0 (text1, text2);
+static void
+stop_grep (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  if (priv->grep_source_id != 0)
+    {
+      g_source_remove (priv->grep_source_id);
+      priv->grep_source_id = 0;
+    }
+  
+  if (priv->grep != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (priv->grep, matches_found_action, dialog);
+      g_signal_handlers_disconnect_by_func (priv->grep, grep_finished_action, dialog);
+      file_search_grep_cancel (priv->grep);
+      g_object_unref (priv->grep);
+      priv->grep = NULL;
+    }
+    
+  if (priv->grep_text != NULL)
+    {
+      g_free (priv->grep_text);
+      priv->grep_text = NULL;
+    }
+}
 
-        g_free (text1);
-        g_free (text2);
-      }
-      break;
+static void
+matches_found_action (FileSearchGrep   *grep,
+                      GPtrArray        *matches,
+                      FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  gint64 start;
+  guint i;
+  
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  start = g_get_monotonic_time ();
+  
+  for (i = 0; i < matches->len; i++)
+    {
+      FileSearchGrepMatch *match = g_ptr_array_index (matches, i);
+      gchar *file_name;
+      gchar *text;
+      
+      file_name = g_path_get_basename (match->file_path);
+      text = g_strdup_printf ("%u:%u: %s", match->line, match->column, match->text);
+      
+      gtk_list_store_insert_with_values (priv->store, NULL, -1,
+                                         FILE_NAME, file_name, 
+                                         FILE_PATH, match->file_path, 
+                                         LINE, match->line,
+                                         TEXT, text,
+                                         -1);
+      g_free (file_name);
+      g_free (text);
     }
+    
+  file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_RENDER, 
+                            g_get_monotonic_time () - start);
+}
 
-  return ret;
+/*
+ * The grep keeps its delivery reference during the emission, so the
+ * last reference can go here.
+ */
+static void
+grep_finished_action (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  g_object_unref (priv->grep);
+  priv->grep = NULL;
+  
+  trim_image (dialog);
+}
+
+/*
+ * Searches are the only thing that pull the image in, so right after 
+ * one is when it may have grown past its memory budget. It is also when
+ * the generations replaced during the search can go.
+ */
+static void
+trim_image (FileSearchDialog *dialog)
+{
+  FileSearchDialogPrivate *priv;
+  FileSearchImage *image;
+  guint slot;
+  
+  priv = FILE_SEARCH_DIALOG_GET_PRIVATE (dialog);
+  
+  image = file_search_epoch_enter (priv->images, &slot);
+  if (image != NULL)
+    file_search_stats_add (priv->stats, FILE_SEARCH_COUNTER_BYTES_RELEASED, 
+                           file_search_image_trim (image));
+  file_search_epoch_leave (priv->images, slot);
+  
+  file_search_epoch_collect (priv->images);
 }
@@ -21,6 +21,9 @@
 
 #include <gtk/gtk.h>
 #include <codeslayer/codeslayer.h>
+#include "filesearch-content.h"
+#include "filesearch-image.h"
+#include "filesearch-stats.h"
 
 G_BEGIN_DECLS
 
@@ -45,8 +48,16 @@ struct _FileSearchDialogClass
 
 GType file_search_dialog_get_type (void) G_GNUC_CONST;
      
-FileSearchDialog*  file_search_dialog_new  (CodeSlayer *codeslayer,
-                                            GtkWidget  *menu);
+FileSearchDialog*  file_search_dialog_new        (CodeSlayer       *codeslayer,
+                                                  GtkWidget        *menu,
+                                                  FileSearchStats  *stats);
+
+void               file_search_dialog_set_image  (FileSearchDialog *dialog,
+                                                  FileSearchImage  *image);
+void               file_search_dialog_set_loading (FileSearchDialog *dialog,
+                                                   gboolean          loading);
+void               file_search_dialog_set_content (FileSearchDialog *dialog,
+                                                   FileSearchContent *content);
                                      
 G_END_DECLS
 
@@ -16,35 +16,151 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#include <unistd.h>
+#include <gio/gunixfdlist.h>
 #include "filesearch-engine.h"
+#include "filesearch-content.h"
+#include "filesearch-crawler.h"
+#include "filesearch-daemon.h"
 #include "filesearch-dialog.h"
+#include "filesearch-image.h"
 #include "filesearch-index.h"
+#include "filesearch-journal.h"
+#include "filesearch-priority.h"
+#include "filesearch-settings.h"
+#include "filesearch-snapshot.h"
+#include "filesearch-stats.h"
+
+/* what a load thread hands back to the main thread */
+typedef struct
+{
+  FileSearchEngine *engine;
+  FileSearchImage  *image;
+} Load;
+
+typedef struct
+{
+  FileSearchEngine  *engine;
+  FileSearchCrawler *crawler;
+} Crawl;
 
 static void file_search_engine_class_init  (FileSearchEngineClass *klass);
 static void file_search_engine_init        (FileSearchEngine      *engine);
 static void file_search_engine_finalize    (FileSearchEngine      *engine);
 
-static void execute                        (CodeSlayer            *codeslayer);
-static GList* get_indexes                  (CodeSlayer            *codeslayer);
-static void get_project_indexes            (CodeSlayerProject     *project, 
-                                            GFile                 *file, 
-                                            GList                 **indexes, 
-                                            GList                 *exclude_types,
-                                            GList                 *exclude_dirs);
-static void write_indexes                  (CodeSlayer            *codeslayer, 
-                                            GIOChannel            *channel,
-                                            GList                 *indexes);                                        
+static FileSearchCrawler* create_crawler   (FileSearchEngine      *engine);
+static gchar* get_indexes_file             (FileSearchEngine      *engine);
+static GHashTable* get_folder_paths        (FileSearchEngine      *engine);
+static void index_files_locally            (FileSearchEngine      *engine,
+                                            FileSearchCrawler     *crawler);
+static gpointer execute                    (Crawl                 *crawl);
+static gboolean crawled_action             (Crawl                 *crawl);
+static void start_lag_probe                (FileSearchEngine      *engine);
+static gboolean probe_lag_action           (FileSearchEngine      *engine);
+static void report_activity                (FileSearchEngine      *engine,
+                                            gint64                 lag,
+                                            gboolean               user_idle);
+static gboolean user_input_action          (GtkWidget             *widget,
+                                            GdkEvent              *event,
+                                            FileSearchEngine      *engine);
+static void index_files_remotely           (FileSearchEngine      *engine,
+                                            FileSearchCrawler     *crawler);
+static void index_called_action            (GDBusConnection       *connection,
+                                            GAsyncResult          *result,
+                                            Crawl                 *crawl);
+static gboolean spawn_daemon               (FileSearchEngine      *engine);
+static void daemon_appeared_action         (GDBusConnection       *connection,
+                                            const gchar           *name,
+                                            const gchar           *name_owner,
+                                            FileSearchEngine      *engine);
+static void daemon_vanished_action         (GDBusConnection       *connection,
+                                            const gchar           *name,
+                                            FileSearchEngine      *engine);
+static FileSearchImage* open_image         (FileSearchEngine      *engine);
+static void import_snapshot                (FileSearchEngine      *engine,
+                                            GHashTable            *folder_paths);
+static void start_load                     (FileSearchEngine      *engine);
+static gpointer load_thread                (FileSearchEngine      *engine);
+static gboolean image_loaded_action        (Load                  *load);
+static gboolean revalidate_action          (FileSearchEngine      *engine);
+static void projects_changed_action        (FileSearchEngine      *engine);
+static void set_image                      (FileSearchEngine      *engine,
+                                            FileSearchImage       *image);
+static void load_content                   (FileSearchEngine      *engine);
+static void indexes_file_changed_action    (GFileMonitor          *monitor,
+                                            GFile                 *file,
+                                            GFile                 *other_file,
+                                            GFileMonitorEvent      event,
+                                            FileSearchEngine      *engine);
+static void index_changed_action           (GDBusConnection       *connection,
+                                            const gchar           *sender_name,
+                                            const gchar           *object_path,
+                                            const gchar           *interface_name,
+                                            const gchar           *signal_name,
+                                            GVariant              *parameters,
+                                            FileSearchEngine      *engine);
+static void get_index_action               (GDBusConnection       *connection,
+                                            GAsyncResult          *result,
+                                            FileSearchEngine      *engine);
+static gboolean dump_stats_action          (FileSearchEngine      *engine);
                             
 #define FILE_SEARCH_ENGINE_GET_PRIVATE(obj) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_ENGINE_TYPE, FileSearchEnginePrivate))
 
+/* seconds without a key press or click after startup before the projects are crawled */
+#define REVALIDATE_DELAY 10
+
+/* how often, in milliseconds, the main loop is timed while a crawl runs */
+#define LAG_PROBE_INTERVAL 100
+/* seconds without a key press or click before the crawl runs at full speed */
+#define USER_IDLE_DELAY 30
+/* how often, in milliseconds, the daemon hears how a crawl it runs for the editor affects it */
+#define ACTIVITY_REPORT_INTERVAL 1000
+
 typedef struct _FileSearchEnginePrivate FileSearchEnginePrivate;
 
 struct _FileSearchEnginePrivate
 {
   CodeSlayer *codeslayer;
   FileSearchDialog *dialog;
+  FileSearchSettings *settings;
+  FileSearchStats *stats;
   gulong projects_changed_id;
+  guint stats_source_id;
+  gboolean use_daemon;
+  gdouble false_positive_rate;
+  gboolean follow_symlinks;
+  gboolean git_index;
+  gboolean git_untracked;
+  gboolean cross_mounts;
+  gint max_depth;
+  gint max_files;
+  gint dirs_per_second;
+  FileSearchCrawler *crawling;
+  FileSearchCrawler *queued_crawler;
+  guint lag_source_id;
+  gint64 lag_probe_time;
+  gint64 user_input_time;
+  gboolean daemon_crawling;
+  gint64 daemon_lag;
+  gint64 activity_report_time;
+  guint daemon_watch_id;
+  gboolean daemon_spawned;
+  GDBusConnection *daemon_connection;
+  guint index_changed_id;
+  FileSearchCrawler *pending_crawler;
+  GFileMonitor *indexes_file_monitor;
+  GFileMonitor *journal_file_monitor;
+  gchar *indexes_file;
+  gchar *content_file;
+  gchar *snapshot_file;
+  GHashTable *snapshot_folder_paths;
+  gsize memory_budget;
+  guint64 generation;
+  gboolean loading;
+  gboolean reload;
+  gboolean started;
+  guint revalidate_source_id;
 };
 
 G_DEFINE_TYPE (FileSearchEngine, file_search_engine, G_TYPE_OBJECT)
@@ -60,6 +176,43 @@ file_search_engine_class_init (FileSearchEngineClass *klass)
 static void
 file_search_engine_init (FileSearchEngine *engine) 
 {
+  FileSearchEnginePrivate *priv;
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  priv->stats_source_id = 0;
+  priv->use_daemon = FALSE;
+  priv->false_positive_rate = FILE_SEARCH_IMAGE_FALSE_POSITIVE_RATE;
+  priv->follow_symlinks = FALSE;
+  priv->git_index = TRUE;
+  priv->git_untracked = TRUE;
+  priv->cross_mounts = FALSE;
+  priv->max_depth = FILE_SEARCH_CRAWLER_MAX_DEPTH;
+  priv->max_files = FILE_SEARCH_CRAWLER_MAX_FILES;
+  priv->dirs_per_second = FILE_SEARCH_CRAWLER_DIRS_PER_SECOND;
+  priv->crawling = NULL;
+  priv->queued_crawler = NULL;
+  priv->lag_source_id = 0;
+  priv->lag_probe_time = 0;
+  priv->user_input_time = 0;
+  priv->daemon_crawling = FALSE;
+  priv->daemon_lag = 0;
+  priv->activity_report_time = 0;
+  priv->daemon_watch_id = 0;
+  priv->daemon_spawned = FALSE;
+  priv->daemon_connection = NULL;
+  priv->index_changed_id = 0;
+  priv->pending_crawler = NULL;
+  priv->indexes_file_monitor = NULL;
+  priv->journal_file_monitor = NULL;
+  priv->indexes_file = NULL;
+  priv->content_file = NULL;
+  priv->snapshot_file = NULL;
+  priv->snapshot_folder_paths = NULL;
+  priv->memory_budget = 0;
+  priv->generation = 0;
+  priv->loading = FALSE;
+  priv->reload = FALSE;
+  priv->started = FALSE;
+  priv->revalidate_source_id = 0;
 }
 
 static void
@@ -67,7 +220,37 @@ file_search_engine_finalize (FileSearchEngine *engine)
 {
   FileSearchEnginePrivate *priv;
   priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  if (priv->stats_source_id != 0)
+    g_source_remove (priv->stats_source_id);
+  if (priv->revalidate_source_id != 0)
+    g_source_remove (priv->revalidate_source_id);
+  if (priv->lag_source_id != 0)
+    g_source_remove (priv->lag_source_id);
+  if (priv->crawling != NULL)
+    g_object_unref (priv->crawling);
+  if (priv->queued_crawler != NULL)
+    g_object_unref (priv->queued_crawler);
+  if (priv->daemon_watch_id != 0)
+    g_bus_unwatch_name (priv->daemon_watch_id);
+  if (priv->daemon_connection != NULL)
+    {
+      g_dbus_connection_signal_unsubscribe (priv->daemon_connection, priv->index_changed_id);
+      g_object_unref (priv->daemon_connection);
+    }
+  if (priv->pending_crawler != NULL)
+    g_object_unref (priv->pending_crawler);
+  if (priv->indexes_file_monitor != NULL)
+    g_object_unref (priv->indexes_file_monitor);
+  if (priv->journal_file_monitor != NULL)
+    g_object_unref (priv->journal_file_monitor);
+  g_free (priv->indexes_file);
+  g_free (priv->content_file);
+  g_free (priv->snapshot_file);
+  if (priv->snapshot_folder_paths != NULL)
+    g_hash_table_destroy (priv->snapshot_folder_paths);
   g_object_unref (priv->dialog);
+  g_object_unref (priv->settings);
+  g_object_unref (priv->stats);
   g_signal_handler_disconnect (priv->codeslayer, priv->projects_changed_id);
   G_OBJECT_CLASS (file_search_engine_parent_class)->finalize (G_OBJECT(engine));
 }
@@ -78,65 +261,195 @@ file_search_engine_new (CodeSlayer *codeslayer,
 {
   FileSearchEnginePrivate *priv;
   FileSearchEngine *engine;
+  gchar *profile_folder_path;
+  gint stats_interval;
+  gint memory_budget;
 
   engine = FILE_SEARCH_ENGINE (g_object_new (file_search_engine_get_type (), NULL));
   priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
 
   priv->codeslayer = codeslayer;
   
-  priv->dialog = file_search_dialog_new (codeslayer, menu);
+  profile_folder_path = codeslayer_get_profile_config_folder_path (codeslayer);
+  priv->settings = file_search_settings_new (profile_folder_path);
+  g_free (profile_folder_path);
+  
+  priv->stats = file_search_stats_new ();
+  
+  priv->dialog = file_search_dialog_new (codeslayer, menu, priv->stats);
+  
+  priv->indexes_file = get_indexes_file (engine);
+  
+  /* indexing the file contents is opt in, it costs a full read of every file once */
+  if (file_search_settings_get_boolean (priv->settings, 
+                                        FILE_SEARCH_SETTINGS_CONTENT_INDEX, FALSE))
+    priv->content_file = g_strconcat (priv->indexes_file, FILE_SEARCH_CONTENT_SUFFIX, NULL);
+    
+  /* a snapshot exported elsewhere, imported when there is no index yet */
+  priv->snapshot_file = file_search_settings_get_string (priv->settings, 
+                                                         FILE_SEARCH_SETTINGS_SNAPSHOT, NULL);
+  if (priv->snapshot_file == NULL)
+    priv->snapshot_file = g_strconcat (priv->indexes_file, FILE_SEARCH_SNAPSHOT_SUFFIX, NULL);
+    
+  /* in megabytes, 0 leaves the residency of the index to the kernel */
+  memory_budget = file_search_settings_get_integer (priv->settings, 
+                                                    FILE_SEARCH_SETTINGS_MEMORY_BUDGET, 0);
+  if (memory_budget > 0)
+    priv->memory_budget = (gsize) memory_budget << 20;
+  
+  /* the periodic stats dump is off unless an interval (in seconds) is configured */
+  stats_interval = file_search_settings_get_integer (priv->settings, 
+                                                     FILE_SEARCH_SETTINGS_STATS_INTERVAL, 0);
+  if (stats_interval > 0)
+    priv->stats_source_id = g_timeout_add_seconds (stats_interval, 
+                                                   (GSourceFunc) dump_stats_action, engine);
+                                                   
+  priv->false_positive_rate = file_search_settings_get_double (priv->settings, 
+                                                               FILE_SEARCH_SETTINGS_FALSE_POSITIVE_RATE,
+                                                               FILE_SEARCH_IMAGE_FALSE_POSITIVE_RATE);
+                                                               
+  priv->follow_symlinks = file_search_settings_get_boolean (priv->settings, 
+                                                            FILE_SEARCH_SETTINGS_FOLLOW_SYMLINKS, FALSE);
+  priv->git_index = file_search_settings_get_boolean (priv->settings, 
+                                                      FILE_SEARCH_SETTINGS_GIT_INDEX, TRUE);
+  priv->git_untracked = file_search_settings_get_boolean (priv->settings, 
+                                                          FILE_SEARCH_SETTINGS_GIT_UNTRACKED, TRUE);
+  priv->cross_mounts = file_search_settings_get_boolean (priv->settings, 
+                                                         FILE_SEARCH_SETTINGS_CROSS_MOUNTS, FALSE);
+  priv->max_depth = file_search_settings_get_integer (priv->settings, 
+                                                      FILE_SEARCH_SETTINGS_MAX_DEPTH,
+                                                      FILE_SEARCH_CRAWLER_MAX_DEPTH);
+  priv->max_files = file_search_settings_get_integer (priv->settings, 
+                                                      FILE_SEARCH_SETTINGS_MAX_FILES,
+                                                      FILE_SEARCH_CRAWLER_MAX_FILES);
+  priv->dirs_per_second = file_search_settings_get_integer (priv->settings, 
+                                                            FILE_SEARCH_SETTINGS_CRAWL_RATE,
+                                                            FILE_SEARCH_CRAWLER_DIRS_PER_SECOND);
+                                                   
+  priv->use_daemon = file_search_settings_get_boolean (priv->settings, 
+                                                       FILE_SEARCH_SETTINGS_DAEMON, FALSE);
+  if (priv->use_daemon)
+    {
+      priv->daemon_watch_id = g_bus_watch_name (G_BUS_TYPE_SESSION, FILE_SEARCH_DAEMON_NAME,
+                                                G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                (GBusNameAppearedCallback) daemon_appeared_action,
+                                                (GBusNameVanishedCallback) daemon_vanished_action,
+                                                engine, NULL);
+    }
+  else
+    {
+      /* any editor sharing the profile may write a new generation */
+      GFile *file = g_file_new_for_path (priv->indexes_file);
+      gchar *journal_file = g_strconcat (priv->indexes_file, FILE_SEARCH_JOURNAL_SUFFIX, NULL);
+      
+      priv->indexes_file_monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+      if (priv->indexes_file_monitor != NULL)
+        g_signal_connect (priv->indexes_file_monitor, "changed", 
+                          G_CALLBACK (indexes_file_changed_action), engine);
+      g_object_unref (file);
+      
+      /* or just append to the log of the current one */
+      file = g_file_new_for_path (journal_file);
+      priv->journal_file_monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+      if (priv->journal_file_monitor != NULL)
+        g_signal_connect (priv->journal_file_monitor, "changed", 
+                          G_CALLBACK (indexes_file_changed_action), engine);
+      g_object_unref (file);
+      g_free (journal_file);
+    }
   
   priv->projects_changed_id = g_signal_connect_swapped (G_OBJECT (codeslayer), "projects-changed",
-                                                        G_CALLBACK (file_search_engine_index_files), engine);
+                                                        G_CALLBACK (projects_changed_action), engine);
+                                                        
+  /* the crawl only slows down for someone using the editor */
+  priv->user_input_time = g_get_monotonic_time ();
+  g_signal_connect_object (G_OBJECT (codeslayer_get_toplevel_window (codeslayer)), 
+                           "key-press-event", G_CALLBACK (user_input_action), engine, 0);
+  g_signal_connect_object (G_OBJECT (codeslayer_get_toplevel_window (codeslayer)), 
+                           "button-press-event", G_CALLBACK (user_input_action), engine, 0);
 
   return engine;
 }
 
+/*
+ * Startup is staged so that the editor never waits on the plugin. The
+ * last index is mapped and read in on a thread at idle priority, and 
+ * only once the editor has been idle for a while are the projects 
+ * crawled again. A search before the index is in lists nothing, and is
+ * searched again once it is.
+ *
+ * A fresh workspace has no index to map, but may have been provisioned
+ * with a snapshot. The load thread imports it for the projects open now
+ * and the crawl after only logs the files that differ.
+ */
 void
-file_search_engine_index_files (FileSearchEngine *engine)
+file_search_engine_start (FileSearchEngine *engine)
 {
   FileSearchEnginePrivate *priv;
   priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
-  g_thread_new ("index files", (GThreadFunc) execute, priv->codeslayer); 
+  
+  if (!g_file_test (priv->indexes_file, G_FILE_TEST_EXISTS) &&
+      g_file_test (priv->snapshot_file, G_FILE_TEST_EXISTS))
+    priv->snapshot_folder_paths = get_folder_paths (engine);
+  
+  start_load (engine);
 }
 
-static void
-execute (CodeSlayer *codeslayer)
+FileSearchStats*
+file_search_engine_get_stats (FileSearchEngine *engine)
 {
-  GList *indexes;
-  gchar *profile_folder_path;
-  gchar *profile_indexes_file;
-  GIOChannel *channel;
-  GError *error = NULL;
+  return FILE_SEARCH_ENGINE_GET_PRIVATE (engine)->stats;
+}
 
-  profile_folder_path = codeslayer_get_profile_config_folder_path (codeslayer);
-  profile_indexes_file = g_strconcat (profile_folder_path, G_DIR_SEPARATOR_S, "filesearch", NULL);
+void
+file_search_engine_index_files (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  FileSearchCrawler *crawler;
+
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  crawler = create_crawler (engine);
   
-  channel = g_io_channel_new_file (profile_indexes_file, "w", &error);
-  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS))
+  if (!priv->use_daemon)
     {
-      g_warning ("Error creating file search file: %s\n", error->message);
-      g_error_free (error);
+      index_files_locally (engine, crawler);
     }
-
-  indexes = get_indexes (codeslayer);
-  if (indexes != NULL)
+  else if (priv->daemon_connection != NULL)
     {
-      write_indexes (codeslayer, channel, indexes);
-      g_io_channel_shutdown (channel, TRUE, NULL);
-      g_list_foreach (indexes, (GFunc) g_object_unref, NULL);
-      g_list_free (indexes);
-      g_io_channel_unref (channel);
+      index_files_remotely (engine, crawler);
+    }
+  else
+    {
+      /* hold on to the request until the daemon shows up on the bus */
+      if (priv->pending_crawler != NULL)
+        g_object_unref (priv->pending_crawler);
+      priv->pending_crawler = g_object_ref (crawler);
+      
+      if (!priv->daemon_spawned)
+        {
+          priv->daemon_spawned = spawn_daemon (engine);
+          if (!priv->daemon_spawned)
+            {
+              g_object_unref (priv->pending_crawler);
+              priv->pending_crawler = NULL;
+              index_files_locally (engine, crawler);
+            }
+        }
     }
     
-  g_free (profile_folder_path);
-  g_free (profile_indexes_file);
+  g_object_unref (crawler);
 }
 
-static GList*
-get_indexes (CodeSlayer *codeslayer)
+/*
+ * The crawler is filled in on the main thread, so that the indexing 
+ * thread or the daemon never has to touch the CodeSlayer objects.
+ */
+static FileSearchCrawler*
+create_crawler (FileSearchEngine *engine)
 {
-  GList *results = NULL;
+  FileSearchEnginePrivate *priv;
+  FileSearchCrawler *crawler;
   GList *projects;
   
   CodeSlayerRegistry *registry;
@@ -144,8 +457,20 @@ get_indexes (CodeSlayer *codeslayer)
   gchar *exclude_dirs_str;
   GList *exclude_types = NULL;
   GList *exclude_dirs = NULL;
+  GList *list;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  crawler = file_search_crawler_new (priv->stats, priv->indexes_file);
+  file_search_crawler_set_false_positive_rate (crawler, priv->false_positive_rate);
+  file_search_crawler_set_content_file (crawler, priv->content_file);
+  file_search_crawler_set_follow_symlinks (crawler, priv->follow_symlinks);
+  file_search_crawler_set_git_index (crawler, priv->git_index, priv->git_untracked);
+  file_search_crawler_set_cross_mounts (crawler, priv->cross_mounts);
+  file_search_crawler_set_limits (crawler, priv->max_depth, priv->max_files);
+  file_search_crawler_set_dirs_per_second (crawler, priv->dirs_per_second);
   
-  registry = codeslayer_get_registry (codeslayer);
+  registry = codeslayer_get_registry (priv->codeslayer);
   
   exclude_types_str = codeslayer_registry_get_string (registry,
                                                       CODESLAYER_REGISTRY_PROJECTS_EXCLUDE_TYPES);
@@ -154,23 +479,17 @@ get_indexes (CodeSlayer *codeslayer)
   exclude_types = codeslayer_utils_string_to_list (exclude_types_str);
   exclude_dirs = codeslayer_utils_string_to_list (exclude_dirs_str);
   
-  projects = codeslayer_get_projects (codeslayer);
+  for (list = exclude_types; list != NULL; list = list->next)
+    file_search_crawler_add_exclude_type (crawler, list->data);
+  for (list = exclude_dirs; list != NULL; list = list->next)
+    file_search_crawler_add_exclude_dir (crawler, list->data);
+  
+  projects = codeslayer_get_projects (priv->codeslayer);
   while (projects != NULL)
     {
       CodeSlayerProject *project = projects->data;
-      GList *indexes = NULL;
-      GFile *file;
-      const gchar *folder_path;
-      
-      folder_path = codeslayer_project_get_folder_path (project);
-      file = g_file_new_for_path (folder_path);
-      
-      get_project_indexes (project, file, &indexes, exclude_types, exclude_dirs);
-      if (indexes != NULL)
-        results = g_list_concat (results, indexes);
-        
-      g_object_unref (file);
-
+      file_search_crawler_add_project (crawler, codeslayer_project_get_key (project),
+                                       codeslayer_project_get_folder_path (project));
       projects = g_list_next (projects);
     }
     
@@ -187,88 +506,757 @@ get_indexes (CodeSlayer *codeslayer)
       g_list_free (exclude_dirs);
     }    
     
-  return results;    
+  return crawler;    
+}
+
+static gchar*
+get_indexes_file (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  gchar *profile_folder_path;
+  gchar *profile_indexes_file;
+
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+
+  profile_folder_path = codeslayer_get_profile_config_folder_path (priv->codeslayer);
+  profile_indexes_file = g_strconcat (profile_folder_path, G_DIR_SEPARATOR_S, "filesearch", NULL);
+  g_free (profile_folder_path);
+  
+  return profile_indexes_file;
+}
+
+/* the folders of the open projects by project key */
+static GHashTable*
+get_folder_paths (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  GHashTable *folder_paths;
+  GList *projects;
+
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  folder_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  
+  for (projects = codeslayer_get_projects (priv->codeslayer); projects != NULL; 
+       projects = g_list_next (projects))
+    {
+      CodeSlayerProject *project = projects->data;
+      g_hash_table_insert (folder_paths, g_strdup (codeslayer_project_get_key (project)),
+                           g_strdup (codeslayer_project_get_folder_path (project)));
+    }
+  
+  return folder_paths;
 }
 
+/*
+ * While the crawl runs the main loop is timed, and how late it runs is 
+ * passed on to the crawler so that it can back off. Only one crawl runs
+ * at a time, a request made meanwhile waits for it to be written and 
+ * replaces any request that was already waiting.
+ */
 static void
-get_project_indexes (CodeSlayerProject *project, 
-                     GFile             *file,
-                     GList             **indexes, 
-                     GList             *exclude_types,
-                     GList             *exclude_dirs)
-{
-  GFileEnumerator *enumerator;
-  
-  enumerator = g_file_enumerate_children (file, "standard::*",
-                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, 
-                                          NULL, NULL);
-                                                                  
-  if (enumerator != NULL)
-    {
-      GFileInfo *file_info;
-      while ((file_info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL)
-        {
-          GFile *child;
-        
-          const char *file_name = g_file_info_get_name (file_info);
+index_files_locally (FileSearchEngine  *engine,
+                     FileSearchCrawler *crawler)
+{
+  FileSearchEnginePrivate *priv;
+  Crawl *crawl;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  if (priv->crawling != NULL)
+    {
+      if (priv->queued_crawler != NULL)
+        g_object_unref (priv->queued_crawler);
+      priv->queued_crawler = g_object_ref (crawler);
+      return;
+    }
+  
+  priv->crawling = g_object_ref (crawler);
+  
+  if (priv->dirs_per_second > 0)
+    start_lag_probe (engine);
 
-          child = g_file_get_child (file, file_name);
+  crawl = g_slice_new (Crawl);
+  crawl->engine = g_object_ref (engine);
+  crawl->crawler = g_object_ref (crawler);
+  g_thread_unref (g_thread_new ("index files", (GThreadFunc) execute, crawl)); 
+}
 
-          if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
-            {
-              if (!codeslayer_utils_contains_element (exclude_dirs, file_name))
-                get_project_indexes (project, child, indexes, exclude_types, exclude_dirs);            
-            }
-          else
-            {
-              if (!codeslayer_utils_contains_element_with_suffix (exclude_types, file_name))
-                {
-                  FileSearchIndex *index;
-                  gchar *file_path;
-                  file_path = g_file_get_path (child);
-                  
-                  index = file_search_index_new ();
-                  file_search_index_set_file_name (index, file_name);
-                  file_search_index_set_file_path (index, file_path);
-                  
-                  g_free (file_path);
-                  
-                  *indexes = g_list_prepend (*indexes, index);
-                }
-            }
+static void
+start_lag_probe (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  if (priv->lag_source_id != 0)
+    return;
+    
+  priv->lag_probe_time = g_get_monotonic_time ();
+  priv->lag_source_id = g_timeout_add (LAG_PROBE_INTERVAL, 
+                                       (GSourceFunc) probe_lag_action, engine);
+}
 
-          g_object_unref(child);
-          g_object_unref (file_info);
-        }
-      g_object_unref (enumerator);
+/* the crawl is either on a thread of the editor or in the daemon */
+static gboolean
+probe_lag_action (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  gboolean user_idle;
+  gint64 now;
+  gint64 lag;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  now = g_get_monotonic_time ();
+  lag = now - priv->lag_probe_time - LAG_PROBE_INTERVAL * 1000;
+  priv->lag_probe_time = now;
+  user_idle = now - priv->user_input_time > (gint64) USER_IDLE_DELAY * G_USEC_PER_SEC;
+  
+  if (priv->crawling != NULL && !file_search_crawler_is_finished (priv->crawling))
+    {
+      if (lag > 0)
+        file_search_crawler_report_lag (priv->crawling, lag / 1000);
+      file_search_crawler_set_user_idle (priv->crawling, user_idle);
+    }
+  else if (priv->daemon_crawling && priv->daemon_connection != NULL)
+    {
+      report_activity (engine, lag / 1000, user_idle);
     }
+  else
+    {
+      priv->lag_source_id = 0;
+      return FALSE;
+    }
+  
+  return TRUE;
 }
 
+/* 
+ * The worst lag is held back and sent once a second, which is also how
+ * the daemon knows that the editor is still there and busy.
+ */
 static void
-write_indexes (CodeSlayer *codeslayer,
-               GIOChannel *channel, 
-               GList      *indexes)
+report_activity (FileSearchEngine *engine,
+                 gint64            lag,
+                 gboolean          user_idle)
+{
+  FileSearchEnginePrivate *priv;
+  gint64 now;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  priv->daemon_lag = MAX (priv->daemon_lag, lag);
+  
+  now = g_get_monotonic_time ();
+  if (now - priv->activity_report_time < (gint64) ACTIVITY_REPORT_INTERVAL * 1000)
+    return;
+    
+  g_dbus_connection_call (priv->daemon_connection, FILE_SEARCH_DAEMON_NAME, 
+                          FILE_SEARCH_DAEMON_OBJECT_PATH, FILE_SEARCH_DAEMON_INTERFACE, 
+                          "ReportActivity", 
+                          g_variant_new ("(sib)", priv->indexes_file, 
+                                         (gint) MIN (priv->daemon_lag, G_MAXINT), user_idle),
+                          NULL, G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, NULL, NULL, NULL);
+                          
+  priv->daemon_lag = 0;
+  priv->activity_report_time = now;
+}
+
+static gboolean
+user_input_action (GtkWidget        *widget,
+                   GdkEvent         *event,
+                   FileSearchEngine *engine)
 {
-  while (indexes != NULL)
+  FILE_SEARCH_ENGINE_GET_PRIVATE (engine)->user_input_time = g_get_monotonic_time ();
+  return FALSE;
+}
+
+/* the engine stays referenced until the main thread has heard of the write */
+static gpointer
+execute (Crawl *crawl)
+{
+  FileSearchCrawler *crawler = crawl->crawler;
+  GList *indexes;
+  
+  /* the thread only crawls, so it can give up its priority for good */
+  file_search_priority_set_idle ();
+
+  indexes = file_search_crawler_get_indexes (crawler);
+  if (indexes != NULL)
     {
-      FileSearchIndex *index = indexes->data;
-      GIOStatus status;
-      gchar *line;
+      GBytes *image;
       
-      line = g_strdup_printf ("%s\t%s\t%s\n", 
-                              file_search_index_get_file_name (index), 
-                              file_search_index_get_file_path (index), 
-                              file_search_index_get_project_key (index));
+      /* the file monitor picks up the new generation on the main thread */
+      image = file_search_crawler_write_indexes (crawler, indexes, FALSE);
+      file_search_crawler_compact_indexes (crawler, image);
+      if (image != NULL)
+        g_bytes_unref (image);
+        
+      g_list_foreach (indexes, (GFunc) g_object_unref, NULL);
+      g_list_free (indexes);
+    }
+    
+  g_idle_add_full (G_PRIORITY_LOW, (GSourceFunc) crawled_action, crawl, NULL);
+  
+  return NULL;
+}
+
+/* the request that came in during the crawl goes next */
+static gboolean
+crawled_action (Crawl *crawl)
+{
+  FileSearchEnginePrivate *priv;
+  FileSearchEngine *engine = crawl->engine;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  g_object_unref (priv->crawling);
+  priv->crawling = NULL;
+  
+  if (priv->queued_crawler != NULL)
+    {
+      FileSearchCrawler *crawler = priv->queued_crawler;
+      priv->queued_crawler = NULL;
+      index_files_locally (engine, crawler);
+      g_object_unref (crawler);
+    }
+  
+  g_object_unref (crawl->crawler);
+  g_slice_free (Crawl, crawl);
+  g_object_unref (engine);
+  
+  return FALSE;
+}
+
+static void
+index_files_remotely (FileSearchEngine  *engine,
+                      FileSearchCrawler *crawler)
+{
+  FileSearchEnginePrivate *priv;
+  GVariantBuilder projects;
+  GVariantBuilder exclude_types;
+  GVariantBuilder exclude_dirs;
+  GList *list;
+  GList *keys;
+  Crawl *crawl;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  g_variant_builder_init (&projects, G_VARIANT_TYPE ("a(ss)"));
+  g_variant_builder_init (&exclude_types, G_VARIANT_TYPE ("as"));
+  g_variant_builder_init (&exclude_dirs, G_VARIANT_TYPE ("as"));
+  
+  keys = file_search_crawler_get_project_keys (crawler);
+  for (list = file_search_crawler_get_projects (crawler); list != NULL; list = list->next)
+    {
+      g_variant_builder_add (&projects, "(ss)", keys->data, list->data);
+      keys = keys->next;
+    }
+  for (list = file_search_crawler_get_exclude_types (crawler); list != NULL; list = list->next)
+    g_variant_builder_add (&exclude_types, "s", list->data);
+  for (list = file_search_crawler_get_exclude_dirs (crawler); list != NULL; list = list->next)
+    g_variant_builder_add (&exclude_dirs, "s", list->data);
+  
+  /* the crawl is done here instead if the daemon does not answer */
+  crawl = g_slice_new (Crawl);
+  crawl->engine = g_object_ref (engine);
+  crawl->crawler = g_object_ref (crawler);
+  
+  g_dbus_connection_call (priv->daemon_connection, FILE_SEARCH_DAEMON_NAME, 
+                          FILE_SEARCH_DAEMON_OBJECT_PATH, FILE_SEARCH_DAEMON_INTERFACE, 
+                          "Index", 
+                          g_variant_new ("(sa(ss)asasb)", 
+                                         file_search_crawler_get_indexes_file (crawler),
+                                         &projects, &exclude_types, &exclude_dirs, FALSE),
+                          G_VARIANT_TYPE ("(t)"), G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, NULL, 
+                          (GAsyncReadyCallback) index_called_action, crawl);
+                          
+  /* the daemon paces the crawl by the editors, until it says it is done */
+  priv->daemon_crawling = TRUE;
+  priv->daemon_lag = 0;
+  priv->activity_report_time = 0;
+  start_lag_probe (engine);
+}
+
+static void
+index_called_action (GDBusConnection *connection,
+                     GAsyncResult    *result,
+                     Crawl           *crawl)
+{
+  GVariant *reply;
+  GError *error = NULL;
+  
+  reply = g_dbus_connection_call_finish (connection, result, &error);
+  if (reply == NULL)
+    {
+      /* the daemon went away underneath us, do the work ourselves */
+      g_warning ("Error calling the file search daemon: %s\n", error->message);
+      g_error_free (error);
+      FILE_SEARCH_ENGINE_GET_PRIVATE (crawl->engine)->daemon_crawling = FALSE;
+      index_files_locally (crawl->engine, crawl->crawler);
+    }
+  else
+    {
+      g_variant_unref (reply);
+    }
+  
+  g_object_unref (crawl->engine);
+  g_object_unref (crawl->crawler);
+  g_slice_free (Crawl, crawl);
+}
 
-      status = g_io_channel_write_chars (channel, line, -1, NULL, NULL);
+static gboolean
+spawn_daemon (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  GError *error = NULL;
+  gchar rate[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar dirs_per_second[16];
+  gchar max_depth[16];
+  gchar max_files[16];
+  gchar *argv[15];
+  gint argc = 0;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  argv[argc++] = FILE_SEARCH_DAEMON_EXECUTABLE;
+  argv[argc++] = "--false-positive-rate";
+  argv[argc++] = g_ascii_dtostr (rate, sizeof (rate), priv->false_positive_rate);
+  argv[argc++] = "--crawl-rate";
+  g_snprintf (dirs_per_second, sizeof (dirs_per_second), "%d", priv->dirs_per_second);
+  argv[argc++] = dirs_per_second;
+  argv[argc++] = "--max-depth";
+  g_snprintf (max_depth, sizeof (max_depth), "%d", priv->max_depth);
+  argv[argc++] = max_depth;
+  argv[argc++] = "--max-files";
+  g_snprintf (max_files, sizeof (max_files), "%d", priv->max_files);
+  argv[argc++] = max_files;
+  if (priv->cross_mounts)
+    argv[argc++] = "--cross-mounts";
+  if (priv->content_file != NULL)
+    argv[argc++] = "--content-index";
+  if (priv->follow_symlinks)
+    argv[argc++] = "--follow-symlinks";
+  if (!priv->git_index)
+    argv[argc++] = "--no-git-index";
+  if (!priv->git_untracked)
+    argv[argc++] = "--no-git-untracked";
+  argv[argc] = NULL;
+  
+  if (!g_spawn_async (NULL, argv, NULL, 
+                      G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL, 
+                      NULL, NULL, NULL, &error))
+    {
+      g_warning ("Error starting the file search daemon: %s\n", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+    
+  return TRUE;
+}
+
+static void
+daemon_appeared_action (GDBusConnection  *connection,
+                        const gchar      *name,
+                        const gchar      *name_owner,
+                        FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  if (priv->daemon_connection != NULL)
+    {
+      g_dbus_connection_signal_unsubscribe (priv->daemon_connection, priv->index_changed_id);
+      g_object_unref (priv->daemon_connection);
+    }
+  priv->daemon_connection = g_object_ref (connection);
+  
+  priv->index_changed_id = g_dbus_connection_signal_subscribe (connection, FILE_SEARCH_DAEMON_NAME,
+                                                               FILE_SEARCH_DAEMON_INTERFACE,
+                                                               "IndexChanged",
+                                                               FILE_SEARCH_DAEMON_OBJECT_PATH,
+                                                               NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                                               (GDBusSignalCallback) index_changed_action,
+                                                               engine, NULL);
+  
+  if (priv->pending_crawler != NULL)
+    {
+      index_files_remotely (engine, priv->pending_crawler);
+      g_object_unref (priv->pending_crawler);
+      priv->pending_crawler = NULL;
+    }
+}
+
+static void
+daemon_vanished_action (GDBusConnection  *connection,
+                        const gchar      *name,
+                        FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  /* the daemon exits when idle, so the next request starts a new one */
+  if (priv->daemon_connection != NULL)
+    {
+      g_dbus_connection_signal_unsubscribe (priv->daemon_connection, priv->index_changed_id);
+      g_object_unref (priv->daemon_connection);
+      priv->daemon_connection = NULL;
+      priv->index_changed_id = 0;
+      priv->daemon_spawned = FALSE;
+    }
+  priv->daemon_crawling = FALSE;
+}
+
+/* the log of the indexes file is replayed on top of it */
+static FileSearchImage*
+open_image (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  FileSearchImage *image;
+  GError *error = NULL;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  image = file_search_journal_load_image (priv->indexes_file, priv->false_positive_rate, &error);
+  if (image == NULL)
+    {
+      /* no index yet, or one written by an older version of the plugin */
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Error loading file search file: %s\n", error->message);
+      g_error_free (error);
+    }
+  
+  return image;
+}
+
+static void
+import_snapshot (FileSearchEngine *engine,
+                 GHashTable       *folder_paths)
+{
+  FileSearchEnginePrivate *priv;
+  GError *error = NULL;
+  gint64 start;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  if (g_hash_table_size (folder_paths) == 0)
+    return;
+  
+  start = g_get_monotonic_time ();
+  
+  if (!file_search_snapshot_import (priv->snapshot_file, folder_paths, priv->indexes_file,
+                                    priv->false_positive_rate, &error))
+    {
+      g_warning ("Error importing file search snapshot: %s\n", error->message);
+      g_error_free (error);
+      return;
+    }
+    
+  file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_SERIALIZE, 
+                            g_get_monotonic_time () - start);
+}
+
+/*
+ * Replaying the log builds a new image, so every load is done on the 
+ * load thread. A change that comes in while it runs loads again after.
+ * The thread is never joined, it hands the image over in an idle.
+ */
+static void
+start_load (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  if (priv->loading)
+    {
+      priv->reload = TRUE;
+      return;
+    }
+  
+  priv->loading = TRUE;
+  file_search_dialog_set_loading (priv->dialog, TRUE);
+  g_thread_unref (g_thread_new ("load file search index", 
+                                (GThreadFunc) load_thread, g_object_ref (engine)));
+}
+
+/* the engine stays referenced until the main thread has the image */
+static gpointer
+load_thread (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  FileSearchImage *image;
+  Load *load;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  file_search_priority_set_idle ();
+  
+  /* only the first load imports, the main thread is done with the table */
+  if (priv->snapshot_folder_paths != NULL)
+    {
+      import_snapshot (engine, priv->snapshot_folder_paths);
+      g_hash_table_destroy (priv->snapshot_folder_paths);
+      priv->snapshot_folder_paths = NULL;
+    }
+  
+  image = open_image (engine);
+  if (image != NULL)
+    {
+      file_search_image_set_memory_budget (image, priv->memory_budget);
+      file_search_image_warm (image);
+    }
+  
+  load = g_slice_new (Load);
+  load->engine = engine;
+  load->image = image;
+  g_idle_add_full (G_PRIORITY_LOW, (GSourceFunc) image_loaded_action, load, NULL);
+  
+  return NULL;
+}
+
+/* 
+ * Publishing the image also refreshes a search that was made while 
+ * there was none yet.
+ */
+static gboolean
+image_loaded_action (Load *load)
+{
+  FileSearchEnginePrivate *priv;
+  FileSearchEngine *engine = load->engine;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  priv->loading = FALSE;
+  file_search_dialog_set_loading (priv->dialog, FALSE);
+  
+  if (load->image != NULL)
+    {
+      set_image (engine, load->image);
+      g_object_unref (load->image);
+    }
+  
+  if (!priv->started)
+    {
+      priv->started = TRUE;
+      priv->revalidate_source_id = g_timeout_add_seconds_full (G_PRIORITY_LOW, REVALIDATE_DELAY,
+                                                               (GSourceFunc) revalidate_action, 
+                                                               engine, NULL);
+    }
+  
+  if (priv->reload)
+    {
+      priv->reload = FALSE;
+      start_load (engine);
+    }
+    
+  g_slice_free (Load, load);
+  g_object_unref (engine);
+  
+  return FALSE;
+}
+
+/* input since the timer was set pushes the crawl back by what is left */
+static gboolean
+revalidate_action (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  gint64 idle;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  idle = g_get_monotonic_time () - priv->user_input_time;
+  if (idle < (gint64) REVALIDATE_DELAY * G_USEC_PER_SEC)
+    {
+      priv->revalidate_source_id = g_timeout_add_full (G_PRIORITY_LOW, 
+                                                       (REVALIDATE_DELAY * G_USEC_PER_SEC - idle) / 1000 + 1,
+                                                       (GSourceFunc) revalidate_action, 
+                                                       engine, NULL);
+      return FALSE;
+    }
+  
+  priv->revalidate_source_id = 0;
+  file_search_engine_index_files (engine);
+  return FALSE;
+}
+
+/* the projects opened during startup are crawled by the deferred revalidation */
+static void
+projects_changed_action (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  if (!priv->started || priv->revalidate_source_id != 0)
+    return;
+  
+  file_search_engine_index_files (engine);
+}
+
+static void
+set_image (FileSearchEngine *engine,
+           FileSearchImage  *image)
+{
+  FileSearchEnginePrivate *priv;
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  if (file_search_image_get_generation (image) == priv->generation)
+    return;
+  
+  priv->generation = file_search_image_get_generation (image);
+  file_search_image_set_memory_budget (image, priv->memory_budget);
+  file_search_dialog_set_image (priv->dialog, image);
+  
+  if (priv->content_file != NULL)
+    load_content (engine);
+}
+
+/*
+ * The content index is always written before the image, so it is at 
+ * least as new as the image that was just loaded.
+ */
+static void
+load_content (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  FileSearchContent *content;
+  GError *error = NULL;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  content = file_search_content_new_from_file (priv->content_file, &error);
+  if (content == NULL)
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Error loading file search content file: %s\n", error->message);
+      g_error_free (error);
+    }
+    
+  file_search_dialog_set_content (priv->dialog, content);
+  
+  if (content != NULL)
+    g_object_unref (content);
+}
+
+static void
+indexes_file_changed_action (GFileMonitor      *monitor,
+                             GFile             *file,
+                             GFile             *other_file,
+                             GFileMonitorEvent  event,
+                             FileSearchEngine  *engine)
+{
+  /* the file is replaced by a rename, so it shows up as created */
+  if (event == G_FILE_MONITOR_EVENT_CREATED ||
+      event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+    start_load (engine);
+}
+
+static void
+index_changed_action (GDBusConnection  *connection,
+                      const gchar      *sender_name,
+                      const gchar      *object_path,
+                      const gchar      *interface_name,
+                      const gchar      *signal_name,
+                      GVariant         *parameters,
+                      FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  const gchar *indexes_file;
+  guint64 generation;
+  
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+  
+  g_variant_get (parameters, "(&st)", &indexes_file, &generation);
+  
+  if (g_strcmp0 (indexes_file, priv->indexes_file) != 0)
+    return;
+    
+  priv->daemon_crawling = FALSE;
+  
+  if (generation == priv->generation)
+    return;
+    
+  g_dbus_connection_call_with_unix_fd_list (connection, FILE_SEARCH_DAEMON_NAME,
+                                            FILE_SEARCH_DAEMON_OBJECT_PATH, 
+                                            FILE_SEARCH_DAEMON_INTERFACE,
+                                            "GetIndex", g_variant_new ("(s)", priv->indexes_file),
+                                            G_VARIANT_TYPE ("(ht)"), 
+                                            G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, 
+                                            NULL, NULL,
+                                            (GAsyncReadyCallback) get_index_action, 
+                                            g_object_ref (engine));
+}
+
+static void
+get_index_action (GDBusConnection  *connection,
+                  GAsyncResult     *result,
+                  FileSearchEngine *engine)
+{
+  FileSearchImage *image = NULL;
+  GUnixFDList *fd_list = NULL;
+  GVariant *reply;
+  GError *error = NULL;
+  
+  reply = g_dbus_connection_call_with_unix_fd_list_finish (connection, &fd_list, result, &error);
+  if (reply != NULL)
+    {
+      gint32 handle;
+      guint64 generation;
+      gint fd;
       
-      g_free (line);
+      g_variant_get (reply, "(ht)", &handle, &generation);
       
-      if (status != G_IO_STATUS_NORMAL)
-        g_warning ("Error writing to file search file.");
-
-      indexes = g_list_next (indexes);
+      if (fd_list == NULL || handle < 0 || handle >= g_unix_fd_list_get_length (fd_list))
+        {
+          g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "The file search daemon did not hand over the index");
+        }
+      else
+        {
+          fd = g_unix_fd_list_get (fd_list, handle, &error);
+          if (fd >= 0)
+            {
+              /* the mapping keeps the memfd alive, the descriptor is not needed */
+              image = file_search_image_new_from_fd (fd, &error);
+              close (fd);
+            }
+        }
+        
+      g_variant_unref (reply);
+      if (fd_list != NULL)
+        g_object_unref (fd_list);
+    }
+    
+  if (image != NULL)
+    {
+      set_image (engine, image);
+      g_object_unref (image);
+    }
+  else
+    {
+      /* no shared memory on this system, the daemon wrote the file as well */
+      g_error_free (error);
+      start_load (engine);
     }
     
-  g_io_channel_flush (channel, NULL);
+  g_object_unref (engine);
+}
+
+static gboolean
+dump_stats_action (FileSearchEngine *engine)
+{
+  FileSearchEnginePrivate *priv;
+  gchar *profile_folder_path;
+  gchar *profile_stats_file;
+
+  priv = FILE_SEARCH_ENGINE_GET_PRIVATE (engine);
+
+  profile_folder_path = codeslayer_get_profile_config_folder_path (priv->codeslayer);
+  profile_stats_file = g_strconcat (profile_folder_path, G_DIR_SEPARATOR_S, "filesearch-stats.json", NULL);
+  
+  file_search_stats_write_json (priv->stats, profile_stats_file);
+  
+  g_free (profile_folder_path);
+  g_free (profile_stats_file);
+
+  return TRUE;
 }
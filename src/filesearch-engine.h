@@ -21,6 +21,7 @@
 
 #include <gtk/gtk.h>
 #include <codeslayer/codeslayer.h>
+#include "filesearch-stats.h"
 
 G_BEGIN_DECLS
 
@@ -48,8 +49,11 @@ GType file_search_engine_get_type (void) G_GNUC_CONST;
 FileSearchEngine*  file_search_engine_new          (CodeSlayer       *codeslayer, 
                                                     GtkWidget        *menu);
                                             
+void               file_search_engine_start        (FileSearchEngine *engine);
 void               file_search_engine_index_files  (FileSearchEngine *engine);
 
+FileSearchStats*   file_search_engine_get_stats    (FileSearchEngine *engine);
+
 G_END_DECLS
 
 #endif /* _FILE_SEARCH_ENGINE_H */
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Readers enter and leave over and over while a writer keeps publishing
+ * new generations, with more readers than slots so that the shared slot
+ * is used as well. A generation is scribbled over when it is destroyed,
+ * so a reader that can still see it notices. Built with ThreadSanitizer
+ * it also reports the race itself:
+ *
+ *   make check CFLAGS="-g -O1 -fsanitize=thread" LDFLAGS="-fsanitize=thread"
+ */
+
+#include <stdlib.h>
+#include "filesearch-epoch.h"
+
+#define N_READERS      (FILE_SEARCH_EPOCH_MAX_READERS + 16)
+#define N_GENERATIONS  2000
+#define N_VALUES       16
+
+typedef struct
+{
+  guint number;
+  guint values[N_VALUES];
+} Generation;
+
+static Generation* generation_new      (guint            number);
+static void generation_destroy         (Generation      *generation);
+static gpointer read_generations       (FileSearchEpoch *epoch);
+static gint check_shared_slot          (void);
+static gint check_readers              (void);
+
+static gint destroyed = 0;
+static gint done = 0;
+
+int
+main (int   argc, 
+      char *argv[])
+{
+  gint failures = 0;
+
+  failures += check_shared_slot ();
+  failures += check_readers ();
+
+  if (failures > 0)
+    {
+      g_printerr ("%d failures\n", failures);
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
+
+static Generation*
+generation_new (guint number)
+{
+  Generation *generation;
+  guint i;
+
+  generation = g_slice_new (Generation);
+  generation->number = number;
+  for (i = 0; i < N_VALUES; i++)
+    generation->values[i] = number;
+
+  return generation;
+}
+
+static void
+generation_destroy (Generation *generation)
+{
+  guint i;
+
+  generation->number = 0;
+  for (i = 0; i < N_VALUES; i++)
+    generation->values[i] = 0;
+
+  g_slice_free (Generation, generation);
+  g_atomic_int_inc (&destroyed);
+}
+
+/* the generations a reader sees never go back, and are never scribbled over */
+static gpointer
+read_generations (FileSearchEpoch *epoch)
+{
+  gint failures = 0;
+  guint last = 0;
+
+  while (!g_atomic_int_get (&done))
+    {
+      Generation *generation;
+      guint slot;
+      guint i;
+
+      generation = file_search_epoch_enter (epoch, &slot);
+
+      if (generation->number < last)
+        failures++;
+      last = generation->number;
+
+      for (i = 0; i < N_VALUES; i++)
+        {
+          if (generation->values[i] != last)
+            failures++;
+        }
+
+      file_search_epoch_leave (epoch, slot);
+    }
+
+  return GINT_TO_POINTER (failures);
+}
+
+/* 
+ * With every slot taken, a reader gets the shared slot, and holds back 
+ * what was replaced while it was inside until it leaves.
+ */
+static gint
+check_shared_slot (void)
+{
+  FileSearchEpoch *epoch;
+  guint slots[FILE_SEARCH_EPOCH_MAX_READERS];
+  Generation *generation;
+  guint shared;
+  gint failures = 0;
+  guint i;
+
+  epoch = file_search_epoch_new ((GDestroyNotify) generation_destroy);
+  file_search_epoch_publish (epoch, generation_new (1));
+
+  for (i = 0; i < FILE_SEARCH_EPOCH_MAX_READERS; i++)
+    file_search_epoch_enter (epoch, &slots[i]);
+  generation = file_search_epoch_enter (epoch, &shared);
+  for (i = 0; i < FILE_SEARCH_EPOCH_MAX_READERS; i++)
+    file_search_epoch_leave (epoch, slots[i]);
+
+  if (shared != FILE_SEARCH_EPOCH_MAX_READERS || generation->number != 1)
+    {
+      g_printerr ("the reader past the slots did not get the shared one\n");
+      failures++;
+    }
+
+  file_search_epoch_publish (epoch, generation_new (2));
+  file_search_epoch_collect (epoch);
+  if (g_atomic_int_get (&destroyed) != 0)
+    {
+      g_printerr ("a generation went while the shared reader could see it\n");
+      failures++;
+    }
+
+  file_search_epoch_leave (epoch, shared);
+  file_search_epoch_collect (epoch);
+  if (g_atomic_int_get (&destroyed) != 1)
+    {
+      g_printerr ("the shared reader held back a generation after it left\n");
+      failures++;
+    }
+
+  g_object_unref (epoch);
+  g_atomic_int_set (&destroyed, 0);
+
+  return failures;
+}
+
+static gint
+check_readers (void)
+{
+  FileSearchEpoch *epoch;
+  GThread *readers[N_READERS];
+  gint failures = 0;
+  guint i;
+
+  epoch = file_search_epoch_new ((GDestroyNotify) generation_destroy);
+  file_search_epoch_publish (epoch, generation_new (1));
+
+  for (i = 0; i < N_READERS; i++)
+    readers[i] = g_thread_new ("reader", (GThreadFunc) read_generations, epoch);
+
+  for (i = 2; i <= N_GENERATIONS; i++)
+    file_search_epoch_publish (epoch, generation_new (i));
+
+  g_atomic_int_set (&done, 1);
+
+  for (i = 0; i < N_READERS; i++)
+    failures += GPOINTER_TO_INT (g_thread_join (readers[i]));
+
+  if (failures > 0)
+    g_printerr ("readers saw %d replaced or scribbled generations\n", failures);
+
+  file_search_epoch_collect (epoch);
+  if (g_atomic_int_get (&destroyed) != N_GENERATIONS - 1)
+    {
+      g_printerr ("%d of %d replaced generations were destroyed\n", 
+                  g_atomic_int_get (&destroyed), N_GENERATIONS - 1);
+      failures++;
+    }
+
+  g_object_unref (epoch);
+
+  return failures;
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "filesearch-epoch.h"
+
+/* handed to the readers that found every slot taken */
+#define SHARED_SLOT FILE_SEARCH_EPOCH_MAX_READERS
+
+typedef struct
+{
+  gpointer data;
+  gint     epoch;
+} Retired;
+
+static void file_search_epoch_class_init  (FileSearchEpochClass *klass);
+static void file_search_epoch_init        (FileSearchEpoch      *epoch);
+static void file_search_epoch_finalize    (FileSearchEpoch      *epoch);
+
+static GSList* take_reclaimable           (FileSearchEpoch      *epoch);
+static guint destroy_retired              (FileSearchEpoch      *epoch,
+                                           GSList               *retired);
+
+#define FILE_SEARCH_EPOCH_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_EPOCH_TYPE, FileSearchEpochPrivate))
+
+typedef struct _FileSearchEpochPrivate FileSearchEpochPrivate;
+
+/*
+ * Holds the current generation of something that threads read without 
+ * ever taking a lock, while a writer now and then puts a new generation
+ * in its place. A reader announces the epoch it entered in before it 
+ * looks at the current generation, and clears its slot when it leaves. 
+ * Replaced generations are retired with the epoch they were replaced 
+ * in and only destroyed once every reader still inside entered after 
+ * that, so no reader can still be looking at them. 
+ *
+ * Readers with a slot never wait on a writer. Writers only wait on each
+ * other, and reclaim whatever they can as they publish. Epoch zero marks
+ * a free slot. Readers that find every slot taken share one more under
+ * the mutex, it holds the epoch of the oldest of them until they all 
+ * left.
+ */
+struct _FileSearchEpochPrivate
+{
+  GDestroyNotify  destroy;
+  gpointer        current;
+  gint            epoch;
+  gint            readers[FILE_SEARCH_EPOCH_MAX_READERS];
+  gint            shared_epoch;
+  guint           shared_readers;
+  GMutex          mutex;
+  GQueue          retired;
+};
+
+G_DEFINE_TYPE (FileSearchEpoch, file_search_epoch, G_TYPE_OBJECT)
+
+static void
+file_search_epoch_class_init (FileSearchEpochClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = (GObjectFinalizeFunc) file_search_epoch_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchEpochPrivate));
+}
+
+static void
+file_search_epoch_init (FileSearchEpoch *epoch)
+{
+  FileSearchEpochPrivate *priv;
+  guint i;
+
+  priv = FILE_SEARCH_EPOCH_GET_PRIVATE (epoch);
+  priv->destroy = NULL;
+  priv->current = NULL;
+  priv->epoch = 1;
+  for (i = 0; i < FILE_SEARCH_EPOCH_MAX_READERS; i++)
+    priv->readers[i] = 0;
+  priv->shared_epoch = 0;
+  priv->shared_readers = 0;
+  g_mutex_init (&priv->mutex);
+  g_queue_init (&priv->retired);
+}
+
+/* no reader can be inside any more, the object would still be referenced */
+static void
+file_search_epoch_finalize (FileSearchEpoch *epoch)
+{
+  FileSearchEpochPrivate *priv;
+  Retired *retired;
+
+  priv = FILE_SEARCH_EPOCH_GET_PRIVATE (epoch);
+
+  while ((retired = g_queue_pop_head (&priv->retired)) != NULL)
+    {
+      if (priv->destroy != NULL)
+        priv->destroy (retired->data);
+      g_slice_free (Retired, retired);
+    }
+
+  if (priv->current != NULL && priv->destroy != NULL)
+    priv->destroy (priv->current);
+
+  g_mutex_clear (&priv->mutex);
+
+  G_OBJECT_CLASS (file_search_epoch_parent_class)->finalize (G_OBJECT (epoch));
+}
+
+/*
+ * The destroy function is called on the generations that are replaced,
+ * on whichever thread publishes or collects once nobody can see them.
+ */
+FileSearchEpoch*
+file_search_epoch_new (GDestroyNotify destroy)
+{
+  FileSearchEpoch *epoch;
+  epoch = FILE_SEARCH_EPOCH (g_object_new (file_search_epoch_get_type (), NULL));
+  FILE_SEARCH_EPOCH_GET_PRIVATE (epoch)->destroy = destroy;
+  return epoch;
+}
+
+/*
+ * Returns the current generation, which stays valid until the reader
+ * passes the slot it was given to file_search_epoch_leave(). A reader 
+ * that needs it for longer has to take a reference of its own before 
+ * it leaves. Readers should not stay inside for long, since nothing 
+ * replaced after they entered can be destroyed until they leave. Past
+ * FILE_SEARCH_EPOCH_MAX_READERS readers briefly take the mutex instead
+ * of waiting for a slot.
+ */
+gpointer
+file_search_epoch_enter (FileSearchEpoch *epoch,
+                         guint           *slot)
+{
+  FileSearchEpochPrivate *priv;
+  gpointer current;
+  gint current_epoch;
+  guint i;
+
+  priv = FILE_SEARCH_EPOCH_GET_PRIVATE (epoch);
+
+  /* 
+   * The epoch can only move on between the read and the announcement,
+   * which makes the reader look older than it is. That only holds 
+   * back reclaiming, it never lets a generation go too early.
+   */
+  current_epoch = g_atomic_int_get (&priv->epoch);
+
+  for (i = 0; i < FILE_SEARCH_EPOCH_MAX_READERS; i++)
+    {
+      if (g_atomic_int_compare_and_exchange (&priv->readers[i], 0, current_epoch))
+        {
+          *slot = i;
+          return g_atomic_pointer_get (&priv->current);
+        }
+    }
+
+  /* a writer can not publish meanwhile, so the epoch and data agree */
+  g_mutex_lock (&priv->mutex);
+  if (priv->shared_readers++ == 0)
+    priv->shared_epoch = priv->epoch;
+  current = priv->current;
+  g_mutex_unlock (&priv->mutex);
+
+  *slot = SHARED_SLOT;
+  return current;
+}
+
+void
+file_search_epoch_leave (FileSearchEpoch *epoch,
+                         guint            slot)
+{
+  FileSearchEpochPrivate *priv;
+
+  priv = FILE_SEARCH_EPOCH_GET_PRIVATE (epoch);
+
+  g_return_if_fail (slot <= SHARED_SLOT);
+
+  if (slot == SHARED_SLOT)
+    {
+      g_mutex_lock (&priv->mutex);
+      if (--priv->shared_readers == 0)
+        priv->shared_epoch = 0;
+      g_mutex_unlock (&priv->mutex);
+      return;
+    }
+
+  g_atomic_int_set (&priv->readers[slot], 0);
+}
+
+/*
+ * Makes the data the current generation, taking over the caller's 
+ * reference, and retires the one it replaces. Readers that entered 
+ * before keep seeing the old one, later ones see the new one.
+ */
+void
+file_search_epoch_publish (FileSearchEpoch *epoch,
+                           gpointer         data)
+{
+  FileSearchEpochPrivate *priv;
+  gpointer replaced;
+  GSList *reclaimable;
+
+  priv = FILE_SEARCH_EPOCH_GET_PRIVATE (epoch);
+
+  g_mutex_lock (&priv->mutex);
+
+  replaced = priv->current;
+  g_atomic_pointer_set (&priv->current, data);
+
+  if (replaced != NULL)
+    {
+      Retired *retired = g_slice_new (Retired);
+      retired->data = replaced;
+      retired->epoch = g_atomic_int_get (&priv->epoch);
+      g_queue_push_tail (&priv->retired, retired);
+    }
+
+  g_atomic_int_inc (&priv->epoch);
+
+  reclaimable = take_reclaimable (epoch);
+
+  g_mutex_unlock (&priv->mutex);
+
+  destroy_retired (epoch, reclaimable);
+}
+
+/*
+ * Destroys the retired generations that no reader can see any more, and
+ * returns how many there were. Publishing does the same, this is for
+ * when the last readers of an old generation have left since.
+ */
+guint
+file_search_epoch_collect (FileSearchEpoch *epoch)
+{
+  FileSearchEpochPrivate *priv;
+  GSList *reclaimable;
+
+  priv = FILE_SEARCH_EPOCH_GET_PRIVATE (epoch);
+
+  g_mutex_lock (&priv->mutex);
+  reclaimable = take_reclaimable (epoch);
+  g_mutex_unlock (&priv->mutex);
+
+  return destroy_retired (epoch, reclaimable);
+}
+
+/*
+ * A reader that entered in an epoch can have seen anything retired in
+ * that epoch or later. The queue is in epoch order, so it is taken from
+ * the head up to the epoch of the oldest reader still inside. Called 
+ * with the mutex held, the generations are destroyed after it is let go.
+ */
+static GSList*
+take_reclaimable (FileSearchEpoch *epoch)
+{
+  FileSearchEpochPrivate *priv;
+  GSList *reclaimable = NULL;
+  Retired *retired;
+  gint oldest = G_MAXINT;
+  guint i;
+
+  priv = FILE_SEARCH_EPOCH_GET_PRIVATE (epoch);
+
+  if (priv->shared_epoch != 0)
+    oldest = priv->shared_epoch;
+
+  for (i = 0; i < FILE_SEARCH_EPOCH_MAX_READERS; i++)
+    {
+      gint reader = g_atomic_int_get (&priv->readers[i]);
+      if (reader != 0 && reader < oldest)
+        oldest = reader;
+    }
+
+  while ((retired = g_queue_peek_head (&priv->retired)) != NULL && 
+         retired->epoch < oldest)
+    {
+      g_queue_pop_head (&priv->retired);
+      reclaimable = g_slist_prepend (reclaimable, retired);
+    }
+
+  return reclaimable;
+}
+
+static guint
+destroy_retired (FileSearchEpoch *epoch,
+                 GSList          *retired)
+{
+  FileSearchEpochPrivate *priv;
+  GSList *list;
+  guint n_destroyed = 0;
+
+  priv = FILE_SEARCH_EPOCH_GET_PRIVATE (epoch);
+
+  for (list = retired; list != NULL; list = list->next)
+    {
+      Retired *item = list->data;
+      if (priv->destroy != NULL)
+        priv->destroy (item->data);
+      g_slice_free (Retired, item);
+      n_destroyed++;
+    }
+
+  g_slist_free (retired);
+
+  return n_destroyed;
+}
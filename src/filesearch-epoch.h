@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_EPOCH_H__
+#define	__FILE_SEARCH_EPOCH_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_EPOCH_TYPE            (file_search_epoch_get_type ())
+#define FILE_SEARCH_EPOCH(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_EPOCH_TYPE, FileSearchEpoch))
+#define FILE_SEARCH_EPOCH_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_EPOCH_TYPE, FileSearchEpochClass))
+#define IS_FILE_SEARCH_EPOCH(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_EPOCH_TYPE))
+#define IS_FILE_SEARCH_EPOCH_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_EPOCH_TYPE))
+
+/* readers with a slot of their own, any more share one behind the mutex */
+#define FILE_SEARCH_EPOCH_MAX_READERS  64
+
+typedef struct _FileSearchEpoch FileSearchEpoch;
+typedef struct _FileSearchEpochClass FileSearchEpochClass;
+
+struct _FileSearchEpoch
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchEpochClass
+{
+  GObjectClass parent_class;
+};
+
+GType file_search_epoch_get_type (void) G_GNUC_CONST;
+
+FileSearchEpoch*  file_search_epoch_new      (GDestroyNotify   destroy);
+
+gpointer          file_search_epoch_enter    (FileSearchEpoch *epoch,
+                                              guint           *slot);
+void              file_search_epoch_leave    (FileSearchEpoch *epoch,
+                                              guint            slot);
+void              file_search_epoch_publish  (FileSearchEpoch *epoch,
+                                              gpointer         data);
+guint             file_search_epoch_collect  (FileSearchEpoch *epoch);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_EPOCH_H__ */
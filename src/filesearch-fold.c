@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include "filesearch-fold.h"
+
+/*
+ * Writes the folded text into the buffer, NUL terminated and cut short
+ * to fit its size, and returns its length. Plain ASCII, which is almost
+ * every file name, is folded in place without any allocation.
+ */
+gsize
+file_search_fold (const gchar *text,
+                  gsize        length,
+                  gchar       *buffer,
+                  gsize        size)
+{
+  gchar *decomposed;
+  gchar *folded;
+  gchar *composed;
+  gsize result;
+  gsize i;
+
+  g_return_val_if_fail (size > 0, 0);
+
+  for (i = 0; i < length; i++)
+    {
+      if ((guchar) text[i] >= 0x80)
+        break;
+      if (i < size - 1)
+        buffer[i] = g_ascii_tolower (text[i]);
+    }
+
+  if (i == length || !g_utf8_validate (text, length, NULL))
+    {
+      /* non UTF-8 names can still fold their ASCII letters */
+      for (; i < length && i < size - 1; i++)
+        buffer[i] = g_ascii_tolower (text[i]);
+      result = MIN (length, size - 1);
+      buffer[result] = '\0';
+      return result;
+    }
+
+  /* the case folding is defined on decomposed text */
+  decomposed = g_utf8_normalize (text, length, G_NORMALIZE_NFD);
+  folded = g_utf8_casefold (decomposed, -1);
+  composed = g_utf8_normalize (folded, -1, G_NORMALIZE_NFC);
+
+  result = strlen (composed);
+  if (result > size - 1)
+    {
+      const gchar *end = g_utf8_find_prev_char (composed, composed + size);
+      result = end != NULL ? (gsize) (end - composed) : 0;
+    }
+
+  memcpy (buffer, composed, result);
+  buffer[result] = '\0';
+
+  g_free (composed);
+  g_free (folded);
+  g_free (decomposed);
+
+  return result;
+}
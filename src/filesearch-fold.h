@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_FOLD_H__
+#define	__FILE_SEARCH_FOLD_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Folds a file name for case insensitive matching: Unicode case folding
+ * in composed (NFC) form, so names typed on different systems and in 
+ * different cases fold to the same key. Names that are not UTF-8 only 
+ * have their ASCII letters folded.
+ */
+
+gsize  file_search_fold  (const gchar *text,
+                          gsize        length,
+                          gchar       *buffer,
+                          gsize        size);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_FOLD_H__ */
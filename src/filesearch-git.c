@@ -0,0 +1,737 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <fnmatch.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include "filesearch-git.h"
+
+/*
+ * The git index is "DIRC", a version and an entry count followed by the
+ * entries sorted by path. Every entry is 62 bytes of stat data, object
+ * id and flags, 2 more bytes of flags when the extended bit is set, and
+ * the path. Versions 2 and 3 store the path NUL terminated and pad the
+ * entry to 8 bytes, version 4 strips the prefix it shares with the path
+ * before it. Extensions and a checksum follow the entries.
+ *
+ * The lengths are those of 20 byte SHA-1 object ids, a repository that
+ * uses SHA-256 ids is crawled instead.
+ */
+
+#define INDEX_SIGNATURE       "DIRC"
+#define INDEX_HEADER_LENGTH   12
+#define INDEX_CHECKSUM_LENGTH 20
+#define ENTRY_NAME_OFFSET     62
+
+#define ENTRY_EXTENDED        0x4000
+#define ENTRY_STAGE_SHIFT     12
+#define ENTRY_SKIP_WORKTREE   0x4000
+
+#define MODE_TYPE             0170000
+#define MODE_DIR              0040000
+#define MODE_GITLINK          0160000
+
+typedef struct
+{
+  gchar    *base;
+  gchar    *pattern;
+  gboolean  negate;
+  gboolean  dir_only;
+  gboolean  anchored;
+} Ignore;
+
+static gchar* find_git_dir          (const gchar  *folder_path,
+                                     gchar       **work_tree);
+static gboolean uses_sha1           (const gchar  *git_dir);
+static gboolean read_index          (const gchar  *index_file,
+                                     const gchar  *work_tree,
+                                     const gchar  *prefix,
+                                     GList        *exclude_dirs,
+                                     GPtrArray    *paths);
+static guint32 read_be32            (const guint8  *p);
+static guint16 read_be16            (const guint8  *p);
+static gboolean read_offset_varint  (const guint8 **p,
+                                     const guint8  *end,
+                                     gsize         *value);
+static void walk_untracked          (const gchar  *work_tree,
+                                     const gchar  *dir,
+                                     dev_t         device,
+                                     GList        *exclude_dirs,
+                                     GPtrArray    *ignores,
+                                     GHashTable   *tracked,
+                                     GPtrArray    *paths);
+static void load_ignores            (const gchar  *file_path,
+                                     const gchar  *base,
+                                     GPtrArray    *ignores);
+static gboolean is_ignored          (GPtrArray    *ignores,
+                                     const gchar  *path,
+                                     const gchar  *name,
+                                     gboolean      is_dir);
+static gboolean is_excluded         (GList        *exclude_dirs,
+                                     const gchar  *path);
+static void ignore_free             (Ignore       *ignore);
+
+/*
+ * Returns the absolute paths of the files, or NULL when the folder is
+ * not in a git work tree or its index can not be used, in which case
+ * the folder has to be crawled.
+ */
+GPtrArray*
+file_search_git_get_paths (const gchar *folder_path,
+                           GList       *exclude_dirs,
+                           gboolean     untracked)
+{
+  GPtrArray *paths;
+  gchar *git_dir;
+  gchar *work_tree;
+  gchar *index_file;
+  gchar *prefix;
+  gboolean result;
+
+  git_dir = find_git_dir (folder_path, &work_tree);
+  if (git_dir == NULL)
+    return NULL;
+
+  if (!uses_sha1 (git_dir))
+    {
+      g_free (work_tree);
+      g_free (git_dir);
+      return NULL;
+    }
+
+  /* the folder relative to the work tree, with a trailing slash */
+  if (strcmp (folder_path, work_tree) == 0)
+    prefix = g_strdup ("");
+  else
+    prefix = g_strconcat (folder_path + strlen (work_tree) + 1, "/", NULL);
+
+  paths = g_ptr_array_new_with_free_func (g_free);
+  index_file = g_build_filename (git_dir, "index", NULL);
+
+  result = read_index (index_file, work_tree, prefix, exclude_dirs, paths);
+
+  if (result && untracked)
+    {
+      GPtrArray *ignores;
+      GHashTable *tracked;
+      GStatBuf folder_buf;
+      gchar *exclude_file;
+      gchar **parts;
+      gchar *base;
+      guint i;
+
+      tracked = g_hash_table_new (g_str_hash, g_str_equal);
+      for (i = 0; i < paths->len; i++)
+        g_hash_table_insert (tracked, g_ptr_array_index (paths, i), NULL);
+
+      ignores = g_ptr_array_new_with_free_func ((GDestroyNotify) ignore_free);
+
+      exclude_file = g_build_filename (git_dir, "info", "exclude", NULL);
+      load_ignores (exclude_file, "", ignores);
+      g_free (exclude_file);
+
+      /* the folders between the work tree and the project still count */
+      parts = g_strsplit (prefix, "/", -1);
+      base = g_strdup ("");
+      for (i = 0; parts[i] != NULL && parts[i + 1] != NULL; i++)
+        {
+          gchar *ignore_file;
+          gchar *next;
+          ignore_file = g_build_filename (work_tree, base, ".gitignore", NULL);
+          load_ignores (ignore_file, base, ignores);
+          g_free (ignore_file);
+          next = g_strconcat (base, parts[i], "/", NULL);
+          g_free (base);
+          base = next;
+        }
+      g_free (base);
+      g_strfreev (parts);
+
+      /* the walk stays on the filesystem of the project, like the crawler */
+      if (g_stat (folder_path, &folder_buf) == 0)
+        walk_untracked (work_tree, prefix, folder_buf.st_dev, exclude_dirs, 
+                        ignores, tracked, paths);
+
+      g_ptr_array_free (ignores, TRUE);
+      g_hash_table_destroy (tracked);
+    }
+
+  g_free (index_file);
+  g_free (prefix);
+  g_free (work_tree);
+  g_free (git_dir);
+
+  if (!result)
+    {
+      g_ptr_array_free (paths, TRUE);
+      return NULL;
+    }
+
+  return paths;
+}
+
+/*
+ * Looks for the .git directory in the folder and its parents. Linked
+ * work trees and submodules have a .git file pointing at it instead.
+ */
+static gchar*
+find_git_dir (const gchar  *folder_path,
+              gchar       **work_tree)
+{
+  gchar *dir;
+
+  dir = g_strdup (folder_path);
+
+  while (TRUE)
+    {
+      gchar *dot_git;
+      gchar *parent;
+
+      dot_git = g_build_filename (dir, ".git", NULL);
+
+      if (g_file_test (dot_git, G_FILE_TEST_IS_DIR))
+        {
+          *work_tree = dir;
+          return dot_git;
+        }
+
+      if (g_file_test (dot_git, G_FILE_TEST_IS_REGULAR))
+        {
+          gchar *contents;
+          if (g_file_get_contents (dot_git, &contents, NULL, NULL))
+            {
+              gchar *git_dir = NULL;
+              g_strstrip (contents);
+              if (g_str_has_prefix (contents, "gitdir: "))
+                {
+                  const gchar *path = contents + strlen ("gitdir: ");
+                  if (g_path_is_absolute (path))
+                    git_dir = g_strdup (path);
+                  else
+                    git_dir = g_build_filename (dir, path, NULL);
+                }
+              g_free (contents);
+              if (git_dir != NULL)
+                {
+                  g_free (dot_git);
+                  *work_tree = dir;
+                  return git_dir;
+                }
+            }
+        }
+
+      g_free (dot_git);
+
+      parent = g_path_get_dirname (dir);
+      if (strcmp (parent, dir) == 0)
+        {
+          g_free (parent);
+          g_free (dir);
+          return NULL;
+        }
+
+      g_free (dir);
+      dir = parent;
+    }
+}
+
+/*
+ * The object format is set by extensions.objectFormat in the config of
+ * the repository, which linked work trees share through commondir. No
+ * config or no setting means SHA-1, anything that can not be read as
+ * "sha1" is taken to mean some other format.
+ */
+static gboolean
+uses_sha1 (const gchar *git_dir)
+{
+  gchar *common_dir = NULL;
+  gchar *file_path;
+  gchar *contents;
+  gchar **lines;
+  gboolean extensions = FALSE;
+  gboolean result = TRUE;
+  guint i;
+
+  file_path = g_build_filename (git_dir, "commondir", NULL);
+  if (g_file_get_contents (file_path, &contents, NULL, NULL))
+    {
+      g_strstrip (contents);
+      if (g_path_is_absolute (contents))
+        common_dir = g_strdup (contents);
+      else
+        common_dir = g_build_filename (git_dir, contents, NULL);
+      g_free (contents);
+    }
+  g_free (file_path);
+
+  file_path = g_build_filename (common_dir != NULL ? common_dir : git_dir, "config", NULL);
+  g_free (common_dir);
+
+  if (!g_file_get_contents (file_path, &contents, NULL, NULL))
+    {
+      g_free (file_path);
+      return TRUE;
+    }
+  g_free (file_path);
+
+  lines = g_strsplit (contents, "\n", -1);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar *line = g_strstrip (lines[i]);
+      gchar *value;
+
+      if (*line == '[')
+        {
+          extensions = g_ascii_strncasecmp (line, "[extensions]", strlen ("[extensions]")) == 0;
+          continue;
+        }
+
+      value = strchr (line, '=');
+      if (!extensions || value == NULL)
+        continue;
+
+      *value++ = '\0';
+      value[strcspn (value, "#;")] = '\0';
+      if (g_ascii_strcasecmp (g_strstrip (line), "objectformat") == 0)
+        result = g_ascii_strcasecmp (g_strstrip (value), "sha1") == 0;
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return result;
+}
+
+/*
+ * A split or sparse index does not list every file by itself, those
+ * are left to the crawler.
+ */
+static gboolean
+read_index (const gchar *index_file,
+            const gchar *work_tree,
+            const gchar *prefix,
+            GList       *exclude_dirs,
+            GPtrArray   *paths)
+{
+  GMappedFile *mapped_file;
+  const guint8 *data;
+  const guint8 *p;
+  const guint8 *end;
+  GString *path;
+  GString *last;
+  guint32 version;
+  guint32 n_entries;
+  guint32 i;
+  gsize length;
+  gsize prefix_length;
+  gboolean result = FALSE;
+
+  mapped_file = g_mapped_file_new (index_file, FALSE, NULL);
+  if (mapped_file == NULL)
+    return FALSE;
+
+  data = (const guint8 *) g_mapped_file_get_contents (mapped_file);
+  length = g_mapped_file_get_length (mapped_file);
+
+  if (length < INDEX_HEADER_LENGTH + INDEX_CHECKSUM_LENGTH ||
+      memcmp (data, INDEX_SIGNATURE, 4) != 0)
+    {
+      g_mapped_file_unref (mapped_file);
+      return FALSE;
+    }
+
+  version = read_be32 (data + 4);
+  n_entries = read_be32 (data + 8);
+
+  if (version < 2 || version > 4)
+    {
+      g_mapped_file_unref (mapped_file);
+      return FALSE;
+    }
+
+  p = data + INDEX_HEADER_LENGTH;
+  end = data + length - INDEX_CHECKSUM_LENGTH;
+  prefix_length = strlen (prefix);
+
+  path = g_string_new (NULL);
+  last = g_string_new (NULL);
+
+  for (i = 0; i < n_entries; i++)
+    {
+      const guint8 *entry = p;
+      const guint8 *nul;
+      guint32 mode;
+      guint16 flags;
+      guint16 extended = 0;
+
+      if (end - p < ENTRY_NAME_OFFSET)
+        goto out;
+
+      mode = read_be32 (p + 24);
+      flags = read_be16 (p + 60);
+      p += ENTRY_NAME_OFFSET;
+
+      if (flags & ENTRY_EXTENDED)
+        {
+          if (version < 3 || end - p < 2)
+            goto out;
+          extended = read_be16 (p);
+          p += 2;
+        }
+
+      if (version == 4)
+        {
+          gsize strip;
+          if (!read_offset_varint (&p, end, &strip) || strip > path->len)
+            goto out;
+          g_string_truncate (path, path->len - strip);
+        }
+      else
+        {
+          g_string_truncate (path, 0);
+        }
+
+      nul = memchr (p, '\0', end - p);
+      if (nul == NULL)
+        goto out;
+      g_string_append_len (path, (const gchar *) p, nul - p);
+
+      if (version == 4)
+        {
+          p = nul + 1;
+        }
+      else
+        {
+          gsize entry_length = ((p - entry) + (nul - p) + 8) & ~7;
+          if (entry_length > (gsize) (end - entry))
+            goto out;
+          p = entry + entry_length;
+        }
+
+      /* a conflict lists the path once per stage */
+      if ((flags >> ENTRY_STAGE_SHIFT) & 3 && strcmp (path->str, last->str) == 0)
+        continue;
+
+      if (extended & ENTRY_SKIP_WORKTREE ||
+          (mode & MODE_TYPE) == MODE_DIR ||
+          (mode & MODE_TYPE) == MODE_GITLINK)
+        continue;
+
+      if (strncmp (path->str, prefix, prefix_length) != 0 ||
+          is_excluded (exclude_dirs, path->str + prefix_length))
+        continue;
+
+      g_string_assign (last, path->str);
+      g_ptr_array_add (paths, g_strconcat (work_tree, G_DIR_SEPARATOR_S, path->str, NULL));
+    }
+
+  while (end - p >= 8)
+    {
+      guint32 size = read_be32 (p + 4);
+      if (memcmp (p, "link", 4) == 0 || memcmp (p, "sdir", 4) == 0)
+        goto out;
+      if (size > (gsize) (end - p) - 8)
+        goto out;
+      p += 8 + size;
+    }
+
+  result = TRUE;
+
+out:
+  if (!result)
+    g_ptr_array_set_size (paths, 0);
+  g_string_free (last, TRUE);
+  g_string_free (path, TRUE);
+  g_mapped_file_unref (mapped_file);
+  return result;
+}
+
+/* version 4 entries are not aligned */
+static guint32
+read_be32 (const guint8 *p)
+{
+  guint32 value;
+  memcpy (&value, p, sizeof (value));
+  return GUINT32_FROM_BE (value);
+}
+
+static guint16
+read_be16 (const guint8 *p)
+{
+  guint16 value;
+  memcpy (&value, p, sizeof (value));
+  return GUINT16_FROM_BE (value);
+}
+
+/*
+ * The offset varints of git differ from the usual ones, every byte but
+ * the last adds one before shifting so no value has two encodings.
+ */
+static gboolean
+read_offset_varint (const guint8 **p,
+                    const guint8  *end,
+                    gsize         *value)
+{
+  const guint8 *q = *p;
+  gsize result;
+
+  if (q >= end)
+    return FALSE;
+
+  result = *q & 0x7f;
+  while (*q++ & 0x80)
+    {
+      if (q >= end || result > (G_MAXSIZE >> 8))
+        return FALSE;
+      result = ((result + 1) << 7) | (*q & 0x7f);
+    }
+
+  *p = q;
+  *value = result;
+  return TRUE;
+}
+
+static void
+walk_untracked (const gchar *work_tree,
+                const gchar *dir,
+                dev_t        device,
+                GList       *exclude_dirs,
+                GPtrArray   *ignores,
+                GHashTable  *tracked,
+                GPtrArray   *paths)
+{
+  const gchar *name;
+  gchar *dir_path;
+  gchar *ignore_file;
+  GDir *gdir;
+  guint n_ignores;
+
+  dir_path = g_build_filename (work_tree, dir, NULL);
+
+  n_ignores = ignores->len;
+  ignore_file = g_build_filename (dir_path, ".gitignore", NULL);
+  load_ignores (ignore_file, dir, ignores);
+  g_free (ignore_file);
+
+  gdir = g_dir_open (dir_path, 0, NULL);
+  if (gdir != NULL)
+    {
+      while ((name = g_dir_read_name (gdir)) != NULL)
+        {
+          gchar *path;
+          gchar *file_path;
+          GStatBuf buf;
+          gboolean is_dir;
+
+          if (strcmp (name, ".git") == 0)
+            continue;
+
+          file_path = g_build_filename (dir_path, name, NULL);
+
+          /* symbolic links to directories are not walked into, like the crawler */
+          if (g_lstat (file_path, &buf) != 0)
+            {
+              g_free (file_path);
+              continue;
+            }
+
+          is_dir = S_ISDIR (buf.st_mode);
+          path = g_strconcat (dir, name, NULL);
+
+          if (is_ignored (ignores, path, name, is_dir) ||
+              (is_dir && buf.st_dev != device) ||
+              (is_dir && g_list_find_custom (exclude_dirs, name, (GCompareFunc) g_strcmp0) != NULL))
+            {
+              g_free (path);
+              g_free (file_path);
+              continue;
+            }
+
+          if (is_dir)
+            {
+              gchar *child = g_strconcat (path, "/", NULL);
+              walk_untracked (work_tree, child, device, exclude_dirs, ignores, tracked, paths);
+              g_free (child);
+              g_free (file_path);
+            }
+          else if (g_hash_table_lookup_extended (tracked, file_path, NULL, NULL))
+            {
+              g_free (file_path);
+            }
+          else
+            {
+              g_ptr_array_add (paths, file_path);
+            }
+
+          g_free (path);
+        }
+      g_dir_close (gdir);
+    }
+
+  g_ptr_array_set_size (ignores, n_ignores);
+  g_free (dir_path);
+}
+
+/*
+ * Reads the patterns of an ignore file. The base is the directory of
+ * the file relative to the work tree, the patterns with a slash in them
+ * are matched against the path below it and the others against the
+ * name alone. A leading double star only means any directory.
+ */
+static void
+load_ignores (const gchar *file_path,
+              const gchar *base,
+              GPtrArray   *ignores)
+{
+  gchar *contents;
+  gchar **lines;
+  guint i;
+
+  if (!g_file_get_contents (file_path, &contents, NULL, NULL))
+    return;
+
+  lines = g_strsplit (contents, "\n", -1);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar *line = g_strchomp (lines[i]);
+      Ignore *ignore;
+      gsize length;
+
+      if (*line == '\0' || *line == '#')
+        continue;
+
+      ignore = g_slice_new (Ignore);
+      ignore->negate = FALSE;
+      ignore->dir_only = FALSE;
+      ignore->anchored = FALSE;
+
+      if (*line == '!')
+        {
+          ignore->negate = TRUE;
+          line++;
+        }
+      else if (*line == '\\')
+        {
+          line++;
+        }
+
+      length = strlen (line);
+      if (length > 0 && line[length - 1] == '/')
+        {
+          ignore->dir_only = TRUE;
+          line[--length] = '\0';
+        }
+
+      if (g_str_has_prefix (line, "**/"))
+        line += 3;
+      else if (*line == '/')
+        ignore->anchored = TRUE;
+
+      if (*line == '/')
+        line++;
+
+      if (*line == '\0')
+        {
+          g_slice_free (Ignore, ignore);
+          continue;
+        }
+
+      if (strchr (line, '/') != NULL)
+        ignore->anchored = TRUE;
+
+      ignore->base = g_strdup (base);
+      ignore->pattern = g_strdup (line);
+      g_ptr_array_add (ignores, ignore);
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+}
+
+/*
+ * The last pattern that matches decides, so a negation further down can
+ * bring back what an earlier pattern ignored.
+ */
+static gboolean
+is_ignored (GPtrArray   *ignores,
+            const gchar *path,
+            const gchar *name,
+            gboolean     is_dir)
+{
+  guint i;
+
+  for (i = ignores->len; i > 0; i--)
+    {
+      Ignore *ignore = g_ptr_array_index (ignores, i - 1);
+
+      if (ignore->dir_only && !is_dir)
+        continue;
+
+      if (ignore->anchored)
+        {
+          if (fnmatch (ignore->pattern, path + strlen (ignore->base), FNM_PATHNAME) != 0)
+            continue;
+        }
+      else
+        {
+          if (fnmatch (ignore->pattern, name, 0) != 0)
+            continue;
+        }
+
+      return !ignore->negate;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+is_excluded (GList       *exclude_dirs,
+             const gchar *path)
+{
+  const gchar *start = path;
+  const gchar *slash;
+
+  if (exclude_dirs == NULL)
+    return FALSE;
+
+  while ((slash = strchr (start, '/')) != NULL)
+    {
+      GList *list;
+      for (list = exclude_dirs; list != NULL; list = g_list_next (list))
+        {
+          const gchar *exclude_dir = list->data;
+          if (strlen (exclude_dir) == (gsize) (slash - start) &&
+              strncmp (exclude_dir, start, slash - start) == 0)
+            return TRUE;
+        }
+      start = slash + 1;
+    }
+
+  return FALSE;
+}
+
+static void
+ignore_free (Ignore *ignore)
+{
+  g_free (ignore->base);
+  g_free (ignore->pattern);
+  g_slice_free (Ignore, ignore);
+}
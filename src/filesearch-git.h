@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_GIT_H__
+#define	__FILE_SEARCH_GIT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Lists the files of a project folder inside a git work tree from the
+ * git index, without crawling it. The untracked files that are not
+ * ignored are added with a walk that honors the .gitignore files.
+ */
+
+GPtrArray*  file_search_git_get_paths  (const gchar *folder_path,
+                                        GList       *exclude_dirs,
+                                        gboolean     untracked);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_GIT_H__ */
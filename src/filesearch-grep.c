@@ -0,0 +1,545 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include "filesearch-grep.h"
+#include "filesearch-probes.h"
+
+static void file_search_grep_class_init  (FileSearchGrepClass *klass);
+static void file_search_grep_init        (FileSearchGrep      *grep);
+static void file_search_grep_finalize    (FileSearchGrep      *grep);
+
+static gpointer feed_thread              (FileSearchGrep      *grep);
+static gboolean feed_file                (FileSearchGrep      *grep,
+                                          GThreadPool         *pool,
+                                          gchar               *file_path);
+static void scan_file                    (gchar               *file_path,
+                                          FileSearchGrep      *grep);
+static gboolean scan_lines               (FileSearchGrep      *grep,
+                                          const gchar         *file_path,
+                                          const gchar         *data,
+                                          const gchar         *end,
+                                          guint               *line);
+static void add_match                    (FileSearchGrep      *grep,
+                                          const gchar         *file_path,
+                                          guint                line,
+                                          guint                column,
+                                          const gchar         *line_start,
+                                          const gchar         *line_end);
+static gboolean deliver_action           (FileSearchGrep      *grep);
+static void match_free                   (FileSearchGrepMatch *match);
+
+#define FILE_SEARCH_GREP_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_GREP_TYPE, FileSearchGrepPrivate))
+
+/* a NUL byte in the head of a file marks it as binary */
+#define BINARY_CHECK_LENGTH  4096
+
+/* files are read this much at a time, a longer line grows the buffer */
+#define READ_LENGTH          (64 * 1024)
+
+/* the longest line text handed to the view */
+#define MAX_TEXT_LENGTH      256
+
+/* how often the matches found so far are handed to the main thread */
+#define DELIVER_INTERVAL     100
+
+/* files queued ahead of the workers */
+#define MAX_QUEUED           1024
+
+typedef struct _FileSearchGrepPrivate FileSearchGrepPrivate;
+
+/*
+ * One thread walks the image and queues the candidate files on a pool
+ * with a worker per processor. The workers read each file and search it
+ * with memmem, which glibc vectorizes, and queue what they find. The
+ * main thread picks the matches up in batches so the view never sees
+ * more than one update per interval.
+ */
+struct _FileSearchGrepPrivate
+{
+  FileSearchImage *image;
+  FileSearchContent *content;
+  FileSearchStats *stats;
+  gchar           *text;
+  gsize            text_length;
+  GCancellable    *cancellable;
+  GMutex           mutex;
+  GPtrArray       *pending;
+  gboolean         done;
+  gint             n_matches;
+  gint64           bytes_scanned;
+  guint            deliver_id;
+};
+
+enum
+{
+  MATCHES_FOUND,
+  FINISHED,
+  LAST_SIGNAL
+};
+
+static guint file_search_grep_signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE (FileSearchGrep, file_search_grep, G_TYPE_OBJECT)
+
+static void
+file_search_grep_class_init (FileSearchGrepClass *klass)
+{
+  file_search_grep_signals[MATCHES_FOUND] =
+    g_signal_new ("matches-found",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS,
+                  G_STRUCT_OFFSET (FileSearchGrepClass, matches_found),
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__POINTER, G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+  file_search_grep_signals[FINISHED] =
+    g_signal_new ("finished",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS,
+                  G_STRUCT_OFFSET (FileSearchGrepClass, finished),
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+
+  G_OBJECT_CLASS (klass)->finalize = (GObjectFinalizeFunc) file_search_grep_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchGrepPrivate));
+}
+
+static void
+file_search_grep_init (FileSearchGrep *grep)
+{
+  FileSearchGrepPrivate *priv;
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+  priv->image = NULL;
+  priv->content = NULL;
+  priv->stats = NULL;
+  priv->text = NULL;
+  priv->text_length = 0;
+  priv->cancellable = g_cancellable_new ();
+  g_mutex_init (&priv->mutex);
+  priv->pending = g_ptr_array_new_with_free_func ((GDestroyNotify) match_free);
+  priv->done = FALSE;
+  priv->n_matches = 0;
+  priv->bytes_scanned = 0;
+  priv->deliver_id = 0;
+}
+
+static void
+file_search_grep_finalize (FileSearchGrep *grep)
+{
+  FileSearchGrepPrivate *priv;
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+  if (priv->image)
+    g_object_unref (priv->image);
+  if (priv->content)
+    g_object_unref (priv->content);
+  if (priv->stats)
+    g_object_unref (priv->stats);
+  if (priv->text)
+    g_free (priv->text);
+  g_object_unref (priv->cancellable);
+  g_ptr_array_free (priv->pending, TRUE);
+  g_mutex_clear (&priv->mutex);
+  G_OBJECT_CLASS (file_search_grep_parent_class)->finalize (G_OBJECT (grep));
+}
+
+/*
+ * Searches the contents of every file in the image for the literal text.
+ */
+FileSearchGrep*
+file_search_grep_new (FileSearchImage *image,
+                      FileSearchStats *stats,
+                      const gchar     *text)
+{
+  FileSearchGrepPrivate *priv;
+  FileSearchGrep *grep;
+
+  grep = FILE_SEARCH_GREP (g_object_new (file_search_grep_get_type (), NULL));
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+  priv->image = g_object_ref (image);
+  priv->stats = g_object_ref (stats);
+  priv->text = g_strdup (text);
+  priv->text_length = strlen (text);
+
+  return grep;
+}
+
+/*
+ * With a content index only the files that contain every trigram of the 
+ * text are read, instead of every file in the image.
+ */
+void
+file_search_grep_set_content (FileSearchGrep    *grep,
+                              FileSearchContent *content)
+{
+  FileSearchGrepPrivate *priv;
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+  
+  if (priv->content != NULL)
+    g_object_unref (priv->content);
+  priv->content = content != NULL ? g_object_ref (content) : NULL;
+}
+
+/*
+ * The delivery timeout holds a reference until the threads are done, so
+ * the caller may drop its own reference right after cancelling.
+ */
+void
+file_search_grep_start (FileSearchGrep *grep)
+{
+  FileSearchGrepPrivate *priv;
+  GThread *thread;
+
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+
+  g_return_if_fail (priv->deliver_id == 0);
+
+  priv->deliver_id = g_timeout_add_full (G_PRIORITY_DEFAULT, DELIVER_INTERVAL,
+                                         (GSourceFunc) deliver_action,
+                                         g_object_ref (grep), g_object_unref);
+
+  thread = g_thread_new ("filesearch-grep", (GThreadFunc) feed_thread, grep);
+  g_thread_unref (thread);
+}
+
+void
+file_search_grep_cancel (FileSearchGrep *grep)
+{
+  g_cancellable_cancel (FILE_SEARCH_GREP_GET_PRIVATE (grep)->cancellable);
+}
+
+static gpointer
+feed_thread (FileSearchGrep *grep)
+{
+  FileSearchGrepPrivate *priv;
+  FileSearchImageCursor cursor;
+  GThreadPool *pool;
+  GPtrArray *candidates = NULL;
+  gint64 start;
+  glong n_threads;
+
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+
+  start = g_get_monotonic_time ();
+  FILE_SEARCH_PROBE1 (grep__start, priv->text);
+
+  n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+  if (n_threads < 1)
+    n_threads = 1;
+
+  pool = g_thread_pool_new ((GFunc) scan_file, grep, n_threads, FALSE, NULL);
+
+  if (priv->content != NULL)
+    candidates = file_search_content_query (priv->content, priv->text);
+
+  if (candidates != NULL)
+    {
+      guint i;
+      for (i = 0; i < candidates->len; i++)
+        {
+          if (!feed_file (grep, pool, g_strdup (g_ptr_array_index (candidates, i))))
+            break;
+        }
+      g_ptr_array_free (candidates, TRUE);
+    }
+  else
+    {
+      FileSearchImage *image = priv->image;
+      gboolean fed = TRUE;
+      
+      /* the files the log added are in the overlay */
+      while (image != NULL && fed)
+        {
+          file_search_image_cursor_init (image, &cursor, 0);
+          while (fed && file_search_image_cursor_next (&cursor))
+            fed = feed_file (grep, pool, file_search_image_cursor_get_file_path (&cursor));
+          image = image != priv->image ? NULL : file_search_image_get_overlay (image);
+        }
+    }
+
+  /* once cancelled or full the workers drop what is still queued */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  file_search_stats_add (priv->stats, FILE_SEARCH_COUNTER_BYTES_SCANNED, priv->bytes_scanned);
+  file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_GREP,
+                            g_get_monotonic_time () - start);
+  FILE_SEARCH_PROBE1 (grep__done, priv->n_matches);
+
+  /* the object may go away as soon as this is set */
+  g_mutex_lock (&priv->mutex);
+  priv->done = TRUE;
+  g_mutex_unlock (&priv->mutex);
+
+  return NULL;
+}
+
+/*
+ * Queues the file on the pool, holding back while the workers are far 
+ * behind. Returns FALSE once the search should stop.
+ */
+static gboolean
+feed_file (FileSearchGrep *grep,
+           GThreadPool    *pool,
+           gchar          *file_path)
+{
+  FileSearchGrepPrivate *priv;
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+
+  if (file_path != NULL)
+    g_thread_pool_push (pool, file_path, NULL);
+
+  while (g_thread_pool_unprocessed (pool) > MAX_QUEUED &&
+         !g_cancellable_is_cancelled (priv->cancellable))
+    g_usleep (1000);
+
+  return !g_cancellable_is_cancelled (priv->cancellable) &&
+         g_atomic_int_get (&priv->n_matches) < FILE_SEARCH_GREP_MAX_MATCHES;
+}
+
+/*
+ * The file is read rather than mapped, another process can truncate it 
+ * while it is scanned and a mapping would fault on the pages that went.
+ * The lines are matched as they come in, whole lines only, so that the
+ * text never straddles two reads.
+ */
+static void
+scan_file (gchar          *file_path,
+           FileSearchGrep *grep)
+{
+  FileSearchGrepPrivate *priv;
+  gchar *buffer;
+  gsize size = READ_LENGTH;
+  gsize length = 0;
+  gsize scanned = 0;
+  gboolean checked = FALSE;
+  gboolean more = TRUE;
+  guint line = 1;
+  gint fd;
+
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+
+  if (g_cancellable_is_cancelled (priv->cancellable) ||
+      g_atomic_int_get (&priv->n_matches) >= FILE_SEARCH_GREP_MAX_MATCHES)
+    {
+      g_free (file_path);
+      return;
+    }
+
+  fd = g_open (file_path, O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0)
+    {
+      g_free (file_path);
+      return;
+    }
+
+  buffer = g_malloc (size);
+
+  while (more && !g_cancellable_is_cancelled (priv->cancellable))
+    {
+      const gchar *end;
+      gssize n;
+
+      if (length == size)
+        {
+          size *= 2;
+          buffer = g_realloc (buffer, size);
+        }
+
+      n = read (fd, buffer + length, size - length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        more = FALSE;
+      else
+        length += n;
+
+      if (!checked)
+        {
+          if (more && length < BINARY_CHECK_LENGTH)
+            continue;
+          if (memchr (buffer, '\0', MIN (length, BINARY_CHECK_LENGTH)) != NULL)
+            break;
+          checked = TRUE;
+        }
+
+      if (more)
+        {
+          end = memrchr (buffer, '\n', length);
+          if (end == NULL)
+            continue;
+          end++;
+        }
+      else
+        {
+          end = buffer + length;
+        }
+
+      scanned += end - buffer;
+
+      if (!scan_lines (grep, file_path, buffer, end, &line))
+        break;
+
+      length -= end - buffer;
+      memmove (buffer, end, length);
+    }
+
+  close (fd);
+  g_free (buffer);
+
+  g_mutex_lock (&priv->mutex);
+  priv->bytes_scanned += scanned;
+  g_mutex_unlock (&priv->mutex);
+
+  g_free (file_path);
+}
+
+/*
+ * Matches the lines from data up to end, which is the end of a line or
+ * of the file, and counts them into line. Returns FALSE once there are
+ * enough matches.
+ */
+static gboolean
+scan_lines (FileSearchGrep *grep,
+            const gchar    *file_path,
+            const gchar    *data,
+            const gchar    *end,
+            guint          *line)
+{
+  FileSearchGrepPrivate *priv;
+  const gchar *newline;
+  const gchar *line_start = data;
+  const gchar *p = data;
+
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+
+  while (p < end)
+    {
+      const gchar *match;
+      const gchar *line_end;
+
+      match = memmem (p, end - p, priv->text, priv->text_length);
+      if (match == NULL)
+        break;
+
+      /* count the lines skipped over to get to the match */
+      while ((newline = memchr (line_start, '\n', match - line_start)) != NULL)
+        {
+          line_start = newline + 1;
+          (*line)++;
+        }
+
+      line_end = memchr (match, '\n', end - match);
+      if (line_end == NULL)
+        line_end = end;
+
+      add_match (grep, file_path, *line, match - line_start + 1, line_start, line_end);
+
+      if (g_atomic_int_add (&priv->n_matches, 1) + 1 >= FILE_SEARCH_GREP_MAX_MATCHES)
+        return FALSE;
+      if (line_end == end)
+        return TRUE;
+
+      /* one match per line, like grep */
+      p = line_start = line_end + 1;
+      (*line)++;
+    }
+
+  while ((newline = memchr (line_start, '\n', end - line_start)) != NULL)
+    {
+      line_start = newline + 1;
+      (*line)++;
+    }
+
+  return TRUE;
+}
+
+static void
+add_match (FileSearchGrep *grep,
+           const gchar    *file_path,
+           guint           line,
+           guint           column,
+           const gchar    *line_start,
+           const gchar    *line_end)
+{
+  FileSearchGrepPrivate *priv;
+  FileSearchGrepMatch *match;
+  const gchar *valid_end;
+
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+
+  match = g_slice_new (FileSearchGrepMatch);
+  match->file_path = g_strdup (file_path);
+  match->line = line;
+  match->column = column;
+  match->text = g_strndup (line_start, MIN (line_end - line_start, MAX_TEXT_LENGTH));
+
+  /* the view only takes UTF-8, cut the text at the first bad byte */
+  g_utf8_validate (match->text, -1, &valid_end);
+  match->text[valid_end - match->text] = '\0';
+  g_strstrip (match->text);
+
+  g_mutex_lock (&priv->mutex);
+  g_ptr_array_add (priv->pending, match);
+  g_mutex_unlock (&priv->mutex);
+}
+
+static gboolean
+deliver_action (FileSearchGrep *grep)
+{
+  FileSearchGrepPrivate *priv;
+  GPtrArray *matches;
+  gboolean done;
+
+  priv = FILE_SEARCH_GREP_GET_PRIVATE (grep);
+
+  g_mutex_lock (&priv->mutex);
+  matches = priv->pending;
+  priv->pending = g_ptr_array_new_with_free_func ((GDestroyNotify) match_free);
+  done = priv->done;
+  g_mutex_unlock (&priv->mutex);
+
+  if (matches->len > 0 && !g_cancellable_is_cancelled (priv->cancellable))
+    g_signal_emit (grep, file_search_grep_signals[MATCHES_FOUND], 0, matches);
+
+  g_ptr_array_free (matches, TRUE);
+
+  if (done)
+    {
+      priv->deliver_id = 0;
+      g_signal_emit (grep, file_search_grep_signals[FINISHED], 0);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+match_free (FileSearchGrepMatch *match)
+{
+  g_free (match->file_path);
+  g_free (match->text);
+  g_slice_free (FileSearchGrepMatch, match);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_GREP_H__
+#define	__FILE_SEARCH_GREP_H__
+
+#include <glib-object.h>
+#include "filesearch-content.h"
+#include "filesearch-image.h"
+#include "filesearch-stats.h"
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_GREP_TYPE            (file_search_grep_get_type ())
+#define FILE_SEARCH_GREP(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_GREP_TYPE, FileSearchGrep))
+#define FILE_SEARCH_GREP_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_GREP_TYPE, FileSearchGrepClass))
+#define IS_FILE_SEARCH_GREP(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_GREP_TYPE))
+#define IS_FILE_SEARCH_GREP_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_GREP_TYPE))
+
+/* the search stops by itself once this many lines matched */
+#define FILE_SEARCH_GREP_MAX_MATCHES 5000
+
+typedef struct _FileSearchGrep FileSearchGrep;
+typedef struct _FileSearchGrepClass FileSearchGrepClass;
+
+typedef struct
+{
+  gchar *file_path;
+  guint  line;
+  guint  column;
+  gchar *text;
+} FileSearchGrepMatch;
+
+struct _FileSearchGrep
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchGrepClass
+{
+  GObjectClass parent_class;
+
+  void (*matches_found) (FileSearchGrep *grep,
+                         GPtrArray      *matches);
+  void (*finished)      (FileSearchGrep *grep);
+};
+
+GType file_search_grep_get_type (void) G_GNUC_CONST;
+
+FileSearchGrep*  file_search_grep_new     (FileSearchImage *image,
+                                           FileSearchStats *stats,
+                                           const gchar     *text);
+
+void             file_search_grep_set_content (FileSearchGrep    *grep,
+                                               FileSearchContent *content);
+void             file_search_grep_start   (FileSearchGrep  *grep);
+void             file_search_grep_cancel  (FileSearchGrep  *grep);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_GREP_H__ */
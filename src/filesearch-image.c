@@ -0,0 +1,2203 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include "filesearch-fold.h"
+#include "filesearch-image.h"
+#include "filesearch-index.h"
+#include "filesearch-varint.h"
+
+/*
+ * The image is the immutable, position independent form of the index.
+ * It is written to the profile folder and, when the daemon builds it,
+ * also published as a sealed memfd. Readers map it and never copy it,
+ * so any number of processes share the same pages.
+ *
+ *   header | section table | sections...
+ *
+ * Every section starts on an 8 byte boundary. The layout is in host
+ * byte order since the image never leaves the machine it was built on,
+ * or at least the architecture: a relative image, one of the snapshots
+ * of filesearch-snapshot.h, is built elsewhere and copied in. Its flags
+ * are set in the header and its directories are relative to the folder
+ * of each project, "." for the folder itself.
+ *
+ * The directories and the entries are sorted lists stored with front
+ * coding: each record keeps the length of the prefix it shares with the
+ * previous key, the remaining suffix and its ids as varints. Records are
+ * grouped in blocks, and every RESTART_INTERVAL records the full key is
+ * stored again so a lookup binary searches the restarts and decodes at
+ * most one run of records.
+ *
+ *   list    = list header | block offsets[n_blocks + 1] | blocks...
+ *   block   = restart offsets[] | records... | padding to 4 bytes
+ *   record  = shared | suffix length | suffix | ids... | [value length | value]
+ *
+ * Entries are keyed by their folded file name (see filesearch-fold.h)
+ * and sorted by project, then key and then directory. A record holds the
+ * directory id, the project id and the file name itself, which is left
+ * empty when it is the same as the key. The path is the directory joined
+ * with the file name, project ids index the sorted list of project keys.
+ *
+ * The entries of each project are thus one partition, a sorted run of
+ * its own. The partitions section holds the first entry of every project
+ * plus the number of entries:
+ *
+ *   partitions = first entry[n_projects + 1]
+ *
+ * A scope is a bitmap over the project ids. The cursor only walks the
+ * partitions in it and looks the pattern's prefix up in each, so the
+ * entries of the projects out of scope are never read.
+ *
+ * Each block of entries also gets a bloom filter over the trigrams of its
+ * folded file names, sized for the requested false positive rate. A 
+ * pattern has to contain the trigrams of its literal parts, so a block 
+ * whose filter is missing any of them is skipped without being decoded.
+ *
+ *   filters = filter header | offsets[n_blocks + 1] | padding | words...
+ *
+ * The updates logged since the image was written (see filesearch-
+ * journal.h) are laid over it rather than built into a new one: the 
+ * entries they removed are marked in a bitmap the cursor skips, and the
+ * files they added make up a small image of their own, the overlay, 
+ * whose entries are numbered on from the last of this one.
+ */
+
+#define FILE_SEARCH_IMAGE_MAGIC    "CSFSIDX"
+#define FILE_SEARCH_IMAGE_VERSION  4
+
+#define BLOCK_SIZE        64
+#define RESTART_INTERVAL  16
+#define MAX_IDS           2
+
+/* blocks of a list that are kept or dropped from memory together */
+#define SHARD_BLOCKS      64
+
+typedef enum
+{
+  SECTION_PROJECTS = 1,
+  SECTION_DIRS,
+  SECTION_ENTRIES,
+  SECTION_FILTERS,
+  SECTION_PARTITIONS,
+  SECTIONS
+} SectionId;
+
+typedef struct
+{
+  gchar   magic[8];
+  guint32 version;
+  guint32 n_sections;
+  guint64 generation;
+  guint32 n_entries;
+  guint32 flags;
+} Header;
+
+typedef struct
+{
+  guint32 id;
+  guint32 reserved;
+  guint64 offset;
+  guint64 length;
+} Section;
+
+typedef struct
+{
+  guint32 n_items;
+  guint32 n_blocks;
+  guint32 block_size;
+  guint32 restart_interval;
+} ListHeader;
+
+typedef struct
+{
+  guint32 n_blocks;
+  guint32 n_hashes;
+  guint32 reserved[2];
+} FilterHeader;
+
+typedef struct
+{
+  guint          n_items;
+  guint          n_blocks;
+  guint          block_size;
+  guint          restart_interval;
+  guint          n_ids;
+  gboolean       has_values;
+  const guint32 *block_offsets;
+  const guint8  *blocks;
+  gint          *stamps;
+  gint          *clock;
+} List;
+
+typedef struct
+{
+  guint          n_blocks;
+  guint          n_hashes;
+  const guint32 *offsets;
+  const guint64 *words;
+} Filters;
+
+typedef struct
+{
+  const List   *list;
+  guint         item;
+  const guint8 *p;
+  const guint8 *end;
+  gchar        *key;
+  gsize         length;
+  guint32       ids[MAX_IDS];
+  const gchar  *value;
+  gsize         value_length;
+  gboolean      same_key;
+} ListCursor;
+
+typedef struct
+{
+  GByteArray *blocks;
+  GByteArray *records;
+  GArray     *block_offsets;
+  GArray     *restarts;
+  guint       n_items;
+  gchar      *previous;
+} ListWriter;
+
+typedef struct
+{
+  const gchar *file_name;
+  const gchar *key;
+  const gchar *dir;
+  const gchar *project_key;
+  guint32      ids[MAX_IDS];
+} Record;
+
+static void file_search_image_class_init  (FileSearchImageClass *klass);
+static void file_search_image_init        (FileSearchImage      *image);
+static void file_search_image_finalize    (FileSearchImage      *image);
+
+static FileSearchImage* new_from_mapped_file  (GMappedFile      *mapped_file,
+                                               GError          **error);
+static gboolean validate                      (FileSearchImage  *image,
+                                               GError          **error);
+static gboolean validate_list                 (List             *list,
+                                               const guint8     *data,
+                                               guint64           length,
+                                               guint             n_ids,
+                                               gboolean          has_values);
+static gboolean validate_projects             (FileSearchImage  *image,
+                                               const gchar      *data,
+                                               guint64           length);
+static gboolean validate_filters              (Filters          *filters,
+                                               const guint8     *data,
+                                               guint64           length);
+static gboolean validate_partitions           (FileSearchImage  *image,
+                                               const guint32    *data,
+                                               guint64           length);
+static gboolean cursor_seek                   (FileSearchImageCursor *cursor,
+                                               guint             entry);
+static gboolean cursor_next_partition         (FileSearchImageCursor *cursor);
+static gboolean cursor_next_entry             (FileSearchImageCursor *cursor);
+static void cursor_set_trigrams               (FileSearchImageCursor *cursor,
+                                               const gchar      *pattern);
+static gboolean get_partition_run             (FileSearchImage  *image,
+                                               guint             project,
+                                               const gchar      *prefix,
+                                               gsize             prefix_length,
+                                               guint            *first,
+                                               guint            *limit);
+static gboolean list_seek                     (ListCursor       *cursor,
+                                               const List       *list,
+                                               guint             item,
+                                               gchar            *key);
+static gboolean list_next                     (ListCursor       *cursor);
+static void list_touch                        (const List       *list,
+                                               guint             block_index);
+static guint list_n_shards                    (const List       *list);
+static gsize list_get_shard_length            (const List       *list,
+                                               guint             shard);
+static gsize list_release_shard               (const List       *list,
+                                               guint             shard);
+static gint list_compare_restart              (const List       *list,
+                                               guint             restart,
+                                               const gchar      *key,
+                                               gsize             key_length);
+static guint list_lookup                      (const List       *list,
+                                               const gchar      *key,
+                                               guint             first,
+                                               guint             limit);
+static guint32 get_trigram                    (const gchar      *text);
+static guint get_filter_bit                   (guint32           trigram,
+                                               guint             hash,
+                                               guint             n_bits);
+static gboolean filter_contains               (const Filters    *filters,
+                                               guint             block,
+                                               const guint32    *trigrams,
+                                               guint             n_trigrams);
+static gint compare_trigrams                  (gconstpointer     a,
+                                               gconstpointer     b);
+static GByteArray* build_filters              (GArray           *records,
+                                               gdouble           false_positive_rate);
+static GByteArray* build_partitions           (GArray           *records,
+                                               guint             n_projects);
+static void list_writer_init                  (ListWriter       *writer);
+static void list_writer_add                   (ListWriter       *writer,
+                                               const gchar      *key,
+                                               const guint32    *ids,
+                                               guint             n_ids,
+                                               const gchar      *value);
+static void list_writer_flush                 (ListWriter       *writer);
+static GByteArray* list_writer_finish         (ListWriter       *writer);
+static gint compare_strings                   (gconstpointer     a,
+                                               gconstpointer     b);
+static gint compare_records                   (gconstpointer     a,
+                                               gconstpointer     b);
+
+#define FILE_SEARCH_IMAGE_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_IMAGE_TYPE, FileSearchImagePrivate))
+
+typedef struct _FileSearchImagePrivate FileSearchImagePrivate;
+
+struct _FileSearchImagePrivate
+{
+  GMappedFile  *mapped_file;
+  const gchar  *data;
+  gsize         length;
+  const Header *header;
+  GPtrArray    *projects;
+  const guint32 *partitions;
+  List          dirs;
+  List          entries;
+  Filters       filters;
+  gsize         memory_budget;
+  gint         *stamps;
+  gint          clock;
+  FileSearchImage *overlay;
+  guint8       *removed;
+  guint64       generation;
+};
+
+G_DEFINE_TYPE (FileSearchImage, file_search_image, G_TYPE_OBJECT)
+
+static void
+file_search_image_class_init (FileSearchImageClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = (GObjectFinalizeFunc) file_search_image_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchImagePrivate));
+}
+
+static void
+file_search_image_init (FileSearchImage *image)
+{
+  FileSearchImagePrivate *priv;
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+  priv->mapped_file = NULL;
+  priv->data = NULL;
+  priv->length = 0;
+  priv->header = NULL;
+  priv->projects = g_ptr_array_new ();
+  priv->partitions = NULL;
+  memset (&priv->dirs, 0, sizeof (List));
+  memset (&priv->entries, 0, sizeof (List));
+  memset (&priv->filters, 0, sizeof (Filters));
+  priv->memory_budget = 0;
+  priv->stamps = NULL;
+  priv->clock = 0;
+  priv->overlay = NULL;
+  priv->removed = NULL;
+  priv->generation = 0;
+}
+
+static void
+file_search_image_finalize (FileSearchImage *image)
+{
+  FileSearchImagePrivate *priv;
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+  g_ptr_array_free (priv->projects, TRUE);
+  g_free (priv->stamps);
+  g_free (priv->removed);
+  if (priv->overlay != NULL)
+    g_object_unref (priv->overlay);
+  if (priv->mapped_file)
+    g_mapped_file_unref (priv->mapped_file);
+  G_OBJECT_CLASS (file_search_image_parent_class)->finalize (G_OBJECT (image));
+}
+
+GQuark
+file_search_image_error_quark (void)
+{
+  return g_quark_from_static_string ("file-search-image-error-quark");
+}
+
+FileSearchImage*
+file_search_image_new_from_file (const gchar  *file_path,
+                                 GError      **error)
+{
+  GMappedFile *mapped_file;
+
+  mapped_file = g_mapped_file_new (file_path, FALSE, error);
+  if (mapped_file == NULL)
+    return NULL;
+
+  return new_from_mapped_file (mapped_file, error);
+}
+
+/*
+ * The fd is only needed while mapping, the caller keeps ownership of it.
+ */
+FileSearchImage*
+file_search_image_new_from_fd (gint     fd,
+                               GError **error)
+{
+  GMappedFile *mapped_file;
+
+  mapped_file = g_mapped_file_new_from_fd (fd, FALSE, error);
+  if (mapped_file == NULL)
+    return NULL;
+
+  return new_from_mapped_file (mapped_file, error);
+}
+
+static FileSearchImage*
+new_from_mapped_file (GMappedFile  *mapped_file,
+                      GError      **error)
+{
+  FileSearchImagePrivate *priv;
+  FileSearchImage *image;
+
+  image = FILE_SEARCH_IMAGE (g_object_new (file_search_image_get_type (), NULL));
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  priv->mapped_file = mapped_file;
+  priv->data = g_mapped_file_get_contents (mapped_file);
+  priv->length = g_mapped_file_get_length (mapped_file);
+
+  if (!validate (image, error))
+    {
+      g_object_unref (image);
+      return NULL;
+    }
+
+  return image;
+}
+
+/*
+ * Only the structure is checked here, the records themselves are
+ * bounds checked as they are decoded so that loading stays cheap.
+ */
+static gboolean
+validate (FileSearchImage  *image,
+          GError          **error)
+{
+  FileSearchImagePrivate *priv;
+  const Section *sections;
+  const Header *header;
+  gboolean has_projects = FALSE;
+  gboolean has_dirs = FALSE;
+  gboolean has_entries = FALSE;
+  gboolean has_filters = FALSE;
+  const guint32 *partitions = NULL;
+  guint64 partitions_length = 0;
+  guint32 i;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  if (priv->length < sizeof (Header) ||
+      memcmp (priv->data, FILE_SEARCH_IMAGE_MAGIC, sizeof (FILE_SEARCH_IMAGE_MAGIC)) != 0)
+    {
+      g_set_error (error, FILE_SEARCH_IMAGE_ERROR, FILE_SEARCH_IMAGE_ERROR_CORRUPT,
+                   "The file search index is not an index image.");
+      return FALSE;
+    }
+
+  header = (const Header *) priv->data;
+
+  if (header->version != FILE_SEARCH_IMAGE_VERSION)
+    {
+      g_set_error (error, FILE_SEARCH_IMAGE_ERROR, FILE_SEARCH_IMAGE_ERROR_VERSION,
+                   "The file search index has version %u, expected %u.",
+                   header->version, FILE_SEARCH_IMAGE_VERSION);
+      return FALSE;
+    }
+
+  if (header->n_sections > SECTIONS ||
+      sizeof (Header) + header->n_sections * sizeof (Section) > priv->length)
+    {
+      g_set_error (error, FILE_SEARCH_IMAGE_ERROR, FILE_SEARCH_IMAGE_ERROR_CORRUPT,
+                   "The file search index has a broken section table.");
+      return FALSE;
+    }
+
+  priv->header = header;
+  sections = (const Section *) (priv->data + sizeof (Header));
+
+  for (i = 0; i < header->n_sections; i++)
+    {
+      const Section *section = &sections[i];
+      const gchar *data;
+      gboolean valid = TRUE;
+
+      if (section->offset > priv->length ||
+          section->length > priv->length - section->offset ||
+          section->offset % 8 != 0)
+        {
+          g_set_error (error, FILE_SEARCH_IMAGE_ERROR, FILE_SEARCH_IMAGE_ERROR_CORRUPT,
+                       "The file search index section %u is out of bounds.", section->id);
+          return FALSE;
+        }
+
+      data = priv->data + section->offset;
+
+      switch (section->id)
+        {
+        case SECTION_PROJECTS:
+          valid = !has_projects && validate_projects (image, data, section->length);
+          has_projects = TRUE;
+          break;
+        case SECTION_DIRS:
+          valid = !has_dirs && validate_list (&priv->dirs, (const guint8 *) data,
+                                              section->length, 0, FALSE);
+          has_dirs = TRUE;
+          break;
+        case SECTION_ENTRIES:
+          valid = !has_entries && validate_list (&priv->entries, (const guint8 *) data,
+                                                 section->length, MAX_IDS, TRUE);
+          has_entries = TRUE;
+          break;
+        case SECTION_FILTERS:
+          valid = !has_filters && validate_filters (&priv->filters, (const guint8 *) data,
+                                                    section->length);
+          has_filters = TRUE;
+          break;
+        case SECTION_PARTITIONS:
+          /* checked against the projects and entries once both are known */
+          valid = partitions == NULL;
+          partitions = (const guint32 *) data;
+          partitions_length = section->length;
+          break;
+        }
+
+      if (!valid)
+        {
+          g_set_error (error, FILE_SEARCH_IMAGE_ERROR, FILE_SEARCH_IMAGE_ERROR_CORRUPT,
+                       "The file search index section %u is broken.", section->id);
+          return FALSE;
+        }
+    }
+
+  if (!has_projects || !has_dirs || !has_entries || partitions == NULL ||
+      !validate_partitions (image, partitions, partitions_length) ||
+      priv->entries.n_items != header->n_entries ||
+      (has_filters && priv->filters.n_blocks != priv->entries.n_blocks))
+    {
+      g_set_error (error, FILE_SEARCH_IMAGE_ERROR, FILE_SEARCH_IMAGE_ERROR_CORRUPT,
+                   "The file search index is missing sections.");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+validate_list (List         *list,
+               const guint8 *data,
+               guint64       length,
+               guint         n_ids,
+               gboolean      has_values)
+{
+  const ListHeader *header;
+  guint64 table_length;
+  guint64 blocks_length;
+  guint32 i;
+
+  if (length < sizeof (ListHeader))
+    return FALSE;
+
+  header = (const ListHeader *) data;
+
+  if (header->block_size == 0 || header->restart_interval == 0 ||
+      header->block_size % header->restart_interval != 0 ||
+      header->n_blocks != (header->n_items + header->block_size - 1) / header->block_size)
+    return FALSE;
+
+  table_length = ((guint64) header->n_blocks + 1) * sizeof (guint32);
+  if (table_length > length - sizeof (ListHeader))
+    return FALSE;
+
+  list->n_items = header->n_items;
+  list->n_blocks = header->n_blocks;
+  list->block_size = header->block_size;
+  list->restart_interval = header->restart_interval;
+  list->n_ids = n_ids;
+  list->has_values = has_values;
+  list->block_offsets = (const guint32 *) (data + sizeof (ListHeader));
+  list->blocks = data + sizeof (ListHeader) + table_length;
+
+  blocks_length = length - sizeof (ListHeader) - table_length;
+
+  if (list->block_offsets[0] != 0 || list->block_offsets[list->n_blocks] > blocks_length)
+    return FALSE;
+
+  /* every block has to hold at least its restart table */
+  for (i = 0; i < list->n_blocks; i++)
+    {
+      guint32 n_restarts = list->block_size / list->restart_interval;
+      guint32 start = list->block_offsets[i];
+      guint32 end = list->block_offsets[i + 1];
+
+      if (start % sizeof (guint32) != 0 || end < start ||
+          end - start < n_restarts * sizeof (guint32))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * The filters are optional, without them every block is decoded.
+ */
+static gboolean
+validate_filters (Filters      *filters,
+                  const guint8 *data,
+                  guint64       length)
+{
+  const FilterHeader *header;
+  guint64 table_length;
+  guint64 n_words;
+  guint32 i;
+
+  if (length < sizeof (FilterHeader))
+    return FALSE;
+
+  header = (const FilterHeader *) data;
+
+  if (header->n_hashes == 0 || header->n_hashes > 16)
+    return FALSE;
+
+  table_length = (((guint64) header->n_blocks + 1) * sizeof (guint32) + 7) & ~7;
+  if (table_length > length - sizeof (FilterHeader))
+    return FALSE;
+
+  filters->n_blocks = header->n_blocks;
+  filters->n_hashes = header->n_hashes;
+  filters->offsets = (const guint32 *) (data + sizeof (FilterHeader));
+  filters->words = (const guint64 *) (data + sizeof (FilterHeader) + table_length);
+
+  n_words = (length - sizeof (FilterHeader) - table_length) / sizeof (guint64);
+
+  if (filters->offsets[0] != 0 || filters->offsets[filters->n_blocks] > n_words)
+    return FALSE;
+
+  for (i = 0; i < filters->n_blocks; i++)
+    {
+      if (filters->offsets[i + 1] <= filters->offsets[i])
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+validate_projects (FileSearchImage *image,
+                   const gchar     *data,
+                   guint64          length)
+{
+  FileSearchImagePrivate *priv;
+  const gchar *end = data + length;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  if (length == 0 || data[length - 1] != '\0')
+    return FALSE;
+
+  /* there are only a handful of projects so resolve them up front */
+  while (data < end)
+    {
+      g_ptr_array_add (priv->projects, (gpointer) data);
+      data += strlen (data) + 1;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+validate_partitions (FileSearchImage *image,
+                     const guint32   *data,
+                     guint64          length)
+{
+  FileSearchImagePrivate *priv;
+  guint i;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  if (length != (priv->projects->len + 1) * sizeof (guint32) ||
+      data[0] != 0 || data[priv->projects->len] != priv->entries.n_items)
+    return FALSE;
+
+  for (i = 0; i < priv->projects->len; i++)
+    {
+      if (data[i + 1] < data[i])
+        return FALSE;
+    }
+
+  priv->partitions = data;
+
+  return TRUE;
+}
+
+guint64
+file_search_image_get_generation (FileSearchImage *image)
+{
+  FileSearchImagePrivate *priv;
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+  return priv->generation != 0 ? priv->generation : priv->header->generation;
+}
+
+/*
+ * Lays the updates of the log over the image, before it is handed to 
+ * any reader. removed is a bitmap over the entries, which the image
+ * takes over, overlay holds the files added and may be NULL. The image
+ * then reports the generation of the log.
+ */
+void
+file_search_image_set_overlay (FileSearchImage *image,
+                               FileSearchImage *overlay,
+                               guint8          *removed,
+                               guint64          generation)
+{
+  FileSearchImagePrivate *priv;
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+  
+  g_free (priv->removed);
+  if (priv->overlay != NULL)
+    g_object_unref (priv->overlay);
+  
+  priv->overlay = overlay != NULL ? g_object_ref (overlay) : NULL;
+  priv->removed = removed;
+  priv->generation = generation;
+}
+
+/* 
+ * The overlay entries come after the entries of the image, so entry n
+ * of the overlay is file_search_image_get_n_entries() + n to the caller.
+ */
+FileSearchImage*
+file_search_image_get_overlay (FileSearchImage *image)
+{
+  return FILE_SEARCH_IMAGE_GET_PRIVATE (image)->overlay;
+}
+
+/*
+ * Finds the entry of the file path, without the overlay. The entries
+ * with the same folded name sit together in each partition, so only 
+ * those are compared. Returns FALSE when the path is not in the image.
+ */
+gboolean
+file_search_image_lookup (FileSearchImage *image,
+                          const gchar     *file_path,
+                          guint           *entry,
+                          guint           *project)
+{
+  FileSearchImagePrivate *priv;
+  FileSearchImageCursor cursor;
+  const gchar *file_name;
+  gchar key[FILE_SEARCH_IMAGE_KEY_MAX];
+  gsize key_length;
+  gsize length;
+  guint p;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  file_name = strrchr (file_path, G_DIR_SEPARATOR);
+  file_name = file_name != NULL ? file_name + 1 : file_path;
+  length = strlen (file_name);
+  if (length >= FILE_SEARCH_IMAGE_KEY_MAX)
+    return FALSE;
+  
+  key_length = file_search_fold (file_name, length, key, sizeof (key));
+  if (key_length >= FILE_SEARCH_IMAGE_KEY_MAX)
+    return FALSE;
+
+  for (p = 0; p < priv->projects->len; p++)
+    {
+      guint first;
+      guint limit;
+
+      if (!get_partition_run (image, p, key, key_length, &first, &limit))
+        continue;
+
+      file_search_image_cursor_init (image, &cursor, first);
+      cursor.limit = limit;
+
+      while (cursor_next_entry (&cursor) && cursor.key_length == key_length)
+        {
+          gchar *path;
+          gboolean found;
+          
+          path = file_search_image_cursor_get_file_path (&cursor);
+          found = path != NULL && strcmp (path, file_path) == 0;
+          g_free (path);
+          
+          if (found)
+            {
+              *entry = cursor.entry;
+              *project = cursor.project;
+              return TRUE;
+            }
+        }
+    }
+
+  return FALSE;
+}
+
+gboolean
+file_search_image_is_relative (FileSearchImage *image)
+{
+  return (FILE_SEARCH_IMAGE_GET_PRIVATE (image)->header->flags & FILE_SEARCH_IMAGE_RELATIVE) != 0;
+}
+
+guint
+file_search_image_get_n_entries (FileSearchImage *image)
+{
+  return FILE_SEARCH_IMAGE_GET_PRIVATE (image)->header->n_entries;
+}
+
+guint
+file_search_image_get_n_projects (FileSearchImage *image)
+{
+  return FILE_SEARCH_IMAGE_GET_PRIVATE (image)->projects->len;
+}
+
+/*
+ * Project ids follow the order of the project keys, the empty key of the
+ * entries without a project is always there.
+ */
+const gchar*
+file_search_image_get_project_key (FileSearchImage *image,
+                                   guint            project)
+{
+  FileSearchImagePrivate *priv;
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+  g_return_val_if_fail (project < priv->projects->len, NULL);
+  return g_ptr_array_index (priv->projects, project);
+}
+
+/*
+ * Positions the cursor so that the next call to
+ * file_search_image_cursor_next() returns the given entry. The cursor
+ * walks on through the rest of the entries, whatever their project.
+ */
+void
+file_search_image_cursor_init (FileSearchImage       *image,
+                               FileSearchImageCursor *cursor,
+                               guint                  entry)
+{
+  FileSearchImagePrivate *priv;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  cursor->image = image;
+  cursor->entry = entry;
+  cursor->limit = priv->entries.n_items;
+  cursor->n_trigrams = 0;
+  cursor->n_skipped = 0;
+  cursor->length = 0;
+  cursor->file_name[0] = '\0';
+  cursor->scope = NULL;
+  cursor->next_project = priv->projects->len;
+  cursor->prefix_length = 0;
+  cursor->prefix[0] = '\0';
+
+  cursor_seek (cursor, entry);
+}
+
+/*
+ * Limits the cursor to the entries that can match the glob pattern: in 
+ * every partition of the scope the run of keys starting with its literal
+ * prefix, minus the blocks whose filters lack a trigram of its literal 
+ * parts. The pattern has to be folded already, whatever it is matched 
+ * against afterwards. The scope is a bitmap over the project ids that 
+ * has to outlive the cursor, or NULL for all of the projects.
+ */
+void
+file_search_image_cursor_init_pattern (FileSearchImage       *image,
+                                       FileSearchImageCursor *cursor,
+                                       const gchar           *pattern,
+                                       const guint8          *scope)
+{
+  FileSearchImagePrivate *priv;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  file_search_image_cursor_init (image, cursor, priv->entries.n_items);
+
+  cursor->scope = scope;
+  cursor->next_project = 0;
+  cursor->prefix_length = MIN (strcspn (pattern, "*?"), FILE_SEARCH_IMAGE_KEY_MAX - 1);
+  memcpy (cursor->prefix, pattern, cursor->prefix_length);
+  cursor->prefix[cursor->prefix_length] = '\0';
+
+  cursor_set_trigrams (cursor, pattern);
+}
+
+/*
+ * The runs of entries that file_search_image_cursor_init_pattern() would
+ * walk, one per partition of the scope that has any, so that the caller 
+ * can split the work up. The array holds FileSearchImageRun items.
+ */
+GArray*
+file_search_image_get_runs (FileSearchImage *image,
+                            const gchar     *pattern,
+                            const guint8    *scope)
+{
+  FileSearchImagePrivate *priv;
+  GArray *runs;
+  gsize prefix_length;
+  guint project;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  runs = g_array_new (FALSE, FALSE, sizeof (FileSearchImageRun));
+  prefix_length = MIN (strcspn (pattern, "*?"), FILE_SEARCH_IMAGE_KEY_MAX - 1);
+
+  for (project = 0; project < priv->projects->len; project++)
+    {
+      FileSearchImageRun run;
+
+      if (scope != NULL && (scope[project / 8] & (1 << (project % 8))) == 0)
+        continue;
+
+      if (get_partition_run (image, project, pattern, prefix_length, 
+                             &run.first, &run.limit))
+        g_array_append_val (runs, run);
+    }
+
+  return runs;
+}
+
+/*
+ * Limits the cursor to the entries from first up to limit, one of the
+ * runs of file_search_image_get_runs() or a piece of one, minus the 
+ * blocks whose filters lack a trigram of the pattern. Cursors over 
+ * different runs can be walked on different threads at the same time.
+ */
+void
+file_search_image_cursor_init_run (FileSearchImage       *image,
+                                   FileSearchImageCursor *cursor,
+                                   const gchar           *pattern,
+                                   guint                  first,
+                                   guint                  limit)
+{
+  file_search_image_cursor_init (image, cursor, first);
+  cursor->limit = MIN (limit, cursor->limit);
+  cursor_set_trigrams (cursor, pattern);
+}
+
+static void
+cursor_set_trigrams (FileSearchImageCursor *cursor,
+                     const gchar           *pattern)
+{
+  FileSearchImagePrivate *priv;
+  const gchar *literal;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (cursor->image);
+
+  if (priv->filters.n_blocks == 0)
+    return;
+
+  for (literal = pattern; *literal != '\0'; literal++)
+    {
+      if (cursor->n_trigrams == FILE_SEARCH_IMAGE_MAX_TRIGRAMS)
+        break;
+      if (literal[0] != '*' && literal[0] != '?' && literal[1] != '\0' && 
+          literal[1] != '*' && literal[1] != '?' && literal[2] != '\0' && 
+          literal[2] != '*' && literal[2] != '?')
+        cursor->trigrams[cursor->n_trigrams++] = get_trigram (literal);
+    }
+}
+
+static gboolean
+cursor_seek (FileSearchImageCursor *cursor,
+             guint                  entry)
+{
+  FileSearchImagePrivate *priv;
+  ListCursor list_cursor;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (cursor->image);
+
+  cursor->next = entry;
+  cursor->block = G_MAXUINT;
+  cursor->key_length = 0;
+  cursor->key[0] = '\0';
+  cursor->same_key = FALSE;
+  cursor->same_name = FALSE;
+  cursor->p = NULL;
+  cursor->end = NULL;
+  cursor->decoded = FALSE;
+
+  if (entry >= priv->entries.n_items)
+    return FALSE;
+
+  if (!list_seek (&list_cursor, &priv->entries, entry, cursor->key))
+    {
+      cursor->next = cursor->limit;
+      return FALSE;
+    }
+
+  cursor->key_length = list_cursor.length;
+  cursor->p = list_cursor.p;
+  cursor->end = list_cursor.end;
+
+  return TRUE;
+}
+
+/*
+ * Moves the cursor on to the run of prefixed keys in the next partition
+ * of its scope. Returns FALSE when there is none left.
+ */
+static gboolean
+cursor_next_partition (FileSearchImageCursor *cursor)
+{
+  FileSearchImagePrivate *priv;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (cursor->image);
+
+  while (cursor->next_project < priv->projects->len)
+    {
+      guint project = cursor->next_project++;
+      guint first;
+      guint limit;
+
+      if (cursor->scope != NULL && 
+          (cursor->scope[project / 8] & (1 << (project % 8))) == 0)
+        continue;
+
+      if (!get_partition_run (cursor->image, project, cursor->prefix, 
+                              cursor->prefix_length, &first, &limit))
+        continue;
+
+      cursor->limit = limit;
+      if (cursor_seek (cursor, first))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/*
+ * Finds the run of keys starting with the prefix within the partition 
+ * of the project. Returns FALSE when the run is empty.
+ */
+static gboolean
+get_partition_run (FileSearchImage *image,
+                   guint            project,
+                   const gchar     *prefix,
+                   gsize            prefix_length,
+                   guint           *first,
+                   guint           *limit)
+{
+  FileSearchImagePrivate *priv;
+  gchar key[FILE_SEARCH_IMAGE_KEY_MAX];
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  *first = priv->partitions[project];
+  *limit = priv->partitions[project + 1];
+
+  if (*first == *limit)
+    return FALSE;
+
+  memcpy (key, prefix, prefix_length);
+  key[prefix_length] = '\0';
+
+  *first = list_lookup (&priv->entries, key, *first, *limit);
+
+  /* the first key past the prefix is the prefix with its last byte bumped */
+  while (prefix_length > 0 && (guchar) key[prefix_length - 1] == 0xff)
+    prefix_length--;
+  if (prefix_length > 0)
+    {
+      key[prefix_length - 1]++;
+      key[prefix_length] = '\0';
+      *limit = list_lookup (&priv->entries, key, *first, *limit);
+    }
+
+  return *first < *limit;
+}
+
+/*
+ * Decodes the next entry into the cursor. Returns FALSE at the end of
+ * the image, or if the image turns out to be corrupt. The entries the
+ * log removed are passed over, the overlay is walked on its own.
+ */
+gboolean
+file_search_image_cursor_next (FileSearchImageCursor *cursor)
+{
+  FileSearchImagePrivate *priv;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (cursor->image);
+
+  while (cursor_next_entry (cursor))
+    {
+      if (priv->removed == NULL || 
+          (priv->removed[cursor->entry / 8] & (1 << (cursor->entry % 8))) == 0)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+cursor_next_entry (FileSearchImageCursor *cursor)
+{
+  FileSearchImagePrivate *priv;
+  ListCursor list_cursor;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (cursor->image);
+
+  for (;;)
+    {
+      /* the filters are checked once per block as the cursor enters it */
+      while (cursor->n_trigrams > 0 && cursor->next < cursor->limit &&
+             cursor->next / priv->entries.block_size != cursor->block)
+        {
+          cursor->block = cursor->next / priv->entries.block_size;
+          if (filter_contains (&priv->filters, cursor->block, 
+                               cursor->trigrams, cursor->n_trigrams))
+            break;
+          cursor->next = (cursor->block + 1) * priv->entries.block_size;
+          cursor->n_skipped++;
+        }
+
+      if (cursor->next < cursor->limit)
+        break;
+
+      if (!cursor_next_partition (cursor))
+        return FALSE;
+    }
+
+  list_cursor.list = &priv->entries;
+  list_cursor.item = cursor->next;
+  list_cursor.p = cursor->p;
+  list_cursor.end = cursor->end;
+  list_cursor.key = cursor->key;
+  list_cursor.length = cursor->key_length;
+  list_cursor.value = NULL;
+  list_cursor.value_length = 0;
+  list_cursor.same_key = FALSE;
+
+  if (!list_next (&list_cursor) ||
+      list_cursor.ids[0] >= priv->dirs.n_items ||
+      list_cursor.ids[1] >= priv->projects->len)
+    {
+      cursor->next = priv->entries.n_items;
+      cursor->next_project = priv->projects->len;
+      return FALSE;
+    }
+
+  cursor->entry = cursor->next;
+  cursor->next = list_cursor.item;
+  cursor->key_length = list_cursor.length;
+  cursor->p = list_cursor.p;
+  cursor->end = list_cursor.end;
+  cursor->dir = list_cursor.ids[0];
+  cursor->project = list_cursor.ids[1];
+
+  /* 
+   * Repeats are only told apart within a block, the first entry of each
+   * counts as a new name. The file name only needs comparing when it is
+   * stored apart from the key, and a repeated one is already in place.
+   */
+  cursor->same_key = cursor->decoded && list_cursor.same_key;
+
+  if (list_cursor.value_length > 0)
+    {
+      cursor->same_name = cursor->same_key && cursor->has_value &&
+                          cursor->length == list_cursor.value_length &&
+                          memcmp (cursor->file_name, list_cursor.value, cursor->length) == 0;
+      cursor->has_value = TRUE;
+      if (!cursor->same_name)
+        {
+          memcpy (cursor->file_name, list_cursor.value, list_cursor.value_length);
+          cursor->length = list_cursor.value_length;
+        }
+    }
+  else
+    {
+      cursor->same_name = cursor->same_key && !cursor->has_value;
+      cursor->has_value = FALSE;
+      if (!cursor->same_name)
+        {
+          memcpy (cursor->file_name, cursor->key, cursor->key_length);
+          cursor->length = cursor->key_length;
+        }
+    }
+  cursor->file_name[cursor->length] = '\0';
+  cursor->decoded = TRUE;
+
+  return TRUE;
+}
+
+gchar*
+file_search_image_cursor_get_file_path (FileSearchImageCursor *cursor)
+{
+  gchar dir[FILE_SEARCH_IMAGE_KEY_MAX];
+
+  if (!file_search_image_get_dir (cursor->image, cursor->dir, dir))
+    return NULL;
+
+  return g_build_filename (dir, cursor->file_name, NULL);
+}
+
+const gchar*
+file_search_image_cursor_get_project_key (FileSearchImageCursor *cursor)
+{
+  FileSearchImagePrivate *priv;
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (cursor->image);
+  return g_ptr_array_index (priv->projects, cursor->project);
+}
+
+/*
+ * Copies the directory path into the buffer, which has to hold
+ * FILE_SEARCH_IMAGE_KEY_MAX bytes.
+ */
+gboolean
+file_search_image_get_dir (FileSearchImage *image,
+                           guint            dir,
+                           gchar           *buffer)
+{
+  FileSearchImagePrivate *priv;
+  ListCursor cursor;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  if (dir >= priv->dirs.n_items)
+    return FALSE;
+
+  return list_seek (&cursor, &priv->dirs, dir, buffer) && list_next (&cursor);
+}
+
+/*
+ * Caps how much of the image is kept in memory. The filters, the tables
+ * and the project keys stay resident, the blocks of the entries and the
+ * directories are tracked in shards and file_search_image_trim() drops 
+ * the least recently used ones until the budget holds. A dropped shard 
+ * is read back in from the page cache or the disk when used again. A 
+ * budget of 0 leaves it all to the kernel.
+ *
+ * Has to be called before the image is handed to other threads.
+ */
+void
+file_search_image_set_memory_budget (FileSearchImage *image,
+                                     gsize            memory_budget)
+{
+  FileSearchImagePrivate *priv;
+  guint n_shards;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  priv->memory_budget = memory_budget;
+
+  if (memory_budget == 0 || priv->stamps != NULL)
+    return;
+
+  n_shards = list_n_shards (&priv->entries) + list_n_shards (&priv->dirs);
+  priv->stamps = g_new0 (gint, MAX (n_shards, 1));
+
+  priv->entries.stamps = priv->stamps;
+  priv->entries.clock = &priv->clock;
+  priv->dirs.stamps = priv->stamps + list_n_shards (&priv->entries);
+  priv->dirs.clock = &priv->clock;
+
+  /* the directories are only read a few at a time for the results */
+  if (priv->dirs.n_blocks > 0)
+    {
+      const guint8 *start = priv->dirs.blocks;
+      const guint8 *end = priv->dirs.blocks + priv->dirs.block_offsets[priv->dirs.n_blocks];
+      guintptr page_size = sysconf (_SC_PAGESIZE);
+      guintptr aligned = (guintptr) start & ~(page_size - 1);
+      madvise ((gpointer) aligned, end - (const guint8 *) aligned, MADV_RANDOM);
+    }
+}
+
+/*
+ * Asks the kernel to read the entries in ahead, so that the first search
+ * does not fault them in a page at a time. Within a memory budget only 
+ * as much as the budget holds is read. The reads are issued by the 
+ * calling thread, at its priority.
+ */
+void
+file_search_image_warm (FileSearchImage *image)
+{
+  FileSearchImagePrivate *priv;
+  const guint8 *start;
+  const guint8 *end;
+  guintptr page_size;
+  guintptr aligned;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  if (priv->entries.n_blocks == 0)
+    return;
+
+  start = priv->entries.blocks;
+  end = priv->entries.blocks + priv->entries.block_offsets[priv->entries.n_blocks];
+  if (priv->memory_budget > 0 && (gsize) (end - start) > priv->memory_budget)
+    end = start + priv->memory_budget;
+
+  page_size = sysconf (_SC_PAGESIZE);
+  aligned = (guintptr) start & ~(page_size - 1);
+  madvise ((gpointer) aligned, end - (const guint8 *) aligned, MADV_WILLNEED);
+}
+
+/*
+ * Drops the least recently used shards until the image fits its memory
+ * budget and returns the number of bytes dropped. Only an estimate of 
+ * what is resident is kept: a shard counts from its first use until it
+ * is dropped. Safe to call while other threads read the image, they 
+ * just fault the pages back in.
+ */
+gsize
+file_search_image_trim (FileSearchImage *image)
+{
+  FileSearchImagePrivate *priv;
+  guint n_entry_shards;
+  guint n_shards;
+  gsize resident;
+  gsize released = 0;
+  guint i;
+
+  priv = FILE_SEARCH_IMAGE_GET_PRIVATE (image);
+
+  if (priv->memory_budget == 0 || priv->stamps == NULL)
+    return 0;
+
+  n_entry_shards = list_n_shards (&priv->entries);
+  n_shards = n_entry_shards + list_n_shards (&priv->dirs);
+
+  /* everything outside the blocks of the lists is always resident */
+  resident = priv->length - 
+             priv->entries.block_offsets[priv->entries.n_blocks] - 
+             priv->dirs.block_offsets[priv->dirs.n_blocks];
+
+  for (i = 0; i < n_shards; i++)
+    {
+      if (g_atomic_int_get (&priv->stamps[i]) == 0)
+        continue;
+      if (i < n_entry_shards)
+        resident += list_get_shard_length (&priv->entries, i);
+      else
+        resident += list_get_shard_length (&priv->dirs, i - n_entry_shards);
+    }
+
+  while (resident > priv->memory_budget)
+    {
+      guint oldest = G_MAXUINT;
+      gint oldest_stamp = G_MAXINT;
+      gsize length;
+
+      for (i = 0; i < n_shards; i++)
+        {
+          gint stamp = g_atomic_int_get (&priv->stamps[i]);
+          if (stamp != 0 && stamp < oldest_stamp)
+            {
+              oldest = i;
+              oldest_stamp = stamp;
+            }
+        }
+
+      if (oldest == G_MAXUINT)
+        break;
+
+      g_atomic_int_set (&priv->stamps[oldest], 0);
+
+      if (oldest < n_entry_shards)
+        length = list_release_shard (&priv->entries, oldest);
+      else
+        length = list_release_shard (&priv->dirs, oldest - n_entry_shards);
+
+      resident -= MIN (length, resident);
+      released += length;
+    }
+
+  return released;
+}
+
+/*
+ * Starts at the restart point in front of the item and decodes up to
+ * it, so the next call to list_next() returns the item itself.
+ */
+static gboolean
+list_seek (ListCursor *cursor,
+           const List *list,
+           guint       item,
+           gchar      *key)
+{
+  const guint8 *block;
+  const guint32 *restarts;
+  guint block_index;
+  guint restart;
+
+  block_index = item / list->block_size;
+  restart = (item % list->block_size) / list->restart_interval;
+
+  list_touch (list, block_index);
+
+  block = list->blocks + list->block_offsets[block_index];
+  restarts = (const guint32 *) block;
+
+  cursor->list = list;
+  cursor->item = block_index * list->block_size + restart * list->restart_interval;
+  cursor->end = list->blocks + list->block_offsets[block_index + 1];
+  cursor->p = block + restarts[restart];
+  cursor->key = key;
+  cursor->length = 0;
+  cursor->value = NULL;
+  cursor->value_length = 0;
+  cursor->same_key = FALSE;
+  key[0] = '\0';
+
+  if (cursor->p > cursor->end)
+    return FALSE;
+
+  while (cursor->item < item)
+    {
+      if (!list_next (cursor))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+list_next (ListCursor *cursor)
+{
+  const List *list = cursor->list;
+  guint32 shared;
+  guint32 suffix;
+  guint i;
+
+  if (cursor->item >= list->n_items)
+    return FALSE;
+
+  /* the first record of a block follows its restart table */
+  if (cursor->item % list->block_size == 0)
+    {
+      guint block_index = cursor->item / list->block_size;
+      list_touch (list, block_index);
+      cursor->p = list->blocks + list->block_offsets[block_index] +
+                  (list->block_size / list->restart_interval) * sizeof (guint32);
+      cursor->end = list->blocks + list->block_offsets[block_index + 1];
+      cursor->length = 0;
+    }
+
+  if (!file_search_varint_read (&cursor->p, cursor->end, &shared) ||
+      !file_search_varint_read (&cursor->p, cursor->end, &suffix) ||
+      shared > cursor->length ||
+      suffix >= FILE_SEARCH_IMAGE_KEY_MAX - shared ||
+      suffix > (gsize) (cursor->end - cursor->p))
+    return FALSE;
+
+  /* a restart stores the whole key again, so the suffix is compared too */
+  cursor->same_key = shared + suffix == cursor->length &&
+                     memcmp (cursor->key + shared, cursor->p, suffix) == 0;
+
+  memcpy (cursor->key + shared, cursor->p, suffix);
+  cursor->length = shared + suffix;
+  cursor->key[cursor->length] = '\0';
+  cursor->p += suffix;
+
+  for (i = 0; i < list->n_ids; i++)
+    {
+      if (!file_search_varint_read (&cursor->p, cursor->end, &cursor->ids[i]))
+        return FALSE;
+    }
+
+  if (list->has_values)
+    {
+      guint32 value_length;
+      if (!file_search_varint_read (&cursor->p, cursor->end, &value_length) ||
+          value_length >= FILE_SEARCH_IMAGE_KEY_MAX ||
+          value_length > (gsize) (cursor->end - cursor->p))
+        return FALSE;
+      cursor->value = (const gchar *) cursor->p;
+      cursor->value_length = value_length;
+      cursor->p += value_length;
+    }
+
+  cursor->item++;
+
+  return TRUE;
+}
+
+/*
+ * Stamps the shard of the block with the time it was last used.
+ */
+static void
+list_touch (const List *list,
+            guint       block_index)
+{
+  if (list->stamps != NULL)
+    g_atomic_int_set (&list->stamps[block_index / SHARD_BLOCKS], 
+                      g_atomic_int_add (list->clock, 1) + 1);
+}
+
+static guint
+list_n_shards (const List *list)
+{
+  return (list->n_blocks + SHARD_BLOCKS - 1) / SHARD_BLOCKS;
+}
+
+static gsize
+list_get_shard_length (const List *list,
+                       guint       shard)
+{
+  guint first = shard * SHARD_BLOCKS;
+  guint last = MIN (first + SHARD_BLOCKS, list->n_blocks);
+  return list->block_offsets[last] - list->block_offsets[first];
+}
+
+/*
+ * Only the pages that lie wholly inside the shard are dropped, the ones
+ * it shares with its neighbours stay. The mapping is never written, so 
+ * dropping its pages loses nothing.
+ */
+static gsize
+list_release_shard (const List *list,
+                    guint       shard)
+{
+  guint first = shard * SHARD_BLOCKS;
+  guint last = MIN (first + SHARD_BLOCKS, list->n_blocks);
+  guintptr page_size = sysconf (_SC_PAGESIZE);
+  guintptr start = (guintptr) (list->blocks + list->block_offsets[first]);
+  guintptr end = (guintptr) (list->blocks + list->block_offsets[last]);
+
+  start = (start + page_size - 1) & ~(page_size - 1);
+  end = end & ~(page_size - 1);
+
+  if (end <= start)
+    return 0;
+
+  madvise ((gpointer) start, end - start, MADV_DONTNEED);
+
+  return end - start;
+}
+
+/*
+ * Compares the full key stored at a restart point with the given key,
+ * straight from the mapping. Restarts are numbered across all blocks.
+ */
+static gint
+list_compare_restart (const List  *list,
+                      guint        restart,
+                      const gchar *key,
+                      gsize        key_length)
+{
+  guint n_restarts = list->block_size / list->restart_interval;
+  const guint8 *block;
+  const guint8 *p;
+  const guint8 *end;
+  guint32 shared;
+  guint32 suffix;
+  gint result;
+
+  block = list->blocks + list->block_offsets[restart / n_restarts];
+  end = list->blocks + list->block_offsets[restart / n_restarts + 1];
+  p = block + ((const guint32 *) block)[restart % n_restarts];
+
+  /* a broken record sorts last so the search stays in bounds */
+  if (p > end || !file_search_varint_read (&p, end, &shared) ||
+      !file_search_varint_read (&p, end, &suffix) || suffix > (gsize) (end - p))
+    return 1;
+
+  result = memcmp (p, key, MIN (suffix, key_length));
+  if (result != 0)
+    return result;
+
+  return suffix < key_length ? -1 : (suffix > key_length ? 1 : 0);
+}
+
+/*
+ * Returns the first item of the sorted run [first, limit) whose key sorts
+ * at or after the key, so every key starting with a prefix is found in 
+ * one contiguous stretch. Items before first may sort anywhere.
+ */
+static guint
+list_lookup (const List  *list,
+             const gchar *key,
+             guint        first,
+             guint        limit)
+{
+  ListCursor cursor;
+  gchar buffer[FILE_SEARCH_IMAGE_KEY_MAX];
+  gsize key_length;
+  guint low;
+  guint high;
+
+  if (first >= limit)
+    return limit;
+
+  key_length = strlen (key);
+  low = first / list->restart_interval;
+  high = (limit + list->restart_interval - 1) / list->restart_interval;
+
+  /* find the last restart inside the run that sorts before the key */
+  while (high - low > 1)
+    {
+      guint middle = low + (high - low) / 2;
+      if (list_compare_restart (list, middle, key, key_length) < 0)
+        low = middle;
+      else
+        high = middle;
+    }
+
+  if (!list_seek (&cursor, list, MAX (low * list->restart_interval, first), buffer))
+    return limit;
+
+  while (cursor.item < limit)
+    {
+      guint item = cursor.item;
+      if (!list_next (&cursor))
+        return limit;
+      if (strcmp (buffer, key) >= 0)
+        return item;
+    }
+
+  return limit;
+}
+
+static guint32
+get_trigram (const gchar *text)
+{
+  return ((guint8) text[0] << 16) | ((guint8) text[1] << 8) | (guint8) text[2];
+}
+
+/*
+ * Double hashing, the hashes of a trigram all derive from one multiply.
+ */
+static guint
+get_filter_bit (guint32 trigram,
+                guint   hash,
+                guint   n_bits)
+{
+  guint64 x = (trigram + 1) * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+  guint32 h1 = x >> 32;
+  guint32 h2 = (guint32) x | 1;
+  return (h1 + hash * h2) % n_bits;
+}
+
+static gboolean
+filter_contains (const Filters *filters,
+                 guint          block,
+                 const guint32 *trigrams,
+                 guint          n_trigrams)
+{
+  const guint64 *words;
+  guint n_bits;
+  guint i;
+  guint j;
+
+  words = filters->words + filters->offsets[block];
+  n_bits = (filters->offsets[block + 1] - filters->offsets[block]) * 64;
+
+  for (i = 0; i < n_trigrams; i++)
+    {
+      for (j = 0; j < filters->n_hashes; j++)
+        {
+          guint bit = get_filter_bit (trigrams[i], j, n_bits);
+          if ((words[bit / 64] & (G_GUINT64_CONSTANT (1) << (bit % 64))) == 0)
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static gint
+compare_trigrams (gconstpointer a,
+                  gconstpointer b)
+{
+  guint32 trigram_a = *(const guint32 *) a;
+  guint32 trigram_b = *(const guint32 *) b;
+  return trigram_a < trigram_b ? -1 : (trigram_a > trigram_b ? 1 : 0);
+}
+
+/*
+ * One filter per block of entries. Every filter is sized for the distinct
+ * trigrams in its block, so the false positive rate is the same for all.
+ */
+static GByteArray*
+build_filters (GArray  *records,
+               gdouble  false_positive_rate)
+{
+  GByteArray *filters;
+  GArray *offsets;
+  GArray *words;
+  GArray *trigrams;
+  FilterHeader header;
+  gdouble bits_per_key;
+  guint32 offset = 0;
+  guint n_blocks;
+  guint block;
+  static const guint8 padding[8] = { 0 };
+
+  if (false_positive_rate <= 0.0 || false_positive_rate >= 1.0)
+    false_positive_rate = FILE_SEARCH_IMAGE_FALSE_POSITIVE_RATE;
+
+  bits_per_key = -log (false_positive_rate) / (G_LN2 * G_LN2);
+
+  memset (&header, 0, sizeof (header));
+  header.n_hashes = CLAMP ((guint) (bits_per_key * G_LN2 + 0.5), 1, 16);
+
+  n_blocks = (records->len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  offsets = g_array_new (FALSE, FALSE, sizeof (guint32));
+  words = g_array_new (FALSE, TRUE, sizeof (guint64));
+  trigrams = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  g_array_append_val (offsets, offset);
+
+  for (block = 0; block < n_blocks; block++)
+    {
+      guint n_trigrams = 0;
+      guint n_words;
+      guint n_bits;
+      guint i;
+
+      g_array_set_size (trigrams, 0);
+
+      for (i = block * BLOCK_SIZE; i < MIN ((block + 1) * BLOCK_SIZE, records->len); i++)
+        {
+          const gchar *key = g_array_index (records, Record, i).key;
+          gsize length;
+          gsize j;
+
+          /* a run of the same name adds its trigrams once */
+          if (i > block * BLOCK_SIZE && key == g_array_index (records, Record, i - 1).key)
+            continue;
+
+          length = strlen (key);
+
+          for (j = 0; j + 3 <= length; j++)
+            {
+              guint32 trigram = get_trigram (key + j);
+              g_array_append_val (trigrams, trigram);
+            }
+        }
+
+      g_array_sort (trigrams, compare_trigrams);
+
+      for (i = 0; i < trigrams->len; i++)
+        {
+          if (i == 0 || g_array_index (trigrams, guint32, i) != 
+                        g_array_index (trigrams, guint32, n_trigrams - 1))
+            g_array_index (trigrams, guint32, n_trigrams++) = g_array_index (trigrams, guint32, i);
+        }
+
+      n_words = MAX (1, (guint) (n_trigrams * bits_per_key + 63) / 64);
+      n_bits = n_words * 64;
+      g_array_set_size (words, offset + n_words);
+
+      for (i = 0; i < n_trigrams; i++)
+        {
+          guint32 trigram = g_array_index (trigrams, guint32, i);
+          guint j;
+
+          for (j = 0; j < header.n_hashes; j++)
+            {
+              guint bit = get_filter_bit (trigram, j, n_bits);
+              g_array_index (words, guint64, offset + bit / 64) |= G_GUINT64_CONSTANT (1) << (bit % 64);
+            }
+        }
+
+      offset += n_words;
+      g_array_append_val (offsets, offset);
+    }
+
+  header.n_blocks = n_blocks;
+
+  filters = g_byte_array_new ();
+  g_byte_array_append (filters, (const guint8 *) &header, sizeof (header));
+  g_byte_array_append (filters, (const guint8 *) offsets->data, offsets->len * sizeof (guint32));
+  g_byte_array_append (filters, padding, (8 - filters->len % 8) % 8);
+  g_byte_array_append (filters, (const guint8 *) words->data, words->len * sizeof (guint64));
+
+  g_array_free (trigrams, TRUE);
+  g_array_free (words, TRUE);
+  g_array_free (offsets, TRUE);
+
+  return filters;
+}
+
+/*
+ * The records are sorted by project, so each project starts where the
+ * previous one ends.
+ */
+static GByteArray*
+build_partitions (GArray *records,
+                  guint   n_projects)
+{
+  GByteArray *partitions;
+  guint32 first = 0;
+  guint project;
+
+  partitions = g_byte_array_sized_new ((n_projects + 1) * sizeof (guint32));
+
+  for (project = 0; project <= n_projects; project++)
+    {
+      while (first < records->len && 
+             g_array_index (records, Record, first).ids[1] < project)
+        first++;
+      g_byte_array_append (partitions, (const guint8 *) &first, sizeof (guint32));
+    }
+
+  return partitions;
+}
+
+static void
+list_writer_init (ListWriter *writer)
+{
+  writer->blocks = g_byte_array_new ();
+  writer->records = g_byte_array_new ();
+  writer->block_offsets = g_array_new (FALSE, FALSE, sizeof (guint32));
+  writer->restarts = g_array_new (FALSE, FALSE, sizeof (guint32));
+  writer->n_items = 0;
+  writer->previous = NULL;
+}
+
+static void
+list_writer_add (ListWriter    *writer,
+                 const gchar   *key,
+                 const guint32 *ids,
+                 guint          n_ids,
+                 const gchar   *value)
+{
+  gsize length;
+  gsize shared = 0;
+  guint i;
+
+  if (writer->n_items % BLOCK_SIZE == 0 && writer->n_items > 0)
+    list_writer_flush (writer);
+
+  length = strlen (key);
+
+  if (writer->n_items % RESTART_INTERVAL == 0)
+    {
+      guint32 offset = writer->records->len;
+      g_array_append_val (writer->restarts, offset);
+    }
+  else
+    {
+      while (writer->previous[shared] != '\0' &&
+             writer->previous[shared] == key[shared])
+        shared++;
+    }
+
+  file_search_varint_write (writer->records, shared);
+  file_search_varint_write (writer->records, length - shared);
+  g_byte_array_append (writer->records, (const guint8 *) key + shared, length - shared);
+
+  for (i = 0; i < n_ids; i++)
+    file_search_varint_write (writer->records, ids[i]);
+
+  if (value != NULL)
+    {
+      gsize value_length = strlen (value);
+      file_search_varint_write (writer->records, value_length);
+      g_byte_array_append (writer->records, (const guint8 *) value, value_length);
+    }
+
+  g_free (writer->previous);
+  writer->previous = g_strdup (key);
+  writer->n_items++;
+}
+
+static void
+list_writer_flush (ListWriter *writer)
+{
+  guint32 offset = writer->blocks->len;
+  guint32 table_length;
+  guint i;
+  static const guint8 padding[4] = { 0 };
+
+  g_array_append_val (writer->block_offsets, offset);
+
+  /* a short last block still gets a full restart table */
+  table_length = (BLOCK_SIZE / RESTART_INTERVAL) * sizeof (guint32);
+  for (i = 0; i < BLOCK_SIZE / RESTART_INTERVAL; i++)
+    {
+      guint32 restart = table_length;
+      if (i < writer->restarts->len)
+        restart += g_array_index (writer->restarts, guint32, i);
+      else
+        restart += writer->records->len;
+      g_byte_array_append (writer->blocks, (const guint8 *) &restart, sizeof (guint32));
+    }
+
+  g_byte_array_append (writer->blocks, writer->records->data, writer->records->len);
+  g_byte_array_append (writer->blocks, padding,
+                       (4 - writer->blocks->len % 4) % 4);
+
+  g_byte_array_set_size (writer->records, 0);
+  g_array_set_size (writer->restarts, 0);
+}
+
+static GByteArray*
+list_writer_finish (ListWriter *writer)
+{
+  GByteArray *list;
+  ListHeader header;
+  guint32 offset;
+
+  /* the first record of every block is a restart */
+  if (writer->restarts->len > 0)
+    list_writer_flush (writer);
+
+  offset = writer->blocks->len;
+  g_array_append_val (writer->block_offsets, offset);
+
+  header.n_items = writer->n_items;
+  header.n_blocks = writer->block_offsets->len - 1;
+  header.block_size = BLOCK_SIZE;
+  header.restart_interval = RESTART_INTERVAL;
+
+  list = g_byte_array_sized_new (sizeof (header) +
+                                 writer->block_offsets->len * sizeof (guint32) +
+                                 writer->blocks->len);
+  g_byte_array_append (list, (const guint8 *) &header, sizeof (header));
+  g_byte_array_append (list, (const guint8 *) writer->block_offsets->data,
+                       writer->block_offsets->len * sizeof (guint32));
+  g_byte_array_append (list, writer->blocks->data, writer->blocks->len);
+
+  g_byte_array_free (writer->blocks, TRUE);
+  g_byte_array_free (writer->records, TRUE);
+  g_array_free (writer->block_offsets, TRUE);
+  g_array_free (writer->restarts, TRUE);
+  g_free (writer->previous);
+
+  return list;
+}
+
+GBytes*
+file_search_image_build (GList                *indexes,
+                         guint64               generation,
+                         gdouble               false_positive_rate,
+                         FileSearchImageFlags  flags)
+{
+  GByteArray *image;
+  GByteArray *lists[SECTIONS];
+  GByteArray *projects;
+  GArray *records;
+  GPtrArray *dir_paths;
+  GPtrArray *folded_names;
+  GHashTable *names;
+  GHashTable *dirs;
+  GHashTable *project_keys;
+  GList *keys;
+  GList *list;
+  ListWriter writer;
+  Header header;
+  Section sections[SECTIONS - 1];
+  gsize offset;
+  guint i;
+  static const gchar padding[8] = { 0 };
+
+  records = g_array_new (FALSE, FALSE, sizeof (Record));
+  dir_paths = g_ptr_array_new_with_free_func (g_free);
+  folded_names = g_ptr_array_new_with_free_func (g_free);
+  names = g_hash_table_new (g_str_hash, g_str_equal);
+  dirs = g_hash_table_new (g_str_hash, g_str_equal);
+  project_keys = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* project id zero is the empty key */
+  g_hash_table_insert (project_keys, (gpointer) "", NULL);
+
+  for (list = indexes; list != NULL; list = g_list_next (list))
+    {
+      FileSearchIndex *index = list->data;
+      const gchar *project_key;
+      Record record;
+      gchar folded[FILE_SEARCH_IMAGE_KEY_MAX];
+      gpointer name;
+      gpointer key;
+      gsize length;
+      gchar *dir;
+
+      record.file_name = file_search_index_get_file_name (index);
+      length = strlen (record.file_name);
+      dir = g_path_get_dirname (file_search_index_get_file_path (index));
+
+      /* nothing could open these anyway */
+      if (length >= FILE_SEARCH_IMAGE_KEY_MAX ||
+          strlen (dir) >= FILE_SEARCH_IMAGE_KEY_MAX)
+        {
+          g_free (dir);
+          continue;
+        }
+
+      /* 
+       * The same few names turn up all over a tree, so each distinct name
+       * is folded once and its records share the strings. Equal names then
+       * compare by pointer and group together in the sort.
+       */
+      if (g_hash_table_lookup_extended (names, record.file_name, &name, &key))
+        {
+          record.file_name = name;
+          record.key = key;
+        }
+      else
+        {
+          /* most names are already folded and share their string with the key */
+          if (file_search_fold (record.file_name, length, folded, sizeof (folded)) == length &&
+              memcmp (folded, record.file_name, length) == 0)
+            {
+              record.key = record.file_name;
+            }
+          else
+            {
+              record.key = g_strdup (folded);
+              g_ptr_array_add (folded_names, (gpointer) record.key);
+            }
+          g_hash_table_insert (names, (gpointer) record.file_name, (gpointer) record.key);
+        }
+
+      if (!g_hash_table_lookup_extended (dirs, dir, (gpointer *) &record.dir, NULL))
+        {
+          g_ptr_array_add (dir_paths, dir);
+          g_hash_table_insert (dirs, dir, NULL);
+          record.dir = dir;
+        }
+      else
+        {
+          g_free (dir);
+        }
+
+      project_key = file_search_index_get_project_key (index);
+      if (project_key == NULL)
+        project_key = "";
+      g_hash_table_insert (project_keys, (gpointer) project_key, NULL);
+      record.project_key = project_key;
+
+      g_array_append_val (records, record);
+    }
+
+  /* projects, whose ids the entries are sorted by */
+  projects = g_byte_array_new ();
+  keys = g_list_sort (g_hash_table_get_keys (project_keys), compare_strings);
+  for (list = keys, i = 0; list != NULL; list = g_list_next (list), i++)
+    {
+      const gchar *project_key = list->data;
+      g_byte_array_append (projects, (const guint8 *) project_key, strlen (project_key) + 1);
+      g_hash_table_insert (project_keys, (gpointer) project_key, GUINT_TO_POINTER (i));
+    }
+  g_list_free (keys);
+  lists[SECTION_PROJECTS] = projects;
+
+  for (i = 0; i < records->len; i++)
+    {
+      Record *record = &g_array_index (records, Record, i);
+      record->ids[1] = GPOINTER_TO_UINT (g_hash_table_lookup (project_keys, record->project_key));
+    }
+
+  g_array_sort (records, compare_records);
+
+  /* directories */
+  list_writer_init (&writer);
+  keys = g_list_sort (g_hash_table_get_keys (dirs), compare_strings);
+  for (list = keys, i = 0; list != NULL; list = g_list_next (list), i++)
+    {
+      list_writer_add (&writer, list->data, NULL, 0, NULL);
+      g_hash_table_insert (dirs, list->data, GUINT_TO_POINTER (i));
+    }
+  g_list_free (keys);
+  lists[SECTION_DIRS] = list_writer_finish (&writer);
+
+  /* entries */
+  list_writer_init (&writer);
+  for (i = 0; i < records->len; i++)
+    {
+      Record *record = &g_array_index (records, Record, i);
+      record->ids[0] = GPOINTER_TO_UINT (g_hash_table_lookup (dirs, record->dir));
+      list_writer_add (&writer, record->key, record->ids, MAX_IDS, 
+                       record->key == record->file_name ? "" : record->file_name);
+    }
+  lists[SECTION_ENTRIES] = list_writer_finish (&writer);
+  lists[SECTION_FILTERS] = build_filters (records, false_positive_rate);
+  lists[SECTION_PARTITIONS] = build_partitions (records, g_hash_table_size (project_keys));
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, FILE_SEARCH_IMAGE_MAGIC, sizeof (FILE_SEARCH_IMAGE_MAGIC));
+  header.version = FILE_SEARCH_IMAGE_VERSION;
+  header.n_sections = G_N_ELEMENTS (sections);
+  header.generation = generation;
+  header.n_entries = records->len;
+  header.flags = flags;
+
+  offset = sizeof (Header) + sizeof (sections);
+  memset (sections, 0, sizeof (sections));
+
+  for (i = 0; i < G_N_ELEMENTS (sections); i++)
+    {
+      sections[i].id = SECTION_PROJECTS + i;
+      sections[i].offset = offset;
+      sections[i].length = lists[sections[i].id]->len;
+      offset += (sections[i].length + 7) & ~7;
+    }
+
+  image = g_byte_array_sized_new (offset);
+  g_byte_array_append (image, (const guint8 *) &header, sizeof (header));
+  g_byte_array_append (image, (const guint8 *) sections, sizeof (sections));
+
+  for (i = 0; i < G_N_ELEMENTS (sections); i++)
+    {
+      GByteArray *section = lists[sections[i].id];
+      g_byte_array_append (image, section->data, section->len);
+      g_byte_array_append (image, (const guint8 *) padding, (8 - section->len % 8) % 8);
+      g_byte_array_free (section, TRUE);
+    }
+
+  g_array_free (records, TRUE);
+  g_hash_table_destroy (project_keys);
+  g_hash_table_destroy (names);
+  g_hash_table_destroy (dirs);
+  g_ptr_array_free (dir_paths, TRUE);
+  g_ptr_array_free (folded_names, TRUE);
+
+  return g_byte_array_free_to_bytes (image);
+}
+
+static gint
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return strcmp (a, b);
+}
+
+/*
+ * Plain byte order, the lookup depends on it.
+ */
+static gint
+compare_records (gconstpointer a,
+                 gconstpointer b)
+{
+  const Record *record_a = a;
+  const Record *record_b = b;
+  gint result;
+
+  if (record_a->ids[1] != record_b->ids[1])
+    return record_a->ids[1] < record_b->ids[1] ? -1 : 1;
+
+  if (record_a->key != record_b->key)
+    {
+      result = strcmp (record_a->key, record_b->key);
+      if (result != 0)
+        return result;
+    }
+
+  return strcmp (record_a->dir, record_b->dir);
+}
+
+/*
+ * g_file_set_contents writes a temporary file and renames it into 
+ * place, so a reader maps either the old generation or the new one.
+ */
+gboolean
+file_search_image_write (GBytes       *bytes,
+                         const gchar  *file_path,
+                         GError      **error)
+{
+  return g_file_set_contents (file_path, g_bytes_get_data (bytes, NULL), 
+                              g_bytes_get_size (bytes), error);
+}
+
+/*
+ * Copies the image into an anonymous memfd and seals it, so that the
+ * readers it is handed to can map it but nobody can change it anymore.
+ * Returns -1 when memfd is not available, the readers then map the
+ * image file instead.
+ */
+gint
+file_search_image_publish (GBytes  *bytes,
+                           GError **error)
+{
+#ifdef HAVE_MEMFD_CREATE
+  const guint8 *data;
+  gsize length;
+  gsize written = 0;
+  gint fd;
+
+  data = g_bytes_get_data (bytes, &length);
+
+  fd = memfd_create ("filesearch", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error creating the file search memfd: %s", g_strerror (errno));
+      return -1;
+    }
+
+  while (written < length)
+    {
+      gssize result = write (fd, data + written, length - written);
+      if (result < 0 && errno == EINTR)
+        continue;
+      if (result < 0)
+        {
+          g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                       "Error writing the file search memfd: %s", g_strerror (errno));
+          close (fd);
+          return -1;
+        }
+      written += result;
+    }
+
+  if (fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error sealing the file search memfd: %s", g_strerror (errno));
+      close (fd);
+      return -1;
+    }
+
+  return fd;
+#else
+  g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOSYS,
+               "The file search memfd is not supported on this system.");
+  return -1;
+#endif
+}
+
+guint64
+file_search_image_peek_generation (GBytes *bytes)
+{
+  const Header *header;
+  gsize length;
+  
+  header = g_bytes_get_data (bytes, &length);
+  if (length < sizeof (Header))
+    return 0;
+    
+  return header->generation;
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_IMAGE_H__
+#define	__FILE_SEARCH_IMAGE_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_IMAGE_TYPE            (file_search_image_get_type ())
+#define FILE_SEARCH_IMAGE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_IMAGE_TYPE, FileSearchImage))
+#define FILE_SEARCH_IMAGE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_IMAGE_TYPE, FileSearchImageClass))
+#define IS_FILE_SEARCH_IMAGE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_IMAGE_TYPE))
+#define IS_FILE_SEARCH_IMAGE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_IMAGE_TYPE))
+
+#define FILE_SEARCH_IMAGE_ERROR           (file_search_image_error_quark ())
+
+typedef enum
+{
+  FILE_SEARCH_IMAGE_ERROR_CORRUPT,
+  FILE_SEARCH_IMAGE_ERROR_VERSION,
+  FILE_SEARCH_IMAGE_ERROR_RELATIVE
+} FileSearchImageError;
+
+/* 
+ * A relative image stores its directories relative to the folder of 
+ * the project the entries belong to, see filesearch-snapshot.h. 
+ */
+typedef enum
+{
+  FILE_SEARCH_IMAGE_RELATIVE = 1 << 0
+} FileSearchImageFlags;
+
+/* longest file name or directory path the image stores */
+#define FILE_SEARCH_IMAGE_KEY_MAX         4096
+
+/* trigrams of a pattern checked against the block filters */
+#define FILE_SEARCH_IMAGE_MAX_TRIGRAMS    32
+
+#define FILE_SEARCH_IMAGE_FALSE_POSITIVE_RATE 0.05
+
+typedef struct _FileSearchImage FileSearchImage;
+typedef struct _FileSearchImageClass FileSearchImageClass;
+typedef struct _FileSearchImageCursor FileSearchImageCursor;
+typedef struct _FileSearchImageRun FileSearchImageRun;
+
+struct _FileSearchImage
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchImageClass
+{
+  GObjectClass parent_class;
+};
+
+/*
+ * Walks the entries project by project, in folded file name order within
+ * each project. The entries are front coded, so the file name and its 
+ * folded key are decoded into the cursor and only valid until the next 
+ * call to file_search_image_cursor_next().
+ * n_skipped counts the blocks of entries the filters ruled out.
+ * same_key and same_name are set when the entry repeats the key, or the
+ * key and the file name, of the entry right before it, so that whatever
+ * was worked out for that one holds for this one as well.
+ */
+struct _FileSearchImageCursor
+{
+  guint            entry;
+  guint            dir;
+  guint            project;
+  gsize            length;
+  gchar            file_name[FILE_SEARCH_IMAGE_KEY_MAX];
+  gsize            key_length;
+  gchar            key[FILE_SEARCH_IMAGE_KEY_MAX];
+  gboolean         same_key;
+  gboolean         same_name;
+  guint            n_skipped;
+
+  /*< private >*/
+  FileSearchImage *image;
+  guint            next;
+  guint            limit;
+  guint            block;
+  const guint8    *p;
+  const guint8    *end;
+  gboolean         decoded;
+  gboolean         has_value;
+  guint            n_trigrams;
+  guint32          trigrams[FILE_SEARCH_IMAGE_MAX_TRIGRAMS];
+  const guint8    *scope;
+  guint            next_project;
+  gsize            prefix_length;
+  gchar            prefix[FILE_SEARCH_IMAGE_KEY_MAX];
+};
+
+/* the entries from first up to, but not including, limit */
+struct _FileSearchImageRun
+{
+  guint first;
+  guint limit;
+};
+
+GType file_search_image_get_type (void) G_GNUC_CONST;
+
+GQuark            file_search_image_error_quark       (void);
+
+FileSearchImage*  file_search_image_new_from_file     (const gchar     *file_path,
+                                                       GError         **error);
+FileSearchImage*  file_search_image_new_from_fd       (gint             fd,
+                                                       GError         **error);
+
+guint64           file_search_image_get_generation    (FileSearchImage *image);
+void              file_search_image_set_overlay       (FileSearchImage *image,
+                                                       FileSearchImage *overlay,
+                                                       guint8          *removed,
+                                                       guint64          generation);
+FileSearchImage*  file_search_image_get_overlay       (FileSearchImage *image);
+gboolean          file_search_image_lookup            (FileSearchImage *image,
+                                                       const gchar     *file_path,
+                                                       guint           *entry,
+                                                       guint           *project);
+gboolean          file_search_image_is_relative       (FileSearchImage *image);
+guint             file_search_image_get_n_entries     (FileSearchImage *image);
+guint             file_search_image_get_n_projects    (FileSearchImage *image);
+const gchar*      file_search_image_get_project_key   (FileSearchImage *image,
+                                                       guint            project);
+gboolean          file_search_image_get_dir           (FileSearchImage *image,
+                                                       guint            dir,
+                                                       gchar           *buffer);
+void              file_search_image_set_memory_budget (FileSearchImage *image,
+                                                       gsize            memory_budget);
+gsize             file_search_image_trim              (FileSearchImage *image);
+void              file_search_image_warm              (FileSearchImage *image);
+GArray*           file_search_image_get_runs          (FileSearchImage *image,
+                                                       const gchar     *pattern,
+                                                       const guint8    *scope);
+
+void              file_search_image_cursor_init       (FileSearchImage       *image,
+                                                       FileSearchImageCursor *cursor,
+                                                       guint                  entry);
+void              file_search_image_cursor_init_pattern    (FileSearchImage       *image,
+                                                            FileSearchImageCursor *cursor,
+                                                            const gchar           *pattern,
+                                                            const guint8          *scope);
+void              file_search_image_cursor_init_run   (FileSearchImage       *image,
+                                                       FileSearchImageCursor *cursor,
+                                                       const gchar           *pattern,
+                                                       guint                  first,
+                                                       guint                  limit);
+gboolean          file_search_image_cursor_next       (FileSearchImageCursor *cursor);
+gchar*            file_search_image_cursor_get_file_path   (FileSearchImageCursor *cursor);
+const gchar*      file_search_image_cursor_get_project_key (FileSearchImageCursor *cursor);
+
+GBytes*           file_search_image_build             (GList           *indexes,
+                                                       guint64          generation,
+                                                       gdouble          false_positive_rate,
+                                                       FileSearchImageFlags flags);
+gboolean          file_search_image_write             (GBytes          *bytes,
+                                                       const gchar     *file_path,
+                                                       GError         **error);
+gint              file_search_image_publish           (GBytes          *bytes,
+                                                       GError         **error);
+guint64           file_search_image_peek_generation   (GBytes          *bytes);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_IMAGE_H__ */
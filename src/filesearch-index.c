@@ -39,7 +39,9 @@ struct _FileSearchIndexPrivate
 {
   gchar *project_key;
   gchar *file_name;
+  gchar *folded_name;
   gchar *file_path;
+  GBytes *spans;
 };
 
 enum
@@ -47,7 +49,9 @@ enum
   PROP_0,
   PROP_PROJECT_KEY,
   PROP_FILE_NAME,
-  PROP_FILE_PATH
+  PROP_FOLDED_NAME,
+  PROP_FILE_PATH,
+  PROP_SPANS
 };
 
 G_DEFINE_TYPE (FileSearchIndex, file_search_index, G_TYPE_OBJECT)
@@ -78,6 +82,13 @@ file_search_index_class_init (FileSearchIndexClass *klass)
                                                         "File Name", "",
                                                         G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, 
+                                   PROP_FOLDED_NAME,
+                                   g_param_spec_string ("folded_name", 
+                                                        "Folded Name",
+                                                        "Folded Name", "",
+                                                        G_PARAM_READWRITE));
+
   g_object_class_install_property (gobject_class, 
                                    PROP_FILE_PATH,
                                    g_param_spec_string ("file_path",
@@ -85,6 +96,14 @@ file_search_index_class_init (FileSearchIndexClass *klass)
                                                         "File Path",
                                                         "",
                                                         G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, 
+                                   PROP_SPANS,
+                                   g_param_spec_boxed ("spans",
+                                                       "Spans",
+                                                       "Spans",
+                                                       G_TYPE_BYTES,
+                                                       G_PARAM_READWRITE));
 }
 
 static void
@@ -94,7 +113,9 @@ file_search_index_init (FileSearchIndex *index)
   priv = FILE_SEARCH_INDEX_GET_PRIVATE (index);
   priv->project_key = NULL;
   priv->file_name = NULL;
+  priv->folded_name = NULL;
   priv->file_path = NULL;
+  priv->spans = NULL;
 }
 
 static void
@@ -112,11 +133,21 @@ file_search_index_finalize (FileSearchIndex *index)
       g_free (priv->file_name);
       priv->file_name = NULL;
     }
+  if (priv->folded_name)
+    {
+      g_free (priv->folded_name);
+      priv->folded_name = NULL;
+    }
   if (priv->file_path)
     {
       g_free (priv->file_path);
       priv->file_path = NULL;
     }
+  if (priv->spans)
+    {
+      g_bytes_unref (priv->spans);
+      priv->spans = NULL;
+    }
   G_OBJECT_CLASS (file_search_index_parent_class)->finalize (G_OBJECT (index));
 }
 
@@ -140,9 +171,15 @@ file_search_index_get_property (GObject    *object,
     case PROP_FILE_NAME:
       g_value_set_string (value, priv->file_name);
       break;
+    case PROP_FOLDED_NAME:
+      g_value_set_string (value, priv->folded_name);
+      break;
     case PROP_FILE_PATH:
       g_value_set_string (value, priv->file_path);
       break;
+    case PROP_SPANS:
+      g_value_set_boxed (value, priv->spans);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -166,9 +203,15 @@ file_search_index_set_property (GObject      *object,
     case PROP_FILE_NAME:
       file_search_index_set_file_name (index, g_value_get_string (value));
       break;
+    case PROP_FOLDED_NAME:
+      file_search_index_set_folded_name (index, g_value_get_string (value));
+      break;
     case PROP_FILE_PATH:
       file_search_index_set_file_path (index, g_value_get_string (value));
       break;
+    case PROP_SPANS:
+      file_search_index_set_spans (index, g_value_get_boxed (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -221,6 +264,30 @@ file_search_index_set_file_name (FileSearchIndex *index,
   priv->file_name = g_strdup (file_name);
 }
 
+/*
+ * The case folded file name that the searches match against when they
+ * ignore the case.
+ */
+const gchar*
+file_search_index_get_folded_name (FileSearchIndex *index)
+{
+  return FILE_SEARCH_INDEX_GET_PRIVATE (index)->folded_name;
+}
+
+void
+file_search_index_set_folded_name (FileSearchIndex *index, 
+                                   const gchar     *folded_name)
+{
+  FileSearchIndexPrivate *priv;
+  priv = FILE_SEARCH_INDEX_GET_PRIVATE (index);
+  if (priv->folded_name)
+    {
+      g_free (priv->folded_name);
+      priv->folded_name = NULL;
+    }
+  priv->folded_name = g_strdup (folded_name);
+}
+
 const gchar *
 file_search_index_get_file_path (FileSearchIndex *index)
 {
@@ -240,3 +307,29 @@ file_search_index_set_file_path (FileSearchIndex *index,
     }
   priv->file_path = g_strdup (file_path);
 }
+
+/*
+ * The runs of the file name the search matched, as the array of
+ * FileSearchQuerySpan that filesearch-query.h describes. NULL when 
+ * nothing in the name is to be highlighted.
+ */
+GBytes*
+file_search_index_get_spans (FileSearchIndex *index)
+{
+  return FILE_SEARCH_INDEX_GET_PRIVATE (index)->spans;
+}
+
+void
+file_search_index_set_spans (FileSearchIndex *index,
+                             GBytes          *spans)
+{
+  FileSearchIndexPrivate *priv;
+  priv = FILE_SEARCH_INDEX_GET_PRIVATE (index);
+  if (priv->spans)
+    {
+      g_bytes_unref (priv->spans);
+      priv->spans = NULL;
+    }
+  if (spans)
+    priv->spans = g_bytes_ref (spans);
+}
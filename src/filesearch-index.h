@@ -19,7 +19,7 @@
 #ifndef __FILE_SEARCH_INDEX_H__
 #define	__FILE_SEARCH_INDEX_H__
 
-#include <gtk/gtk.h>
+#include <glib-object.h>
 
 G_BEGIN_DECLS
 
@@ -52,9 +52,15 @@ void              file_search_index_set_project_key  (FileSearchIndex *index,
 const gchar*      file_search_index_get_file_name    (FileSearchIndex *index);
 void              file_search_index_set_file_name    (FileSearchIndex *index,
                                                       const gchar     *file_name);
+const gchar*      file_search_index_get_folded_name  (FileSearchIndex *index);
+void              file_search_index_set_folded_name  (FileSearchIndex *index,
+                                                      const gchar     *folded_name);
 const gchar*      file_search_index_get_file_path    (FileSearchIndex *index);
 void              file_search_index_set_file_path    (FileSearchIndex *index,
                                                       const gchar     *file_path);
+GBytes*           file_search_index_get_spans        (FileSearchIndex *index);
+void              file_search_index_set_spans        (FileSearchIndex *index,
+                                                      GBytes          *spans);
 
 G_END_DECLS
 
@@ -0,0 +1,954 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <glib/gstdio.h>
+#include "filesearch-index.h"
+#include "filesearch-journal.h"
+#include "filesearch-varint.h"
+
+/*
+ * The journal is an append only log of the changes made to an index
+ * file since it was written, so that a small change costs one append
+ * instead of a new index file.
+ *
+ *   header | record... 
+ *   header = magic[4] | version | base generation
+ *   record = payload length | crc32 of the payload | payload
+ *   payload = op | fields...
+ *
+ * Additions hold the project key and the path, removals the path and
+ * renames the old and the new path, each a varint length and the bytes.
+ * The records of one update are followed by a commit that holds the new
+ * generation. Replay stops at the first record that is cut short or 
+ * fails its checksum and only applies the updates that were committed,
+ * so a crash in the middle of an append loses that update and nothing 
+ * else. The next append cuts the log back to its last commit.
+ *
+ * Editors that share a profile can append to the same log. An append 
+ * holds an exclusive lock on it and fails when the log was committed to
+ * since it was read, the records were worked out against what it held
+ * then.
+ *
+ * A log whose base generation is not the generation of the index file
+ * next to it is stale, it was left behind by a crash after the index 
+ * file was rewritten, and is ignored.
+ *
+ * Readers lay the log over the index file, so loading costs about as 
+ * much as the log is long: each path it touches is looked up by name, 
+ * and only the files it added are built into an image. The writer folds
+ * the log into a new index file once it grows past its limit.
+ */
+
+#define FILE_SEARCH_JOURNAL_MAGIC    "CSFJ"
+#define FILE_SEARCH_JOURNAL_VERSION  1
+
+typedef struct
+{
+  gchar   magic[4];
+  guint32 version;
+  guint64 base_generation;
+} Header;
+
+typedef struct
+{
+  guint32 length;
+  guint32 crc;
+} RecordHeader;
+
+static void file_search_journal_class_init  (FileSearchJournalClass *klass);
+static void file_search_journal_init        (FileSearchJournal      *journal);
+static void file_search_journal_finalize    (FileSearchJournal      *journal);
+
+static void read_records                    (FileSearchJournal      *journal,
+                                             const guint8           *data,
+                                             gsize                   length);
+static FileSearchJournalRecord* parse_record (const guint8          *p,
+                                              const guint8          *end,
+                                              guint64               *generation);
+static gboolean read_string                 (const guint8          **p,
+                                             const guint8           *end,
+                                             gchar                 **string);
+static void write_record                    (GByteArray             *bytes,
+                                             FileSearchJournalRecord *record,
+                                             guint64                 generation);
+static void write_string                    (GByteArray             *payload,
+                                             const gchar            *string);
+static gboolean write_all                   (gint                    fd,
+                                             const guint8           *data,
+                                             gsize                   length,
+                                             gsize                   offset);
+static guint32 get_crc                      (const guint8           *data,
+                                             gsize                   length);
+static gsize read_length                    (FileSearchJournal      *journal,
+                                             gint                    fd);
+static gboolean lay_over                    (FileSearchJournal      *journal,
+                                             FileSearchImage        *image,
+                                             gdouble                 false_positive_rate,
+                                             GError                **error);
+static void remove_file                     (FileSearchImage        *image,
+                                             guint8                 *removed,
+                                             GHashTable             *added,
+                                             const gchar            *file_path,
+                                             gchar                 **project_key);
+static GBytes* build_replayed               (FileSearchJournal      *journal,
+                                             FileSearchImage        *image,
+                                             gdouble                 false_positive_rate);
+static GList* get_indexes                   (GHashTable             *files);
+static FileSearchImage* open_bytes          (GBytes                 *bytes,
+                                             GError                **error);
+
+#define FILE_SEARCH_JOURNAL_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_JOURNAL_TYPE, FileSearchJournalPrivate))
+
+typedef struct _FileSearchJournalPrivate FileSearchJournalPrivate;
+
+/* the committed records, and the length of the log up to the last commit */
+struct _FileSearchJournalPrivate
+{
+  gchar     *file_path;
+  guint64    base_generation;
+  guint64    generation;
+  gsize      length;
+  GPtrArray *records;
+};
+
+G_DEFINE_TYPE (FileSearchJournal, file_search_journal, G_TYPE_OBJECT)
+
+static void
+file_search_journal_class_init (FileSearchJournalClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = (GObjectFinalizeFunc) file_search_journal_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchJournalPrivate));
+}
+
+static void
+file_search_journal_init (FileSearchJournal *journal)
+{
+  FileSearchJournalPrivate *priv;
+  priv = FILE_SEARCH_JOURNAL_GET_PRIVATE (journal);
+  priv->file_path = NULL;
+  priv->base_generation = 0;
+  priv->generation = 0;
+  priv->length = 0;
+  priv->records = g_ptr_array_new_with_free_func ((GDestroyNotify) file_search_journal_record_free);
+}
+
+static void
+file_search_journal_finalize (FileSearchJournal *journal)
+{
+  FileSearchJournalPrivate *priv;
+  priv = FILE_SEARCH_JOURNAL_GET_PRIVATE (journal);
+  g_free (priv->file_path);
+  g_ptr_array_free (priv->records, TRUE);
+  G_OBJECT_CLASS (file_search_journal_parent_class)->finalize (G_OBJECT (journal));
+}
+
+/*
+ * Reads the committed records of the log. A log that is missing, stale
+ * or unreadable gives an empty journal that the next append starts over.
+ */
+FileSearchJournal*
+file_search_journal_new_from_file (const gchar *file_path,
+                                   guint64      base_generation)
+{
+  FileSearchJournalPrivate *priv;
+  FileSearchJournal *journal;
+  gchar *contents;
+  gsize length;
+
+  journal = FILE_SEARCH_JOURNAL (g_object_new (file_search_journal_get_type (), NULL));
+  priv = FILE_SEARCH_JOURNAL_GET_PRIVATE (journal);
+  priv->file_path = g_strdup (file_path);
+  priv->base_generation = base_generation;
+  priv->generation = base_generation;
+
+  if (g_file_get_contents (file_path, &contents, &length, NULL))
+    {
+      read_records (journal, (const guint8 *) contents, length);
+      g_free (contents);
+    }
+
+  return journal;
+}
+
+guint64
+file_search_journal_get_generation (FileSearchJournal *journal)
+{
+  return FILE_SEARCH_JOURNAL_GET_PRIVATE (journal)->generation;
+}
+
+gsize
+file_search_journal_get_length (FileSearchJournal *journal)
+{
+  return FILE_SEARCH_JOURNAL_GET_PRIVATE (journal)->length;
+}
+
+guint
+file_search_journal_get_n_records (FileSearchJournal *journal)
+{
+  return FILE_SEARCH_JOURNAL_GET_PRIVATE (journal)->records->len;
+}
+
+static void
+read_records (FileSearchJournal *journal,
+              const guint8      *data,
+              gsize              length)
+{
+  FileSearchJournalPrivate *priv;
+  const Header *header;
+  const guint8 *p;
+  const guint8 *end;
+  GPtrArray *pending;
+  guint i;
+
+  priv = FILE_SEARCH_JOURNAL_GET_PRIVATE (journal);
+
+  header = (const Header *) data;
+  if (length < sizeof (Header) ||
+      memcmp (header->magic, FILE_SEARCH_JOURNAL_MAGIC, sizeof (header->magic)) != 0 ||
+      header->version != FILE_SEARCH_JOURNAL_VERSION ||
+      header->base_generation != priv->base_generation)
+    return;
+
+  priv->length = sizeof (Header);
+
+  pending = g_ptr_array_new ();
+
+  p = data + sizeof (Header);
+  end = data + length;
+
+  while ((gsize) (end - p) >= sizeof (RecordHeader))
+    {
+      FileSearchJournalRecord *record;
+      RecordHeader record_header;
+      guint64 generation;
+
+      memcpy (&record_header, p, sizeof (RecordHeader));
+      p += sizeof (RecordHeader);
+
+      if (record_header.length > (gsize) (end - p) ||
+          get_crc (p, record_header.length) != record_header.crc)
+        break;
+
+      record = parse_record (p, p + record_header.length, &generation);
+      if (record == NULL)
+        break;
+
+      p += record_header.length;
+
+      if (record->op != FILE_SEARCH_JOURNAL_COMMIT)
+        {
+          g_ptr_array_add (pending, record);
+          continue;
+        }
+
+      file_search_journal_record_free (record);
+
+      for (i = 0; i < pending->len; i++)
+        g_ptr_array_add (priv->records, g_ptr_array_index (pending, i));
+      g_ptr_array_set_size (pending, 0);
+
+      priv->generation = generation;
+      priv->length = p - data;
+    }
+
+  /* an update that was never committed */
+  g_ptr_array_foreach (pending, (GFunc) file_search_journal_record_free, NULL);
+  g_ptr_array_free (pending, TRUE);
+}
+
+static FileSearchJournalRecord*
+parse_record (const guint8 *p,
+              const guint8 *end,
+              guint64      *generation)
+{
+  FileSearchJournalRecord *record;
+
+  if (p == end)
+    return NULL;
+
+  record = file_search_journal_record_new (*p++, NULL, NULL, NULL);
+
+  switch (record->op)
+    {
+    case FILE_SEARCH_JOURNAL_ADD:
+      if (read_string (&p, end, &record->project_key) &&
+          read_string (&p, end, &record->file_path) && p == end)
+        return record;
+      break;
+    case FILE_SEARCH_JOURNAL_REMOVE:
+      if (read_string (&p, end, &record->file_path) && p == end)
+        return record;
+      break;
+    case FILE_SEARCH_JOURNAL_RENAME:
+      if (read_string (&p, end, &record->file_path) &&
+          read_string (&p, end, &record->new_file_path) && p == end)
+        return record;
+      break;
+    case FILE_SEARCH_JOURNAL_COMMIT:
+      if (end - p == sizeof (guint64))
+        {
+          memcpy (generation, p, sizeof (guint64));
+          return record;
+        }
+      break;
+    }
+
+  file_search_journal_record_free (record);
+  return NULL;
+}
+
+static gboolean
+read_string (const guint8 **p,
+             const guint8  *end,
+             gchar        **string)
+{
+  guint32 length;
+
+  if (!file_search_varint_read (p, end, &length) || length > (gsize) (end - *p))
+    return FALSE;
+
+  *string = g_strndup ((const gchar *) *p, length);
+  *p += length;
+
+  return TRUE;
+}
+
+/*
+ * Appends the records as one update with the given generation and syncs
+ * the log. The journal takes the records over, whether the append works
+ * or not.
+ */
+gboolean
+file_search_journal_append (FileSearchJournal *journal,
+                            GPtrArray         *records,
+                            guint64            generation,
+                            GError           **error)
+{
+  FileSearchJournalPrivate *priv;
+  GByteArray *bytes;
+  gboolean result = TRUE;
+  gsize committed = 0;
+  guint i;
+  gint fd;
+
+  priv = FILE_SEARCH_JOURNAL_GET_PRIVATE (journal);
+
+  bytes = g_byte_array_new ();
+
+  if (priv->length == 0)
+    {
+      Header header;
+      memset (&header, 0, sizeof (Header));
+      memcpy (header.magic, FILE_SEARCH_JOURNAL_MAGIC, sizeof (header.magic));
+      header.version = FILE_SEARCH_JOURNAL_VERSION;
+      header.base_generation = priv->base_generation;
+      g_byte_array_append (bytes, (const guint8 *) &header, sizeof (Header));
+    }
+
+  for (i = 0; i < records->len; i++)
+    write_record (bytes, g_ptr_array_index (records, i), 0);
+  write_record (bytes, NULL, generation);
+
+  fd = open (priv->file_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+  if (fd < 0 || flock (fd, LOCK_EX) < 0)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error locking the file search log: %s", g_strerror (errno));
+      result = FALSE;
+    }
+  else if ((committed = read_length (journal, fd)) != priv->length)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                   "The file search log was appended to by another writer");
+      result = FALSE;
+    }
+  /* whatever follows the last commit is a torn append, or a stale log */
+  else if (ftruncate (fd, committed) < 0 ||
+           !write_all (fd, bytes->data, bytes->len, committed) ||
+           fdatasync (fd) < 0)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error appending to the file search log: %s", g_strerror (errno));
+      result = FALSE;
+    }
+
+  if (fd >= 0)
+    close (fd);
+
+  if (result)
+    {
+      priv->length += bytes->len;
+      priv->generation = generation;
+      for (i = 0; i < records->len; i++)
+        g_ptr_array_add (priv->records, g_ptr_array_index (records, i));
+    }
+  else
+    {
+      for (i = 0; i < records->len; i++)
+        file_search_journal_record_free (g_ptr_array_index (records, i));
+    }
+
+  g_byte_array_free (bytes, TRUE);
+
+  return result;
+}
+
+/* 
+ * The length up to the last commit of the log as it is on disk, read 
+ * with the lock held. 0 when it is empty, stale or unreadable.
+ */
+static gsize
+read_length (FileSearchJournal *journal,
+             gint               fd)
+{
+  FileSearchJournal *current;
+  GStatBuf buf;
+  guint8 *data;
+  gsize length = 0;
+  gsize result = 0;
+
+  if (fstat (fd, &buf) < 0)
+    return 0;
+
+  data = g_malloc (buf.st_size + 1);
+
+  while (length < (gsize) buf.st_size)
+    {
+      gssize n;
+      n = pread (fd, data + length, buf.st_size - length, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      length += n;
+    }
+
+  current = FILE_SEARCH_JOURNAL (g_object_new (file_search_journal_get_type (), NULL));
+  FILE_SEARCH_JOURNAL_GET_PRIVATE (current)->base_generation = 
+    FILE_SEARCH_JOURNAL_GET_PRIVATE (journal)->base_generation;
+
+  read_records (current, data, length);
+  result = FILE_SEARCH_JOURNAL_GET_PRIVATE (current)->length;
+
+  g_object_unref (current);
+  g_free (data);
+
+  return result;
+}
+
+/* a NULL record is the commit */
+static void
+write_record (GByteArray              *bytes,
+              FileSearchJournalRecord *record,
+              guint64                  generation)
+{
+  RecordHeader record_header;
+  GByteArray *payload;
+  guint8 op;
+
+  payload = g_byte_array_new ();
+
+  op = record != NULL ? record->op : FILE_SEARCH_JOURNAL_COMMIT;
+  g_byte_array_append (payload, &op, 1);
+
+  switch (op)
+    {
+    case FILE_SEARCH_JOURNAL_ADD:
+      write_string (payload, record->project_key);
+      write_string (payload, record->file_path);
+      break;
+    case FILE_SEARCH_JOURNAL_REMOVE:
+      write_string (payload, record->file_path);
+      break;
+    case FILE_SEARCH_JOURNAL_RENAME:
+      write_string (payload, record->file_path);
+      write_string (payload, record->new_file_path);
+      break;
+    case FILE_SEARCH_JOURNAL_COMMIT:
+      g_byte_array_append (payload, (const guint8 *) &generation, sizeof (guint64));
+      break;
+    }
+
+  record_header.length = payload->len;
+  record_header.crc = get_crc (payload->data, payload->len);
+
+  g_byte_array_append (bytes, (const guint8 *) &record_header, sizeof (RecordHeader));
+  g_byte_array_append (bytes, payload->data, payload->len);
+
+  g_byte_array_free (payload, TRUE);
+}
+
+static void
+write_string (GByteArray  *payload,
+              const gchar *string)
+{
+  gsize length = strlen (string);
+  file_search_varint_write (payload, length);
+  g_byte_array_append (payload, (const guint8 *) string, length);
+}
+
+static gboolean
+write_all (gint          fd,
+           const guint8 *data,
+           gsize         length,
+           gsize         offset)
+{
+  gsize written = 0;
+
+  while (written < length)
+    {
+      gssize result = pwrite (fd, data + written, length - written, offset + written);
+      if (result < 0 && errno == EINTR)
+        continue;
+      if (result < 0)
+        return FALSE;
+      written += result;
+    }
+
+  return TRUE;
+}
+
+/*
+ * The paths of the image with the committed updates applied, mapped to
+ * their project keys.
+ */
+GHashTable*
+file_search_journal_replay (FileSearchJournal *journal,
+                            FileSearchImage   *image)
+{
+  FileSearchJournalPrivate *priv;
+  FileSearchImageCursor cursor;
+  GHashTable *files;
+  guint i;
+
+  priv = FILE_SEARCH_JOURNAL_GET_PRIVATE (journal);
+
+  files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  file_search_image_cursor_init (image, &cursor, 0);
+  while (file_search_image_cursor_next (&cursor))
+    {
+      gchar *file_path = file_search_image_cursor_get_file_path (&cursor);
+      if (file_path != NULL)
+        g_hash_table_insert (files, file_path, 
+                             g_strdup (file_search_image_cursor_get_project_key (&cursor)));
+    }
+
+  for (i = 0; i < priv->records->len; i++)
+    {
+      FileSearchJournalRecord *record = g_ptr_array_index (priv->records, i);
+      gpointer file_path;
+      gpointer project_key;
+
+      switch (record->op)
+        {
+        case FILE_SEARCH_JOURNAL_ADD:
+          g_hash_table_insert (files, g_strdup (record->file_path), 
+                               g_strdup (record->project_key));
+          break;
+        case FILE_SEARCH_JOURNAL_REMOVE:
+          g_hash_table_remove (files, record->file_path);
+          break;
+        case FILE_SEARCH_JOURNAL_RENAME:
+          if (g_hash_table_lookup_extended (files, record->file_path, &file_path, &project_key))
+            {
+              g_hash_table_steal (files, record->file_path);
+              g_free (file_path);
+              g_hash_table_insert (files, g_strdup (record->new_file_path), project_key);
+            }
+          break;
+        case FILE_SEARCH_JOURNAL_COMMIT:
+          break;
+        }
+    }
+
+  return files;
+}
+
+/*
+ * Maps the index file and lays its log over it. Only when the log adds
+ * files to a project the index file does not have is a new image built
+ * from every path, in memory and published as a memfd. The index file
+ * itself is only rewritten when the log is compacted.
+ */
+FileSearchImage*
+file_search_journal_load_image (const gchar  *indexes_file,
+                                gdouble       false_positive_rate,
+                                GError      **error)
+{
+  FileSearchJournal *journal;
+  FileSearchImage *image;
+  FileSearchImage *replayed = NULL;
+  GBytes *bytes;
+  GError *replay_error = NULL;
+  gchar *journal_file;
+
+  image = file_search_image_new_from_file (indexes_file, error);
+  if (image == NULL)
+    return NULL;
+
+  /* a snapshot copied over the index file has to be imported instead */
+  if (file_search_image_is_relative (image))
+    {
+      g_set_error (error, FILE_SEARCH_IMAGE_ERROR, FILE_SEARCH_IMAGE_ERROR_RELATIVE,
+                   "The file search index %s is a snapshot.", indexes_file);
+      g_object_unref (image);
+      return NULL;
+    }
+
+  journal_file = g_strconcat (indexes_file, FILE_SEARCH_JOURNAL_SUFFIX, NULL);
+  journal = file_search_journal_new_from_file (journal_file, 
+                                               file_search_image_get_generation (image));
+  g_free (journal_file);
+
+  if (file_search_journal_get_generation (journal) == file_search_image_get_generation (image) ||
+      lay_over (journal, image, false_positive_rate, &replay_error))
+    {
+      g_object_unref (journal);
+      return image;
+    }
+
+  if (replay_error == NULL)
+    {
+      bytes = build_replayed (journal, image, false_positive_rate);
+      replayed = open_bytes (bytes, &replay_error);
+      g_bytes_unref (bytes);
+    }
+
+  /* the index file alone is still a consistent, older generation */
+  if (replayed == NULL)
+    {
+      g_warning ("Error replaying the file search log: %s\n", replay_error->message);
+      g_error_free (replay_error);
+      replayed = g_object_ref (image);
+    }
+
+  g_object_unref (journal);
+  g_object_unref (image);
+
+  return replayed;
+}
+
+/*
+ * Rewrites the index file with the log folded in and removes the log. 
+ * The image is built from the index file and its log unless the caller
+ * has it already, at the generation of the log.
+ */
+gboolean
+file_search_journal_compact (const gchar  *indexes_file,
+                             GBytes       *bytes,
+                             gdouble       false_positive_rate,
+                             GError      **error)
+{
+  gchar *journal_file;
+  gboolean result;
+
+  journal_file = g_strconcat (indexes_file, FILE_SEARCH_JOURNAL_SUFFIX, NULL);
+
+  if (bytes != NULL)
+    {
+      g_bytes_ref (bytes);
+    }
+  else
+    {
+      FileSearchJournal *journal;
+      FileSearchImage *image;
+
+      image = file_search_image_new_from_file (indexes_file, error);
+      if (image == NULL)
+        {
+          g_free (journal_file);
+          return FALSE;
+        }
+
+      journal = file_search_journal_new_from_file (journal_file, 
+                                                   file_search_image_get_generation (image));
+      bytes = build_replayed (journal, image, false_positive_rate);
+      g_object_unref (journal);
+      g_object_unref (image);
+    }
+
+  result = file_search_image_write (bytes, indexes_file, error);
+
+  /* the log went stale with the rename, this only tidies it away */
+  if (result)
+    g_unlink (journal_file);
+
+  g_bytes_unref (bytes);
+  g_free (journal_file);
+
+  return result;
+}
+
+/*
+ * Marks the entries the log removed and collects the files it added. 
+ * Returns FALSE, with the error set when it failed, if the log can not 
+ * be laid over the image: an added file of a project the image lacks 
+ * would be out of reach of the scopes, which are over its projects.
+ */
+static gboolean
+lay_over (FileSearchJournal *journal,
+          FileSearchImage   *image,
+          gdouble            false_positive_rate,
+          GError           **error)
+{
+  FileSearchJournalPrivate *priv;
+  FileSearchImage *overlay = NULL;
+  GHashTable *added;
+  GHashTable *project_keys;
+  GHashTableIter iter;
+  gpointer project_key;
+  guint8 *removed;
+  gboolean result = TRUE;
+  guint i;
+
+  priv = FILE_SEARCH_JOURNAL_GET_PRIVATE (journal);
+
+  removed = g_malloc0 (file_search_image_get_n_entries (image) / 8 + 1);
+  added = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  for (i = 0; i < priv->records->len; i++)
+    {
+      FileSearchJournalRecord *record = g_ptr_array_index (priv->records, i);
+      gchar *moved_key = NULL;
+
+      switch (record->op)
+        {
+        case FILE_SEARCH_JOURNAL_ADD:
+          remove_file (image, removed, added, record->file_path, NULL);
+          g_hash_table_insert (added, g_strdup (record->file_path), 
+                               g_strdup (record->project_key));
+          break;
+        case FILE_SEARCH_JOURNAL_REMOVE:
+          remove_file (image, removed, added, record->file_path, NULL);
+          break;
+        case FILE_SEARCH_JOURNAL_RENAME:
+          remove_file (image, removed, added, record->file_path, &moved_key);
+          if (moved_key != NULL)
+            {
+              remove_file (image, removed, added, record->new_file_path, NULL);
+              g_hash_table_insert (added, g_strdup (record->new_file_path), moved_key);
+            }
+          break;
+        case FILE_SEARCH_JOURNAL_COMMIT:
+          break;
+        }
+    }
+
+  project_keys = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < file_search_image_get_n_projects (image); i++)
+    g_hash_table_add (project_keys, (gpointer) file_search_image_get_project_key (image, i));
+
+  g_hash_table_iter_init (&iter, added);
+  while (result && g_hash_table_iter_next (&iter, NULL, &project_key))
+    result = g_hash_table_contains (project_keys, project_key);
+
+  if (result && g_hash_table_size (added) > 0)
+    {
+      GList *indexes;
+      GBytes *bytes;
+
+      indexes = get_indexes (added);
+      bytes = file_search_image_build (indexes, priv->generation, false_positive_rate, 0);
+      overlay = open_bytes (bytes, error);
+      result = overlay != NULL;
+
+      g_bytes_unref (bytes);
+      g_list_foreach (indexes, (GFunc) g_object_unref, NULL);
+      g_list_free (indexes);
+    }
+
+  if (result)
+    file_search_image_set_overlay (image, overlay, removed, priv->generation);
+  else
+    g_free (removed);
+
+  if (overlay != NULL)
+    g_object_unref (overlay);
+  g_hash_table_destroy (project_keys);
+  g_hash_table_destroy (added);
+
+  return result;
+}
+
+/*
+ * Takes the path out of the files added so far and marks its entry in 
+ * the image, if it has one, as removed. Hands back the project key the
+ * file had when asked for it, NULL if it was in neither.
+ */
+static void
+remove_file (FileSearchImage  *image,
+             guint8           *removed,
+             GHashTable       *added,
+             const gchar      *file_path,
+             gchar           **project_key)
+{
+  gpointer key;
+  gpointer value;
+  guint entry;
+  guint project;
+
+  if (g_hash_table_lookup_extended (added, file_path, &key, &value))
+    {
+      g_hash_table_steal (added, file_path);
+      g_free (key);
+      if (project_key != NULL)
+        *project_key = value;
+      else
+        g_free (value);
+    }
+
+  if (file_search_image_lookup (image, file_path, &entry, &project))
+    {
+      removed[entry / 8] |= 1 << (entry % 8);
+      if (project_key != NULL && *project_key == NULL)
+        *project_key = g_strdup (file_search_image_get_project_key (image, project));
+    }
+}
+
+/* every path of the index file with the log replayed on top */
+static GBytes*
+build_replayed (FileSearchJournal *journal,
+                FileSearchImage   *image,
+                gdouble            false_positive_rate)
+{
+  GHashTable *files;
+  GList *indexes;
+  GBytes *bytes;
+
+  files = file_search_journal_replay (journal, image);
+  indexes = get_indexes (files);
+
+  bytes = file_search_image_build (indexes, file_search_journal_get_generation (journal),
+                                   false_positive_rate, 0);
+
+  g_list_foreach (indexes, (GFunc) g_object_unref, NULL);
+  g_list_free (indexes);
+  g_hash_table_destroy (files);
+
+  return bytes;
+}
+
+/* the indexes of a table of file paths and their project keys */
+static GList*
+get_indexes (GHashTable *files)
+{
+  GHashTableIter iter;
+  gpointer file_path;
+  gpointer project_key;
+  GList *indexes = NULL;
+
+  g_hash_table_iter_init (&iter, files);
+  while (g_hash_table_iter_next (&iter, &file_path, &project_key))
+    {
+      FileSearchIndex *index;
+      gchar *file_name;
+
+      file_name = g_path_get_basename (file_path);
+      index = file_search_index_new ();
+      file_search_index_set_file_name (index, file_name);
+      file_search_index_set_file_path (index, file_path);
+      file_search_index_set_project_key (index, project_key);
+      indexes = g_list_prepend (indexes, index);
+      g_free (file_name);
+    }
+
+  return indexes;
+}
+
+/* an image built in memory is mapped from a memfd like a published one */
+static FileSearchImage*
+open_bytes (GBytes  *bytes,
+            GError **error)
+{
+  FileSearchImage *image = NULL;
+  gint fd;
+
+  fd = file_search_image_publish (bytes, error);
+  if (fd >= 0)
+    {
+      image = file_search_image_new_from_fd (fd, error);
+      close (fd);
+    }
+
+  return image;
+}
+
+FileSearchJournalRecord*
+file_search_journal_record_new (FileSearchJournalOp  op,
+                                const gchar         *project_key,
+                                const gchar         *file_path,
+                                const gchar         *new_file_path)
+{
+  FileSearchJournalRecord *record;
+
+  record = g_slice_new (FileSearchJournalRecord);
+  record->op = op;
+  record->project_key = g_strdup (project_key);
+  record->file_path = g_strdup (file_path);
+  record->new_file_path = g_strdup (new_file_path);
+
+  return record;
+}
+
+void
+file_search_journal_record_free (FileSearchJournalRecord *record)
+{
+  g_free (record->project_key);
+  g_free (record->file_path);
+  g_free (record->new_file_path);
+  g_slice_free (FileSearchJournalRecord, record);
+}
+
+/* the CRC-32 of zlib and gzip, without needing either */
+static guint32
+get_crc (const guint8 *data,
+         gsize         length)
+{
+  static guint32 table[256];
+  static gsize initialized = 0;
+  guint32 crc = 0xffffffff;
+  gsize i;
+
+  if (g_once_init_enter (&initialized))
+    {
+      guint32 n;
+      for (n = 0; n < 256; n++)
+        {
+          guint32 c = n;
+          gint k;
+          for (k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+          table[n] = c;
+        }
+      g_once_init_leave (&initialized, 1);
+    }
+
+  for (i = 0; i < length; i++)
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+  return crc ^ 0xffffffff;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_JOURNAL_H__
+#define	__FILE_SEARCH_JOURNAL_H__
+
+#include <glib-object.h>
+#include "filesearch-image.h"
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_JOURNAL_TYPE            (file_search_journal_get_type ())
+#define FILE_SEARCH_JOURNAL(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_JOURNAL_TYPE, FileSearchJournal))
+#define FILE_SEARCH_JOURNAL_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_JOURNAL_TYPE, FileSearchJournalClass))
+#define IS_FILE_SEARCH_JOURNAL(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_JOURNAL_TYPE))
+#define IS_FILE_SEARCH_JOURNAL_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_JOURNAL_TYPE))
+
+/* the log lives next to the index file it applies to */
+#define FILE_SEARCH_JOURNAL_SUFFIX          ".log"
+
+/* past this many bytes the writer folds the log into a new index file */
+#define FILE_SEARCH_JOURNAL_MAX_SIZE        (1 << 20)
+
+typedef struct _FileSearchJournal FileSearchJournal;
+typedef struct _FileSearchJournalClass FileSearchJournalClass;
+
+typedef enum
+{
+  FILE_SEARCH_JOURNAL_ADD = 1,
+  FILE_SEARCH_JOURNAL_REMOVE,
+  FILE_SEARCH_JOURNAL_RENAME,
+  FILE_SEARCH_JOURNAL_COMMIT
+} FileSearchJournalOp;
+
+/* the project key is only set on additions, the new path only on renames */
+typedef struct
+{
+  FileSearchJournalOp  op;
+  gchar               *project_key;
+  gchar               *file_path;
+  gchar               *new_file_path;
+} FileSearchJournalRecord;
+
+struct _FileSearchJournal
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchJournalClass
+{
+  GObjectClass parent_class;
+};
+
+GType file_search_journal_get_type (void) G_GNUC_CONST;
+
+FileSearchJournal*  file_search_journal_new_from_file  (const gchar       *file_path,
+                                                        guint64            base_generation);
+
+guint64             file_search_journal_get_generation (FileSearchJournal *journal);
+gsize               file_search_journal_get_length     (FileSearchJournal *journal);
+guint               file_search_journal_get_n_records  (FileSearchJournal *journal);
+
+gboolean            file_search_journal_append         (FileSearchJournal *journal,
+                                                        GPtrArray         *records,
+                                                        guint64            generation,
+                                                        GError           **error);
+GHashTable*         file_search_journal_replay         (FileSearchJournal *journal,
+                                                        FileSearchImage   *image);
+
+FileSearchImage*    file_search_journal_load_image     (const gchar       *indexes_file,
+                                                        gdouble            false_positive_rate,
+                                                        GError           **error);
+gboolean            file_search_journal_compact        (const gchar       *indexes_file,
+                                                        GBytes            *bytes,
+                                                        gdouble            false_positive_rate,
+                                                        GError           **error);
+
+FileSearchJournalRecord*  file_search_journal_record_new  (FileSearchJournalOp      op,
+                                                           const gchar             *project_key,
+                                                           const gchar             *file_path,
+                                                           const gchar             *new_file_path);
+void                      file_search_journal_record_free (FileSearchJournalRecord *record);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_JOURNAL_H__ */
@@ -0,0 +1,766 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include "filesearch-index.h"
+#include "filesearch-matcher.h"
+
+/* an entry that matched, with the runs of its name to highlight */
+typedef struct
+{
+  guint               entry;
+  guint               n_spans;
+  FileSearchQuerySpan spans[FILE_SEARCH_QUERY_MAX_SPANS];
+} Match;
+
+typedef struct
+{
+  Match  match;
+  gchar *file_name;
+} Hit;
+
+/*
+ * A piece of one run of the image. Each task keeps the best names it
+ * matched in a heap with the last of them on top, so nothing past the
+ * limit is ever copied out of the image. A run of the overlay numbers
+ * its entries on from those of the image by the offset.
+ */
+typedef struct
+{
+  FileSearchImage *image;
+  FileSearchQuery *query;
+  const gchar     *globbing;
+  guint            offset;
+  guint            first;
+  guint            limit;
+  GPtrArray       *heap;
+  guint            n_matches;
+  guint            n_skipped;
+} Task;
+
+/* the matches a query came up with, in the order they are handed back */
+typedef struct
+{
+  gchar    *key;
+  GArray   *matches;
+  gboolean  truncated;
+  GList    *link;
+} Result;
+
+static void file_search_matcher_class_init  (FileSearchMatcherClass *klass);
+static void file_search_matcher_init        (FileSearchMatcher      *matcher);
+static void file_search_matcher_finalize    (FileSearchMatcher      *matcher);
+
+static GPtrArray* split_runs                (FileSearchMatcher      *matcher,
+                                             GArray                 *runs,
+                                             gboolean               *parallel);
+static void add_overlay_tasks               (GPtrArray              *tasks,
+                                             FileSearchImage        *image,
+                                             FileSearchQuery        *query,
+                                             const gchar            *globbing,
+                                             const guint8           *scope);
+static gboolean run_parallel                (FileSearchMatcher      *matcher,
+                                             GPtrArray              *tasks);
+static void run_pooled_task                 (Task                   *task,
+                                             FileSearchMatcher      *matcher);
+static void run_task                        (Task                   *task,
+                                             FileSearchQuery        *query);
+static void add_hit                         (Task                   *task,
+                                             FileSearchQuery        *query,
+                                             FileSearchImageCursor  *cursor);
+static void sift_up                         (GPtrArray              *heap,
+                                             guint                   i);
+static void sift_down                       (GPtrArray              *heap,
+                                             guint                   i);
+static gint compare_hits                    (gconstpointer           a,
+                                             gconstpointer           b);
+static GList* load_entries                  (FileSearchImage        *image,
+                                             GArray                 *matches);
+static gchar* get_cache_key                 (FileSearchImage        *image,
+                                             FileSearchQuery        *query,
+                                             const guint8           *scope);
+static Result* cache_lookup                 (FileSearchMatcher      *matcher,
+                                             FileSearchImage        *image,
+                                             const gchar            *key);
+static void cache_insert                    (FileSearchMatcher      *matcher,
+                                             gchar                  *key,
+                                             GArray                 *matches,
+                                             gboolean                truncated);
+static void task_free                       (Task                   *task);
+static void hit_free                        (Hit                    *hit);
+static void result_free                     (Result                 *result);
+
+#define FILE_SEARCH_MATCHER_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_MATCHER_TYPE, FileSearchMatcherPrivate))
+
+/* below this many candidate entries the query is matched on the calling thread */
+#define INLINE_ENTRIES   32768
+
+/* enough tasks per worker to even out the runs that match more than others */
+#define TASKS_PER_THREAD 4
+
+/* the least entries worth handing to a worker */
+#define MIN_TASK_ENTRIES 4096
+
+/* results of queries kept, the least recently run go first */
+#define CACHE_SIZE       32
+
+typedef struct _FileSearchMatcherPrivate FileSearchMatcherPrivate;
+
+/*
+ * The pool is only started by the first query big enough to need it,
+ * after that its threads wait around for the next one. The calling
+ * thread blocks until the last of its tasks is done.
+ *
+ * The results of the last few queries are cached by their normalized 
+ * text and scope, since the same queries come back over and over while
+ * typing and deleting. They only hold for the generation of the image
+ * they were matched in, a new generation empties the cache.
+ */
+struct _FileSearchMatcherPrivate
+{
+  FileSearchStats *stats;
+  GThreadPool     *pool;
+  glong            n_threads;
+  GMutex           mutex;
+  GCond            cond;
+  guint            pending;
+  guint64          generation;
+  GHashTable      *cache;
+  GQueue           lru;
+};
+
+G_DEFINE_TYPE (FileSearchMatcher, file_search_matcher, G_TYPE_OBJECT)
+
+static void
+file_search_matcher_class_init (FileSearchMatcherClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = (GObjectFinalizeFunc) file_search_matcher_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchMatcherPrivate));
+}
+
+static void
+file_search_matcher_init (FileSearchMatcher *matcher)
+{
+  FileSearchMatcherPrivate *priv;
+  priv = FILE_SEARCH_MATCHER_GET_PRIVATE (matcher);
+  priv->stats = NULL;
+  priv->pool = NULL;
+  priv->pending = 0;
+  g_mutex_init (&priv->mutex);
+  g_cond_init (&priv->cond);
+  priv->generation = 0;
+  priv->cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, 
+                                       (GDestroyNotify) result_free);
+  g_queue_init (&priv->lru);
+
+  priv->n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+  if (priv->n_threads < 1)
+    priv->n_threads = 1;
+}
+
+static void
+file_search_matcher_finalize (FileSearchMatcher *matcher)
+{
+  FileSearchMatcherPrivate *priv;
+  priv = FILE_SEARCH_MATCHER_GET_PRIVATE (matcher);
+
+  if (priv->pool != NULL)
+    g_thread_pool_free (priv->pool, TRUE, TRUE);
+
+  g_mutex_clear (&priv->mutex);
+  g_cond_clear (&priv->cond);
+  g_hash_table_destroy (priv->cache);
+  g_queue_clear (&priv->lru);
+
+  G_OBJECT_CLASS (file_search_matcher_parent_class)->finalize (G_OBJECT (matcher));
+}
+
+FileSearchMatcher*
+file_search_matcher_new (FileSearchStats *stats)
+{
+  FileSearchMatcherPrivate *priv;
+  FileSearchMatcher *matcher;
+
+  matcher = FILE_SEARCH_MATCHER (g_object_new (file_search_matcher_get_type (), NULL));
+  priv = FILE_SEARCH_MATCHER_GET_PRIVATE (matcher);
+  priv->stats = stats;
+
+  return matcher;
+}
+
+/*
+ * Matches the query against the entries of the projects in scope and
+ * returns the first FILE_SEARCH_MATCHER_MAX_RESULTS of them in file name
+ * order, as new FileSearchIndex objects with the spans of their names 
+ * set. Sets truncated when there were more matches than that. Small 
+ * queries run right here, the rest are split across the pool and their 
+ * best names merged at the end. A query that was run on the same 
+ * generation before is answered from the cache. Only one thread at a 
+ * time may run queries.
+ */
+GList*
+file_search_matcher_run (FileSearchMatcher *matcher,
+                         FileSearchImage   *image,
+                         FileSearchQuery   *query,
+                         const guint8      *scope,
+                         gboolean          *truncated)
+{
+  FileSearchMatcherPrivate *priv;
+  const gchar *globbing;
+  GArray *runs;
+  GPtrArray *tasks;
+  GPtrArray *hits;
+  GArray *matches;
+  GList *results;
+  Result *result;
+  gchar *key;
+  gboolean parallel;
+  guint n_matches = 0;
+  guint n_skipped = 0;
+  gint64 start;
+  gint64 load_start;
+  guint i;
+
+  priv = FILE_SEARCH_MATCHER_GET_PRIVATE (matcher);
+
+  start = g_get_monotonic_time ();
+
+  key = get_cache_key (image, query, scope);
+  result = cache_lookup (matcher, image, key);
+  if (result != NULL)
+    {
+      g_free (key);
+      *truncated = result->truncated;
+      results = load_entries (image, result->matches);
+      file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_LOAD, 
+                                g_get_monotonic_time () - start);
+      return results;
+    }
+
+  globbing = file_search_query_get_globbing (query);
+  runs = file_search_image_get_runs (image, globbing, scope);
+  tasks = split_runs (matcher, runs, &parallel);
+  g_array_free (runs, TRUE);
+
+  for (i = 0; i < tasks->len; i++)
+    {
+      Task *task = g_ptr_array_index (tasks, i);
+      task->image = image;
+      task->query = query;
+      task->globbing = globbing;
+    }
+    
+  if (file_search_image_get_overlay (image) != NULL)
+    add_overlay_tasks (tasks, image, query, globbing, scope);
+
+  if (!parallel || !run_parallel (matcher, tasks))
+    {
+      for (i = 0; i < tasks->len; i++)
+        run_task (g_ptr_array_index (tasks, i), query);
+    }
+
+  hits = g_ptr_array_new_with_free_func ((GDestroyNotify) hit_free);
+
+  for (i = 0; i < tasks->len; i++)
+    {
+      Task *task = g_ptr_array_index (tasks, i);
+      guint j;
+
+      n_matches += task->n_matches;
+      n_skipped += task->n_skipped;
+
+      for (j = 0; j < task->heap->len; j++)
+        g_ptr_array_add (hits, g_ptr_array_index (task->heap, j));
+      g_ptr_array_set_size (task->heap, 0);
+    }
+
+  g_ptr_array_foreach (tasks, (GFunc) task_free, NULL);
+  g_ptr_array_free (tasks, TRUE);
+
+  g_ptr_array_sort (hits, compare_hits);
+  if (hits->len > FILE_SEARCH_MATCHER_MAX_RESULTS)
+    g_ptr_array_set_size (hits, FILE_SEARCH_MATCHER_MAX_RESULTS);
+
+  *truncated = n_matches > hits->len;
+
+  matches = g_array_sized_new (FALSE, FALSE, sizeof (Match), hits->len);
+  for (i = 0; i < hits->len; i++)
+    g_array_append_val (matches, ((Hit *) g_ptr_array_index (hits, i))->match);
+  g_ptr_array_free (hits, TRUE);
+
+  load_start = g_get_monotonic_time ();
+  results = load_entries (image, matches);
+  cache_insert (matcher, key, matches, *truncated);
+
+  file_search_stats_add (priv->stats, FILE_SEARCH_COUNTER_BLOCKS_SKIPPED, n_skipped);
+  file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_MATCH, load_start - start);
+  file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_LOAD, 
+                            g_get_monotonic_time () - load_start);
+
+  return results;
+}
+
+/*
+ * Cuts the runs into tasks of about the same number of entries, a few
+ * per worker. A query with few candidates stays a task per run.
+ */
+static GPtrArray*
+split_runs (FileSearchMatcher *matcher,
+            GArray            *runs,
+            gboolean          *parallel)
+{
+  FileSearchMatcherPrivate *priv;
+  GPtrArray *tasks;
+  guint n_entries = 0;
+  guint task_entries = G_MAXUINT;
+  guint i;
+
+  priv = FILE_SEARCH_MATCHER_GET_PRIVATE (matcher);
+
+  for (i = 0; i < runs->len; i++)
+    {
+      FileSearchImageRun *run = &g_array_index (runs, FileSearchImageRun, i);
+      n_entries += run->limit - run->first;
+    }
+
+  *parallel = priv->n_threads > 1 && n_entries >= INLINE_ENTRIES;
+  if (*parallel)
+    task_entries = MAX (MIN_TASK_ENTRIES, n_entries / (priv->n_threads * TASKS_PER_THREAD));
+
+  tasks = g_ptr_array_new ();
+
+  for (i = 0; i < runs->len; i++)
+    {
+      FileSearchImageRun *run = &g_array_index (runs, FileSearchImageRun, i);
+      guint first = run->first;
+
+      while (first < run->limit)
+        {
+          Task *task = g_slice_new0 (Task);
+          task->first = first;
+          task->limit = run->limit - first > task_entries ? first + task_entries : run->limit;
+          task->heap = g_ptr_array_new ();
+          g_ptr_array_add (tasks, task);
+          first = task->limit;
+        }
+    }
+
+  return tasks;
+}
+
+/*
+ * The files the log added since the image was written, a task per run.
+ * The scope is over the projects of the image, so it is mapped onto the
+ * projects of the overlay by their keys.
+ */
+static void
+add_overlay_tasks (GPtrArray       *tasks,
+                   FileSearchImage *image,
+                   FileSearchQuery *query,
+                   const gchar     *globbing,
+                   const guint8    *scope)
+{
+  FileSearchImage *overlay;
+  guint8 *overlay_scope = NULL;
+  GArray *runs;
+  guint i;
+
+  overlay = file_search_image_get_overlay (image);
+
+  if (scope != NULL)
+    {
+      guint n_projects = file_search_image_get_n_projects (overlay);
+      guint j = 0;
+
+      /* both lists of project keys are sorted */
+      overlay_scope = g_malloc0 ((n_projects + 7) / 8);
+      for (i = 0; i < n_projects; i++)
+        {
+          const gchar *project_key = file_search_image_get_project_key (overlay, i);
+          
+          while (j < file_search_image_get_n_projects (image) &&
+                 strcmp (file_search_image_get_project_key (image, j), project_key) < 0)
+            j++;
+          
+          if (j < file_search_image_get_n_projects (image) &&
+              strcmp (file_search_image_get_project_key (image, j), project_key) == 0 &&
+              (scope[j / 8] & (1 << (j % 8))) != 0)
+            overlay_scope[i / 8] |= 1 << (i % 8);
+        }
+    }
+
+  runs = file_search_image_get_runs (overlay, globbing, overlay_scope);
+
+  for (i = 0; i < runs->len; i++)
+    {
+      FileSearchImageRun *run = &g_array_index (runs, FileSearchImageRun, i);
+      Task *task = g_slice_new0 (Task);
+      task->image = overlay;
+      task->query = query;
+      task->globbing = globbing;
+      task->offset = file_search_image_get_n_entries (image);
+      task->first = run->first;
+      task->limit = run->limit;
+      task->heap = g_ptr_array_new ();
+      g_ptr_array_add (tasks, task);
+    }
+
+  g_array_free (runs, TRUE);
+  g_free (overlay_scope);
+}
+
+/*
+ * Hands the tasks to the pool and waits for all of them. Returns FALSE,
+ * with nothing run, if the pool could not be started.
+ */
+static gboolean
+run_parallel (FileSearchMatcher *matcher,
+              GPtrArray         *tasks)
+{
+  FileSearchMatcherPrivate *priv;
+  guint i;
+
+  priv = FILE_SEARCH_MATCHER_GET_PRIVATE (matcher);
+
+  if (priv->pool == NULL)
+    {
+      GError *error = NULL;
+      priv->pool = g_thread_pool_new ((GFunc) run_pooled_task, matcher, 
+                                      priv->n_threads, TRUE, &error);
+      if (error != NULL)
+        {
+          g_warning ("Not able to start the query threads: %s", error->message);
+          g_error_free (error);
+          if (priv->pool != NULL)
+            g_thread_pool_free (priv->pool, TRUE, TRUE);
+          priv->pool = NULL;
+          priv->n_threads = 1;
+          return FALSE;
+        }
+    }
+
+  g_mutex_lock (&priv->mutex);
+  priv->pending = tasks->len;
+  g_mutex_unlock (&priv->mutex);
+
+  for (i = 0; i < tasks->len; i++)
+    g_thread_pool_push (priv->pool, g_ptr_array_index (tasks, i), NULL);
+
+  g_mutex_lock (&priv->mutex);
+  while (priv->pending > 0)
+    g_cond_wait (&priv->cond, &priv->mutex);
+  g_mutex_unlock (&priv->mutex);
+
+  return TRUE;
+}
+
+/*
+ * The query caches what it matched per directory and project, so every 
+ * task compiles a copy of its own to match with.
+ */
+static void
+run_pooled_task (Task              *task,
+                 FileSearchMatcher *matcher)
+{
+  FileSearchMatcherPrivate *priv;
+  FileSearchQuery *query;
+
+  priv = FILE_SEARCH_MATCHER_GET_PRIVATE (matcher);
+
+  query = file_search_query_new (file_search_query_get_text (task->query),
+                                 file_search_query_get_match_case (task->query));
+  run_task (task, query);
+  g_object_unref (query);
+
+  g_mutex_lock (&priv->mutex);
+  if (--priv->pending == 0)
+    g_cond_signal (&priv->cond);
+  g_mutex_unlock (&priv->mutex);
+}
+
+static void
+run_task (Task            *task,
+          FileSearchQuery *query)
+{
+  FileSearchImageCursor cursor;
+
+  file_search_image_cursor_init_run (task->image, &cursor, task->globbing, 
+                                     task->first, task->limit);
+
+  while (file_search_image_cursor_next (&cursor))
+    {
+      if (file_search_query_match_cursor (query, &cursor))
+        add_hit (task, query, &cursor);
+    }
+
+  task->n_skipped = cursor.n_skipped;
+}
+
+/* 
+ * The spans are only worked out for the names that get into the heap,
+ * most matches of a broad query never do.
+ */
+static void
+add_hit (Task                  *task,
+         FileSearchQuery       *query,
+         FileSearchImageCursor *cursor)
+{
+  Hit *hit;
+
+  task->n_matches++;
+
+  /* the entries come in order, so a name equal to the last kept one loses */
+  if (task->heap->len == FILE_SEARCH_MATCHER_MAX_RESULTS)
+    {
+      hit = g_ptr_array_index (task->heap, 0);
+      if (strcmp (cursor->file_name, hit->file_name) >= 0)
+        return;
+      g_free (hit->file_name);
+      hit->file_name = g_strndup (cursor->file_name, cursor->length);
+      hit->match.entry = cursor->entry + task->offset;
+      hit->match.n_spans = file_search_query_get_cursor_spans (query, cursor, hit->match.spans);
+      sift_down (task->heap, 0);
+      return;
+    }
+
+  hit = g_slice_new (Hit);
+  hit->match.entry = cursor->entry + task->offset;
+  hit->match.n_spans = file_search_query_get_cursor_spans (query, cursor, hit->match.spans);
+  hit->file_name = g_strndup (cursor->file_name, cursor->length);
+  g_ptr_array_add (task->heap, hit);
+  sift_up (task->heap, task->heap->len - 1);
+}
+
+static void
+sift_up (GPtrArray *heap,
+         guint      i)
+{
+  while (i > 0)
+    {
+      guint parent = (i - 1) / 2;
+      gpointer swap;
+
+      if (compare_hits (&heap->pdata[i], &heap->pdata[parent]) <= 0)
+        break;
+
+      swap = heap->pdata[i];
+      heap->pdata[i] = heap->pdata[parent];
+      heap->pdata[parent] = swap;
+      i = parent;
+    }
+}
+
+static void
+sift_down (GPtrArray *heap,
+           guint      i)
+{
+  for (;;)
+    {
+      guint largest = i;
+      guint child = 2 * i + 1;
+      gpointer swap;
+
+      if (child < heap->len && 
+          compare_hits (&heap->pdata[child], &heap->pdata[largest]) > 0)
+        largest = child;
+      if (child + 1 < heap->len && 
+          compare_hits (&heap->pdata[child + 1], &heap->pdata[largest]) > 0)
+        largest = child + 1;
+
+      if (largest == i)
+        break;
+
+      swap = heap->pdata[i];
+      heap->pdata[i] = heap->pdata[largest];
+      heap->pdata[largest] = swap;
+      i = largest;
+    }
+}
+
+/* the order of the list, the file name and then the entry */
+static gint
+compare_hits (gconstpointer a,
+              gconstpointer b)
+{
+  const Hit *hit_a = *((Hit**) a);
+  const Hit *hit_b = *((Hit**) b);
+  gint result;
+
+  result = strcmp (hit_a->file_name, hit_b->file_name);
+  if (result != 0)
+    return result;
+
+  return hit_a->match.entry < hit_b->match.entry ? -1 : 
+         hit_a->match.entry > hit_b->match.entry;
+}
+
+/* only the hits that made the cut are worth a path and an object */
+static GList*
+load_entries (FileSearchImage *image,
+              GArray          *matches)
+{
+  FileSearchImageCursor cursor;
+  GList *results = NULL;
+  guint n_entries;
+  guint i;
+
+  n_entries = file_search_image_get_n_entries (image);
+
+  for (i = matches->len; i > 0; i--)
+    {
+      Match *match = &g_array_index (matches, Match, i - 1);
+      FileSearchIndex *index;
+      gchar *file_path;
+
+      if (match->entry < n_entries)
+        file_search_image_cursor_init (image, &cursor, match->entry);
+      else
+        file_search_image_cursor_init (file_search_image_get_overlay (image), &cursor, 
+                                       match->entry - n_entries);
+      if (!file_search_image_cursor_next (&cursor))
+        continue;
+
+      file_path = file_search_image_cursor_get_file_path (&cursor);
+      if (file_path == NULL)
+        continue;
+
+      index = file_search_index_new ();
+      file_search_index_set_file_name (index, cursor.file_name);
+      file_search_index_set_folded_name (index, cursor.key);
+      file_search_index_set_file_path (index, file_path);
+      file_search_index_set_project_key (index, file_search_image_cursor_get_project_key (&cursor));
+      if (match->n_spans > 0)
+        {
+          GBytes *spans;
+          spans = g_bytes_new (match->spans, match->n_spans * sizeof (FileSearchQuerySpan));
+          file_search_index_set_spans (index, spans);
+          g_bytes_unref (spans);
+        }
+      results = g_list_prepend (results, index);
+      g_free (file_path);
+    }
+
+  return results;
+}
+
+/* 
+ * The scope is part of the key as well, as the bitmap over the project
+ * ids it is.
+ */
+static gchar*
+get_cache_key (FileSearchImage *image,
+               FileSearchQuery *query,
+               const guint8    *scope)
+{
+  GString *key;
+
+  key = g_string_new (NULL);
+  g_string_append_printf (key, "%d %s\n", file_search_query_get_match_case (query),
+                          file_search_query_get_normalized (query));
+
+  if (scope != NULL)
+    {
+      guint n_bytes = (file_search_image_get_n_projects (image) + 7) / 8;
+      guint i;
+      for (i = 0; i < n_bytes; i++)
+        g_string_append_printf (key, "%02x", scope[i]);
+    }
+
+  return g_string_free (key, FALSE);
+}
+
+static Result*
+cache_lookup (FileSearchMatcher *matcher,
+              FileSearchImage   *image,
+              const gchar       *key)
+{
+  FileSearchMatcherPrivate *priv;
+  Result *result;
+
+  priv = FILE_SEARCH_MATCHER_GET_PRIVATE (matcher);
+
+  if (file_search_image_get_generation (image) != priv->generation)
+    {
+      g_queue_clear (&priv->lru);
+      g_hash_table_remove_all (priv->cache);
+      priv->generation = file_search_image_get_generation (image);
+      return NULL;
+    }
+
+  result = g_hash_table_lookup (priv->cache, key);
+  if (result != NULL)
+    {
+      g_queue_unlink (&priv->lru, result->link);
+      g_queue_push_head_link (&priv->lru, result->link);
+    }
+
+  return result;
+}
+
+/* takes over the key and the matches */
+static void
+cache_insert (FileSearchMatcher *matcher,
+              gchar             *key,
+              GArray            *matches,
+              gboolean           truncated)
+{
+  FileSearchMatcherPrivate *priv;
+  Result *result;
+
+  priv = FILE_SEARCH_MATCHER_GET_PRIVATE (matcher);
+
+  if (g_queue_get_length (&priv->lru) == CACHE_SIZE)
+    {
+      Result *oldest = g_queue_pop_tail (&priv->lru);
+      g_hash_table_remove (priv->cache, oldest->key);
+    }
+
+  result = g_slice_new (Result);
+  result->key = key;
+  result->matches = matches;
+  result->truncated = truncated;
+  g_queue_push_head (&priv->lru, result);
+  result->link = priv->lru.head;
+  g_hash_table_insert (priv->cache, result->key, result);
+}
+
+static void
+task_free (Task *task)
+{
+  g_ptr_array_foreach (task->heap, (GFunc) hit_free, NULL);
+  g_ptr_array_free (task->heap, TRUE);
+  g_slice_free (Task, task);
+}
+
+static void
+hit_free (Hit *hit)
+{
+  g_free (hit->file_name);
+  g_slice_free (Hit, hit);
+}
+
+static void
+result_free (Result *result)
+{
+  g_free (result->key);
+  g_array_free (result->matches, TRUE);
+  g_slice_free (Result, result);
+}
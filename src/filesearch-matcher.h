@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_MATCHER_H__
+#define	__FILE_SEARCH_MATCHER_H__
+
+#include <glib-object.h>
+#include "filesearch-image.h"
+#include "filesearch-query.h"
+#include "filesearch-stats.h"
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_MATCHER_TYPE            (file_search_matcher_get_type ())
+#define FILE_SEARCH_MATCHER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_MATCHER_TYPE, FileSearchMatcher))
+#define FILE_SEARCH_MATCHER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_MATCHER_TYPE, FileSearchMatcherClass))
+#define IS_FILE_SEARCH_MATCHER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_MATCHER_TYPE))
+#define IS_FILE_SEARCH_MATCHER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_MATCHER_TYPE))
+
+/* only the first names in file name order are handed back */
+#define FILE_SEARCH_MATCHER_MAX_RESULTS 1000
+
+typedef struct _FileSearchMatcher FileSearchMatcher;
+typedef struct _FileSearchMatcherClass FileSearchMatcherClass;
+
+struct _FileSearchMatcher
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchMatcherClass
+{
+  GObjectClass parent_class;
+};
+
+GType file_search_matcher_get_type (void) G_GNUC_CONST;
+
+FileSearchMatcher*  file_search_matcher_new  (FileSearchStats   *stats);
+
+GList*              file_search_matcher_run  (FileSearchMatcher *matcher,
+                                              FileSearchImage   *image,
+                                              FileSearchQuery   *query,
+                                              const guint8      *scope,
+                                              gboolean          *truncated);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_MATCHER_H__ */
@@ -42,7 +42,7 @@ activate (CodeSlayer *codeslayer)
   
   codeslayer_add_to_menu_bar (codeslayer, GTK_MENU_ITEM (menu));
   
-  file_search_engine_index_files (engine);
+  file_search_engine_start (engine);
 }
 
 G_MODULE_EXPORT void 
@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include "filesearch-preview.h"
+
+typedef struct
+{
+  FileSearchPreview *preview;
+  gchar             *file_path;
+  GCancellable      *cancellable;
+  gchar             *text;
+  gboolean           shown;
+  gboolean           changed;
+} Request;
+
+typedef struct
+{
+  gchar  *file_path;
+  gint64  mtime;
+  gint64  size;
+  gchar  *text;
+  GList  *link;
+} Entry;
+
+static void file_search_preview_class_init  (FileSearchPreviewClass *klass);
+static void file_search_preview_init        (FileSearchPreview      *preview);
+static void file_search_preview_finalize    (FileSearchPreview      *preview);
+
+static void load_func                       (Request                *request,
+                                             FileSearchPreview      *preview);
+static gchar* read_head                     (const gchar            *file_path);
+static void cache_insert                    (FileSearchPreview      *preview,
+                                             const gchar            *file_path,
+                                             gint64                  mtime,
+                                             gint64                  size,
+                                             const gchar            *text);
+static gboolean deliver_action              (Request                *request);
+static void request_free                    (Request                *request);
+static void entry_free                      (Entry                  *entry);
+
+#define FILE_SEARCH_PREVIEW_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_PREVIEW_TYPE, FileSearchPreviewPrivate))
+
+/* heads of files kept, the least recently shown go first */
+#define CACHE_SIZE 64
+
+typedef struct _FileSearchPreviewPrivate FileSearchPreviewPrivate;
+
+/*
+ * The heads are read on a single worker thread, so that a slow disk never
+ * holds up the dialog, and kept in a small cache that is checked against
+ * the modification time and size of the file before it is trusted. Only 
+ * the request for the selected row is ever current, moving the selection
+ * cancels it.
+ */
+struct _FileSearchPreviewPrivate
+{
+  FileSearchStats *stats;
+  GThreadPool     *pool;
+  GMutex           mutex;
+  GHashTable      *cache;
+  GQueue           lru;
+  Request         *current;
+};
+
+enum
+{
+  LOADED,
+  LAST_SIGNAL
+};
+
+static guint file_search_preview_signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE (FileSearchPreview, file_search_preview, G_TYPE_OBJECT)
+
+static void
+file_search_preview_class_init (FileSearchPreviewClass *klass)
+{
+  file_search_preview_signals[LOADED] =
+    g_signal_new ("loaded",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS,
+                  G_STRUCT_OFFSET (FileSearchPreviewClass, loaded),
+                  NULL, NULL,
+                  g_cclosure_marshal_generic, G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_STRING);
+
+  G_OBJECT_CLASS (klass)->finalize = (GObjectFinalizeFunc) file_search_preview_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchPreviewPrivate));
+}
+
+static void
+file_search_preview_init (FileSearchPreview *preview)
+{
+  FileSearchPreviewPrivate *priv;
+  priv = FILE_SEARCH_PREVIEW_GET_PRIVATE (preview);
+  priv->stats = NULL;
+  priv->pool = g_thread_pool_new ((GFunc) load_func, preview, 1, FALSE, NULL);
+  g_mutex_init (&priv->mutex);
+  priv->cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, 
+                                       (GDestroyNotify) entry_free);
+  g_queue_init (&priv->lru);
+  priv->current = NULL;
+}
+
+static void
+file_search_preview_finalize (FileSearchPreview *preview)
+{
+  FileSearchPreviewPrivate *priv;
+  priv = FILE_SEARCH_PREVIEW_GET_PRIVATE (preview);
+  /* every request holds a reference, so the pool is idle by now */
+  g_thread_pool_free (priv->pool, TRUE, TRUE);
+  if (priv->stats)
+    g_object_unref (priv->stats);
+  g_hash_table_destroy (priv->cache);
+  g_queue_clear (&priv->lru);
+  g_mutex_clear (&priv->mutex);
+  G_OBJECT_CLASS (file_search_preview_parent_class)->finalize (G_OBJECT (preview));
+}
+
+FileSearchPreview*
+file_search_preview_new (FileSearchStats *stats)
+{
+  FileSearchPreviewPrivate *priv;
+  FileSearchPreview *preview;
+
+  preview = FILE_SEARCH_PREVIEW (g_object_new (file_search_preview_get_type (), NULL));
+  priv = FILE_SEARCH_PREVIEW_GET_PRIVATE (preview);
+  priv->stats = g_object_ref (stats);
+
+  return preview;
+}
+
+/*
+ * Emits "loaded" with the head of the file, or NULL text when it cannot
+ * be read or is binary. A cached head is shown straight away and shown 
+ * again only if the worker finds the file changed since.
+ */
+void
+file_search_preview_load (FileSearchPreview *preview,
+                          const gchar       *file_path)
+{
+  FileSearchPreviewPrivate *priv;
+  Request *request;
+  Entry *entry;
+  gchar *text = NULL;
+  
+  priv = FILE_SEARCH_PREVIEW_GET_PRIVATE (preview);
+  
+  file_search_preview_cancel (preview);
+  
+  request = g_slice_new0 (Request);
+  request->preview = g_object_ref (preview);
+  request->file_path = g_strdup (file_path);
+  request->cancellable = g_cancellable_new ();
+  priv->current = request;
+  
+  g_mutex_lock (&priv->mutex);
+  entry = g_hash_table_lookup (priv->cache, file_path);
+  if (entry != NULL)
+    {
+      g_queue_unlink (&priv->lru, entry->link);
+      g_queue_push_head_link (&priv->lru, entry->link);
+      text = g_strdup (entry->text);
+      request->shown = TRUE;
+    }
+  g_mutex_unlock (&priv->mutex);
+  
+  if (request->shown)
+    {
+      g_signal_emit_by_name ((gpointer) preview, "loaded", file_path, text);
+      g_free (text);
+    }
+  
+  g_thread_pool_push (priv->pool, request, NULL);
+}
+
+/*
+ * A cancelled request is still freed by the worker, it is just never 
+ * delivered.
+ */
+void
+file_search_preview_cancel (FileSearchPreview *preview)
+{
+  FileSearchPreviewPrivate *priv;
+  priv = FILE_SEARCH_PREVIEW_GET_PRIVATE (preview);
+  
+  if (priv->current != NULL)
+    {
+      g_cancellable_cancel (priv->current->cancellable);
+      priv->current = NULL;
+    }
+}
+
+static void
+load_func (Request           *request,
+           FileSearchPreview *preview)
+{
+  FileSearchPreviewPrivate *priv;
+  GStatBuf stat_buf;
+  Entry *entry;
+  gint64 start;
+  
+  priv = FILE_SEARCH_PREVIEW_GET_PRIVATE (preview);
+  
+  /* arrowing through the list queues up requests that are stale by now */
+  if (g_cancellable_is_cancelled (request->cancellable))
+    {
+      g_idle_add ((GSourceFunc) deliver_action, request);
+      return;
+    }
+  
+  start = g_get_monotonic_time ();
+    
+  if (g_stat (request->file_path, &stat_buf) == 0)
+    {
+      g_mutex_lock (&priv->mutex);
+      entry = g_hash_table_lookup (priv->cache, request->file_path);
+      if (entry != NULL && entry->mtime == stat_buf.st_mtime && entry->size == stat_buf.st_size)
+        request->text = g_strdup (entry->text);
+      else
+        entry = NULL;
+      g_mutex_unlock (&priv->mutex);
+      
+      if (entry == NULL)
+        {
+          request->text = read_head (request->file_path);
+          request->changed = TRUE;
+          cache_insert (preview, request->file_path, stat_buf.st_mtime, 
+                        stat_buf.st_size, request->text);
+        }
+    }
+  else
+    {
+      request->changed = TRUE;
+    }
+  
+  file_search_stats_record (priv->stats, FILE_SEARCH_PHASE_PREVIEW, 
+                            g_get_monotonic_time () - start);
+  
+  g_idle_add ((GSourceFunc) deliver_action, request);
+}
+
+/*
+ * The whole head is asked for up front, so that a cold file costs one
+ * round trip to the disk instead of a read ahead window at a time.
+ */
+static gchar*
+read_head (const gchar *file_path)
+{
+  gchar *buffer;
+  const gchar *end;
+  gsize length = 0;
+  gint lines = 0;
+  gsize i;
+  int fd;
+  
+  fd = g_open (file_path, O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0)
+    return NULL;
+    
+#ifdef POSIX_FADV_WILLNEED
+  posix_fadvise (fd, 0, FILE_SEARCH_PREVIEW_MAX_BYTES, POSIX_FADV_WILLNEED);
+#endif
+
+  buffer = g_malloc (FILE_SEARCH_PREVIEW_MAX_BYTES + 1);
+  
+  while (length < FILE_SEARCH_PREVIEW_MAX_BYTES)
+    {
+      gssize n;
+      n = read (fd, buffer + length, FILE_SEARCH_PREVIEW_MAX_BYTES - length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      length += n;
+    }
+    
+  close (fd);
+  
+  if (memchr (buffer, '\0', length) != NULL)
+    {
+      g_free (buffer);
+      return NULL;
+    }
+  
+  for (i = 0; i < length; i++)
+    {
+      if (buffer[i] == '\n' && ++lines == FILE_SEARCH_PREVIEW_LINES)
+        {
+          length = i;
+          break;
+        }
+    }
+  
+  /* the last character may have been cut in half */
+  g_utf8_validate (buffer, length, &end);
+  buffer[end - buffer] = '\0';
+  
+  return buffer;
+}
+
+static void
+cache_insert (FileSearchPreview *preview,
+              const gchar       *file_path,
+              gint64             mtime,
+              gint64             size,
+              const gchar       *text)
+{
+  FileSearchPreviewPrivate *priv;
+  Entry *entry;
+  Entry *old;
+  
+  priv = FILE_SEARCH_PREVIEW_GET_PRIVATE (preview);
+  
+  entry = g_slice_new (Entry);
+  entry->file_path = g_strdup (file_path);
+  entry->mtime = mtime;
+  entry->size = size;
+  entry->text = g_strdup (text);
+  entry->link = g_list_alloc ();
+  entry->link->data = entry;
+  
+  g_mutex_lock (&priv->mutex);
+  
+  old = g_hash_table_lookup (priv->cache, file_path);
+  if (old != NULL)
+    g_queue_delete_link (&priv->lru, old->link);
+    
+  g_hash_table_replace (priv->cache, entry->file_path, entry);
+  g_queue_push_head_link (&priv->lru, entry->link);
+  
+  while (g_queue_get_length (&priv->lru) > CACHE_SIZE)
+    {
+      Entry *last = g_queue_pop_tail (&priv->lru);
+      g_hash_table_remove (priv->cache, last->file_path);
+    }
+    
+  g_mutex_unlock (&priv->mutex);
+}
+
+static gboolean
+deliver_action (Request *request)
+{
+  FileSearchPreviewPrivate *priv;
+  priv = FILE_SEARCH_PREVIEW_GET_PRIVATE (request->preview);
+  
+  if (priv->current == request)
+    {
+      priv->current = NULL;
+      if (!request->shown || request->changed)
+        g_signal_emit_by_name ((gpointer) request->preview, "loaded", 
+                               request->file_path, request->text);
+    }
+    
+  request_free (request);
+  
+  return FALSE;
+}
+
+static void
+request_free (Request *request)
+{
+  g_object_unref (request->preview);
+  g_object_unref (request->cancellable);
+  g_free (request->file_path);
+  g_free (request->text);
+  g_slice_free (Request, request);
+}
+
+static void
+entry_free (Entry *entry)
+{
+  g_free (entry->file_path);
+  g_free (entry->text);
+  g_slice_free (Entry, entry);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_PREVIEW_H__
+#define	__FILE_SEARCH_PREVIEW_H__
+
+#include <glib-object.h>
+#include "filesearch-stats.h"
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_PREVIEW_TYPE            (file_search_preview_get_type ())
+#define FILE_SEARCH_PREVIEW(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_PREVIEW_TYPE, FileSearchPreview))
+#define FILE_SEARCH_PREVIEW_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_PREVIEW_TYPE, FileSearchPreviewClass))
+#define IS_FILE_SEARCH_PREVIEW(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_PREVIEW_TYPE))
+#define IS_FILE_SEARCH_PREVIEW_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_PREVIEW_TYPE))
+
+/* the head of a file shown is this many lines, read from at most this many bytes */
+#define FILE_SEARCH_PREVIEW_LINES      50
+#define FILE_SEARCH_PREVIEW_MAX_BYTES  16384
+
+typedef struct _FileSearchPreview FileSearchPreview;
+typedef struct _FileSearchPreviewClass FileSearchPreviewClass;
+
+struct _FileSearchPreview
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchPreviewClass
+{
+  GObjectClass parent_class;
+
+  void (*loaded) (FileSearchPreview *preview,
+                  const gchar       *file_path,
+                  const gchar       *text);
+};
+
+GType file_search_preview_get_type (void) G_GNUC_CONST;
+
+FileSearchPreview*  file_search_preview_new     (FileSearchStats   *stats);
+
+void                file_search_preview_load    (FileSearchPreview *preview,
+                                                 const gchar       *file_path);
+void                file_search_preview_cancel  (FileSearchPreview *preview);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_PREVIEW_H__ */
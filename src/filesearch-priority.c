@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "filesearch-priority.h"
+
+/* from linux/ioprio.h, which is not always installed */
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_WHO_PROCESS  1
+
+/*
+ * Lowers the calling thread to the idle io class and the weakest nice
+ * value. Neither can be raised back without privileges, so only call it
+ * from threads that do nothing else.
+ */
+void
+file_search_priority_set_idle (void)
+{
+#if defined (__linux__) && defined (SYS_gettid)
+  pid_t tid = syscall (SYS_gettid);
+
+  setpriority (PRIO_PROCESS, tid, 19);
+#ifdef SYS_ioprio_set
+  syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+#endif
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_PRIORITY_H__
+#define	__FILE_SEARCH_PRIORITY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Background work of the plugin runs at the lowest cpu and io priority
+ * so that it never competes with the editor. On Linux both are set per
+ * thread, elsewhere this does nothing.
+ */
+
+void  file_search_priority_set_idle  (void);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_PRIORITY_H__ */
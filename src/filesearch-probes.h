@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_PROBES_H__
+#define	__FILE_SEARCH_PROBES_H__
+
+/*
+ * Static tracepoints for perf and bpftrace. The probes live in the
+ * "filesearch" provider, for example:
+ *
+ *   bpftrace -e 'usdt:libfilesearchcodeslayerplugin.so:filesearch:phase
+ *                { @[arg0] = hist(arg1); }'
+ *
+ * When sys/sdt.h is not available they compile to nothing.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define FILE_SEARCH_PROBE(name)              DTRACE_PROBE (filesearch, name)
+#define FILE_SEARCH_PROBE1(name, a)          DTRACE_PROBE1 (filesearch, name, a)
+#define FILE_SEARCH_PROBE2(name, a, b)       DTRACE_PROBE2 (filesearch, name, a, b)
+#define FILE_SEARCH_PROBE3(name, a, b, c)    DTRACE_PROBE3 (filesearch, name, a, b, c)
+
+#else
+
+#define FILE_SEARCH_PROBE(name)
+#define FILE_SEARCH_PROBE1(name, a)
+#define FILE_SEARCH_PROBE2(name, a, b)
+#define FILE_SEARCH_PROBE3(name, a, b, c)
+
+#endif
+
+#endif /* __FILE_SEARCH_PROBES_H__ */
@@ -0,0 +1,1042 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include "filesearch-query.h"
+#include "filesearch-fold.h"
+
+/*
+ * A query is a list of terms separated by spaces that all have to match.
+ * A term is a list of alternatives separated by '|' of which one has to
+ * match, and every alternative can be negated with a leading '!':
+ *
+ *   Dialog|Window *.h !dir:test project:codeslayer ext:c|ext:h
+ *
+ * A plain alternative matches the start of the file name, like the old
+ * single pattern did, and may hold '*' and '?' wildcards. "*.h" and
+ * "ext:h" match the extension, "dir:" the start of any directory in the
+ * path and "project:" the start of the project key.
+ *
+ * The query is compiled into one plan. Every alternative gets a bit, the
+ * terms become masks of the bits that satisfy them (positive) and of the
+ * bits whose absence satisfies them (negative). The literal prefixes and
+ * extensions are merged into two tries that set all of their bits in a
+ * single walk over the name, from the front and from the back. Only the
+ * alternatives with wildcards go through a pattern of their own. The
+ * directory and project bits are worked out once per directory and
+ * project and cached, so a long query costs about the same as a short
+ * one.
+ */
+
+typedef enum
+{
+  TERM_NAME,
+  TERM_EXTENSION,
+  TERM_DIR,
+  TERM_PROJECT
+} TermKind;
+
+typedef struct
+{
+  TermKind      kind;
+  gchar        *text;
+  GPatternSpec *pattern;
+} Term;
+
+typedef struct
+{
+  guint64 positive;
+  guint64 negative;
+} Clause;
+
+typedef struct
+{
+  guint64 accept;
+  guint   child;
+  guint   sibling;
+  guchar  byte;
+} Node;
+
+static void file_search_query_class_init  (FileSearchQueryClass *klass);
+static void file_search_query_init        (FileSearchQuery      *query);
+static void file_search_query_finalize    (FileSearchQuery      *query);
+
+static void parse_alternative             (FileSearchQuery      *query,
+                                           const gchar          *text,
+                                           Clause               *clause);
+static void append_term                   (GString              *normalized,
+                                           const Term           *term,
+                                           gboolean              alternative,
+                                           gboolean              negate);
+static void add_literal                   (GArray               *trie,
+                                           const gchar          *text,
+                                           gboolean              reverse,
+                                           guint64               bit);
+static guint64 walk_trie                  (GArray               *trie,
+                                           const gchar          *text,
+                                           gsize                 length,
+                                           gboolean              reverse);
+static guint64 match_name                 (FileSearchQuery      *query,
+                                           const gchar          *name,
+                                           gsize                 length);
+static guint64 match_dir                  (FileSearchQuery      *query,
+                                           const gchar          *dir_path);
+static guint64 match_project              (FileSearchQuery      *query,
+                                           const gchar          *project_key);
+static gboolean evaluate                  (FileSearchQuery      *query,
+                                           guint64               mask);
+static guint get_spans                    (FileSearchQuery      *query,
+                                           guint64               mask,
+                                           const gchar          *name,
+                                           gsize                 length,
+                                           FileSearchQuerySpan  *spans);
+static guint add_pattern_spans            (const gchar          *pattern,
+                                           const gchar          *name,
+                                           gsize                 length,
+                                           FileSearchQuerySpan  *spans,
+                                           guint                 n_spans);
+static guint add_span                     (FileSearchQuerySpan  *spans,
+                                           guint                 n_spans,
+                                           gsize                 start,
+                                           gsize                 end);
+static gboolean has_wildcards             (const gchar          *text);
+
+#define FILE_SEARCH_QUERY_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_QUERY_TYPE, FileSearchQueryPrivate))
+
+typedef struct _FileSearchQueryPrivate FileSearchQueryPrivate;
+
+struct _FileSearchQueryPrivate
+{
+  gchar           *text;
+  gboolean         match_case;
+  gchar           *globbing;
+  gchar           *normalized;
+  GArray          *terms;
+  GArray          *clauses;
+  GArray          *prefixes;
+  GArray          *extensions;
+  guint64          name_terms;
+  guint64          pattern_terms;
+  guint64          dir_terms;
+  guint64          project_terms;
+  guint64          last_term;
+  FileSearchImage *image;
+  GHashTable      *dirs;
+  GHashTable      *projects;
+  guint            name_entry;
+  guint64          name_mask;
+};
+
+G_DEFINE_TYPE (FileSearchQuery, file_search_query, G_TYPE_OBJECT)
+
+static void
+file_search_query_class_init (FileSearchQueryClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = (GObjectFinalizeFunc) file_search_query_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchQueryPrivate));
+}
+
+static void
+file_search_query_init (FileSearchQuery *query)
+{
+  FileSearchQueryPrivate *priv;
+  Node root = {0, 0, 0, 0};
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+  priv->text = NULL;
+  priv->match_case = FALSE;
+  priv->globbing = NULL;
+  priv->normalized = NULL;
+  priv->terms = g_array_new (FALSE, FALSE, sizeof (Term));
+  priv->clauses = g_array_new (FALSE, FALSE, sizeof (Clause));
+  priv->prefixes = g_array_new (FALSE, FALSE, sizeof (Node));
+  priv->extensions = g_array_new (FALSE, FALSE, sizeof (Node));
+  g_array_append_val (priv->prefixes, root);
+  g_array_append_val (priv->extensions, root);
+  priv->name_terms = 0;
+  priv->pattern_terms = 0;
+  priv->dir_terms = 0;
+  priv->project_terms = 0;
+  priv->last_term = 0;
+  priv->image = NULL;
+  priv->dirs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  priv->projects = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  priv->name_entry = G_MAXUINT;
+  priv->name_mask = 0;
+}
+
+static void
+file_search_query_finalize (FileSearchQuery *query)
+{
+  FileSearchQueryPrivate *priv;
+  guint i;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  for (i = 0; i < priv->terms->len; i++)
+    {
+      Term *term = &g_array_index (priv->terms, Term, i);
+      g_free (term->text);
+      if (term->pattern != NULL)
+        g_pattern_spec_free (term->pattern);
+    }
+
+  g_array_free (priv->terms, TRUE);
+  g_array_free (priv->clauses, TRUE);
+  g_array_free (priv->prefixes, TRUE);
+  g_array_free (priv->extensions, TRUE);
+  g_hash_table_destroy (priv->dirs);
+  g_hash_table_destroy (priv->projects);
+  if (priv->image != NULL)
+    g_object_unref (priv->image);
+  g_free (priv->globbing);
+  g_free (priv->normalized);
+  g_free (priv->text);
+
+  G_OBJECT_CLASS (file_search_query_parent_class)->finalize (G_OBJECT (query));
+}
+
+/*
+ * Compiles the query text. Without match_case the alternatives are case
+ * folded and have to be matched against folded names.
+ */
+FileSearchQuery*
+file_search_query_new (const gchar *text,
+                       gboolean     match_case)
+{
+  FileSearchQueryPrivate *priv;
+  FileSearchQuery *query;
+  GString *normalized;
+  gchar **tokens;
+  gchar **token;
+  gchar *seek = NULL;
+  guint i;
+
+  query = FILE_SEARCH_QUERY (g_object_new (file_search_query_get_type (), NULL));
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+  priv->text = g_strdup (text);
+  priv->match_case = match_case;
+
+  normalized = g_string_new (NULL);
+  tokens = g_strsplit_set (text, " \t", -1);
+
+  for (token = tokens; *token != NULL; token++)
+    {
+      Clause clause = {0, 0};
+      gchar **alternatives;
+      gchar **alternative;
+      guint first_term = priv->terms->len;
+
+      alternatives = g_strsplit (*token, "|", -1);
+      for (alternative = alternatives; *alternative != NULL; alternative++)
+        parse_alternative (query, *alternative, &clause);
+      g_strfreev (alternatives);
+
+      /* a term that is still being typed, like "dir:", is left out */
+      if (clause.positive == 0 && clause.negative == 0)
+        continue;
+
+      g_array_append_val (priv->clauses, clause);
+
+      if (normalized->len > 0)
+        g_string_append_c (normalized, ' ');
+      for (i = first_term; i < priv->terms->len; i++)
+        append_term (normalized, &g_array_index (priv->terms, Term, i), i > first_term,
+                     (clause.negative & (G_GUINT64_CONSTANT (1) << i)) != 0);
+    }
+
+  g_strfreev (tokens);
+  priv->normalized = g_string_free (normalized, FALSE);
+
+  /*
+   * The image can only be narrowed down by a term that every match has
+   * to satisfy, which is one with a single positive alternative.
+   */
+  for (i = 0; i < priv->clauses->len && seek == NULL; i++)
+    {
+      Clause *clause = &g_array_index (priv->clauses, Clause, i);
+      Term *term;
+      guint bit = 0;
+
+      if (clause->negative != 0 || (clause->positive & (clause->positive - 1)) != 0)
+        continue;
+
+      while ((clause->positive >> bit) != 1)
+        bit++;
+
+      term = &g_array_index (priv->terms, Term, bit);
+      if (term->kind == TERM_NAME)
+        seek = g_strconcat (term->text, "*", NULL);
+      else if (term->kind == TERM_EXTENSION)
+        seek = g_strconcat ("*.", term->text, NULL);
+    }
+
+  if (seek == NULL)
+    seek = g_strdup ("*");
+
+  /* the image keys are always folded */
+  if (match_case)
+    {
+      gchar folded[FILE_SEARCH_IMAGE_KEY_MAX];
+      file_search_fold (seek, strlen (seek), folded, sizeof (folded));
+      priv->globbing = g_strdup (folded);
+      g_free (seek);
+    }
+  else
+    {
+      priv->globbing = seek;
+    }
+
+  return query;
+}
+
+static void
+parse_alternative (FileSearchQuery *query,
+                   const gchar     *text,
+                   Clause          *clause)
+{
+  FileSearchQueryPrivate *priv;
+  gchar folded[FILE_SEARCH_IMAGE_KEY_MAX];
+  Term term;
+  gboolean negate = FALSE;
+  guint64 bit;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  if (priv->terms->len == FILE_SEARCH_QUERY_MAX_TERMS)
+    {
+      priv->last_term = 0;
+      return;
+    }
+
+  if (*text == '!')
+    {
+      negate = TRUE;
+      text++;
+    }
+
+  term.kind = TERM_NAME;
+  if (g_str_has_prefix (text, "dir:"))
+    {
+      term.kind = TERM_DIR;
+      text += strlen ("dir:");
+    }
+  else if (g_str_has_prefix (text, "project:"))
+    {
+      term.kind = TERM_PROJECT;
+      text += strlen ("project:");
+    }
+  else if (g_str_has_prefix (text, "ext:"))
+    {
+      term.kind = TERM_EXTENSION;
+      text += strlen ("ext:");
+    }
+  else if (g_str_has_prefix (text, "*.") && text[2] != '\0' && !has_wildcards (text + 2))
+    {
+      term.kind = TERM_EXTENSION;
+      text += strlen ("*.");
+    }
+
+  if (*text == '\0')
+    return;
+
+  if (!priv->match_case)
+    {
+      file_search_fold (text, strlen (text), folded, sizeof (folded));
+      text = folded;
+    }
+
+  bit = G_GUINT64_CONSTANT (1) << priv->terms->len;
+  term.text = g_strdup (text);
+  term.pattern = NULL;
+
+  switch (term.kind)
+    {
+    case TERM_NAME:
+      priv->name_terms |= bit;
+      if (has_wildcards (text))
+        {
+          gchar *globbing = g_strconcat (text, "*", NULL);
+          term.pattern = g_pattern_spec_new (globbing);
+          priv->pattern_terms |= bit;
+          g_free (globbing);
+        }
+      else
+        {
+          add_literal (priv->prefixes, text, FALSE, bit);
+        }
+      break;
+    case TERM_EXTENSION:
+      {
+        gchar *suffix = g_strconcat (".", text, NULL);
+        add_literal (priv->extensions, suffix, TRUE, bit);
+        g_free (suffix);
+      }
+      break;
+    case TERM_DIR:
+    case TERM_PROJECT:
+      {
+        gchar *globbing = g_strconcat (text, "*", NULL);
+        term.pattern = g_pattern_spec_new (globbing);
+        g_free (globbing);
+        if (term.kind == TERM_DIR)
+          priv->dir_terms |= bit;
+        else
+          priv->project_terms |= bit;
+      }
+      break;
+    }
+
+  g_array_append_val (priv->terms, term);
+
+  if (negate)
+    clause->negative |= bit;
+  else
+    clause->positive |= bit;
+
+  priv->last_term = negate ? 0 : bit;
+}
+
+const gchar*
+file_search_query_get_text (FileSearchQuery *query)
+{
+  return FILE_SEARCH_QUERY_GET_PRIVATE (query)->text;
+}
+
+gboolean
+file_search_query_get_match_case (FileSearchQuery *query)
+{
+  return FILE_SEARCH_QUERY_GET_PRIVATE (query)->match_case;
+}
+
+/*
+ * The folded pattern that every match satisfies, for
+ * file_search_image_cursor_init_pattern().
+ */
+const gchar*
+file_search_query_get_globbing (FileSearchQuery *query)
+{
+  return FILE_SEARCH_QUERY_GET_PRIVATE (query)->globbing;
+}
+
+/*
+ * The query as it was compiled: only the terms that count, spelled out
+ * the one way and folded unless the case is matched. Texts that compile
+ * to the same normalized form with the same match_case match the same
+ * files.
+ */
+const gchar*
+file_search_query_get_normalized (FileSearchQuery *query)
+{
+  return FILE_SEARCH_QUERY_GET_PRIVATE (query)->normalized;
+}
+
+/*
+ * Whether every file the query matches was matched by the previous one
+ * as well, so the previous results only need to be filtered. That holds
+ * while typing on at the end of a positive name, directory or project
+ * alternative, since those are all prefixes.
+ */
+gboolean
+file_search_query_narrows (FileSearchQuery *query,
+                           FileSearchQuery *previous)
+{
+  FileSearchQueryPrivate *priv;
+  FileSearchQueryPrivate *previous_priv;
+  const gchar *typed;
+  guint i;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+  previous_priv = FILE_SEARCH_QUERY_GET_PRIVATE (previous);
+
+  if (priv->match_case != previous_priv->match_case ||
+      !g_str_has_prefix (priv->text, previous_priv->text) ||
+      previous_priv->last_term == 0 ||
+      (previous_priv->last_term & (previous_priv->name_terms |
+                                   previous_priv->dir_terms |
+                                   previous_priv->project_terms)) == 0)
+    return FALSE;
+
+  /* the last alternative has to be the one at the end of the text */
+  i = strlen (previous_priv->text);
+  if (i == 0 || strchr (" \t|!:", previous_priv->text[i - 1]) != NULL)
+    return FALSE;
+
+  for (typed = priv->text + i; *typed != '\0'; typed++)
+    if (strchr (" \t|!:", *typed) != NULL)
+      return FALSE;
+
+  return TRUE;
+}
+
+/*
+ * Matches the entry under the cursor, against its folded key unless the
+ * query matches the case. The directory and project matches are cached 
+ * in the query, so a query is only ever matched on one thread at a time.
+ * So is the name match of the last entry, which the entries after it
+ * share for as long as they repeat its name.
+ */
+gboolean
+file_search_query_match_cursor (FileSearchQuery       *query,
+                                FileSearchImageCursor *cursor)
+{
+  FileSearchQueryPrivate *priv;
+  guint64 mask = 0;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  /* the cached ids only hold within one image */
+  if (priv->image != cursor->image)
+    {
+      g_hash_table_remove_all (priv->dirs);
+      g_hash_table_remove_all (priv->projects);
+      priv->name_entry = G_MAXUINT;
+      if (priv->image != NULL)
+        g_object_unref (priv->image);
+      priv->image = g_object_ref (cursor->image);
+    }
+
+  if (priv->dir_terms != 0)
+    {
+      guint64 *dir_mask;
+
+      dir_mask = g_hash_table_lookup (priv->dirs, GUINT_TO_POINTER (cursor->dir));
+      if (dir_mask == NULL)
+        {
+          gchar dir_path[FILE_SEARCH_IMAGE_KEY_MAX];
+
+          dir_mask = g_new (guint64, 1);
+          *dir_mask = 0;
+          if (file_search_image_get_dir (cursor->image, cursor->dir, dir_path))
+            *dir_mask = match_dir (query, dir_path);
+          g_hash_table_insert (priv->dirs, GUINT_TO_POINTER (cursor->dir), dir_mask);
+        }
+      mask |= *dir_mask;
+    }
+
+  if (priv->project_terms != 0)
+    {
+      guint64 *project_mask;
+
+      project_mask = g_hash_table_lookup (priv->projects, GUINT_TO_POINTER (cursor->project));
+      if (project_mask == NULL)
+        {
+          project_mask = g_new (guint64, 1);
+          *project_mask = match_project (query, file_search_image_cursor_get_project_key (cursor));
+          g_hash_table_insert (priv->projects, GUINT_TO_POINTER (cursor->project), project_mask);
+        }
+      mask |= *project_mask;
+    }
+
+  if (cursor->entry == 0 || cursor->entry - 1 != priv->name_entry ||
+      !(priv->match_case ? cursor->same_name : cursor->same_key))
+    {
+      if (priv->match_case)
+        priv->name_mask = match_name (query, cursor->file_name, cursor->length);
+      else
+        priv->name_mask = match_name (query, cursor->key, cursor->key_length);
+    }
+  priv->name_entry = cursor->entry;
+  mask |= priv->name_mask;
+
+  return evaluate (query, mask);
+}
+
+/*
+ * The spans of the file name under the cursor, right after it matched.
+ * They come from what the name matched already, nothing is matched 
+ * again. Returns how many of the FILE_SEARCH_QUERY_MAX_SPANS there are.
+ */
+guint
+file_search_query_get_cursor_spans (FileSearchQuery       *query,
+                                    FileSearchImageCursor *cursor,
+                                    FileSearchQuerySpan   *spans)
+{
+  FileSearchQueryPrivate *priv;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  if (cursor->entry != priv->name_entry)
+    return 0;
+
+  if (priv->match_case)
+    return get_spans (query, priv->name_mask, cursor->file_name, cursor->length, spans);
+
+  /* folding changed the length, the spans would not line up with the name */
+  if (cursor->key_length != cursor->length)
+    return 0;
+
+  return get_spans (query, priv->name_mask, cursor->key, cursor->key_length, spans);
+}
+
+/*
+ * Matches a file that is already in the results, when they only need
+ * to be filtered. When spans is set, the spans of a file that matched 
+ * are worked out along the way.
+ */
+gboolean
+file_search_query_match_file (FileSearchQuery     *query,
+                              const gchar         *file_name,
+                              const gchar         *folded_name,
+                              const gchar         *file_path,
+                              const gchar         *project_key,
+                              FileSearchQuerySpan *spans,
+                              guint               *n_spans)
+{
+  FileSearchQueryPrivate *priv;
+  const gchar *name;
+  guint64 name_mask = 0;
+  guint64 mask = 0;
+  gsize length = 0;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  if (priv->dir_terms != 0 && file_path != NULL)
+    {
+      gchar *dir_path = g_path_get_dirname (file_path);
+      mask |= match_dir (query, dir_path);
+      g_free (dir_path);
+    }
+
+  if (priv->project_terms != 0)
+    mask |= match_project (query, project_key);
+
+  name = priv->match_case ? file_name : folded_name;
+  if (name != NULL)
+    {
+      length = strlen (name);
+      name_mask = match_name (query, name, length);
+      mask |= name_mask;
+    }
+
+  if (!evaluate (query, mask))
+    return FALSE;
+
+  if (spans != NULL)
+    {
+      *n_spans = 0;
+      if (name != NULL && file_name != NULL && strlen (file_name) == length)
+        *n_spans = get_spans (query, name_mask, name, length, spans);
+    }
+
+  return TRUE;
+}
+
+/*
+ * Whether the files of the project can match at all, judged by the terms
+ * that are only made up of project alternatives. The projects that fail
+ * are left out of the scope before any file name is looked at.
+ */
+gboolean
+file_search_query_match_project (FileSearchQuery *query,
+                                 const gchar     *project_key)
+{
+  FileSearchQueryPrivate *priv;
+  guint64 mask;
+  guint i;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  if (priv->project_terms == 0)
+    return TRUE;
+
+  mask = match_project (query, project_key);
+
+  for (i = 0; i < priv->clauses->len; i++)
+    {
+      Clause *clause = &g_array_index (priv->clauses, Clause, i);
+
+      if (((clause->positive | clause->negative) & ~priv->project_terms) != 0)
+        continue;
+
+      if ((mask & clause->positive) == 0 && (~mask & clause->negative) == 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* 
+ * Every term is spelled out the one way, whichever way it was typed. 
+ * The kind always leads, a name can look like any of the prefixes.
+ */
+static void
+append_term (GString    *normalized,
+             const Term *term,
+             gboolean    alternative,
+             gboolean    negate)
+{
+  static const gchar kinds[] = { 'n', 'e', 'd', 'p' };
+
+  if (alternative)
+    g_string_append_c (normalized, '|');
+  if (negate)
+    g_string_append_c (normalized, '!');
+
+  g_string_append_c (normalized, kinds[term->kind]);
+  g_string_append_c (normalized, ':');
+  g_string_append (normalized, term->text);
+}
+
+static void
+add_literal (GArray      *trie,
+             const gchar *text,
+             gboolean     reverse,
+             guint64      bit)
+{
+  gsize length = strlen (text);
+  guint node = 0;
+  gsize i;
+
+  for (i = 0; i < length; i++)
+    {
+      guchar byte = reverse ? text[length - 1 - i] : text[i];
+      guint child = g_array_index (trie, Node, node).child;
+
+      while (child != 0 && g_array_index (trie, Node, child).byte != byte)
+        child = g_array_index (trie, Node, child).sibling;
+
+      if (child == 0)
+        {
+          Node added = {0, 0, 0, 0};
+          added.byte = byte;
+          added.sibling = g_array_index (trie, Node, node).child;
+          child = trie->len;
+          g_array_append_val (trie, added);
+          g_array_index (trie, Node, node).child = child;
+        }
+
+      node = child;
+    }
+
+  g_array_index (trie, Node, node).accept |= bit;
+}
+
+/*
+ * Collects the bits of every literal the text starts with, or ends with
+ * when walking in reverse.
+ */
+static guint64
+walk_trie (GArray      *trie,
+           const gchar *text,
+           gsize        length,
+           gboolean     reverse)
+{
+  const Node *nodes = (const Node *) trie->data;
+  guint64 mask = nodes[0].accept;
+  guint node = 0;
+  gsize i;
+
+  for (i = 0; i < length && nodes[node].child != 0; i++)
+    {
+      guchar byte = reverse ? text[length - 1 - i] : text[i];
+      guint child = nodes[node].child;
+
+      while (child != 0 && nodes[child].byte != byte)
+        child = nodes[child].sibling;
+
+      if (child == 0)
+        break;
+
+      node = child;
+      mask |= nodes[node].accept;
+    }
+
+  return mask;
+}
+
+static guint64
+match_name (FileSearchQuery *query,
+            const gchar     *name,
+            gsize            length)
+{
+  FileSearchQueryPrivate *priv;
+  guint64 mask;
+  guint i;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  mask = walk_trie (priv->prefixes, name, length, FALSE);
+  mask |= walk_trie (priv->extensions, name, length, TRUE);
+
+  for (i = 0; i < priv->terms->len; i++)
+    {
+      Term *term;
+
+      if ((priv->pattern_terms & (G_GUINT64_CONSTANT (1) << i)) == 0)
+        continue;
+
+      term = &g_array_index (priv->terms, Term, i);
+      if (g_pattern_match (term->pattern, length, name, NULL))
+        mask |= G_GUINT64_CONSTANT (1) << i;
+    }
+
+  return mask;
+}
+
+/*
+ * A directory alternative matches the start of any directory in the
+ * path, so "dir:test" rules out everything under a test directory.
+ */
+static guint64
+match_dir (FileSearchQuery *query,
+           const gchar     *dir_path)
+{
+  FileSearchQueryPrivate *priv;
+  gchar folded[FILE_SEARCH_IMAGE_KEY_MAX];
+  const gchar *component;
+  guint64 mask = 0;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  if (!priv->match_case)
+    {
+      file_search_fold (dir_path, strlen (dir_path), folded, sizeof (folded));
+      dir_path = folded;
+    }
+
+  component = dir_path;
+  while (*component != '\0')
+    {
+      gsize length = strcspn (component, G_DIR_SEPARATOR_S);
+
+      if (length > 0)
+        {
+          gchar *name = g_strndup (component, length);
+          guint i;
+
+          for (i = 0; i < priv->terms->len; i++)
+            {
+              guint64 bit = G_GUINT64_CONSTANT (1) << i;
+              if ((priv->dir_terms & bit) != 0 && (mask & bit) == 0 &&
+                  g_pattern_match_string (g_array_index (priv->terms, Term, i).pattern, name))
+                mask |= bit;
+            }
+
+          g_free (name);
+        }
+
+      component += length;
+      if (*component != '\0')
+        component++;
+    }
+
+  return mask;
+}
+
+static guint64
+match_project (FileSearchQuery *query,
+               const gchar     *project_key)
+{
+  FileSearchQueryPrivate *priv;
+  gchar folded[FILE_SEARCH_IMAGE_KEY_MAX];
+  guint64 mask = 0;
+  guint i;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  if (project_key == NULL)
+    return 0;
+
+  if (!priv->match_case)
+    {
+      file_search_fold (project_key, strlen (project_key), folded, sizeof (folded));
+      project_key = folded;
+    }
+
+  for (i = 0; i < priv->terms->len; i++)
+    {
+      guint64 bit = G_GUINT64_CONSTANT (1) << i;
+      if ((priv->project_terms & bit) != 0 &&
+          g_pattern_match_string (g_array_index (priv->terms, Term, i).pattern, project_key))
+        mask |= bit;
+    }
+
+  return mask;
+}
+
+/*
+ * Every term needs one of its positive bits set or one of its negative
+ * bits clear. A query without any terms matches nothing.
+ */
+static gboolean
+evaluate (FileSearchQuery *query,
+          guint64          mask)
+{
+  FileSearchQueryPrivate *priv;
+  guint i;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  if (priv->clauses->len == 0)
+    return FALSE;
+
+  for (i = 0; i < priv->clauses->len; i++)
+    {
+      Clause *clause = &g_array_index (priv->clauses, Clause, i);
+      if ((mask & clause->positive) == 0 && (~mask & clause->negative) == 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * The runs of the name that the name and extension alternatives in the
+ * mask matched, in order and merged where they touch. A plain name 
+ * matched its start and an extension the end. A pattern is laid over
+ * the name piece by piece, every literal after a '*' where it first 
+ * turns up. Negated alternatives matched nothing to show.
+ */
+static guint
+get_spans (FileSearchQuery     *query,
+           guint64              mask,
+           const gchar         *name,
+           gsize                length,
+           FileSearchQuerySpan *spans)
+{
+  FileSearchQueryPrivate *priv;
+  guint64 positive = 0;
+  guint n_spans = 0;
+  guint i;
+
+  priv = FILE_SEARCH_QUERY_GET_PRIVATE (query);
+
+  for (i = 0; i < priv->clauses->len; i++)
+    positive |= g_array_index (priv->clauses, Clause, i).positive;
+
+  mask &= positive;
+
+  for (i = 0; i < priv->terms->len && mask != 0; i++)
+    {
+      guint64 bit = G_GUINT64_CONSTANT (1) << i;
+      Term *term;
+      gsize term_length;
+
+      if ((mask & bit) == 0)
+        continue;
+      mask &= ~bit;
+
+      term = &g_array_index (priv->terms, Term, i);
+      term_length = strlen (term->text);
+
+      if (term->kind == TERM_NAME && term->pattern != NULL)
+        n_spans = add_pattern_spans (term->text, name, length, spans, n_spans);
+      else if (term->kind == TERM_NAME && term_length <= length)
+        n_spans = add_span (spans, n_spans, 0, term_length);
+      else if (term->kind == TERM_EXTENSION && term_length < length)
+        n_spans = add_span (spans, n_spans, length - term_length - 1, length);
+    }
+
+  return n_spans;
+}
+
+static guint
+add_pattern_spans (const gchar         *pattern,
+                   const gchar         *name,
+                   gsize                length,
+                   FileSearchQuerySpan *spans,
+                   guint                n_spans)
+{
+  gboolean anchored = TRUE;
+  gsize position = 0;
+
+  while (*pattern != '\0')
+    {
+      gsize literal;
+      gsize start;
+
+      if (*pattern == '*')
+        {
+          anchored = FALSE;
+          pattern++;
+          continue;
+        }
+
+      if (*pattern == '?')
+        {
+          if (position < length)
+            position = g_utf8_next_char (name + position) - name;
+          pattern++;
+          continue;
+        }
+
+      literal = strcspn (pattern, "*?");
+
+      for (start = position; start + literal <= length; start++)
+        {
+          if (memcmp (name + start, pattern, literal) == 0 || anchored)
+            break;
+        }
+
+      if (start + literal > length || memcmp (name + start, pattern, literal) != 0)
+        break;
+
+      n_spans = add_span (spans, n_spans, start, start + literal);
+      position = start + literal;
+      anchored = TRUE;
+      pattern += literal;
+    }
+
+  return n_spans;
+}
+
+/* keeps the spans sorted, and merges the ones that overlap or touch */
+static guint
+add_span (FileSearchQuerySpan *spans,
+          guint                n_spans,
+          gsize                start,
+          gsize                end)
+{
+  guint i = 0;
+  guint j;
+
+  if (start >= end || end > G_MAXUINT16)
+    return n_spans;
+
+  while (i < n_spans && spans[i].end < start)
+    i++;
+
+  if (i < n_spans && spans[i].start <= end)
+    {
+      /* swallow every span after it that the merged one reaches */
+      spans[i].start = MIN (spans[i].start, start);
+      spans[i].end = MAX (spans[i].end, end);
+      for (j = i + 1; j < n_spans && spans[j].start <= spans[i].end; j++)
+        spans[i].end = MAX (spans[i].end, spans[j].end);
+      memmove (&spans[i + 1], &spans[j], (n_spans - j) * sizeof (FileSearchQuerySpan));
+      return n_spans - (j - i - 1);
+    }
+
+  if (n_spans == FILE_SEARCH_QUERY_MAX_SPANS)
+    return n_spans;
+
+  memmove (&spans[i + 1], &spans[i], (n_spans - i) * sizeof (FileSearchQuerySpan));
+  spans[i].start = start;
+  spans[i].end = end;
+
+  return n_spans + 1;
+}
+
+static gboolean
+has_wildcards (const gchar *text)
+{
+  return strpbrk (text, "*?") != NULL;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_QUERY_H__
+#define	__FILE_SEARCH_QUERY_H__
+
+#include <glib-object.h>
+#include "filesearch-image.h"
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_QUERY_TYPE            (file_search_query_get_type ())
+#define FILE_SEARCH_QUERY(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_QUERY_TYPE, FileSearchQuery))
+#define FILE_SEARCH_QUERY_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_QUERY_TYPE, FileSearchQueryClass))
+#define IS_FILE_SEARCH_QUERY(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_QUERY_TYPE))
+#define IS_FILE_SEARCH_QUERY_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_QUERY_TYPE))
+
+/* terms past this many are left out of the query */
+#define FILE_SEARCH_QUERY_MAX_TERMS       64
+
+/* the spans of a name past this many are not highlighted */
+#define FILE_SEARCH_QUERY_MAX_SPANS       4
+
+typedef struct _FileSearchQuery FileSearchQuery;
+typedef struct _FileSearchQueryClass FileSearchQueryClass;
+typedef struct _FileSearchQuerySpan FileSearchQuerySpan;
+
+struct _FileSearchQuery
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchQueryClass
+{
+  GObjectClass parent_class;
+};
+
+/* the bytes of a file name from start up to, but not including, end */
+struct _FileSearchQuerySpan
+{
+  guint16 start;
+  guint16 end;
+};
+
+GType file_search_query_get_type (void) G_GNUC_CONST;
+
+FileSearchQuery*  file_search_query_new            (const gchar           *text,
+                                                    gboolean               match_case);
+
+const gchar*      file_search_query_get_text       (FileSearchQuery       *query);
+gboolean          file_search_query_get_match_case (FileSearchQuery       *query);
+const gchar*      file_search_query_get_globbing   (FileSearchQuery       *query);
+const gchar*      file_search_query_get_normalized (FileSearchQuery       *query);
+gboolean          file_search_query_narrows        (FileSearchQuery       *query,
+                                                    FileSearchQuery       *previous);
+
+gboolean          file_search_query_match_cursor   (FileSearchQuery       *query,
+                                                    FileSearchImageCursor *cursor);
+guint             file_search_query_get_cursor_spans (FileSearchQuery       *query,
+                                                      FileSearchImageCursor *cursor,
+                                                      FileSearchQuerySpan   *spans);
+gboolean          file_search_query_match_file     (FileSearchQuery       *query,
+                                                    const gchar           *file_name,
+                                                    const gchar           *folded_name,
+                                                    const gchar           *file_path,
+                                                    const gchar           *project_key,
+                                                    FileSearchQuerySpan   *spans,
+                                                    guint                 *n_spans);
+gboolean          file_search_query_match_project  (FileSearchQuery       *query,
+                                                    const gchar           *project_key);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_QUERY_H__ */
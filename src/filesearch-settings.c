@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "filesearch-settings.h"
+
+static void file_search_settings_class_init  (FileSearchSettingsClass *klass);
+static void file_search_settings_init        (FileSearchSettings      *settings);
+static void file_search_settings_finalize    (FileSearchSettings      *settings);
+
+#define FILE_SEARCH_SETTINGS_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_SETTINGS_TYPE, FileSearchSettingsPrivate))
+
+typedef struct _FileSearchSettingsPrivate FileSearchSettingsPrivate;
+
+struct _FileSearchSettingsPrivate
+{
+  GKeyFile *key_file;
+};
+
+G_DEFINE_TYPE (FileSearchSettings, file_search_settings, G_TYPE_OBJECT)
+
+static void
+file_search_settings_class_init (FileSearchSettingsClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = (GObjectFinalizeFunc) file_search_settings_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchSettingsPrivate));
+}
+
+static void
+file_search_settings_init (FileSearchSettings *settings)
+{
+  FileSearchSettingsPrivate *priv;
+  priv = FILE_SEARCH_SETTINGS_GET_PRIVATE (settings);
+  priv->key_file = g_key_file_new ();
+}
+
+static void
+file_search_settings_finalize (FileSearchSettings *settings)
+{
+  FileSearchSettingsPrivate *priv;
+  priv = FILE_SEARCH_SETTINGS_GET_PRIVATE (settings);
+  g_key_file_free (priv->key_file);
+  G_OBJECT_CLASS (file_search_settings_parent_class)->finalize (G_OBJECT (settings));
+}
+
+/*
+ * A missing settings file is not an error, every getter falls back
+ * to the default value the caller hands in.
+ */
+FileSearchSettings*
+file_search_settings_new (const gchar *profile_folder_path)
+{
+  FileSearchSettingsPrivate *priv;
+  FileSearchSettings *settings;
+  gchar *file_path;
+  GError *error = NULL;
+
+  settings = FILE_SEARCH_SETTINGS (g_object_new (file_search_settings_get_type (), NULL));
+  priv = FILE_SEARCH_SETTINGS_GET_PRIVATE (settings);
+
+  file_path = g_build_filename (profile_folder_path, FILE_SEARCH_SETTINGS_FILE, NULL);
+
+  if (!g_key_file_load_from_file (priv->key_file, file_path, G_KEY_FILE_NONE, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Error reading file search settings: %s\n", error->message);
+      g_error_free (error);
+    }
+
+  g_free (file_path);
+
+  return settings;
+}
+
+gint
+file_search_settings_get_integer (FileSearchSettings *settings,
+                                  const gchar        *key,
+                                  gint                default_value)
+{
+  FileSearchSettingsPrivate *priv;
+  GError *error = NULL;
+  gint result;
+
+  priv = FILE_SEARCH_SETTINGS_GET_PRIVATE (settings);
+
+  result = g_key_file_get_integer (priv->key_file, FILE_SEARCH_SETTINGS_GROUP, key, &error);
+  if (error != NULL)
+    {
+      g_error_free (error);
+      return default_value;
+    }
+
+  return result;
+}
+
+gboolean
+file_search_settings_get_boolean (FileSearchSettings *settings,
+                                  const gchar        *key,
+                                  gboolean            default_value)
+{
+  FileSearchSettingsPrivate *priv;
+  GError *error = NULL;
+  gboolean result;
+
+  priv = FILE_SEARCH_SETTINGS_GET_PRIVATE (settings);
+
+  result = g_key_file_get_boolean (priv->key_file, FILE_SEARCH_SETTINGS_GROUP, key, &error);
+  if (error != NULL)
+    {
+      g_error_free (error);
+      return default_value;
+    }
+
+  return result;
+}
+
+gdouble
+file_search_settings_get_double (FileSearchSettings *settings,
+                                 const gchar        *key,
+                                 gdouble             default_value)
+{
+  FileSearchSettingsPrivate *priv;
+  GError *error = NULL;
+  gdouble result;
+
+  priv = FILE_SEARCH_SETTINGS_GET_PRIVATE (settings);
+
+  result = g_key_file_get_double (priv->key_file, FILE_SEARCH_SETTINGS_GROUP, key, &error);
+  if (error != NULL)
+    {
+      g_error_free (error);
+      return default_value;
+    }
+
+  return result;
+}
+
+gchar*
+file_search_settings_get_string (FileSearchSettings *settings,
+                                 const gchar        *key,
+                                 const gchar        *default_value)
+{
+  FileSearchSettingsPrivate *priv;
+  gchar *result;
+
+  priv = FILE_SEARCH_SETTINGS_GET_PRIVATE (settings);
+
+  result = g_key_file_get_string (priv->key_file, FILE_SEARCH_SETTINGS_GROUP, key, NULL);
+  if (result == NULL)
+    return g_strdup (default_value);
+
+  return result;
+}
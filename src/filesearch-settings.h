@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_SETTINGS_H__
+#define	__FILE_SEARCH_SETTINGS_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_SETTINGS_TYPE            (file_search_settings_get_type ())
+#define FILE_SEARCH_SETTINGS(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_SETTINGS_TYPE, FileSearchSettings))
+#define FILE_SEARCH_SETTINGS_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_SETTINGS_TYPE, FileSearchSettingsClass))
+#define IS_FILE_SEARCH_SETTINGS(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_SETTINGS_TYPE))
+#define IS_FILE_SEARCH_SETTINGS_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_SETTINGS_TYPE))
+
+/* the keys live in the [filesearch] group of the filesearch.conf profile file */
+#define FILE_SEARCH_SETTINGS_FILE            "filesearch.conf"
+#define FILE_SEARCH_SETTINGS_GROUP           "filesearch"
+
+#define FILE_SEARCH_SETTINGS_STATS_INTERVAL  "stats_interval"
+#define FILE_SEARCH_SETTINGS_DAEMON          "daemon"
+#define FILE_SEARCH_SETTINGS_FALSE_POSITIVE_RATE "false_positive_rate"
+#define FILE_SEARCH_SETTINGS_CONTENT_INDEX   "content_index"
+#define FILE_SEARCH_SETTINGS_FOLLOW_SYMLINKS "follow_symlinks"
+#define FILE_SEARCH_SETTINGS_GIT_INDEX       "git_index"
+#define FILE_SEARCH_SETTINGS_GIT_UNTRACKED   "git_untracked"
+#define FILE_SEARCH_SETTINGS_MEMORY_BUDGET   "memory_budget"
+#define FILE_SEARCH_SETTINGS_CRAWL_RATE      "crawl_rate"
+#define FILE_SEARCH_SETTINGS_CROSS_MOUNTS    "cross_mounts"
+#define FILE_SEARCH_SETTINGS_MAX_DEPTH       "max_depth"
+#define FILE_SEARCH_SETTINGS_MAX_FILES       "max_files"
+#define FILE_SEARCH_SETTINGS_SNAPSHOT        "snapshot"
+
+typedef struct _FileSearchSettings FileSearchSettings;
+typedef struct _FileSearchSettingsClass FileSearchSettingsClass;
+
+struct _FileSearchSettings
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchSettingsClass
+{
+  GObjectClass parent_class;
+};
+
+GType file_search_settings_get_type (void) G_GNUC_CONST;
+
+FileSearchSettings*  file_search_settings_new          (const gchar        *profile_folder_path);
+
+gint                 file_search_settings_get_integer  (FileSearchSettings *settings,
+                                                        const gchar        *key,
+                                                        gint                default_value);
+gboolean             file_search_settings_get_boolean  (FileSearchSettings *settings,
+                                                        const gchar        *key,
+                                                        gboolean            default_value);
+gdouble              file_search_settings_get_double   (FileSearchSettings *settings,
+                                                        const gchar        *key,
+                                                        gdouble             default_value);
+gchar*               file_search_settings_get_string   (FileSearchSettings *settings,
+                                                        const gchar        *key,
+                                                        const gchar        *default_value);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_SETTINGS_H__ */
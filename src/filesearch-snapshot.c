@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include "filesearch-snapshot.h"
+#include "filesearch-image.h"
+#include "filesearch-index.h"
+#include "filesearch-journal.h"
+
+static const gchar* get_relative_path  (const gchar *folder_path,
+                                        const gchar *file_path);
+static gchar* get_absolute_path        (const gchar *folder_path,
+                                        const gchar *dir,
+                                        const gchar *file_name);
+
+/*
+ * Writes the indexes of the projects in the table as a snapshot. Files
+ * of other projects, or outside of their project folder, are left out.
+ */
+gboolean
+file_search_snapshot_export (GList        *indexes,
+                             GHashTable   *folder_paths,
+                             const gchar  *snapshot_file,
+                             gdouble       false_positive_rate,
+                             GError      **error)
+{
+  GList *relative = NULL;
+  GList *list;
+  GBytes *bytes;
+  gboolean result;
+
+  for (list = indexes; list != NULL; list = list->next)
+    {
+      FileSearchIndex *index = list->data;
+      FileSearchIndex *copy;
+      const gchar *project_key;
+      const gchar *folder_path;
+      const gchar *file_path;
+
+      project_key = file_search_index_get_project_key (index);
+      if (project_key == NULL)
+        continue;
+
+      folder_path = g_hash_table_lookup (folder_paths, project_key);
+      if (folder_path == NULL)
+        continue;
+
+      file_path = get_relative_path (folder_path, file_search_index_get_file_path (index));
+      if (file_path == NULL)
+        continue;
+
+      copy = file_search_index_new ();
+      file_search_index_set_file_name (copy, file_search_index_get_file_name (index));
+      file_search_index_set_file_path (copy, file_path);
+      file_search_index_set_project_key (copy, project_key);
+      relative = g_list_prepend (relative, copy);
+    }
+
+  bytes = file_search_image_build (relative, g_get_real_time (), false_positive_rate, 
+                                   FILE_SEARCH_IMAGE_RELATIVE);
+  result = file_search_image_write (bytes, snapshot_file, error);
+
+  g_bytes_unref (bytes);
+  g_list_foreach (relative, (GFunc) g_object_unref, NULL);
+  g_list_free (relative);
+
+  return result;
+}
+
+/*
+ * Writes the snapshot out as the index file of this workspace, with the
+ * paths under the local folders of the projects. The projects of the 
+ * snapshot that are not in the table are dropped, and the ones in the 
+ * table that are not in the snapshot are left to the next crawl. Any 
+ * log of the index file it replaces no longer applies and is removed.
+ */
+gboolean
+file_search_snapshot_import (const gchar  *snapshot_file,
+                             GHashTable   *folder_paths,
+                             const gchar  *indexes_file,
+                             gdouble       false_positive_rate,
+                             GError      **error)
+{
+  FileSearchImage *snapshot;
+  FileSearchImageCursor cursor;
+  GList *indexes = NULL;
+  GBytes *bytes;
+  gchar dir[FILE_SEARCH_IMAGE_KEY_MAX];
+  gchar *journal_file;
+  gboolean result;
+
+  snapshot = file_search_image_new_from_file (snapshot_file, error);
+  if (snapshot == NULL)
+    return FALSE;
+
+  if (!file_search_image_is_relative (snapshot))
+    {
+      g_set_error (error, FILE_SEARCH_IMAGE_ERROR, FILE_SEARCH_IMAGE_ERROR_RELATIVE,
+                   "The file search snapshot %s is not relative to its projects.", 
+                   snapshot_file);
+      g_object_unref (snapshot);
+      return FALSE;
+    }
+
+  file_search_image_cursor_init (snapshot, &cursor, 0);
+  while (file_search_image_cursor_next (&cursor))
+    {
+      const gchar *project_key;
+      const gchar *folder_path;
+      FileSearchIndex *index;
+      gchar *file_path;
+
+      project_key = file_search_image_cursor_get_project_key (&cursor);
+      folder_path = g_hash_table_lookup (folder_paths, project_key);
+      if (folder_path == NULL || 
+          !file_search_image_get_dir (snapshot, cursor.dir, dir))
+        continue;
+
+      file_path = get_absolute_path (folder_path, dir, cursor.file_name);
+
+      index = file_search_index_new ();
+      file_search_index_set_file_name (index, cursor.file_name);
+      file_search_index_set_file_path (index, file_path);
+      file_search_index_set_project_key (index, project_key);
+      indexes = g_list_prepend (indexes, index);
+
+      g_free (file_path);
+    }
+
+  bytes = file_search_image_build (indexes, g_get_real_time (), false_positive_rate, 0);
+  result = file_search_image_write (bytes, indexes_file, error);
+
+  if (result)
+    {
+      journal_file = g_strconcat (indexes_file, FILE_SEARCH_JOURNAL_SUFFIX, NULL);
+      g_unlink (journal_file);
+      g_free (journal_file);
+    }
+
+  g_bytes_unref (bytes);
+  g_list_foreach (indexes, (GFunc) g_object_unref, NULL);
+  g_list_free (indexes);
+  g_object_unref (snapshot);
+
+  return result;
+}
+
+/* NULL unless the file is below the folder */
+static const gchar*
+get_relative_path (const gchar *folder_path,
+                   const gchar *file_path)
+{
+  gsize length;
+
+  length = strlen (folder_path);
+  while (length > 0 && folder_path[length - 1] == G_DIR_SEPARATOR)
+    length--;
+
+  if (strncmp (file_path, folder_path, length) != 0 ||
+      file_path[length] != G_DIR_SEPARATOR || file_path[length + 1] == '\0')
+    return NULL;
+
+  return file_path + length + 1;
+}
+
+static gchar*
+get_absolute_path (const gchar *folder_path,
+                   const gchar *dir,
+                   const gchar *file_name)
+{
+  if (strcmp (dir, ".") == 0)
+    return g_build_filename (folder_path, file_name, NULL);
+
+  return g_build_filename (folder_path, dir, file_name, NULL);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_SNAPSHOT_H__
+#define	__FILE_SEARCH_SNAPSHOT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * A snapshot is an index image with its directories relative to the 
+ * folders of the projects, so that an index crawled once, on a build 
+ * machine say, serves every workspace that checks the same projects 
+ * out somewhere else. The folders are a table of project key to folder 
+ * path, on export and on import alike. An imported snapshot becomes the
+ * index file, and the next crawl only logs the files that differ.
+ */
+
+#define FILE_SEARCH_SNAPSHOT_SUFFIX  ".snapshot"
+
+gboolean  file_search_snapshot_export  (GList        *indexes,
+                                        GHashTable   *folder_paths,
+                                        const gchar  *snapshot_file,
+                                        gdouble       false_positive_rate,
+                                        GError      **error);
+gboolean  file_search_snapshot_import  (const gchar  *snapshot_file,
+                                        GHashTable   *folder_paths,
+                                        const gchar  *indexes_file,
+                                        gdouble       false_positive_rate,
+                                        GError      **error);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_SNAPSHOT_H__ */
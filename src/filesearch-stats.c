@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include "filesearch-stats.h"
+#include "filesearch-probes.h"
+
+static void file_search_stats_class_init  (FileSearchStatsClass *klass);
+static void file_search_stats_init        (FileSearchStats      *stats);
+static void file_search_stats_finalize    (FileSearchStats      *stats);
+
+static guint get_bucket                   (gint64                usec);
+
+#define FILE_SEARCH_STATS_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), FILE_SEARCH_STATS_TYPE, FileSearchStatsPrivate))
+
+typedef struct _FileSearchStatsPrivate FileSearchStatsPrivate;
+
+typedef struct
+{
+  guint64 buckets[FILE_SEARCH_STATS_BUCKETS];
+  guint64 count;
+  gint64  total_usec;
+  gint64  max_usec;
+} Histogram;
+
+/*
+ * The counters are bumped from the indexing thread while the dialog
+ * records its own phases on the main thread, so everything is guarded
+ * by a single mutex. Callers are expected to add in batches rather
+ * than once per file.
+ */
+struct _FileSearchStatsPrivate
+{
+  GMutex    mutex;
+  gint64    counters[FILE_SEARCH_COUNTERS];
+  Histogram histograms[FILE_SEARCH_PHASES];
+};
+
+static const gchar *phase_names[FILE_SEARCH_PHASES] =
+{
+  "enumerate",
+  "filter",
+  "serialize",
+  "load",
+  "match",
+  "render",
+  "grep",
+  "content",
+  "throttle",
+  "preview"
+};
+
+static const gchar *counter_names[FILE_SEARCH_COUNTERS] =
+{
+  "dirs_visited",
+  "files_visited",
+  "excluded",
+  "syscalls",
+  "bytes_written",
+  "blocks_skipped",
+  "bytes_scanned",
+  "bytes_released"
+};
+
+G_DEFINE_TYPE (FileSearchStats, file_search_stats, G_TYPE_OBJECT)
+
+static void
+file_search_stats_class_init (FileSearchStatsClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = (GObjectFinalizeFunc) file_search_stats_finalize;
+  g_type_class_add_private (klass, sizeof (FileSearchStatsPrivate));
+}
+
+static void
+file_search_stats_init (FileSearchStats *stats)
+{
+  FileSearchStatsPrivate *priv;
+  priv = FILE_SEARCH_STATS_GET_PRIVATE (stats);
+  g_mutex_init (&priv->mutex);
+  memset (priv->counters, 0, sizeof (priv->counters));
+  memset (priv->histograms, 0, sizeof (priv->histograms));
+}
+
+static void
+file_search_stats_finalize (FileSearchStats *stats)
+{
+  FileSearchStatsPrivate *priv;
+  priv = FILE_SEARCH_STATS_GET_PRIVATE (stats);
+  g_mutex_clear (&priv->mutex);
+  G_OBJECT_CLASS (file_search_stats_parent_class)->finalize (G_OBJECT (stats));
+}
+
+FileSearchStats*
+file_search_stats_new (void)
+{
+  return FILE_SEARCH_STATS (g_object_new (file_search_stats_get_type (), NULL));
+}
+
+void
+file_search_stats_add (FileSearchStats   *stats,
+                       FileSearchCounter  counter,
+                       gint64             amount)
+{
+  FileSearchStatsPrivate *priv;
+
+  g_return_if_fail (counter < FILE_SEARCH_COUNTERS);
+
+  priv = FILE_SEARCH_STATS_GET_PRIVATE (stats);
+
+  g_mutex_lock (&priv->mutex);
+  priv->counters[counter] += amount;
+  g_mutex_unlock (&priv->mutex);
+}
+
+gint64
+file_search_stats_get_counter (FileSearchStats   *stats,
+                               FileSearchCounter  counter)
+{
+  FileSearchStatsPrivate *priv;
+  gint64 result;
+
+  g_return_val_if_fail (counter < FILE_SEARCH_COUNTERS, 0);
+
+  priv = FILE_SEARCH_STATS_GET_PRIVATE (stats);
+
+  g_mutex_lock (&priv->mutex);
+  result = priv->counters[counter];
+  g_mutex_unlock (&priv->mutex);
+
+  return result;
+}
+
+void
+file_search_stats_record (FileSearchStats *stats,
+                          FileSearchPhase  phase,
+                          gint64           usec)
+{
+  FileSearchStatsPrivate *priv;
+  Histogram *histogram;
+
+  g_return_if_fail (phase < FILE_SEARCH_PHASES);
+
+  FILE_SEARCH_PROBE2 (phase, phase, usec);
+
+  if (usec < 0)
+    usec = 0;
+
+  priv = FILE_SEARCH_STATS_GET_PRIVATE (stats);
+  histogram = &priv->histograms[phase];
+
+  g_mutex_lock (&priv->mutex);
+  histogram->buckets[get_bucket (usec)]++;
+  histogram->count++;
+  histogram->total_usec += usec;
+  if (usec > histogram->max_usec)
+    histogram->max_usec = usec;
+  g_mutex_unlock (&priv->mutex);
+}
+
+void
+file_search_stats_get_histogram (FileSearchStats *stats,
+                                 FileSearchPhase  phase,
+                                 guint64         *buckets,
+                                 guint64         *count,
+                                 gint64          *total_usec)
+{
+  FileSearchStatsPrivate *priv;
+  Histogram *histogram;
+
+  g_return_if_fail (phase < FILE_SEARCH_PHASES);
+
+  priv = FILE_SEARCH_STATS_GET_PRIVATE (stats);
+  histogram = &priv->histograms[phase];
+
+  g_mutex_lock (&priv->mutex);
+  if (buckets != NULL)
+    memcpy (buckets, histogram->buckets, sizeof (histogram->buckets));
+  if (count != NULL)
+    *count = histogram->count;
+  if (total_usec != NULL)
+    *total_usec = histogram->total_usec;
+  g_mutex_unlock (&priv->mutex);
+}
+
+void
+file_search_stats_reset (FileSearchStats *stats)
+{
+  FileSearchStatsPrivate *priv;
+  priv = FILE_SEARCH_STATS_GET_PRIVATE (stats);
+  g_mutex_lock (&priv->mutex);
+  memset (priv->counters, 0, sizeof (priv->counters));
+  memset (priv->histograms, 0, sizeof (priv->histograms));
+  g_mutex_unlock (&priv->mutex);
+}
+
+gchar*
+file_search_stats_to_json (FileSearchStats *stats)
+{
+  FileSearchStatsPrivate *priv;
+  GString *json;
+  gint64 counters[FILE_SEARCH_COUNTERS];
+  Histogram histograms[FILE_SEARCH_PHASES];
+  gint i;
+
+  priv = FILE_SEARCH_STATS_GET_PRIVATE (stats);
+
+  /* take a snapshot so the lock is not held while formatting */
+  g_mutex_lock (&priv->mutex);
+  memcpy (counters, priv->counters, sizeof (counters));
+  memcpy (histograms, priv->histograms, sizeof (histograms));
+  g_mutex_unlock (&priv->mutex);
+
+  json = g_string_new ("{\n  \"counters\": {\n");
+
+  for (i = 0; i < FILE_SEARCH_COUNTERS; i++)
+    {
+      g_string_append_printf (json, "    \"%s\": %" G_GINT64_FORMAT "%s\n",
+                              counter_names[i], counters[i],
+                              i < FILE_SEARCH_COUNTERS - 1 ? "," : "");
+    }
+
+  g_string_append (json, "  },\n  \"phases\": {\n");
+
+  for (i = 0; i < FILE_SEARCH_PHASES; i++)
+    {
+      Histogram *histogram = &histograms[i];
+      gint last = FILE_SEARCH_STATS_BUCKETS - 1;
+      gint j;
+
+      /* trailing empty buckets are just noise */
+      while (last > 0 && histogram->buckets[last] == 0)
+        last--;
+
+      g_string_append_printf (json, "    \"%s\": {\"count\": %" G_GUINT64_FORMAT
+                              ", \"total_usec\": %" G_GINT64_FORMAT
+                              ", \"max_usec\": %" G_GINT64_FORMAT
+                              ", \"buckets_usec_log2\": [",
+                              phase_names[i], histogram->count,
+                              histogram->total_usec, histogram->max_usec);
+
+      for (j = 0; j <= last; j++)
+        g_string_append_printf (json, "%s%" G_GUINT64_FORMAT,
+                                j > 0 ? ", " : "", histogram->buckets[j]);
+
+      g_string_append_printf (json, "]}%s\n", i < FILE_SEARCH_PHASES - 1 ? "," : "");
+    }
+
+  g_string_append (json, "  }\n}\n");
+
+  return g_string_free (json, FALSE);
+}
+
+gboolean
+file_search_stats_write_json (FileSearchStats *stats,
+                              const gchar     *file_path)
+{
+  GError *error = NULL;
+  gchar *json;
+
+  json = file_search_stats_to_json (stats);
+
+  if (!g_file_set_contents (file_path, json, -1, &error))
+    {
+      g_warning ("Error writing file search stats: %s\n", error->message);
+      g_error_free (error);
+      g_free (json);
+      return FALSE;
+    }
+
+  g_free (json);
+  return TRUE;
+}
+
+const gchar*
+file_search_stats_phase_name (FileSearchPhase phase)
+{
+  g_return_val_if_fail (phase < FILE_SEARCH_PHASES, NULL);
+  return phase_names[phase];
+}
+
+const gchar*
+file_search_stats_counter_name (FileSearchCounter counter)
+{
+  g_return_val_if_fail (counter < FILE_SEARCH_COUNTERS, NULL);
+  return counter_names[counter];
+}
+
+static guint
+get_bucket (gint64 usec)
+{
+  guint bucket = 0;
+
+  while (usec > 1 && bucket < FILE_SEARCH_STATS_BUCKETS - 1)
+    {
+      usec >>= 1;
+      bucket++;
+    }
+
+  return bucket;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __FILE_SEARCH_STATS_H__
+#define	__FILE_SEARCH_STATS_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define FILE_SEARCH_STATS_TYPE            (file_search_stats_get_type ())
+#define FILE_SEARCH_STATS(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), FILE_SEARCH_STATS_TYPE, FileSearchStats))
+#define FILE_SEARCH_STATS_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), FILE_SEARCH_STATS_TYPE, FileSearchStatsClass))
+#define IS_FILE_SEARCH_STATS(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FILE_SEARCH_STATS_TYPE))
+#define IS_FILE_SEARCH_STATS_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), FILE_SEARCH_STATS_TYPE))
+
+/* histogram buckets are powers of two in microseconds, the last one is open ended */
+#define FILE_SEARCH_STATS_BUCKETS 24
+
+typedef struct _FileSearchStats FileSearchStats;
+typedef struct _FileSearchStatsClass FileSearchStatsClass;
+
+typedef enum
+{
+  FILE_SEARCH_PHASE_ENUMERATE = 0,
+  FILE_SEARCH_PHASE_FILTER,
+  FILE_SEARCH_PHASE_SERIALIZE,
+  FILE_SEARCH_PHASE_LOAD,
+  FILE_SEARCH_PHASE_MATCH,
+  FILE_SEARCH_PHASE_RENDER,
+  FILE_SEARCH_PHASE_GREP,
+  FILE_SEARCH_PHASE_CONTENT,
+  FILE_SEARCH_PHASE_THROTTLE,
+  FILE_SEARCH_PHASE_PREVIEW,
+  FILE_SEARCH_PHASES
+} FileSearchPhase;
+
+typedef enum
+{
+  FILE_SEARCH_COUNTER_DIRS_VISITED = 0,
+  FILE_SEARCH_COUNTER_FILES_VISITED,
+  FILE_SEARCH_COUNTER_EXCLUDED,
+  FILE_SEARCH_COUNTER_SYSCALLS,
+  FILE_SEARCH_COUNTER_BYTES_WRITTEN,
+  FILE_SEARCH_COUNTER_BLOCKS_SKIPPED,
+  FILE_SEARCH_COUNTER_BYTES_SCANNED,
+  FILE_SEARCH_COUNTER_BYTES_RELEASED,
+  FILE_SEARCH_COUNTERS
+} FileSearchCounter;
+
+struct _FileSearchStats
+{
+  GObject parent_instance;
+};
+
+struct _FileSearchStatsClass
+{
+  GObjectClass parent_class;
+};
+
+GType file_search_stats_get_type (void) G_GNUC_CONST;
+
+FileSearchStats*  file_search_stats_new              (void);
+
+void              file_search_stats_add              (FileSearchStats   *stats,
+                                                      FileSearchCounter  counter,
+                                                      gint64             amount);
+gint64            file_search_stats_get_counter      (FileSearchStats   *stats,
+                                                      FileSearchCounter  counter);
+void              file_search_stats_record           (FileSearchStats   *stats,
+                                                      FileSearchPhase    phase,
+                                                      gint64             usec);
+void              file_search_stats_get_histogram    (FileSearchStats   *stats,
+                                                      FileSearchPhase    phase,
+                                                      guint64           *buckets,
+                                                      guint64           *count,
+                                                      gint64            *total_usec);
+void              file_search_stats_reset            (FileSearchStats   *stats);
+gchar*            file_search_stats_to_json          (FileSearchStats   *stats);
+gboolean          file_search_stats_write_json       (FileSearchStats   *stats,
+                                                      const gchar       *file_path);
+
+const gchar*      file_search_stats_phase_name       (FileSearchPhase    phase);
+const gchar*      file_search_stats_counter_name     (FileSearchCounter  counter);
+
+G_END_DECLS
+
+#endif /* __FILE_SEARCH_STATS_H__ */
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2010 - Jeff Johnston
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "filesearch-varint.h"
+
+gboolean
+file_search_varint_read (const guint8 **p,
+                         const guint8  *end,
+                         guint32       *value)
+{
+  guint32 result = 0;
+  guint shift;
+
+  for (shift = 0; shift < 35 && *p < end; shift += 7)
+    {
+      guint8 byte = *(*p)++;
+      result |= (guint32) (byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+        {
+          *value = result;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+void
+file_search_varint_write (GByteArray *bytes,
+                          guint32     value)
+{
+  guint8 buffer[5];
+  guint length = 0;
+
+  while (value >= 0x80)
+    {
+      buffer[length++] = (value & 0x7f) | 0x80;
+      value >>= 7;
+    }
+  buffer[length++] = value;
+
+  g_byte_array_append (bytes, buffer, length);
+}